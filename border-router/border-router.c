@@ -45,6 +45,8 @@
 #include "net/netstack.h"
 #include "dev/button-sensor.h"
 #include "dev/slip.h"
+#include "timesync.h"
+#include "framing.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,12 +56,22 @@
 #define DEBUG DEBUG_NONE
 #include "net/uip-debug.h"
 
+/* Exchanges with tunslip6 per reference, the fastest one is kept */
+#define HOST_TIME_SAMPLES 4
+#define HOST_TIME_TIMEOUT (CLOCK_SECOND / 8)
+/* Bytes of "?T" and of its answer on the line, with the END */
+#define HOST_TIME_REQUEST 7
+#define HOST_TIME_REPLY   15
+
 uint16_t dag_id[] = {0x1111, 0x1100, 0, 0, 0, 0, 0, 0x0011};
 
 static uip_ipaddr_t prefix;
 static uint8_t prefix_set;
 
+static uint32_t host_time_sent, best_rtt, best_local, best_host;
+
 PROCESS(border_router_process, "Border router process");
+PROCESS(host_time_process, "Host time");
 
 #if WEBSERVER==0
 /* No webserver */
@@ -313,7 +325,7 @@ request_prefix(void)
   uip_buf[0] = '?';
   uip_buf[1] = 'P';
   uip_len = 2;
-  slip_send();
+  framing_send();
   uip_len = 0;
 }
 /*---------------------------------------------------------------------------*/
@@ -328,6 +340,68 @@ set_prefix_64(uip_ipaddr_t *prefix_64)
   uip_ds6_addr_add(&ipaddr, 0, ADDR_AUTOCONF);
 }
 /*---------------------------------------------------------------------------*/
+void
+request_host_time(void)
+{
+  uint32_t now = timesync_local();
+
+  uip_buf[0] = '?';
+  uip_buf[1] = 'T';
+  uip_buf[2] = now >> 24;
+  uip_buf[3] = now >> 16;
+  uip_buf[4] = now >> 8;
+  uip_buf[5] = now;
+  uip_len = 6;
+  framing_send();
+  uip_len = 0;
+  host_time_sent = now;
+}
+/*---------------------------------------------------------------------------*/
+void
+set_host_time(uint32_t sent, uint32_t host)
+{
+  uint32_t rtt = timesync_local() - sent;
+
+  if(sent != host_time_sent) {
+    return;                     /* Late answer to an earlier request */
+  }
+  if(rtt < best_rtt) {
+    /* tunslip6 took its time as the request came in: split the round
+       trip between the request and the longer answer */
+    best_rtt = rtt;
+    best_local = sent +
+      rtt / (HOST_TIME_REQUEST + HOST_TIME_REPLY) * HOST_TIME_REQUEST;
+    best_host = host;
+  }
+  process_poll(&host_time_process);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(host_time_process, ev, data)
+{
+  static struct etimer et;
+  static uint8_t i;
+
+  PROCESS_BEGIN();
+
+  while(1) {
+    best_rtt = 0xffffffff;
+    for(i = 0; i < HOST_TIME_SAMPLES; i++) {
+      etimer_set(&et, HOST_TIME_TIMEOUT);
+      request_host_time();
+      PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL || etimer_expired(&et));
+    }
+    /* Nothing if tunslip6 doesn't know "?T": no timestamps then */
+    if(best_rtt != 0xffffffff) {
+      PRINTF("Host time, round trip %lu us\n", (unsigned long)best_rtt);
+      timesync_reference(best_local, best_host);
+    }
+    etimer_set(&et, TIMESYNC_PERIOD);
+    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
 PROCESS_THREAD(border_router_process, ev, data)
 {
   static struct etimer et;
@@ -373,6 +447,10 @@ PROCESS_THREAD(border_router_process, ev, data)
    * Since we are the DAG root, reception delays would constrain mesh throughbut.
    */
   NETSTACK_MAC.off(1);
+
+  /* Take tunslip6's clock and flood it to the thermostats */
+  timesync_init();
+  process_start(&host_time_process, NULL);
   
 #if DEBUG || 1
   print_local_addresses();
@@ -0,0 +1,228 @@
+/**
+ * \file
+ *         COBS framing with CRC-16 on the serial line.
+ */
+
+#include "contiki.h"
+#include "net/uip.h"
+#include "net/tcpip.h"
+#include "dev/slip.h"
+#include "dev/uart1.h"
+#include "lib/crc16.h"
+#include "framing.h"
+
+#include <string.h>
+
+#define SLIP_END     0300
+#define SLIP_ESC     0333
+#define SLIP_ESC_END 0334
+#define SLIP_ESC_ESC 0335
+
+/* COBS adds a byte per 254, the CRC two */
+#define RX_SIZE      (UIP_BUFSIZE - UIP_LLH_LEN + 4)
+#define BLOCK        0xfe
+
+#define DEBUG_LINE   80
+
+PROCESS(framing_process, "COBS framing");
+
+static void (*input_callback)(void);
+
+static volatile uint8_t cobs, revert;
+/* The UART fills rx[fill], rx[fill ^ 1] waits for the process if ready */
+static uint8_t rx[2][RX_SIZE];
+static volatile uint16_t rx_len, ready_len;
+static volatile uint8_t fill;
+
+static const uint8_t *out_data;
+static uint16_t out_len;
+static uint8_t out_crc[2];
+
+/*---------------------------------------------------------------------------*/
+static int
+framing_input_byte(unsigned char c)
+{
+  static const uint8_t request[] = { SLIP_END, '?', 'F', 'C', SLIP_END };
+
+  if(!cobs) {
+    return slip_input_byte(c);
+  }
+  if(c == 0) {
+    if(rx_len > 0 && ready_len == 0) {
+      ready_len = rx_len;
+      fill ^= 1;
+      process_poll(&framing_process);
+    }
+    /* Otherwise dropped, the previous frame is still being decoded */
+    rx_len = 0;
+    return 1;
+  }
+  if(rx_len == RX_SIZE) {
+    return 1;                   /* Too long, dropped at the zero */
+  }
+  rx[fill][rx_len++] = c;
+  if(rx_len == sizeof(request) && memcmp(rx[fill], request, rx_len) == 0) {
+    /* A restarted tunslip6 asking in SLIP */
+    cobs = 0;
+    rx_len = 0;
+    revert = 1;
+    process_poll(&framing_process);
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* The frame without its CRC into uip_buf, 0 if it is corrupted */
+static uint16_t
+decode(const uint8_t *in, uint16_t len)
+{
+  uint8_t *out = &uip_buf[UIP_LLH_LEN];
+  uint16_t i = 0, o = 0;
+  uint8_t code, n;
+
+  while(i < len) {
+    code = in[i++];
+    if(i + code - 1 > len || o + code > UIP_BUFSIZE - UIP_LLH_LEN) {
+      return 0;
+    }
+    for(n = 1; n < code; n++) {
+      out[o++] = in[i++];
+    }
+    if(code < 0xff && i < len) {
+      out[o++] = 0;
+    }
+  }
+  if(o < 2 || crc16_data(out, o - 2, 0) != (out[o - 2] | (out[o - 1] << 8))) {
+    return 0;
+  }
+  return o - 2;
+}
+/*---------------------------------------------------------------------------*/
+static void
+writeb(uint8_t c)
+{
+  if(c == SLIP_END) {
+    slip_arch_writeb(SLIP_ESC);
+    c = SLIP_ESC_END;
+  } else if(c == SLIP_ESC) {
+    slip_arch_writeb(SLIP_ESC);
+    c = SLIP_ESC_ESC;
+  }
+  slip_arch_writeb(c);
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+out_byte(uint16_t i)
+{
+  return i < out_len ? out_data[i] : out_crc[i - out_len];
+}
+/*---------------------------------------------------------------------------*/
+void
+framing_write(const uint8_t *data, uint16_t len)
+{
+  uint16_t i, total = len + 2;
+  unsigned short crc;
+  uint8_t n;
+
+  if(!cobs) {
+    slip_arch_writeb(SLIP_END);
+    for(i = 0; i < len; i++) {
+      writeb(data[i]);
+    }
+    slip_arch_writeb(SLIP_END);
+    return;
+  }
+  crc = crc16_data(data, len, 0);
+  out_data = data;
+  out_len = len;
+  out_crc[0] = crc & 0xff;
+  out_crc[1] = crc >> 8;
+
+  /* Each block is the count of the bytes up to the next zero, or 254 of
+     them, then the bytes: looked ahead on the way, nothing is buffered */
+  i = 0;
+  while(1) {
+    for(n = 0; i + n < total && n < BLOCK && out_byte(i + n) != 0; n++);
+    slip_arch_writeb(n + 1);
+    for(; n > 0; n--) {
+      slip_arch_writeb(out_byte(i++));
+    }
+    if(i == total) {
+      break;
+    }
+    if(out_byte(i) == 0) {
+      i++;
+    }
+  }
+  slip_arch_writeb(0);
+}
+/*---------------------------------------------------------------------------*/
+void
+framing_send(void)
+{
+  if(cobs) {
+    framing_write(&uip_buf[UIP_LLH_LEN], uip_len);
+  } else {
+    slip_send();
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+framing_request(void)
+{
+  framing_write((const uint8_t *)"!FC", 3);
+  rx_len = ready_len = 0;
+  cobs = 1;
+  /* Ends what tunslip6 took for a COBS frame while we answered */
+  slip_arch_writeb(0);
+}
+/*---------------------------------------------------------------------------*/
+void
+framing_putchar(int c)
+{
+  static uint8_t line[DEBUG_LINE];
+  static uint8_t len;
+
+  if(len == 0) {
+    line[len++] = '\r';         /* Type debug line == '\r' */
+  }
+  line[len++] = c;
+  if(c == '\n' || len == DEBUG_LINE) {
+    framing_write(line, len);
+    len = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(framing_process, ev, data)
+{
+  PROCESS_BEGIN();
+
+  while(1) {
+    PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+
+    if(revert) {
+      revert = 0;
+      framing_request();
+    }
+    if(ready_len > 0) {
+      uip_len = decode(rx[fill ^ 1], ready_len);
+      ready_len = 0;
+      if(uip_len > 0) {
+        input_callback();
+        if(uip_len > 0) {
+          tcpip_input();
+        }
+      }
+    }
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+framing_init(void (*input)(void))
+{
+  input_callback = input;
+  process_start(&framing_process, NULL);
+  uart1_set_input(framing_input_byte);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,48 @@
+/**
+ * \file
+ *         COBS framing with CRC-16 on the serial line, built in with
+ *         make COBS=1.
+ *
+ *         The border router starts in SLIP. tunslip6 -C asks with "?FC";
+ *         the border router answers "!FC", still in SLIP, then sends a zero
+ *         byte and from then on each frame and its CRC (crc16_data(), low
+ *         byte first) are COBS encoded and end with a zero byte. A frame
+ *         that fails its CRC is dropped. A restarted tunslip6 asks again
+ *         with the raw bytes END '?' 'F' 'C' END after a zero: seen at the
+ *         start of a frame they turn the border router back to SLIP, where
+ *         the request is answered as above. The host end is
+ *         tunslip6/serial.h.
+ *
+ *         Input no longer goes through slip_process once in COBS: the UART
+ *         fills one of two buffers, the other one is decoded into uip_buf.
+ */
+
+#ifndef __FRAMING_H__
+#define __FRAMING_H__
+
+#include "contiki.h"
+
+#if COBS_ENABLED
+
+/** Take the UART input, after slip_arch_init(); input as for SLIP */
+void framing_init(void (*input)(void));
+
+/** "?FC" came in over SLIP: answer and switch to COBS */
+void framing_request(void);
+
+/** Send a frame of len bytes in the current framing */
+void framing_write(const uint8_t *data, uint16_t len);
+
+/** Send uip_buf in the current framing, for slip_send() */
+void framing_send(void);
+
+/** Debug output, a '\r' frame per line */
+void framing_putchar(int c);
+
+#else /* COBS_ENABLED */
+
+#define framing_send() slip_send()
+
+#endif /* COBS_ENABLED */
+
+#endif /* __FRAMING_H__ */
@@ -0,0 +1,610 @@
+/**
+ * \file
+ *         Border router on Linux: a SLIP link on a pseudo-terminal, the
+ *         mesh on UDP.
+ *
+ *         The serial side behaves as border-router.c and slip-bridge.c do
+ *         on a mote: it asks for the prefix with "?P" every second until
+ *         tunslip6 answers "!P", answers "?M" with its link-layer address,
+ *         prints its debug lines in '\r' frames and answers ICMPv6 echo
+ *         requests sent to its own address. Every 30 seconds it takes the
+ *         host's time with "?T" like the timesync root does; the native
+ *         thermostats read the host's clock directly, so with -v the offset
+ *         only tells how accurate the exchange is. With -X it sends the
+ *         trace records of border-router/trace.h, the mesh standing for the
+ *         radio. With -C it takes COBS framing when tunslip6 -C asks for it,
+ *         as a border router built with COBS=1 (tunslip6/serial.h).
+ *
+ *         The radio side is a mesh of native thermostats (sensor/native)
+ *         reachable over the host's UDP stack, at the same interface
+ *         identifiers under another /64 (-m). A UDP datagram from the SLIP
+ *         link to prefix::iid is sent from a socket dedicated to its source
+ *         address and port to mesh::iid, and what comes back on that socket
+ *         is wrapped into IPv6 and sent over the link, so requests, Observe
+ *         notifications and their sources survive the round trip.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#include "slip.h"
+
+#define IPV6_HEADER    40
+#define UDP_HEADER     8
+#define MAX_PACKET     1280
+#define FLOWS          256      /* Host endpoints talking to the mesh */
+#define PREFIX_RETRY   1000     /* ms between "?P" requests */
+#define REPORT_MS      10000
+#define TIME_PERIOD    30000    /* ms between two "?T" bursts */
+#define TIME_RETRY     125      /* ms before giving up on an answer */
+#define TIME_SAMPLES   4        /* "?T" per burst, the fastest is kept */
+#define TIME_REQUEST   7        /* Bytes of "?T" and its answer on the line */
+#define TIME_REPLY     15
+
+#define PROTO_UDP      17
+#define PROTO_ICMP6    58
+#define ICMP6_ECHO_REQUEST 128
+#define ICMP6_ECHO_REPLY   129
+
+static int verbose, tracing, cobs;
+static struct slip_link slip;
+static int slave = -1;
+
+/* Link-layer address of the first Cooja mote, the border router */
+static const uint8_t lladdr[8] = { 0x00, 0x12, 0x74, 0x01,
+                                   0x00, 0x01, 0x01, 0x01 };
+static struct in6_addr prefix, mesh, address;
+static int prefix_set;
+
+/* One socket per host endpoint, so that replies find their way back */
+static struct flow {
+  int fd;                       /* -1 when the slot is free */
+  struct in6_addr host;
+  uint16_t host_port;
+  uint64_t used;
+} flows[FLOWS];
+
+static struct pollfd pfds[1 + FLOWS];
+
+/* The "?T" burst in progress */
+static struct {
+  uint64_t next;                /* clock_ms() of the next request */
+  uint32_t sent;                /* clock_us() of the last one */
+  uint32_t best_rtt;
+  int64_t offset;               /* The host's clock minus ours */
+  int requests;
+} host_time;
+
+static struct {
+  uint64_t to_mesh, from_mesh, echoes, dropped;
+  uint64_t bytes_in, bytes_out;
+} stats;
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+clock_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+/* The clock the native thermostats timestamp with */
+static uint64_t
+clock_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+checksum(const uint8_t *packet, uint8_t proto, size_t len)
+{
+  uint32_t sum = proto + len;
+  size_t i;
+
+  /* Pseudo header addresses, then the upper layer */
+  for(i = 8; i < IPV6_HEADER; i += 2) {
+    sum += (packet[i] << 8) | packet[i + 1];
+  }
+  for(i = 0; i + 1 < len; i += 2) {
+    sum += (packet[IPV6_HEADER + i] << 8) | packet[IPV6_HEADER + i + 1];
+  }
+  if(len & 1) {
+    sum += packet[IPV6_HEADER + len - 1] << 8;
+  }
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum & 0xffff;
+}
+/*---------------------------------------------------------------------------*/
+static void
+link_send(uint8_t *packet, int len)
+{
+  if(slip_link_send(&slip, packet, len) < 0) {
+    stats.dropped++;
+    return;
+  }
+  stats.bytes_out += len;
+  slip_link_flush(&slip);
+}
+/*---------------------------------------------------------------------------*/
+/* The "!R" record of a CoAP datagram, as border-router/trace.c sends it */
+static void
+trace_record(uint8_t dir, const uint8_t *coap, size_t len, uint32_t in,
+             uint32_t out)
+{
+  uint8_t record[2 + 1 + 1 + 2 + 1 + 8 + 4 + 4] = { '!', 'R', dir, 1 };
+  uint8_t tkl;
+  int n;
+
+  if(len < 4 || (coap[0] >> 6) != 1 || (tkl = coap[0] & 15) > 8 ||
+     4 + tkl > len) {
+    return;
+  }
+  record[4] = coap[2];
+  record[5] = coap[3];
+  record[6] = tkl;
+  memcpy(record + 7, coap + 4, tkl);
+  n = 7 + tkl;
+  record[n++] = in >> 24;
+  record[n++] = in >> 16;
+  record[n++] = in >> 8;
+  record[n++] = in;
+  record[n++] = out >> 24;
+  record[n++] = out >> 16;
+  record[n++] = out >> 8;
+  record[n++] = out;
+  link_send(record, n);
+}
+/*---------------------------------------------------------------------------*/
+/* The debug output of slip-bridge.c's putchar() */
+static void
+debug_line(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void
+debug_line(const char *fmt, ...)
+{
+  char line[128];
+  va_list ap;
+  int len;
+
+  line[0] = '\r';
+  va_start(ap, fmt);
+  len = vsnprintf(line + 1, sizeof(line) - 1, fmt, ap);
+  va_end(ap);
+  if(len > (int)sizeof(line) - 2) len = sizeof(line) - 2;
+  slip_link_send(&slip, line, len + 1);
+  slip_link_flush(&slip);
+  if(verbose) fprintf(stderr, "%s", line + 1);
+}
+/*---------------------------------------------------------------------------*/
+static void
+request_host_time(void)
+{
+  uint32_t now = clock_us();
+  uint8_t request[6] = { '?', 'T', now >> 24, now >> 16, now >> 8, now };
+
+  host_time.sent = now;
+  host_time.requests++;
+  link_send(request, sizeof(request));
+}
+/*---------------------------------------------------------------------------*/
+static void
+host_time_reply(const uint8_t *frame)
+{
+  uint64_t now = clock_us(), host = 0;
+  uint32_t sent, rtt;
+  int i;
+
+  sent = (frame[2] << 24) | (frame[3] << 16) | (frame[4] << 8) | frame[5];
+  if(sent != host_time.sent) {
+    return;                     /* Late answer to an earlier request */
+  }
+  for(i = 0; i < 8; i++) {
+    host = host << 8 | frame[6 + i];
+  }
+  rtt = (uint32_t)now - sent;
+  if(rtt < host_time.best_rtt) {
+    /* tunslip6 took its time as the request came in */
+    host_time.best_rtt = rtt;
+    host_time.offset = (int64_t)(host - (now - rtt) -
+                                 rtt * TIME_REQUEST / (TIME_REQUEST + TIME_REPLY));
+  }
+  host_time.next = clock_ms();
+}
+/*---------------------------------------------------------------------------*/
+static void
+host_time_run(uint64_t now)
+{
+  if(host_time.requests < TIME_SAMPLES) {
+    request_host_time();
+    host_time.next = now + TIME_RETRY;
+    return;
+  }
+  if(verbose && host_time.best_rtt != UINT32_MAX) {
+    fprintf(stderr, "*** host clock %+lld us from ours, round trip %u us\n",
+            (long long)host_time.offset, host_time.best_rtt);
+  }
+  host_time.requests = 0;
+  host_time.best_rtt = UINT32_MAX;
+  host_time.next = now + TIME_PERIOD;
+}
+/*---------------------------------------------------------------------------*/
+static void
+control_callback(void *arg, uint8_t *frame, int len)
+{
+  static const char hex[] = "0123456789abcdef";
+  char buf[INET6_ADDRSTRLEN];
+  int i;
+
+  if(len >= 10 && frame[0] == '!' && frame[1] == 'P') {
+    memset(&prefix, 0, sizeof(prefix));
+    memcpy(&prefix, frame + 2, 8);
+    address = prefix;
+    memcpy(&address.s6_addr[8], lladdr, 8);
+    address.s6_addr[8] ^= 0x02;
+    if(!prefix_set) {
+      prefix_set = 1;
+      debug_line("created a new RPL dag\n");
+      debug_line("Server IPv6 addresses:\n");
+      debug_line(" %s\n", inet_ntop(AF_INET6, &address, buf, sizeof(buf)));
+    }
+  } else if(len >= 2 && frame[0] == '?' && frame[1] == 'M') {
+    uint8_t reply[2 + 16] = { '!', 'M' };
+    for(i = 0; i < 8; i++) {
+      reply[2 + i * 2] = hex[lladdr[i] >> 4];
+      reply[3 + i * 2] = hex[lladdr[i] & 15];
+    }
+    link_send(reply, sizeof(reply));
+  } else if(len >= 2 + 4 + 8 && frame[0] == '!' && frame[1] == 'T') {
+    host_time_reply(frame);
+  } else if(cobs && len >= 3 && frame[0] == '?' && frame[1] == 'F' &&
+            frame[2] == 'C') {
+    /* The answer still in SLIP, COBS from then on */
+    slip.cobs = 0;
+    link_send((uint8_t *)"!FC", 3);
+    slip.cobs = 1;
+    if(slip_link_send_raw(&slip, "", 1) < 0) {
+      stats.dropped++;
+    }
+    slip_link_flush(&slip);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+echo_reply(uint8_t *packet, int len)
+{
+  uint8_t src[16];
+  uint16_t sum;
+
+  /* Turn the request around in place */
+  memcpy(src, packet + 8, 16);
+  memcpy(packet + 8, packet + 24, 16);
+  memcpy(packet + 24, src, 16);
+  packet[7] = 64;
+  packet[IPV6_HEADER] = ICMP6_ECHO_REPLY;
+  packet[IPV6_HEADER + 2] = packet[IPV6_HEADER + 3] = 0;
+  sum = checksum(packet, PROTO_ICMP6, len - IPV6_HEADER);
+  packet[IPV6_HEADER + 2] = sum >> 8;
+  packet[IPV6_HEADER + 3] = sum & 0xff;
+  stats.echoes++;
+  link_send(packet, len);
+}
+/*---------------------------------------------------------------------------*/
+static struct flow *
+find_flow(const struct in6_addr *host, uint16_t port)
+{
+  struct flow *f, *oldest = &flows[0];
+  int i;
+
+  for(i = 0; i < FLOWS; i++) {
+    f = &flows[i];
+    if(f->fd != -1 && f->host_port == port &&
+       memcmp(&f->host, host, sizeof(*host)) == 0) {
+      return f;
+    }
+    if(f->fd == -1 || (oldest->fd != -1 && f->used < oldest->used)) {
+      oldest = f;
+    }
+  }
+  /* A new endpoint takes the oldest slot: its observations are lost */
+  f = oldest;
+  if(f->fd != -1) {
+    close(f->fd);
+  }
+  f->fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(f->fd == -1) {
+    warn("socket");
+    return NULL;
+  }
+  f->host = *host;
+  f->host_port = port;
+  pfds[1 + (f - flows)].fd = f->fd;
+  return f;
+}
+/*---------------------------------------------------------------------------*/
+static void
+packet_callback(void *arg, uint8_t *packet, int len)
+{
+  struct sockaddr_in6 to;
+  struct flow *f;
+  size_t plen;
+  uint32_t in = clock_us();
+
+  stats.bytes_in += len;
+  plen = (packet[4] << 8) | packet[5];
+  if(!prefix_set || IPV6_HEADER + plen > (size_t)len) {
+    stats.dropped++;
+    return;
+  }
+  len = IPV6_HEADER + plen;
+
+  if(memcmp(packet + 24, &address, 16) == 0) {
+    if(packet[6] == PROTO_ICMP6 && plen >= 8 &&
+       packet[IPV6_HEADER] == ICMP6_ECHO_REQUEST) {
+      echo_reply(packet, len);
+    } else {
+      stats.dropped++;
+    }
+    return;
+  }
+  if(memcmp(packet + 24, &prefix, 8) != 0 || packet[6] != PROTO_UDP ||
+     plen < UDP_HEADER || checksum(packet, PROTO_UDP, plen) != 0) {
+    stats.dropped++;
+    return;
+  }
+
+  f = find_flow((struct in6_addr *)(packet + 8),
+                (packet[40] << 8) | packet[41]);
+  if(f == NULL) {
+    stats.dropped++;
+    return;
+  }
+  f->used = clock_ms();
+  memset(&to, 0, sizeof(to));
+  to.sin6_family = AF_INET6;
+  memcpy(&to.sin6_addr, &mesh, 8);
+  memcpy(&to.sin6_addr.s6_addr[8], packet + 32, 8);
+  to.sin6_port = htons((packet[42] << 8) | packet[43]);
+  if(sendto(f->fd, packet + IPV6_HEADER + UDP_HEADER, plen - UDP_HEADER, 0,
+            (struct sockaddr *)&to, sizeof(to)) < 0) {
+    stats.dropped++;
+    return;
+  }
+  stats.to_mesh++;
+  if(tracing) {
+    trace_record('d', packet + IPV6_HEADER + UDP_HEADER, plen - UDP_HEADER,
+                 in, clock_us());
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+flow_input(struct flow *f)
+{
+  uint8_t packet[MAX_PACKET];
+  struct sockaddr_in6 from;
+  socklen_t fromlen = sizeof(from);
+  ssize_t n;
+  size_t udp_len;
+  uint16_t sum;
+
+  uint32_t in;
+
+  n = recvfrom(f->fd, packet + IPV6_HEADER + UDP_HEADER,
+               sizeof(packet) - IPV6_HEADER - UDP_HEADER, 0,
+               (struct sockaddr *)&from, &fromlen);
+  if(n < 0) {
+    return;
+  }
+  in = clock_us();
+  if(memcmp(&from.sin6_addr, &mesh, 8) != 0) {
+    stats.dropped++;
+    return;
+  }
+  udp_len = UDP_HEADER + n;
+
+  packet[0] = 0x60;
+  packet[1] = packet[2] = packet[3] = 0;
+  packet[4] = udp_len >> 8;
+  packet[5] = udp_len & 0xff;
+  packet[6] = PROTO_UDP;
+  packet[7] = 64;
+  memcpy(packet + 8, &prefix, 8);
+  memcpy(packet + 16, &from.sin6_addr.s6_addr[8], 8);
+  memcpy(packet + 24, &f->host, 16);
+  packet[40] = ntohs(from.sin6_port) >> 8;
+  packet[41] = ntohs(from.sin6_port) & 0xff;
+  packet[42] = f->host_port >> 8;
+  packet[43] = f->host_port & 0xff;
+  packet[44] = udp_len >> 8;
+  packet[45] = udp_len & 0xff;
+  packet[46] = packet[47] = 0;
+  sum = checksum(packet, PROTO_UDP, udp_len);
+  if(sum == 0) sum = 0xffff;
+  packet[46] = sum >> 8;
+  packet[47] = sum & 0xff;
+
+  f->used = clock_ms();
+  stats.from_mesh++;
+  if(tracing) {
+    uint32_t out = clock_us();
+    link_send(packet, IPV6_HEADER + udp_len);
+    trace_record('u', packet + IPV6_HEADER + UDP_HEADER, n, in, out);
+  } else {
+    link_send(packet, IPV6_HEADER + udp_len);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_pty(const char *link)
+{
+  struct termios tty;
+  int master;
+  char *name;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master == -1 || grantpt(master) == -1 || unlockpt(master) == -1 ||
+     (name = ptsname(master)) == NULL) {
+    err(1, "can't open a pseudo-terminal");
+  }
+  /* Keep the slave open: the master would hang up whenever tunslip6 is
+     not running, and the line is raw before tunslip6 sets it */
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if(slave == -1 || tcgetattr(slave, &tty) == -1) {
+    err(1, "can't open %s", name);
+  }
+  cfmakeraw(&tty);
+  tcsetattr(slave, TCSANOW, &tty);
+  if(link != NULL) {
+    unlink(link);
+    if(symlink(name, link) == -1) {
+      err(1, "can't link %s to %s", link, name);
+    }
+  }
+  fprintf(stderr, "*** SLIP link on %s%s%s\n", name, link ? " linked from " : "",
+          link ? link : "");
+  return master;
+}
+/*---------------------------------------------------------------------------*/
+static void
+report(void)
+{
+  fprintf(stderr, "*** %llu to the mesh, %llu from the mesh, %llu echoes, "
+          "%llu dropped, %llu bytes in, %llu bytes out\n",
+          (unsigned long long)stats.to_mesh,
+          (unsigned long long)stats.from_mesh,
+          (unsigned long long)stats.echoes,
+          (unsigned long long)stats.dropped,
+          (unsigned long long)stats.bytes_in,
+          (unsigned long long)stats.bytes_out);
+  if(slip.corrupted > 0) {
+    fprintf(stderr, "*** %lu corrupted frames dropped\n", slip.corrupted);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+sigcleanup(int signo)
+{
+  exit(0);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  const char *link = NULL;
+  const char *mesh_prefix = "bbbb::";
+  uint64_t last_request = 0, last_report;
+  int c, i;
+
+  while((c = getopt(argc, argv, "CL:m:vXh")) != -1) {
+    switch(c) {
+    case 'L':
+      link = optarg;
+      break;
+    case 'm':
+      mesh_prefix = optarg;
+      break;
+    case 'v':
+      verbose++;
+      break;
+    case 'X':
+      tracing = 1;
+      break;
+    case 'C':
+      cobs = 1;
+      break;
+    case '?':
+    case 'h':
+    default:
+fprintf(stderr,"usage:  %s [options]\n", prog);
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -L link     Symbolic link to the pseudo-terminal, e.g. /tmp/br-tty\n");
+fprintf(stderr," -m prefix   /64 of the native thermostats (default bbbb::)\n");
+fprintf(stderr," -v          Print the debug output and a report every 10 seconds\n");
+fprintf(stderr," -X          Send trace records of the CoAP packets, for tunslip6 -X\n");
+fprintf(stderr," -C          Take COBS framing with a CRC when tunslip6 -C asks\n");
+exit(1);
+      break;
+    }
+  }
+  if(inet_pton(AF_INET6, mesh_prefix, &mesh) != 1) {
+    errx(1, "invalid prefix ``%s''", mesh_prefix);
+  }
+
+  signal(SIGINT, sigcleanup);
+  signal(SIGTERM, sigcleanup);
+  atexit(report);
+
+  slip_link_attach(&slip, open_pty(link));
+  slip.packet = packet_callback;
+  slip.control = control_callback;
+  pfds[0].fd = slip.fd;
+  pfds[0].events = POLLIN;
+  for(i = 0; i < FLOWS; i++) {
+    flows[i].fd = -1;
+    pfds[1 + i].fd = -1;
+    pfds[1 + i].events = POLLIN;
+  }
+  debug_line("RPL-Border router started\n");
+  last_report = clock_ms();
+  host_time.best_rtt = UINT32_MAX;
+
+  while(1) {
+    uint64_t now = clock_ms();
+    int timeout = prefix_set ? REPORT_MS : PREFIX_RETRY;
+
+    if(!prefix_set && now - last_request >= PREFIX_RETRY) {
+      uint8_t request[2] = { '?', 'P' };
+      link_send(request, sizeof(request));
+      last_request = now;
+    }
+    if(prefix_set) {
+      if(now >= host_time.next) {
+        host_time_run(now);
+      }
+      if(host_time.next - now < (uint64_t)timeout) {
+        timeout = host_time.next - now;
+      }
+    }
+    if(verbose && now - last_report >= REPORT_MS) {
+      report();
+      last_report = now;
+    }
+    pfds[0].events = slip_link_pending(&slip) ? POLLIN | POLLOUT : POLLIN;
+    if(poll(pfds, 1 + FLOWS, timeout) == -1) {
+      if(errno == EINTR) continue;
+      err(1, "poll");
+    }
+    if(pfds[0].revents & POLLOUT) {
+      slip_link_flush(&slip);
+    }
+    if(pfds[0].revents & POLLIN) {
+      slip_link_input(&slip);
+    }
+    for(i = 0; i < FLOWS; i++) {
+      if(pfds[1 + i].revents & POLLIN) {
+        flow_input(&flows[i]);
+      }
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
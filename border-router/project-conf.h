@@ -47,6 +47,12 @@
 #define UIP_CONF_RECEIVE_WINDOW  60
 #endif
 
+/* make TRACE=1: per-hop trace records, see trace.h */
+#if TRACE_ENABLED
+#undef NETSTACK_CONF_MAC
+#define NETSTACK_CONF_MAC trace_mac_driver
+#endif
+
 #ifndef WEBSERVER_CONF_CFS_CONNS
 #define WEBSERVER_CONF_CFS_CONNS 2
 #endif
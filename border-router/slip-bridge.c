@@ -44,20 +44,39 @@
 #include "dev/uart1.h"
 #include <string.h>
 
+#include "framing.h"
+
+#if TRACE_ENABLED
+#include "trace.h"
+#endif
+
 #define UIP_IP_BUF        ((struct uip_ip_hdr *)&uip_buf[UIP_LLH_LEN])
 
 #define DEBUG DEBUG_PRINT
 #include "net/uip-debug.h"
 
 void set_prefix_64(uip_ipaddr_t *);
+void set_host_time(uint32_t sent, uint32_t host);
 
 static uip_ipaddr_t last_sender;
 /*---------------------------------------------------------------------------*/
+static uint32_t
+get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+    ((uint32_t)p[2] << 8) | p[3];
+}
+/*---------------------------------------------------------------------------*/
 static void
 slip_input_callback(void)
 {
  // PRINTF("SIN: %u\n", uip_len);
-  if(uip_buf[0] == '!') {
+  if(uip_buf[0] == '!' && uip_buf[1] == 'T' && uip_len >= 2 + 4 + 8) {
+    /* Our request's time, then the host's in microseconds on 64 bits.
+       Before any debug output, which would hold the line meanwhile. */
+    set_host_time(get32(&uip_buf[2]), get32(&uip_buf[10]));
+    uip_len = 0;
+  } else if(uip_buf[0] == '!') {
     PRINTF("Got configuration message of type %c\n", uip_buf[1]);
     uip_len = 0;
     if(uip_buf[1] == 'P') {
@@ -82,11 +101,21 @@ slip_input_callback(void)
         uip_buf[3 + j * 2] = hexchar[uip_lladdr.addr[j] & 15];
       }
       uip_len = 18;
-      slip_send();
+      framing_send();
       
     }
+#if COBS_ENABLED
+    else if(uip_buf[1] == 'F' && uip_len >= 3 && uip_buf[2] == 'C') {
+      framing_request();
+    }
+#endif
     uip_len = 0;
   }
+#if TRACE_ENABLED
+  else {
+    trace_slip_input();
+  }
+#endif
   /* Save the last sender received over SLIP to avoid bouncing the
      packet back if no route is found */
   uip_ipaddr_copy(&last_sender, &UIP_IP_BUF->srcipaddr);
@@ -98,6 +127,9 @@ init(void)
   slip_arch_init(BAUD2UBR(115200));
   process_start(&slip_process, NULL);
   slip_set_input_callback(slip_input_callback);
+#if COBS_ENABLED
+  framing_init(slip_input_callback);
+#endif
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -113,7 +145,13 @@ output(void)
     PRINTF("\n");
   } else {
  //   PRINTF("SUT: %u\n", uip_len);
-    slip_send();
+#if TRACE_ENABLED
+    trace_slip_output();
+    framing_send();
+    trace_flush();
+#else
+    framing_send();
+#endif
   }
 }
 
@@ -123,6 +161,9 @@ output(void)
 int
 putchar(int c)
 {
+#if COBS_ENABLED
+  framing_putchar(c);
+#else
 #define SLIP_END     0300
   static char debug_frame = 0;
 
@@ -144,6 +185,7 @@ putchar(int c)
     slip_arch_writeb(SLIP_END);
     debug_frame = 0;
   }
+#endif
   return c;
 }
 #endif
@@ -0,0 +1,289 @@
+/**
+ * \file
+ *         Per-hop tracing of the CoAP packets crossing the border router.
+ */
+
+#include "contiki.h"
+#include "net/uip.h"
+#include "net/mac/csma.h"
+#include "dev/slip.h"
+#include "timesync.h"
+#include "trace.h"
+#include "framing.h"
+
+#include <string.h>
+
+#define SLIP_END     0300
+#define SLIP_ESC     0333
+#define SLIP_ESC_END 0334
+#define SLIP_ESC_ESC 0335
+
+#define IPV6_HEADER  40
+#define UDP_HEADER   8
+#define COAP_PORT    5683
+
+/* Packets to the mesh traced at once, as many as the MAC can queue */
+#define SLOTS        4
+
+/* From the SLIP input to the MAC, or from the MAC to the SLIP output, the
+   packet goes through uIP synchronously: anything later is another one */
+#define SAME_PACKET  (RTIMER_ARCH_SECOND / 100)
+
+struct record {
+  uint8_t dir;
+  uint8_t flags;
+  uint16_t mid;
+  uint8_t tkl;
+  uint8_t token[8];
+  uint32_t in, out;
+};
+
+/* A packet to the mesh, from the MAC send to its last fragment sent */
+static struct slot {
+  struct record r;
+  mac_callback_t sent;
+  void *ptr;
+  uint8_t fragments;
+} slots[SLOTS];
+
+static struct record pending, up;
+static struct slot *pending_slot;
+static uint8_t pending_set, up_set, radio_in_flags;
+static rtimer_clock_t pending_at, radio_in_at;
+static uint32_t radio_in;
+
+/*---------------------------------------------------------------------------*/
+static uint32_t
+stamp(uint8_t *flags)
+{
+  uint32_t t;
+
+  if(timesync_now(&t) == 0) {
+    *flags = 1;
+    return t;
+  }
+  *flags = 0;
+  return timesync_local();
+}
+/*---------------------------------------------------------------------------*/
+/* The CoAP key of the packet in uip_buf, 0 if it is not CoAP */
+static int
+parse(struct record *r)
+{
+  uint8_t *p = &uip_buf[UIP_LLH_LEN];
+  uint8_t *udp, *coap;
+  uint16_t offset = IPV6_HEADER;
+  uint8_t next = p[6];
+
+  /* RPL's hop-by-hop option */
+  if(next == UIP_PROTO_HBHO && uip_len >= offset + 8) {
+    next = p[offset];
+    offset += (p[offset + 1] + 1) * 8;
+  }
+  if(next != UIP_PROTO_UDP || uip_len < offset + UDP_HEADER + 4) {
+    return 0;
+  }
+  udp = p + offset;
+  if(((udp[0] << 8) | udp[1]) != COAP_PORT &&
+     ((udp[2] << 8) | udp[3]) != COAP_PORT) {
+    return 0;
+  }
+  coap = udp + UDP_HEADER;
+  r->tkl = coap[0] & 15;
+  if((coap[0] >> 6) != 1 || r->tkl > 8 ||
+     offset + UDP_HEADER + 4 + r->tkl > uip_len) {
+    return 0;
+  }
+  r->mid = (coap[2] << 8) | coap[3];
+  memcpy(r->token, coap + 4, r->tkl);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+writeb(uint8_t c)
+{
+  if(c == SLIP_END) {
+    slip_arch_writeb(SLIP_ESC);
+    c = SLIP_ESC_END;
+  } else if(c == SLIP_ESC) {
+    slip_arch_writeb(SLIP_ESC);
+    c = SLIP_ESC_ESC;
+  }
+  slip_arch_writeb(c);
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t *
+put32(uint8_t *p, uint32_t v)
+{
+  *p++ = v >> 24;
+  *p++ = v >> 16;
+  *p++ = v >> 8;
+  *p++ = v;
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_record(const struct record *r)
+{
+  uint8_t frame[7 + 8 + 8], *p = frame;
+  uint8_t len;
+
+  *p++ = '!';
+  *p++ = 'R';
+  *p++ = r->dir;
+  *p++ = r->flags;
+  *p++ = r->mid >> 8;
+  *p++ = r->mid;
+  *p++ = r->tkl;
+  memcpy(p, r->token, r->tkl);
+  p = put32(p + r->tkl, r->in);
+  len = put32(p, r->out) - frame;
+#if COBS_ENABLED
+  framing_write(frame, len);
+#else
+  slip_arch_writeb(SLIP_END);
+  for(p = frame; len > 0; len--) {
+    writeb(*p++);
+  }
+  slip_arch_writeb(SLIP_END);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_slip_input(void)
+{
+  pending_set = parse(&pending);
+  if(pending_set) {
+    pending.dir = 'd';
+    pending.in = stamp(&pending.flags);
+    pending_at = RTIMER_NOW();
+    pending_slot = NULL;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_slip_output(void)
+{
+  uint8_t flags;
+
+  up_set = parse(&up);
+  if(up_set) {
+    up.dir = 'u';
+    up.out = stamp(&flags);
+    if(RTIMER_CLOCK_LT(RTIMER_NOW(), radio_in_at + SAME_PACKET)) {
+      up.in = radio_in;
+      up.flags = flags & radio_in_flags;
+    } else {
+      /* Our own, e.g. an echo reply */
+      up.in = up.out;
+      up.flags = flags;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_flush(void)
+{
+  if(up_set) {
+    send_record(&up);
+    up_set = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+traced_sent(void *ptr, int status, int num_tx)
+{
+  struct slot *s = ptr;
+  mac_callback_t sent = s->sent;
+  uint8_t flags;
+
+  if(--s->fragments == 0) {
+    s->r.out = stamp(&flags);
+    s->r.flags &= flags;
+    send_record(&s->r);
+  }
+  if(sent != NULL) {
+    sent(s->ptr, status, num_tx);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static struct slot *
+find_slot(void)
+{
+  uint8_t i;
+
+  if(!pending_set ||
+     !RTIMER_CLOCK_LT(RTIMER_NOW(), pending_at + SAME_PACKET)) {
+    return NULL;
+  }
+  if(pending_slot != NULL) {
+    return pending_slot;        /* Another fragment */
+  }
+  for(i = 0; i < SLOTS; i++) {
+    if(slots[i].fragments == 0) {
+      pending_slot = &slots[i];
+      pending_slot->r = pending;
+      return pending_slot;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send(mac_callback_t sent, void *ptr)
+{
+  struct slot *s = find_slot();
+
+  if(s == NULL) {
+    csma_driver.send(sent, ptr);
+    return;
+  }
+  s->sent = sent;
+  s->ptr = ptr;
+  s->fragments++;
+  csma_driver.send(traced_sent, s);
+}
+/*---------------------------------------------------------------------------*/
+static void
+input(void)
+{
+  /* The last fragment of a packet completes it */
+  radio_in = stamp(&radio_in_flags);
+  radio_in_at = RTIMER_NOW();
+  csma_driver.input();
+}
+/*---------------------------------------------------------------------------*/
+static void
+init(void)
+{
+  csma_driver.init();
+}
+/*---------------------------------------------------------------------------*/
+static int
+on(void)
+{
+  return csma_driver.on();
+}
+/*---------------------------------------------------------------------------*/
+static int
+off(int keep_radio_on)
+{
+  return csma_driver.off(keep_radio_on);
+}
+/*---------------------------------------------------------------------------*/
+static unsigned short
+channel_check_interval(void)
+{
+  return csma_driver.channel_check_interval();
+}
+/*---------------------------------------------------------------------------*/
+const struct mac_driver trace_mac_driver = {
+  "trace",
+  init,
+  send,
+  input,
+  on,
+  off,
+  channel_check_interval,
+};
+/*---------------------------------------------------------------------------*/
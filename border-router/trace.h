@@ -0,0 +1,35 @@
+/**
+ * \file
+ *         Per-hop tracing of the CoAP packets crossing the border router,
+ *         built in with make TRACE=1.
+ *
+ *         The border router stamps when a packet came in, from the SLIP
+ *         link or the radio, and when it left: once the radio sent its last
+ *         fragment, or as its SLIP frame starts. The record follows on the
+ *         SLIP link as a "!R" frame: the direction ('d' to the mesh, 'u'
+ *         from it), flags (1 when the times are network time, see
+ *         sensor/timesync.h, local time otherwise), the CoAP message ID and
+ *         token length, the token, then ingress and egress in microseconds
+ *         (4 bytes each, network byte order). tunslip6 -X writes the records
+ *         to its trace with its own stamps (tunslip6/trace.h).
+ *
+ *         The radio side is trace_mac_driver, in front of csma_driver.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "net/mac/mac.h"
+
+extern const struct mac_driver trace_mac_driver;
+
+/** A packet from the SLIP link is in uip_buf, on its way to the mesh */
+void trace_slip_input(void);
+
+/** The packet in uip_buf is about to go on the SLIP link */
+void trace_slip_output(void);
+
+/** Send the record of the packet that went on the SLIP link, if any */
+void trace_flush(void);
+
+#endif /* __TRACE_H__ */
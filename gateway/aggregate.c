@@ -0,0 +1,169 @@
+/**
+ * \file
+ *         Streaming per-thermostat and home-wide window statistics.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "aggregate.h"
+#include "loop.h"
+#include "thermostats.h"
+
+static struct loop_timer timer;
+static aggregate_callback_t callback;
+static uint32_t window_length;
+static unsigned window_panes;
+static unsigned rows;
+
+/* Open window and last closed window, swapped at every close */
+static struct aggregate_stats *open_stats, *closed_stats;
+static unsigned *open_rows, *closed_rows;
+static unsigned open_count, closed_count;
+static struct aggregate_stats open_home;
+static int64_t open_home_last_sum;
+
+/* Sliding window: a ring of closed windows and their running total */
+static struct aggregate_stats *panes, *sliding;
+static struct aggregate_stats *home_panes, home_sliding;
+static unsigned pane_head;
+
+static struct aggregate_window last;
+static int closed_once;
+
+/*---------------------------------------------------------------------------*/
+static void
+stats_add(struct aggregate_stats *s, int32_t value)
+{
+  if(s->count == 0 || value < s->min) s->min = value;
+  if(s->count == 0 || value > s->max) s->max = value;
+  s->sum += value;
+  s->count++;
+  s->last = value;
+}
+/*---------------------------------------------------------------------------*/
+void
+aggregate_add(unsigned row, int32_t value)
+{
+  struct aggregate_stats *s;
+
+  if(row >= rows) {
+    return;
+  }
+  s = &open_stats[row];
+  if(s->count == 0) {
+    open_rows[open_count++] = row;
+    open_home_last_sum += value;
+  } else {
+    /* Only the last reading of a thermostat counts for the home average */
+    open_home_last_sum += value - s->last;
+  }
+  stats_add(s, value);
+  stats_add(&open_home, value);
+}
+/*---------------------------------------------------------------------------*/
+/* Push a closed window in the ring and update the sliding window total */
+static void
+slide(struct aggregate_stats *ring, struct aggregate_stats *total,
+      const struct aggregate_stats *closed)
+{
+  struct aggregate_stats *evicted = &ring[pane_head];
+  unsigned i;
+  int first = 1;
+
+  if(evicted->count == 0 && closed->count == 0) {
+    return;                     /* Nothing changes for a quiet thermostat */
+  }
+  total->sum += closed->sum - evicted->sum;
+  total->count += closed->count - evicted->count;
+  if(closed->count) {
+    total->last = closed->last;
+  }
+  *evicted = *closed;
+
+  /* Extremes can't be subtracted, fold the panes: once per window, not
+     per reading */
+  for(i = 0; i < window_panes; i++) {
+    if(ring[i].count == 0) {
+      continue;
+    }
+    if(first || ring[i].min < total->min) total->min = ring[i].min;
+    if(first || ring[i].max > total->max) total->max = ring[i].max;
+    first = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+close_window(struct loop_timer *t)
+{
+  struct aggregate_stats *stats;
+  unsigned *list, i;
+
+  for(i = 0; i < rows; i++) {
+    slide(&panes[(size_t)i * window_panes], &sliding[i], &open_stats[i]);
+  }
+  slide(home_panes, &home_sliding, &open_home);
+  pane_head = (pane_head + 1) % window_panes;
+
+  /* The open window becomes the closed one */
+  stats = closed_stats;
+  closed_stats = open_stats;
+  open_stats = stats;
+  list = closed_rows;
+  closed_rows = open_rows;
+  open_rows = list;
+  for(i = 0; i < closed_count; i++) {
+    memset(&open_stats[open_rows[i]], 0, sizeof(*open_stats));
+  }
+  closed_count = open_count;
+  open_count = 0;
+
+  last.end = clock_wall_ms();
+  last.length = window_length;
+  last.panes = window_panes;
+  last.count = closed_count;
+  last.rows = closed_rows;
+  last.tumbling = closed_stats;
+  last.sliding = sliding;
+  last.home = open_home;
+  last.home_sliding = home_sliding;
+  last.home_average = closed_count ?
+    (double)open_home_last_sum / closed_count : 0;
+  memset(&open_home, 0, sizeof(open_home));
+  open_home_last_sum = 0;
+  closed_once = 1;
+
+  if(callback != NULL) {
+    callback(&last);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+aggregate_init(uint32_t length, unsigned count, aggregate_callback_t cb)
+{
+  rows = thermostats_count;
+  window_length = length;
+  window_panes = count ? count : 1;
+  callback = cb;
+
+  open_stats = calloc(rows, sizeof(*open_stats));
+  closed_stats = calloc(rows, sizeof(*closed_stats));
+  open_rows = calloc(rows, sizeof(*open_rows));
+  closed_rows = calloc(rows, sizeof(*closed_rows));
+  sliding = calloc(rows, sizeof(*sliding));
+  panes = calloc((size_t)rows * window_panes, sizeof(*panes));
+  home_panes = calloc(window_panes, sizeof(*home_panes));
+  if(!open_stats || !closed_stats || !open_rows || !closed_rows ||
+     !sliding || !panes || !home_panes) {
+    err(1, "aggregate_init");
+  }
+  loop_every(&timer, length, close_window);
+}
+/*---------------------------------------------------------------------------*/
+const struct aggregate_window *
+aggregate_last(void)
+{
+  return closed_once ? &last : NULL;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,61 @@
+/**
+ * \file
+ *         Streaming per-thermostat and home-wide window statistics.
+ *
+ *         Replaces the "Home and single thermostats averages" node, which
+ *         re-scanned every stored reading once a minute. Readings update the
+ *         open window in constant time; when it closes, it becomes a pane of
+ *         the sliding window and both are reported.
+ *
+ *         The home average keeps the semantics of the flow: the mean of the
+ *         last reading of each thermostat that reported during the window.
+ */
+
+#ifndef __AGGREGATE_H__
+#define __AGGREGATE_H__
+
+#include <stdint.h>
+
+struct aggregate_stats {
+  int64_t sum;
+  int32_t min, max;
+  uint32_t count;
+  int32_t last;                 /* Last reading added */
+};
+
+#define AGGREGATE_MEAN(s) ((double)(s)->sum / (s)->count)
+
+struct aggregate_window {
+  uint64_t end;                 /* Wall clock milliseconds */
+  uint32_t length;              /* Tumbling window length, milliseconds */
+  unsigned panes;               /* Tumbling windows in a sliding window */
+
+  /* Rows that reported during the tumbling window, in arrival order */
+  unsigned count;
+  const unsigned *rows;
+
+  /* Indexed by row; the tumbling entry is meaningful if its count is > 0 */
+  const struct aggregate_stats *tumbling;
+  const struct aggregate_stats *sliding;
+
+  struct aggregate_stats home;          /* Every reading of the window */
+  struct aggregate_stats home_sliding;
+  double home_average;                  /* Valid if count > 0 */
+};
+
+typedef void (* aggregate_callback_t)(const struct aggregate_window *w);
+
+/**
+ * Start windows of length milliseconds, the sliding window spanning the
+ * last panes of them. The callback runs every time a window closes.
+ */
+void aggregate_init(uint32_t length, unsigned panes,
+                    aggregate_callback_t callback);
+
+/** Account a reading of the thermostat at row */
+void aggregate_add(unsigned row, int32_t value);
+
+/** The last closed window, NULL before the first one closes */
+const struct aggregate_window *aggregate_last(void);
+
+#endif /* __AGGREGATE_H__ */
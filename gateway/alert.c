@@ -0,0 +1,84 @@
+/**
+ * \file
+ *         Event-driven temperature range alerts.
+ */
+
+#include <stdlib.h>
+#include <err.h>
+
+#include "alert.h"
+
+const char *alert_state_names[] = { "normal", "low", "high" };
+
+/* Four bytes of state per thermostat */
+struct alert_rule {
+  uint8_t state;
+  uint8_t candidate;            /* State the current streak points to */
+  uint8_t streak;               /* Consecutive readings towards candidate */
+  uint8_t reserved;
+};
+
+static struct alert_rule *rules;
+static int hysteresis;
+static uint8_t debounce;
+static alert_callback_t callback;
+
+/*---------------------------------------------------------------------------*/
+void
+alert_init(int h, int d, alert_callback_t cb)
+{
+  rules = calloc(thermostats_count, sizeof(*rules));
+  if(rules == NULL) err(1, "alert_init");
+  hysteresis = h;
+  debounce = d < 1 ? 1 : d > 255 ? 255 : d;
+  callback = cb;
+}
+/*---------------------------------------------------------------------------*/
+static alert_state_t
+classify(const struct thermostat *t, const struct alert_rule *r, int value)
+{
+  if(value < t->min) {
+    return ALERT_LOW;
+  }
+  if(value > t->max) {
+    return ALERT_HIGH;
+  }
+  /* Inside the range: stay in alarm until the reading is clearly back */
+  if(r->state == ALERT_LOW && value < t->min + hysteresis) {
+    return ALERT_LOW;
+  }
+  if(r->state == ALERT_HIGH && value > t->max - hysteresis) {
+    return ALERT_HIGH;
+  }
+  return ALERT_NORMAL;
+}
+/*---------------------------------------------------------------------------*/
+void
+alert_check(struct thermostat *t, int value)
+{
+  struct alert_rule *r = &rules[t - thermostats];
+  alert_state_t state = classify(t, r, value);
+
+  if(state == r->state) {
+    r->streak = 0;
+    return;
+  }
+  if(state != r->candidate) {
+    r->candidate = state;
+    r->streak = 0;
+  }
+  if(++r->streak >= debounce) {
+    r->state = state;
+    r->streak = 0;
+    if(callback != NULL) {
+      callback(t, state);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+alert_state_t
+alert_state(const struct thermostat *t)
+{
+  return rules ? rules[t - thermostats].state : ALERT_NORMAL;
+}
+/*---------------------------------------------------------------------------*/
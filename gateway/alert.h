@@ -0,0 +1,38 @@
+/**
+ * \file
+ *         Event-driven temperature range alerts.
+ *
+ *         Replaces the "Check temperature range" node, which re-checked the
+ *         whole history every minute. Each reading is checked against the
+ *         range of its thermostat as it arrives: a thermostat goes into
+ *         alarm after `debounce' consecutive readings out of [min, max] and
+ *         leaves it after as many readings back within
+ *         [min + hysteresis, max - hysteresis].
+ */
+
+#ifndef __ALERT_H__
+#define __ALERT_H__
+
+#include <stdint.h>
+
+#include "thermostats.h"
+
+typedef enum {
+  ALERT_NORMAL,
+  ALERT_LOW,
+  ALERT_HIGH
+} alert_state_t;
+
+extern const char *alert_state_names[];
+
+typedef void (* alert_callback_t)(struct thermostat *t, alert_state_t state);
+
+/** One rule per thermostat, using the min and max of its table row */
+void alert_init(int hysteresis, int debounce, alert_callback_t callback);
+
+/** Check a new reading, calling back if the alarm state changes */
+void alert_check(struct thermostat *t, int temperature);
+
+alert_state_t alert_state(const struct thermostat *t);
+
+#endif /* __ALERT_H__ */
@@ -0,0 +1,76 @@
+/**
+ * \file
+ *         Growable byte buffer used to format responses.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "buf.h"
+
+/*---------------------------------------------------------------------------*/
+void
+buf_reserve(struct buf *b, size_t extra)
+{
+  size_t size = b->size ? b->size : 256;
+
+  if(b->len + extra <= b->size) {
+    return;
+  }
+  while(size < b->len + extra) {
+    size *= 2;
+  }
+  b->data = realloc(b->data, size);
+  if(b->data == NULL) err(1, "buf_reserve");
+  b->size = size;
+}
+/*---------------------------------------------------------------------------*/
+void
+buf_append(struct buf *b, const void *data, size_t len)
+{
+  buf_reserve(b, len);
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+/*---------------------------------------------------------------------------*/
+void
+buf_printf(struct buf *b, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  buf_reserve(b, 64);
+  va_start(ap, fmt);
+  n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+  va_end(ap);
+  if(n >= (int)(b->size - b->len)) {
+    buf_reserve(b, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+    va_end(ap);
+  }
+  b->len += n;
+}
+/*---------------------------------------------------------------------------*/
+void
+buf_consume(struct buf *b, size_t n)
+{
+  if(n >= b->len) {
+    b->len = 0;
+  } else {
+    memmove(b->data, b->data + n, b->len - n);
+    b->len -= n;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+buf_free(struct buf *b)
+{
+  free(b->data);
+  b->data = NULL;
+  b->len = b->size = 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,26 @@
+/**
+ * \file
+ *         Growable byte buffer used to format responses.
+ */
+
+#ifndef __BUF_H__
+#define __BUF_H__
+
+#include <stddef.h>
+
+struct buf {
+  char *data;
+  size_t len;
+  size_t size;
+};
+
+void buf_reserve(struct buf *b, size_t extra);
+void buf_append(struct buf *b, const void *data, size_t len);
+void buf_printf(struct buf *b, const char *fmt, ...)
+     __attribute__((__format__ (__printf__, 2, 3)));
+
+/** Drop n bytes from the front of the buffer */
+void buf_consume(struct buf *b, size_t n);
+void buf_free(struct buf *b);
+
+#endif /* __BUF_H__ */
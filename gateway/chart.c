@@ -0,0 +1,234 @@
+/**
+ * \file
+ *         Downsampled series for the dashboard charts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "chart.h"
+#include "httpd.h"
+#include "loop.h"
+#include "thermostats.h"
+#include "tsdb.h"
+
+#define MAX_POINTS  4096
+
+/* Readings of a thermostat since the last update */
+struct chart_column {
+  struct chart_point min, max;
+  uint32_t count;
+};
+
+static uint32_t default_span;
+static unsigned default_points;
+static struct chart_column *columns;
+static struct loop_timer update_timer;
+
+/* Scratch series, reused by every request */
+static struct chart_point *series;
+static size_t series_len, series_size;
+static struct chart_point sampled[MAX_POINTS];
+
+/*---------------------------------------------------------------------------*/
+size_t
+chart_lttb(const struct chart_point *in, size_t n,
+           struct chart_point *out, size_t points)
+{
+  double every, ax, ay, avg_x, avg_y, area, max_area;
+  size_t a = 0, i, j, k = 0, start, end, next_end, pick;
+
+  if(n <= points || points < 3) {
+    if(n > points) n = points;
+    memcpy(out, in, n * sizeof(*in));
+    return n;
+  }
+  /* Times relative to the first point keep the areas exact in a double */
+  every = (double)(n - 2) / (points - 2);
+  out[k++] = in[0];
+  for(i = 0; i < points - 2; i++) {
+    start = (size_t)(i * every) + 1;
+    end = (size_t)((i + 1) * every) + 1;
+    next_end = (size_t)((i + 2) * every) + 1;
+    if(next_end > n) next_end = n;
+
+    /* The third vertex is the average of the next bucket */
+    avg_x = avg_y = 0;
+    for(j = end; j < next_end; j++) {
+      avg_x += in[j].time - in[0].time;
+      avg_y += in[j].value;
+    }
+    avg_x /= next_end - end;
+    avg_y /= next_end - end;
+
+    ax = in[a].time - in[0].time;
+    ay = in[a].value;
+    max_area = -1;
+    pick = start;
+    for(j = start; j < end; j++) {
+      area = (ax - avg_x) * (in[j].value - ay) -
+             (ax - (double)(in[j].time - in[0].time)) * (avg_y - ay);
+      if(area < 0) area = -area;
+      if(area > max_area) {
+        max_area = area;
+        pick = j;
+      }
+    }
+    out[k++] = in[pick];
+    a = pick;
+  }
+  out[k++] = in[n - 1];
+  return k;
+}
+/*---------------------------------------------------------------------------*/
+static void
+series_add(uint64_t time, double value)
+{
+  if(series_len == series_size) {
+    series_size = series_size ? series_size * 2 : 1024;
+    series = realloc(series, series_size * sizeof(*series));
+    if(series == NULL) err(1, "chart");
+  }
+  series[series_len].time = time;
+  series[series_len].value = value;
+  series_len++;
+}
+/*---------------------------------------------------------------------------*/
+static void
+scan_callback(const struct tsdb_point *p, void *arg)
+{
+  series_add(p->time, p->value);
+}
+/*---------------------------------------------------------------------------*/
+static void
+series_json(unsigned row, uint64_t from, uint64_t to, unsigned points,
+            struct buf *out)
+{
+  uint64_t column = (to - from) / points;
+  const struct tsdb_bucket *b;
+  size_t i, n;
+
+  /*
+   * Raw readings unless a pixel column spans a few buckets of a tier,
+   * whose means are then a much shorter input with the same shape.
+   */
+  series_len = 0;
+  if(column < 2 * 60 * 1000) {
+    tsdb_scan(row, from, to, scan_callback, NULL);
+  } else {
+    b = tsdb_buckets(row, column < 2 * 3600 * 1000 ? TSDB_MINUTE : TSDB_HOUR,
+                     from, to, &n);
+    for(i = 0; i < n; i++) {
+      series_add(b[i].start, (double)b[i].sum / b[i].count);
+    }
+  }
+  n = chart_lttb(series, series_len, sampled, points);
+
+  buf_append(out, "[", 1);
+  for(i = 0; i < n; i++) {
+    buf_printf(out, "%s[%llu,%g]", i ? "," : "",
+               (unsigned long long)sampled[i].time, sampled[i].value);
+  }
+  buf_append(out, "]", 1);
+}
+/*---------------------------------------------------------------------------*/
+int
+chart_json(int row, const char *query, struct buf *out)
+{
+  uint64_t to = clock_wall_ms(), from = to - default_span;
+  unsigned points = default_points;
+  const char *q;
+  unsigned i;
+
+  for(q = query; q != NULL; q = strchr(q, '&')) {
+    unsigned long long v;
+    if(*q == '&') q++;
+    if(sscanf(q, "from=%llu", &v) == 1) from = v;
+    if(sscanf(q, "to=%llu", &v) == 1) to = v;
+    sscanf(q, "points=%u", &points);
+  }
+  if(to <= from || points == 0 || points > MAX_POINTS) {
+    return 400;
+  }
+
+  if(row >= 0) {
+    series_json(row, from, to, points, out);
+    return 200;
+  }
+  buf_printf(out, "{\"from\":%llu,\"to\":%llu,\"series\":[",
+             (unsigned long long)from, (unsigned long long)to);
+  for(i = 0; i < thermostats_count; i++) {
+    buf_printf(out, "%s{\"id\":%u,\"points\":", i ? "," : "", i);
+    series_json(i, from, to, points, out);
+    buf_append(out, "}", 1);
+  }
+  buf_append(out, "]}", 2);
+  return 200;
+}
+/*---------------------------------------------------------------------------*/
+void
+chart_add(unsigned row, uint64_t time, int32_t value)
+{
+  struct chart_column *c = &columns[row];
+
+  if(c->count == 0 || value < c->min.value) {
+    c->min.time = time;
+    c->min.value = value;
+  }
+  if(c->count == 0 || value >= c->max.value) {
+    c->max.time = time;
+    c->max.value = value;
+  }
+  c->count++;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Every column interval, the min and max of each thermostat that reported,
+ * in time order: {"points":[[id,time,value],...]}. Sent once to all the
+ * WebSockets, the browser keeps at most the default points per series.
+ */
+static void
+update_callback(struct loop_timer *t)
+{
+  const struct chart_point *first, *second;
+  struct buf out = { 0 };
+  struct chart_column *c;
+  unsigned i;
+
+  for(i = 0; i < thermostats_count; i++) {
+    c = &columns[i];
+    if(c->count == 0) {
+      continue;
+    }
+    first = c->min.time < c->max.time ? &c->min : &c->max;
+    second = first == &c->min ? &c->max : &c->min;
+    buf_printf(&out, "%s[%u,%llu,%g]", out.len ? "," : "{\"points\":[", i,
+               (unsigned long long)first->time, first->value);
+    if(second->time != first->time) {
+      buf_printf(&out, ",[%u,%llu,%g]", i,
+                 (unsigned long long)second->time, second->value);
+    }
+    c->count = 0;
+  }
+  if(out.len) {
+    buf_append(&out, "]}", 2);
+    httpd_broadcast("/chart", out.data, out.len);
+  }
+  buf_free(&out);
+}
+/*---------------------------------------------------------------------------*/
+void
+chart_init(uint32_t span, unsigned points)
+{
+  default_span = span;
+  default_points = points < MAX_POINTS ? points : MAX_POINTS;
+  columns = calloc(thermostats_count, sizeof(*columns));
+  if(columns == NULL) err(1, "chart");
+  httpd_websocket("/chart");
+  /* Two points per column keep a span of updates within the points */
+  loop_every(&update_timer, 2 * (uint64_t)span / default_points,
+             update_callback);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,48 @@
+/**
+ * \file
+ *         Downsampled series for the dashboard charts.
+ *
+ *         Replaces feeding every raw reading to the "Last hour values"
+ *         charts: a chart is loaded with at most a fixed number of points per
+ *         thermostat, chosen with Largest-Triangle-Three-Buckets so that the
+ *         shape of the series is kept, and then follows the new readings
+ *         through the WebSocket on /chart, which only receives the min and
+ *         max reading of each thermostat per pixel column.
+ */
+
+#ifndef __CHART_H__
+#define __CHART_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buf.h"
+
+struct chart_point {
+  uint64_t time;                /* Milliseconds since the epoch */
+  double value;
+};
+
+/**
+ * Charts span the last span milliseconds with at most points points per
+ * thermostat, unless the request says otherwise.
+ */
+void chart_init(uint32_t span, unsigned points);
+
+/**
+ * Pick at most points of the n in, first and last included, into out.
+ * Returns how many.
+ */
+size_t chart_lttb(const struct chart_point *in, size_t n,
+                  struct chart_point *out, size_t points);
+
+/**
+ * Format the chart of the thermostat at row, or of all of them if row is
+ * negative, for a from=&to=&points= query. Returns the HTTP status.
+ */
+int chart_json(int row, const char *query, struct buf *out);
+
+/** Account a reading for the next update of the WebSockets */
+void chart_add(unsigned row, uint64_t time, int32_t value);
+
+#endif /* __CHART_H__ */
@@ -0,0 +1,299 @@
+/**
+ * \file
+ *         Minimal CoAP message codec used by the host-side tools.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "coap.h"
+
+#define COAP_HEADER_LEN        4
+#define COAP_PAYLOAD_MARKER    0xff
+
+/*---------------------------------------------------------------------------*/
+void
+coap_init(struct coap_message *m, coap_type_t type, uint8_t code, uint16_t mid)
+{
+  memset(m, 0, sizeof(*m));
+  m->type = type;
+  m->code = code;
+  m->mid = mid;
+  m->observe = -1;
+  m->content_format = -1;
+  m->max_age = -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+parse_nibble(unsigned nibble, const uint8_t **p, const uint8_t *end,
+             unsigned *value)
+{
+  if(nibble < 13) {
+    *value = nibble;
+  } else if(nibble == 13) {
+    if(*p + 1 > end) return -1;
+    *value = 13 + (*p)[0];
+    *p += 1;
+  } else if(nibble == 14) {
+    if(*p + 2 > end) return -1;
+    *value = 269 + (((*p)[0] << 8) | (*p)[1]);
+    *p += 2;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+parse_uint(const uint8_t *p, unsigned len)
+{
+  uint32_t v = 0;
+  while(len--) {
+    v = (v << 8) | *p++;
+  }
+  return v;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_parse(struct coap_message *m, const uint8_t *buf, size_t len)
+{
+  const uint8_t *p = buf + COAP_HEADER_LEN;
+  const uint8_t *end = buf + len;
+  unsigned option = 0;
+
+  if(len < COAP_HEADER_LEN || (buf[0] >> 6) != 1) {
+    return -1;
+  }
+  coap_init(m, (buf[0] >> 4) & 3, buf[1], (buf[2] << 8) | buf[3]);
+  m->token_len = buf[0] & 0x0f;
+  if(m->token_len > COAP_MAX_TOKEN_LEN || p + m->token_len > end) {
+    return -1;
+  }
+  memcpy(m->token, p, m->token_len);
+  p += m->token_len;
+
+  while(p < end) {
+    unsigned delta, olen;
+    uint8_t first = *p++;
+
+    if(first == COAP_PAYLOAD_MARKER) {
+      if(p == end) return -1;
+      m->payload = p;
+      m->payload_len = end - p;
+      break;
+    }
+    if(parse_nibble(first >> 4, &p, end, &delta) < 0 ||
+       parse_nibble(first & 0x0f, &p, end, &olen) < 0 ||
+       p + olen > end) {
+      return -1;
+    }
+    option += delta;
+
+    switch(option) {
+    case COAP_OPTION_OBSERVE:
+      m->observe = parse_uint(p, olen > 3 ? 3 : olen);
+      break;
+    case COAP_OPTION_CONTENT_FORMAT:
+      m->content_format = parse_uint(p, olen > 2 ? 2 : olen);
+      break;
+    case COAP_OPTION_MAX_AGE:
+      /* Up to 4 bytes, past 68 years is as good as forever */
+      m->max_age = olen >= 4 && (*p & 0x80) ? INT32_MAX :
+                   (int32_t)parse_uint(p, olen > 4 ? 4 : olen);
+      break;
+    case COAP_OPTION_URI_PATH:
+      if(m->uri_segments < COAP_MAX_URI_SEGMENTS) {
+        m->uri_segment[m->uri_segments] = p;
+        m->uri_segment_len[m->uri_segments] = olen;
+        m->uri_segments++;
+      }
+      break;
+    }
+    p += olen;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t *
+put_option(uint8_t *p, uint8_t *end, unsigned delta, const uint8_t *value,
+           unsigned len)
+{
+  uint8_t *first = p++;
+  unsigned nibble;
+
+  if(p + 4 + len > end) {
+    return NULL;
+  }
+  if(delta < 13) {
+    nibble = delta << 4;
+  } else if(delta < 269) {
+    nibble = 13 << 4;
+    *p++ = delta - 13;
+  } else {
+    nibble = 14 << 4;
+    *p++ = (delta - 269) >> 8;
+    *p++ = delta - 269;
+  }
+  if(len < 13) {
+    nibble |= len;
+  } else {
+    nibble |= 13;
+    *p++ = len - 13;
+  }
+  *first = nibble;
+  memcpy(p, value, len);
+  return p + len;
+}
+/*---------------------------------------------------------------------------*/
+static unsigned
+uint_bytes(uint32_t v, uint8_t *out)
+{
+  unsigned n = 0;
+  uint8_t tmp[4];
+
+  while(v) {
+    tmp[n++] = v & 0xff;
+    v >>= 8;
+  }
+  for(unsigned i = 0; i < n; i++) {
+    out[i] = tmp[n - 1 - i];
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_serialize(const struct coap_message *m, uint8_t *buf, size_t size)
+{
+  uint8_t *p = buf;
+  uint8_t *end = buf + size;
+  unsigned option = 0;
+  uint8_t value[4];
+
+  if(size < COAP_HEADER_LEN + m->token_len) {
+    return -1;
+  }
+  *p++ = 0x40 | (m->type << 4) | m->token_len;
+  *p++ = m->code;
+  *p++ = m->mid >> 8;
+  *p++ = m->mid;
+  memcpy(p, m->token, m->token_len);
+  p += m->token_len;
+
+  /* Options must be written in ascending order */
+  if(m->observe >= 0) {
+    p = put_option(p, end, COAP_OPTION_OBSERVE - option, value,
+                   uint_bytes(m->observe, value));
+    option = COAP_OPTION_OBSERVE;
+  }
+  if(p != NULL && m->uri_path != NULL) {
+    const char *s = m->uri_path;
+    while(p != NULL && *s) {
+      const char *slash = strchr(s, '/');
+      unsigned len = slash ? (unsigned)(slash - s) : strlen(s);
+      p = put_option(p, end, COAP_OPTION_URI_PATH - option,
+                     (const uint8_t *)s, len);
+      option = COAP_OPTION_URI_PATH;
+      s += len;
+      if(*s == '/') s++;
+    }
+  }
+  if(p != NULL && m->content_format >= 0) {
+    p = put_option(p, end, COAP_OPTION_CONTENT_FORMAT - option, value,
+                   uint_bytes(m->content_format, value));
+    option = COAP_OPTION_CONTENT_FORMAT;
+  }
+  if(p != NULL && m->max_age >= 0) {
+    p = put_option(p, end, COAP_OPTION_MAX_AGE - option, value,
+                   uint_bytes(m->max_age, value));
+    option = COAP_OPTION_MAX_AGE;
+  }
+  if(p == NULL) {
+    return -1;
+  }
+  if(m->payload_len > 0) {
+    if(p + 1 + m->payload_len > end) {
+      return -1;
+    }
+    *p++ = COAP_PAYLOAD_MARKER;
+    memcpy(p, m->payload, m->payload_len);
+    p += m->payload_len;
+  }
+  return p - buf;
+}
+/*---------------------------------------------------------------------------*/
+static const uint8_t *
+json_value(const uint8_t *payload, size_t len, const char *key)
+{
+  size_t klen = strlen(key);
+  const uint8_t *end = payload + len;
+  const uint8_t *p;
+
+  /* Thermostat payloads are tiny flat objects, a linear search is enough */
+  for(p = payload; p + klen + 3 <= end; p++) {
+    if(p[0] == '"' && memcmp(p + 1, key, klen) == 0 && p[klen + 1] == '"') {
+      p += klen + 2;
+      while(p < end && (*p == ' ' || *p == ':' || *p == '\n')) p++;
+      return p < end ? p : NULL;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_json_int(const uint8_t *payload, size_t len, const char *key, int *value)
+{
+  const uint8_t *p = json_value(payload, len, key);
+  const uint8_t *end = payload + len;
+  int sign = 1, v = 0;
+
+  if(p == NULL) {
+    return -1;
+  }
+  if(*p == '-') {
+    sign = -1;
+    p++;
+  }
+  if(p == end || *p < '0' || *p > '9') {
+    return -1;
+  }
+  while(p < end && *p >= '0' && *p <= '9') {
+    v = v * 10 + (*p++ - '0');
+  }
+  *value = sign * v;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_json_uint32(const uint8_t *payload, size_t len, const char *key,
+                 uint32_t *value)
+{
+  const uint8_t *p = json_value(payload, len, key);
+  const uint8_t *end = payload + len;
+  uint32_t v = 0;
+
+  if(p == NULL || *p < '0' || *p > '9') {
+    return -1;
+  }
+  while(p < end && *p >= '0' && *p <= '9') {
+    v = v * 10 + (*p++ - '0');
+  }
+  *value = v;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_json_bool(const uint8_t *payload, size_t len, const char *key, int *value)
+{
+  const uint8_t *p = json_value(payload, len, key);
+  size_t left = p ? (size_t)(payload + len - p) : 0;
+
+  if(left >= 4 && memcmp(p, "true", 4) == 0) {
+    *value = 1;
+  } else if(left >= 5 && memcmp(p, "false", 5) == 0) {
+    *value = 0;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,95 @@
+/**
+ * \file
+ *         Minimal CoAP message codec used by the host-side tools.
+ *
+ *         Only the subset spoken by the thermostats is supported: the fixed
+ *         header, tokens, Observe, Uri-Path, Content-Format and Max-Age
+ *         options and the payload. Parsing never copies: the payload and the Uri-Path segments
+ *         point into the datagram that was parsed.
+ */
+
+#ifndef __COAP_H__
+#define __COAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COAP_DEFAULT_PORT        5683
+#define COAP_MAX_TOKEN_LEN       8
+#define COAP_MAX_URI_SEGMENTS    4
+
+typedef enum {
+  COAP_TYPE_CON = 0,
+  COAP_TYPE_NON = 1,
+  COAP_TYPE_ACK = 2,
+  COAP_TYPE_RST = 3
+} coap_type_t;
+
+/* Codes are stored as class << 5 | detail */
+#define COAP_CODE(c, d)          (((c) << 5) | (d))
+#define COAP_CODE_EMPTY          COAP_CODE(0, 0)
+#define COAP_GET                 COAP_CODE(0, 1)
+#define COAP_POST                COAP_CODE(0, 2)
+#define COAP_PUT                 COAP_CODE(0, 3)
+#define COAP_DELETE              COAP_CODE(0, 4)
+#define COAP_CONTENT             COAP_CODE(2, 5)
+#define COAP_BAD_REQUEST         COAP_CODE(4, 0)
+#define COAP_CODE_CLASS(code)    ((code) >> 5)
+#define COAP_CODE_DETAIL(code)   ((code) & 0x1f)
+
+#define COAP_OPTION_OBSERVE        6
+#define COAP_OPTION_URI_PATH       11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_MAX_AGE        14
+
+#define COAP_FORMAT_TEXT_PLAIN   0
+#define COAP_FORMAT_JSON         50
+
+struct coap_message {
+  uint8_t type;
+  uint8_t code;
+  uint16_t mid;
+  uint8_t token_len;
+  uint8_t token[COAP_MAX_TOKEN_LEN];
+
+  /* Observe option, -1 when absent (GET 0 registers, GET 1 deregisters) */
+  int32_t observe;
+  /* Content-Format option, -1 when absent */
+  int content_format;
+  /* Max-Age option in seconds, -1 when absent (60 s then) */
+  int32_t max_age;
+
+  /* Uri-Path as a '/' separated string when building a request */
+  const char *uri_path;
+  /* Uri-Path segments found when parsing */
+  const uint8_t *uri_segment[COAP_MAX_URI_SEGMENTS];
+  uint16_t uri_segment_len[COAP_MAX_URI_SEGMENTS];
+  uint8_t uri_segments;
+
+  const uint8_t *payload;
+  size_t payload_len;
+};
+
+/** Reset a message to an empty header with no options */
+void coap_init(struct coap_message *m, coap_type_t type, uint8_t code,
+               uint16_t mid);
+
+/** Parse a datagram. Returns 0 on success, -1 if it is not valid CoAP. */
+int coap_parse(struct coap_message *m, const uint8_t *buf, size_t len);
+
+/** Encode a message. Returns the datagram length, or -1 if it doesn't fit. */
+int coap_serialize(const struct coap_message *m, uint8_t *buf, size_t size);
+
+/** Find the integer value of a JSON key in a thermostat payload */
+int coap_json_int(const uint8_t *payload, size_t len, const char *key,
+                  int *value);
+
+/** Find the unsigned 32 bit value of a JSON key in a thermostat payload */
+int coap_json_uint32(const uint8_t *payload, size_t len, const char *key,
+                     uint32_t *value);
+
+/** Find the boolean value of a JSON key in a thermostat payload */
+int coap_json_bool(const uint8_t *payload, size_t len, const char *key,
+                   int *value);
+
+#endif /* __COAP_H__ */
@@ -0,0 +1,627 @@
+/**
+ * \file
+ *         Thermostat gateway daemon.
+ *
+ *         Replaces the per-thermostat Node-RED subflows: the thermostats are
+ *         rows of a table read from a configuration file, and a single event
+ *         loop drives the CoAP observes and requests of all of them and
+ *         serves the collected data to the dashboard over HTTP.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "aggregate.h"
+#include "alert.h"
+#include "chart.h"
+#include "coap.h"
+#include "gateway.h"
+#include "httpd.h"
+#include "link.h"
+#include "loop.h"
+#include "motes.h"
+#include "mqtt.h"
+#include "mux.h"
+#include "spool.h"
+#include "tsdb.h"
+
+/** Averages kept during an uplink outage: 34 hours of one-minute windows */
+#define MQTT_SPOOL_WINDOWS  2048
+#define MQTT_BURST        2
+
+/** A ThingSpeak channel has field1 to field8 */
+#define CHANNEL_FIELDS    8
+
+/** Longest average and time stamp in a message */
+#define NUMBER_LEN        24      /* -1.2345678901234567e-308 */
+#define CREATED_AT_LEN    20      /* 2019-05-14T09:41:00Z */
+
+/** The "Last hour values" charts */
+#define CHART_SPAN        (3600 * 1000)
+
+int verbose = 1;
+
+static const char *alert_command;
+static const char *home_topic = "channels/803420/publish/8JSB8495148O2ZGT";
+static const char *default_thermostats_topic =
+  "channels/805784/publish/0W3FWQOAFQ8NICWR";
+/* One channel per CHANNEL_FIELDS thermostats, in the table's order */
+static const char **thermostats_topics = &default_thermostats_topic;
+static unsigned thermostats_channels = 1;
+static int mqtt_enabled;
+
+static struct loop_timer sync_timer;
+
+/*---------------------------------------------------------------------------*/
+void
+gateway_reading(struct thermostat *t)
+{
+  if(verbose > 1) {
+    if(t->latency != INT32_MIN) {
+      printf("%s: temperature %d, %.3f ms after the reading\n", t->name,
+             t->temperature, t->latency / 1000.0);
+    } else {
+      printf("%s: temperature %d\n", t->name, t->temperature);
+    }
+  }
+  tsdb_append(t - thermostats, t->updated, t->temperature);
+  aggregate_add(t - thermostats, t->temperature);
+  chart_add(t - thermostats, t->updated, t->temperature);
+  alert_check(t, t->temperature);
+  mux_publish(t, MUX_TEMPERATURE);
+}
+/*---------------------------------------------------------------------------*/
+void
+gateway_systems(struct thermostat *t)
+{
+  if(verbose > 1) {
+    printf("%s: cooling %d heating %d ventilation %d\n", t->name,
+           t->systems[SYSTEM_COOLING], t->systems[SYSTEM_HEATING],
+           t->systems[SYSTEM_VENTILATION]);
+  }
+  mux_publish(t, MUX_SYSTEMS);
+}
+/*---------------------------------------------------------------------------*/
+static void
+alert_callback(struct thermostat *t, alert_state_t state)
+{
+  char temperature[16];
+
+  if(verbose) {
+    fprintf(stderr, "*** %s: temperature %d, alarm %s\n", t->name,
+            t->temperature, alert_state_names[state]);
+  }
+  mux_publish(t, MUX_ALERT);
+
+  /* The command runs detached, the loop never waits for it */
+  if(alert_command != NULL && fork() == 0) {
+    snprintf(temperature, sizeof(temperature), "%d", t->temperature);
+    setenv("THERMOSTAT_NAME", t->name, 1);
+    setenv("THERMOSTAT_ADDRESS", t->address, 1);
+    setenv("TEMPERATURE", temperature, 1);
+    setenv("ALERT_STATE", alert_state_names[state], 1);
+    execl("/bin/sh", "sh", "-c", alert_command, (char *)NULL);
+    _exit(127);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Shortest representation that reads back the same, like Node-RED prints:
+ * 20, not 2e+01, unless %g can't do without an exponent
+ */
+static int
+format_number(char *s, size_t size, double v)
+{
+  int precision, n = 0;
+
+  for(precision = 1; precision <= 17; precision++) {
+    n = snprintf(s, size, "%.*g", precision, v);
+    if(strtod(s, NULL) == v &&
+       (strchr(s, 'e') == NULL || fabs(v) < 1e-4 || fabs(v) >= 1e17)) {
+      break;
+    }
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static void
+format_created_at(char *s, size_t size, uint64_t end)
+{
+  time_t t = end / 1000;
+
+  strftime(s, size, "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Same data as the flow published every minute, one message per channel
+ * with all its fields: thermostat row goes to field row % 8 + 1 of channel
+ * row / 8. created_at keeps the time of the window when the message is
+ * replayed from the spool after an outage.
+ */
+static void
+publish_averages(const struct aggregate_window *w)
+{
+  char created_at[32], number[32];
+  struct buf payload = { 0 };
+  unsigned channel, i;
+
+  if(w->count == 0) {
+    return;
+  }
+  format_created_at(created_at, sizeof(created_at), w->end);
+
+  format_number(number, sizeof(number), w->home_average);
+  buf_printf(&payload, "field1=%s&created_at=%s", number, created_at);
+  mqtt_publish(home_topic, payload.data);
+
+  for(channel = 0; channel < thermostats_channels; channel++) {
+    payload.len = 0;
+    for(i = 0; i < w->count; i++) {
+      unsigned row = w->rows[i];
+      if(row / CHANNEL_FIELDS != channel) continue;
+      format_number(number, sizeof(number),
+                    AGGREGATE_MEAN(&w->tumbling[row]));
+      buf_printf(&payload, "field%u=%s&", row % CHANNEL_FIELDS + 1, number);
+    }
+    if(payload.len > 0) {
+      buf_printf(&payload, "created_at=%s", created_at);
+      mqtt_publish(thermostats_topics[channel], payload.data);
+    }
+  }
+  buf_free(&payload);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Merge the messages of n windows queued for one channel during an outage:
+ * each field is the mean of its averages, created_at the last window's
+ */
+static int
+coalesce_averages(const char **payloads, unsigned n, struct buf *out)
+{
+  double sum[CHANNEL_FIELDS] = { 0 }, v;
+  unsigned count[CHANNEL_FIELDS] = { 0 }, field, i;
+  char created_at[32] = "", number[32];
+  const char *p;
+
+  for(i = 0; i < n; i++) {
+    for(p = payloads[i]; *p != '\0'; p += strcspn(p, "&")) {
+      if(*p == '&') p++;
+      if(sscanf(p, "field%u=%lf", &field, &v) == 2 &&
+         field >= 1 && field <= CHANNEL_FIELDS) {
+        sum[field - 1] += v;
+        count[field - 1]++;
+      } else if(sscanf(p, "created_at=%31[^&]", created_at) != 1) {
+        return -1;
+      }
+    }
+  }
+  if(created_at[0] == '\0') {
+    return -1;
+  }
+  for(field = 0; field < CHANNEL_FIELDS; field++) {
+    if(count[field] > 0) {
+      format_number(number, sizeof(number), sum[field] / count[field]);
+      buf_printf(out, "field%u=%s&", field + 1, number);
+    }
+  }
+  buf_printf(out, "created_at=%s", created_at);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Topic and payload of the longest message publish_averages() may queue */
+static size_t
+longest_message(void)
+{
+  size_t home, all, topic = 0;
+  unsigned i;
+
+  home = strlen(home_topic) + strlen("field1=&created_at=") + NUMBER_LEN +
+         CREATED_AT_LEN;
+  for(i = 0; i < thermostats_channels; i++) {
+    if(strlen(thermostats_topics[i]) > topic) {
+      topic = strlen(thermostats_topics[i]);
+    }
+  }
+  all = topic + strlen("created_at=") + CREATED_AT_LEN;
+  for(i = 0; i < thermostats_count && i < CHANNEL_FIELDS; i++) {
+    all += strlen("fieldN=&") + NUMBER_LEN;
+  }
+  return home > all ? home : all;
+}
+/*---------------------------------------------------------------------------*/
+static void
+averages_callback(const struct aggregate_window *w)
+{
+  char number[32], created_at[32];
+
+  if(verbose > 1 && w->count > 0) {
+    /* As published, mqtt-check.sh compares them with what the broker got */
+    format_number(number, sizeof(number), w->home_average);
+    format_created_at(created_at, sizeof(created_at), w->end);
+    printf("*** %u thermostats reported, home average %s at %s\n",
+           w->count, number, created_at);
+  }
+  if(mqtt_enabled) {
+    publish_averages(w);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+stats_json(struct buf *out, const char *name,
+           const struct aggregate_stats *s)
+{
+  buf_printf(out, "\"%s\":{\"count\":%u", name, s->count);
+  if(s->count) {
+    buf_printf(out, ",\"mean\":%g,\"min\":%d,\"max\":%d",
+               AGGREGATE_MEAN(s), s->min, s->max);
+  }
+  buf_append(out, "}", 1);
+}
+/*---------------------------------------------------------------------------*/
+static int
+averages_json(struct buf *out)
+{
+  const struct aggregate_window *w = aggregate_last();
+  unsigned i;
+
+  if(w == NULL) {
+    buf_printf(out, "{}");
+    return 200;
+  }
+  buf_printf(out, "{\"end\":%llu,\"window\":%u,\"panes\":%u,",
+             (unsigned long long)w->end, w->length, w->panes);
+  if(w->count) {
+    buf_printf(out, "\"home_average\":%g,", w->home_average);
+  }
+  stats_json(out, "home", &w->home);
+  buf_append(out, ",", 1);
+  stats_json(out, "home_sliding", &w->home_sliding);
+  buf_printf(out, ",\"thermostats\":[");
+  for(i = 0; i < thermostats_count; i++) {
+    if(w->tumbling[i].count == 0 && w->sliding[i].count == 0) {
+      continue;
+    }
+    buf_printf(out, "{\"id\":%u,", i);
+    stats_json(out, "tumbling", &w->tumbling[i]);
+    buf_append(out, ",", 1);
+    stats_json(out, "sliding", &w->sliding[i]);
+    buf_append(out, "},", 2);
+  }
+  if(out->data[out->len - 1] == ',') {
+    out->len--;
+  }
+  buf_printf(out, "]}");
+  return 200;
+}
+/*---------------------------------------------------------------------------*/
+static void
+history_point(const struct tsdb_point *p, void *arg)
+{
+  struct buf *out = arg;
+  buf_printf(out, "[%llu,%d],", (unsigned long long)p->time, p->value);
+}
+/*---------------------------------------------------------------------------*/
+static int
+history_json(unsigned row, const char *query, struct buf *out)
+{
+  uint64_t to = clock_wall_ms(), from = to - 3600 * 1000;
+  const struct tsdb_bucket *b;
+  char tier[8] = "raw";
+  const char *q;
+  size_t i, n;
+
+  for(q = query; q != NULL; q = strchr(q, '&')) {
+    unsigned long long v;
+    if(*q == '&') q++;
+    if(sscanf(q, "from=%llu", &v) == 1) from = v;
+    if(sscanf(q, "to=%llu", &v) == 1) to = v;
+    sscanf(q, "tier=%7[a-z0-9]", tier);
+  }
+
+  buf_append(out, "[", 1);
+  if(strcmp(tier, "raw") == 0) {
+    tsdb_scan(row, from, to, history_point, out);
+  } else if(strcmp(tier, "1m") == 0 || strcmp(tier, "1h") == 0) {
+    b = tsdb_buckets(row, tier[1] == 'm' ? TSDB_MINUTE : TSDB_HOUR,
+                     from, to, &n);
+    for(i = 0; i < n; i++) {
+      /* [start, min, max, mean, count] */
+      buf_printf(out, "[%llu,%d,%d,%.2f,%u],",
+                 (unsigned long long)b[i].start, b[i].min, b[i].max,
+                 (double)b[i].sum / b[i].count, b[i].count);
+    }
+  } else {
+    return 400;
+  }
+  if(out->data[out->len - 1] == ',') {
+    out->len--;
+  }
+  buf_append(out, "]", 1);
+  return 200;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * GET  /thermostats                          the whole table
+ * GET  /averages                             statistics of the last window
+ * GET  /thermostats/<id>                     a single thermostat
+ * GET  /thermostats/<id>/history?from=&to=&tier=raw|1m|1h
+ *                                            readings, last hour by default
+ * GET  /thermostats/<id>/chart?from=&to=&points=
+ *                                            downsampled readings
+ * GET  /chart?from=&to=&points=              all of them; as a WebSocket,
+ *                                            followed by the new readings
+ * POST /thermostats/<id>/systems/<system>    toggle a system
+ */
+static int
+http_handler(const char *method, const char *path, struct buf *out)
+{
+  unsigned id;
+  int n = 0, system;
+  char name[16];
+
+  if(strcmp(path, "/averages") == 0 && strcmp(method, "GET") == 0) {
+    return averages_json(out);
+  }
+  if(strncmp(path, "/chart", 6) == 0 && (path[6] == '\0' || path[6] == '?') &&
+     strcmp(method, "GET") == 0) {
+    return chart_json(-1, path[6] ? path + 7 : NULL, out);
+  }
+  if(strcmp(path, "/thermostats") == 0) {
+    if(strcmp(method, "GET") != 0) return 400;
+    thermostats_json(out, 0, thermostats_count);
+    return 200;
+  }
+  if(sscanf(path, "/thermostats/%u%n", &id, &n) != 1 ||
+     id >= thermostats_count) {
+    return 404;
+  }
+  path += n;
+  if(*path == '\0' && strcmp(method, "GET") == 0) {
+    thermostats_json(out, id, 1);
+    return 200;
+  }
+  if(strncmp(path, "/history", 8) == 0 &&
+     (path[8] == '\0' || path[8] == '?') && strcmp(method, "GET") == 0) {
+    return history_json(id, path[8] ? path + 9 : NULL, out);
+  }
+  if(strncmp(path, "/chart", 6) == 0 && (path[6] == '\0' || path[6] == '?') &&
+     strcmp(method, "GET") == 0) {
+    return chart_json(id, path[6] ? path + 7 : NULL, out);
+  }
+  if(sscanf(path, "/systems/%15s", name) == 1 &&
+     strcmp(method, "POST") == 0) {
+    system = thermostats_system(name);
+    if(system < 0) return 404;
+    if(motes_actuate(&thermostats[id], system) < 0) return 409;
+    buf_printf(out, "{\"pending\":true}");
+    return 202;
+  }
+  return 404;
+}
+/*---------------------------------------------------------------------------*/
+static void
+sync_callback(struct loop_timer *t)
+{
+  tsdb_sync();
+}
+/*---------------------------------------------------------------------------*/
+static void
+sigstop(int signo)
+{
+  loop_stop();
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *config = "thermostats.conf";
+  const char *mux_path = "/tmp/thermostat-gateway.sock";
+  const char *data_dir = "data";
+  int coap_port = 0;
+  int http_port = 8080;
+  int window = 60, panes = 10;
+  int hysteresis = 1, debounce = 2;
+  int chart_points = 300;
+  const char *broker = NULL, *spool = NULL;
+  const char *link = NULL, *link_address = "aaaa::1/64", *tundev = NULL;
+  double mqtt_rate = 0.1;
+  int mqtt_qos = 0;
+  char spool_path[256];
+  int c;
+
+  setvbuf(stdout, NULL, _IOLBF, 0); /* Line buffered output. */
+
+  while((c = getopt(argc, argv, "a:A:b:c:d:m:n:p:P:q:r:s:H:S:t:T:u:w:W:y:v::h")) != -1) {
+    switch(c) {
+    case 'a':
+      alert_command = optarg;
+      break;
+
+    case 'A':
+      link_address = optarg;
+      break;
+
+    case 'b':
+      debounce = atoi(optarg);
+      break;
+
+    case 'c':
+      config = optarg;
+      break;
+
+    case 'd':
+      data_dir = optarg;
+      break;
+
+    case 'm':
+      broker = optarg;
+      break;
+
+    case 'n':
+      tundev = optarg;
+      break;
+
+    case 'p':
+      coap_port = atoi(optarg);
+      break;
+
+    case 'P':
+      chart_points = atoi(optarg);
+      break;
+
+    case 'q':
+      mqtt_qos = atoi(optarg);
+      break;
+
+    case 'r':
+      mqtt_rate = atof(optarg);
+      break;
+
+    case 's':
+      link = optarg;
+      break;
+
+    case 'S':
+      spool = optarg;
+      break;
+
+    case 't':
+      if(thermostats_topics == &default_thermostats_topic) {
+        thermostats_topics = NULL;
+        thermostats_channels = 0;
+      }
+      thermostats_topics = realloc(thermostats_topics,
+                                   (thermostats_channels + 1) *
+                                   sizeof(*thermostats_topics));
+      if(thermostats_topics == NULL) err(1, "gateway");
+      thermostats_topics[thermostats_channels++] = optarg;
+      break;
+
+    case 'T':
+      home_topic = optarg;
+      break;
+
+    case 'H':
+      http_port = atoi(optarg);
+      break;
+
+    case 'u':
+      mux_path = optarg;
+      break;
+
+    case 'w':
+      window = atoi(optarg);
+      break;
+
+    case 'W':
+      panes = atoi(optarg);
+      break;
+
+    case 'y':
+      hysteresis = atoi(optarg);
+      break;
+
+    case 'v':
+      verbose = 2;
+      if(optarg) verbose = atoi(optarg);
+      break;
+
+    case 'h':
+    default:
+fprintf(stderr,"usage:  %s [options]\n", argv[0]);
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -a command     Shell command run on every alarm change, with\n");
+fprintf(stderr,"                THERMOSTAT_NAME, THERMOSTAT_ADDRESS, TEMPERATURE and\n");
+fprintf(stderr,"                ALERT_STATE (low, high, normal) in its environment\n");
+fprintf(stderr," -A address     Own address on the link (default aaaa::1/64)\n");
+fprintf(stderr," -b readings    Readings needed to change the alarm state (default 2)\n");
+fprintf(stderr," -c file        Thermostats table (default thermostats.conf)\n");
+fprintf(stderr," -d dir         Readings store directory (default data)\n");
+fprintf(stderr," -m host[:port] Publish the averages to this MQTT broker\n");
+fprintf(stderr," -n tundev      With -s, tun interface for the non-CoAP traffic\n");
+fprintf(stderr," -p port        Local CoAP port (default ephemeral, 5683 with -s)\n");
+fprintf(stderr," -P points      Points per chart series (default 300)\n");
+fprintf(stderr," -q qos         MQTT QoS, 0 (default) or 1\n");
+fprintf(stderr," -r rate        MQTT messages per second, replay included (default 0.1)\n");
+fprintf(stderr," -s link        Own the border router SLIP link, a serial device or\n");
+fprintf(stderr,"                host:port, instead of going through tunslip6\n");
+fprintf(stderr," -S file        MQTT spool (default <dir>/mqtt.spool)\n");
+fprintf(stderr," -t topic       Thermostats averages topic, once per channel of 8\n");
+fprintf(stderr," -T topic       Home average topic\n");
+fprintf(stderr," -H port        Dashboard HTTP port (default 8080)\n");
+fprintf(stderr," -u path        Notifications socket (default /tmp/thermostat-gateway.sock)\n");
+fprintf(stderr," -w seconds     Averages window (default 60)\n");
+fprintf(stderr," -W windows     Windows in the sliding averages (default 10)\n");
+fprintf(stderr," -y degrees     Alarm hysteresis (default 1)\n");
+fprintf(stderr," -v[level]      Verbosity level\n");
+fprintf(stderr,"    -v0         No messages\n");
+fprintf(stderr,"    -v1         Errors and lost thermostats (default)\n");
+fprintf(stderr,"    -v2         Every reading and systems change\n");
+exit(1);
+      break;
+    }
+  }
+
+  if(thermostats_load(config) <= 0) {
+    errx(1, "no thermostats in ``%s''", config);
+  }
+  if(verbose) {
+    fprintf(stderr, "*** %u thermostats loaded from ``%s''\n",
+            thermostats_count, config);
+  }
+
+  signal(SIGINT, sigstop);
+  signal(SIGTERM, sigstop);
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);     /* Alert commands are reaped automatically */
+
+  if(tsdb_open(data_dir) < 0) {
+    errx(1, "can't open the readings store in ``%s''", data_dir);
+  }
+
+  loop_init();
+  if(link != NULL) {
+    if(coap_port == 0) coap_port = COAP_DEFAULT_PORT;
+    link_init(link, link_address, coap_port, tundev);
+    motes_init(coap_port, link_send);
+  } else {
+    motes_init(coap_port, NULL);
+  }
+  httpd_init(http_port, http_handler);
+  mux_init(mux_path);
+  aggregate_init(window * 1000, panes, averages_callback);
+  alert_init(hysteresis, debounce, alert_callback);
+  chart_init(CHART_SPAN, chart_points > 0 ? chart_points : 300);
+  if(broker != NULL) {
+    if(spool == NULL) {
+      snprintf(spool_path, sizeof(spool_path), "%s/mqtt.spool", data_dir);
+      spool = spool_path;
+    }
+    if(thermostats_count > thermostats_channels * CHANNEL_FIELDS) {
+      warnx("mqtt: %u channels hold the averages of the first %u "
+            "thermostats only, add -t topics", thermostats_channels,
+            thermostats_channels * CHANNEL_FIELDS);
+    }
+    if(spool_open(spool, MQTT_SPOOL_WINDOWS * (1 + thermostats_channels),
+                  longest_message()) < 0) {
+      errx(1, "can't open the MQTT spool ``%s''", spool);
+    }
+    mqtt_init(broker, mqtt_qos, mqtt_rate, MQTT_BURST, coalesce_averages);
+    mqtt_enabled = 1;
+  }
+  loop_every(&sync_timer, 60 * 1000, sync_callback);
+  loop_run();
+
+  mux_close();
+  tsdb_close();
+  spool_close();
+
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
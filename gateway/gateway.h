@@ -0,0 +1,19 @@
+/**
+ * \file
+ *         Glue between the gateway components.
+ */
+
+#ifndef __GATEWAY_H__
+#define __GATEWAY_H__
+
+#include "thermostats.h"
+
+extern int verbose;
+
+/** A new temperature reading of a thermostat has been stored in its row */
+void gateway_reading(struct thermostat *t);
+
+/** The systems status of a thermostat has changed */
+void gateway_systems(struct thermostat *t);
+
+#endif /* __GATEWAY_H__ */
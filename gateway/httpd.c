@@ -0,0 +1,446 @@
+/**
+ * \file
+ *         Small HTTP/1.0 server exposing the gateway data to the dashboard.
+ *
+ *         One request per connection, answered in full and then closed,
+ *         unless it asks for a WebSocket on a path that is broadcast to:
+ *         then the handler's response is sent as the first message and the
+ *         connection stays open for the messages broadcast on its path
+ *         (RFC 6455, text frames only).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <err.h>
+
+#include "gateway.h"
+#include "httpd.h"
+#include "loop.h"
+
+#define MAX_REQUEST 4096
+/** A WebSocket client that falls this far behind is disconnected */
+#define MAX_BACKLOG (256 * 1024)
+
+/** Paths accepting WebSockets */
+#define MAX_WEBSOCKET_PATHS 4
+
+#define WS_GUID     "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_TEXT     0x1
+#define WS_CLOSE    0x8
+#define WS_PING     0x9
+#define WS_PONG     0xa
+
+struct httpd_conn {
+  struct loop_handler h;
+  struct buf in;
+  struct buf out;
+  const char *ws_path;          /* NULL unless a WebSocket */
+  int closing;                  /* Close once out is sent */
+  int dead;                     /* Closed, freed after the epoll batch */
+  struct httpd_conn *next, **pprev;     /* WebSockets */
+};
+
+static struct loop_handler listener;
+static httpd_handler_t handler;
+static struct httpd_conn *websockets;
+static const char *websocket_paths[MAX_WEBSOCKET_PATHS];
+
+/*---------------------------------------------------------------------------*/
+static void
+conn_free(struct loop_handler *h)
+{
+  struct httpd_conn *c = (struct httpd_conn *)h;
+
+  if(c->ws_path != NULL) {
+    if(c->next) c->next->pprev = c->pprev;
+    *c->pprev = c->next;
+  }
+  close(c->h.fd);
+  buf_free(&c->in);
+  buf_free(&c->out);
+  free(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+conn_close(struct httpd_conn *c)
+{
+  /*
+   * Deferred like the mux consumers: a WebSocket closed by a broadcast from
+   * another descriptor's callback may have an event of its own still due
+   */
+  c->dead = 1;
+  loop_release(&c->h, conn_free);
+}
+/*---------------------------------------------------------------------------*/
+static const char *
+status_text(int status)
+{
+  switch(status) {
+  case 200: return "OK";
+  case 202: return "Accepted";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 409: return "Conflict";
+  default: return "Error";
+  }
+}
+/*---------------------------------------------------------------------------*/
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Only used on the handshake key, 60 bytes */
+static void
+sha1(const uint8_t *data, size_t len, uint8_t digest[20])
+{
+  uint32_t h[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+  uint8_t block[64];
+  uint64_t bits = (uint64_t)len * 8;
+  size_t done, i, n;
+  int last = 0;
+
+  for(done = 0; !last; done += 64) {
+    uint32_t w[80], a, b, c, d, e, f, k, tmp;
+
+    n = done < len ? len - done : 0;
+    if(n >= 64) {
+      memcpy(block, data + done, 64);
+    } else {
+      memset(block, 0, 64);
+      memcpy(block, data + done, n);
+      if(done <= len) block[n] = 0x80;
+      if(n < 56) {
+        for(i = 0; i < 8; i++) block[63 - i] = bits >> (8 * i);
+        last = 1;
+      }
+    }
+    for(i = 0; i < 16; i++) {
+      w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 |
+             block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for(i = 16; i < 80; i++) {
+      w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+    for(i = 0; i < 80; i++) {
+      if(i < 20) {
+        f = (b & c) | (~b & d); k = 0x5a827999;
+      } else if(i < 40) {
+        f = b ^ c ^ d; k = 0x6ed9eba1;
+      } else if(i < 60) {
+        f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d; k = 0xca62c1d6;
+      }
+      tmp = ROL(a, 5) + f + e + k + w[i];
+      e = d; d = c; c = ROL(b, 30); b = a; a = tmp;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  }
+  for(i = 0; i < 20; i++) {
+    digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+base64(const uint8_t *in, size_t len, char *out)
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i;
+
+  for(i = 0; i < len; i += 3) {
+    uint32_t v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) |
+                 (i + 2 < len ? in[i + 2] : 0);
+    *out++ = alphabet[v >> 18];
+    *out++ = alphabet[(v >> 12) & 63];
+    *out++ = i + 1 < len ? alphabet[(v >> 6) & 63] : '=';
+    *out++ = i + 2 < len ? alphabet[v & 63] : '=';
+  }
+  *out = '\0';
+}
+/*---------------------------------------------------------------------------*/
+static void
+ws_frame(struct buf *out, int opcode, const char *data, size_t len)
+{
+  uint8_t header[10];
+  size_t n = 2, i;
+
+  header[0] = 0x80 | opcode;
+  if(len < 126) {
+    header[1] = len;
+  } else if(len < 65536) {
+    header[1] = 126;
+    header[2] = len >> 8;
+    header[3] = len;
+    n = 4;
+  } else {
+    header[1] = 127;
+    for(i = 0; i < 8; i++) header[2 + i] = (uint64_t)len >> (56 - 8 * i);
+    n = 10;
+  }
+  buf_append(out, header, n);
+  buf_append(out, data, len);
+}
+/*---------------------------------------------------------------------------*/
+/* Returns -1 if the connection was closed */
+static int
+conn_flush(struct httpd_conn *c)
+{
+  ssize_t n = write(c->h.fd, c->out.data, c->out.len);
+
+  if(n < 0 && errno != EAGAIN) {
+    conn_close(c);
+    return -1;
+  }
+  if(n > 0) {
+    buf_consume(&c->out, n);
+  }
+  if(c->out.len == 0 && (c->ws_path == NULL || c->closing)) {
+    conn_close(c);
+    return -1;
+  }
+  loop_modify(&c->h, c->out.len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns -1 if the connection was closed */
+static int
+ws_send(struct httpd_conn *c, int opcode, const char *data, size_t len)
+{
+  int was_empty = c->out.len == 0;
+
+  if(c->closing || c->dead) {
+    return 0;
+  }
+  if(c->out.len + len > MAX_BACKLOG) {
+    if(verbose) warnx("httpd: dropping a WebSocket that does not keep up");
+    conn_close(c);
+    return -1;
+  }
+  ws_frame(&c->out, opcode, data, len);
+  if(opcode == WS_CLOSE) {
+    c->closing = 1;
+  }
+  if(was_empty) {
+    return conn_flush(c);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+ws_receive(struct httpd_conn *c)
+{
+  uint8_t *p;
+  size_t len, i, header;
+
+  while(c->in.len >= 2) {
+    p = (uint8_t *)c->in.data;
+    len = p[1] & 0x7f;
+    header = 2;
+    if(len == 126) {
+      if(c->in.len < 4) return;
+      len = p[2] << 8 | p[3];
+      header = 4;
+    } else if(len == 127) {
+      /* Nothing that large is expected from a dashboard */
+      conn_close(c);
+      return;
+    }
+    if(p[1] & 0x80) {
+      header += 4;
+    }
+    if(len > MAX_REQUEST) {
+      conn_close(c);
+      return;
+    }
+    if(c->in.len < header + len) return;
+    if(p[1] & 0x80) {
+      for(i = 0; i < len; i++) p[header + i] ^= p[header - 4 + i % 4];
+    }
+    switch(p[0] & 0x0f) {
+    case WS_CLOSE:
+      ws_send(c, WS_CLOSE, (char *)p + header, len < 2 ? len : 2);
+      return;
+    case WS_PING:
+      if(ws_send(c, WS_PONG, (char *)p + header, len) < 0) return;
+      break;
+    }
+    buf_consume(&c->in, header + len);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+ws_handshake(struct httpd_conn *c, const char *path, struct buf *body)
+{
+  char key[64], accept[32];
+  uint8_t digest[20];
+  const char *h;
+  unsigned i;
+  size_t n;
+
+  n = strcspn(path, "?");
+  for(i = 0; i < MAX_WEBSOCKET_PATHS && websocket_paths[i] != NULL; i++) {
+    if(strlen(websocket_paths[i]) == n &&
+       strncmp(websocket_paths[i], path, n) == 0) {
+      break;
+    }
+  }
+  if(i == MAX_WEBSOCKET_PATHS || websocket_paths[i] == NULL) {
+    /* Nothing would ever be sent on it, answer as plain HTTP */
+    return 0;
+  }
+  h = strcasestr(c->in.data, "\r\nSec-WebSocket-Key:");
+  if(h == NULL || strcasestr(c->in.data, "\r\nUpgrade: websocket") == NULL ||
+     sscanf(h + 20, " %24s", key) != 1) {
+    return 0;
+  }
+  n = strlen(key);
+  memcpy(key + n, WS_GUID, sizeof(WS_GUID));
+  sha1((uint8_t *)key, n + sizeof(WS_GUID) - 1, digest);
+  base64(digest, sizeof(digest), accept);
+  buf_printf(&c->out, "HTTP/1.1 101 Switching Protocols\r\n"
+             "Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+  ws_frame(&c->out, WS_TEXT, body->data, body->len);
+
+  c->ws_path = websocket_paths[i];
+  c->next = websockets;
+  if(c->next) c->next->pprev = &c->next;
+  c->pprev = &websockets;
+  websockets = c;
+  buf_consume(&c->in, strstr(c->in.data, "\r\n\r\n") + 4 - c->in.data);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+conn_respond(struct httpd_conn *c)
+{
+  char method[8], path[256];
+  struct buf body = { 0 };
+  int status;
+
+  if(sscanf(c->in.data, "%7s %255s", method, path) != 2) {
+    status = 400;
+  } else {
+    status = handler(method, path, &body);
+  }
+  if(status == 200 && strcmp(method, "GET") == 0 &&
+     ws_handshake(c, path, &body)) {
+    buf_free(&body);
+    conn_flush(c);
+    return;
+  }
+  buf_printf(&c->out, "HTTP/1.0 %d %s\r\n"
+             "Content-Type: application/json\r\n"
+             "Content-Length: %zu\r\n"
+             "Access-Control-Allow-Origin: *\r\n"
+             "Connection: close\r\n\r\n",
+             status, status_text(status), body.len);
+  buf_append(&c->out, body.data, body.len);
+  buf_free(&body);
+  loop_modify(&c->h, EPOLLOUT);
+}
+/*---------------------------------------------------------------------------*/
+static void
+conn_callback(struct loop_handler *h, uint32_t events)
+{
+  struct httpd_conn *c = (struct httpd_conn *)h;
+  ssize_t n;
+
+  if(events & (EPOLLERR | EPOLLHUP)) {
+    conn_close(c);
+    return;
+  }
+  if(events & EPOLLOUT) {
+    conn_flush(c);
+    return;
+  }
+  if(events & EPOLLIN) {
+    if(c->ws_path == NULL && c->out.len > 0) {
+      return;
+    }
+    buf_reserve(&c->in, 1024);
+    n = read(h->fd, c->in.data + c->in.len, c->in.size - c->in.len - 1);
+    if(n <= 0) {
+      if(n == 0 || errno != EAGAIN) conn_close(c);
+      return;
+    }
+    c->in.len += n;
+    c->in.data[c->in.len] = '\0';
+    if(c->ws_path != NULL) {
+      ws_receive(c);
+    } else if(strstr(c->in.data, "\r\n\r\n") != NULL) {
+      conn_respond(c);
+    } else if(c->in.len > MAX_REQUEST) {
+      conn_close(c);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+listener_callback(struct loop_handler *h, uint32_t events)
+{
+  struct httpd_conn *c;
+  int fd;
+
+  while((fd = accept4(h->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    c = calloc(1, sizeof(*c));
+    if(c == NULL) err(1, "httpd");
+    c->h.fd = fd;
+    c->h.callback = conn_callback;
+    loop_add(&c->h, EPOLLIN);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+httpd_websocket(const char *path)
+{
+  unsigned i;
+
+  for(i = 0; i < MAX_WEBSOCKET_PATHS && websocket_paths[i] != NULL; i++);
+  if(i == MAX_WEBSOCKET_PATHS) errx(1, "httpd: too many WebSocket paths");
+  websocket_paths[i] = path;
+}
+/*---------------------------------------------------------------------------*/
+void
+httpd_broadcast(const char *path, const char *text, size_t len)
+{
+  struct httpd_conn *c;
+
+  for(c = websockets; c != NULL; c = c->next) {
+    if(strcmp(c->ws_path, path) == 0) {
+      ws_send(c, WS_TEXT, text, len);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+httpd_init(int port, httpd_handler_t h)
+{
+  struct sockaddr_in6 sa;
+  int on = 1;
+
+  handler = h;
+  listener.fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listener.fd == -1) err(1, "socket");
+  setsockopt(listener.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(port);
+  sa.sin6_addr = in6addr_any;
+  if(bind(listener.fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    err(1, "bind to HTTP port %d", port);
+  }
+  if(listen(listener.fd, 64) == -1) err(1, "listen");
+  listener.callback = listener_callback;
+  loop_add(&listener, EPOLLIN);
+}
+/*---------------------------------------------------------------------------*/
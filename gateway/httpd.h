@@ -0,0 +1,28 @@
+/**
+ * \file
+ *         Small HTTP/1.0 server exposing the gateway data to the dashboard.
+ */
+
+#ifndef __HTTPD_H__
+#define __HTTPD_H__
+
+#include "buf.h"
+
+/**
+ * Serve a request: fill out with the body and return the HTTP status.
+ * The content type defaults to application/json. A successful GET that
+ * asks for a WebSocket on a path given to httpd_websocket() gets the body
+ * as its first message instead.
+ */
+typedef int (* httpd_handler_t)(const char *method, const char *path,
+                                struct buf *out);
+
+void httpd_init(int port, httpd_handler_t handler);
+
+/** Accept WebSockets on path (no query), the path is not copied */
+void httpd_websocket(const char *path);
+
+/** Send a text message to every WebSocket opened on path (no query) */
+void httpd_broadcast(const char *path, const char *text, size_t len);
+
+#endif /* __HTTPD_H__ */
@@ -0,0 +1,242 @@
+/**
+ * \file
+ *         Direct SLIP link to the border router.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <err.h>
+
+#include "slip.h"
+
+#include "coap.h"
+#include "gateway.h"
+#include "link.h"
+#include "loop.h"
+#include "motes.h"
+
+#define IPV6_HEADER   40
+#define UDP_HEADER    8
+#define MAX_PACKET    1280
+
+static struct slip_link slip;
+static struct loop_handler link_handler;
+static struct loop_handler tun_handler = { .fd = -1 };
+static struct in6_addr address;
+static int port;
+static unsigned long tun_dropped, kernel_dropped;
+
+/*---------------------------------------------------------------------------*/
+static uint16_t
+udp_checksum(const uint8_t *packet, size_t udp_len)
+{
+  uint32_t sum = 17 + udp_len;
+  size_t i;
+
+  /* Pseudo header addresses, then the datagram */
+  for(i = 8; i < IPV6_HEADER; i += 2) {
+    sum += (packet[i] << 8) | packet[i + 1];
+  }
+  for(i = 0; i + 1 < udp_len; i += 2) {
+    sum += (packet[IPV6_HEADER + i] << 8) | packet[IPV6_HEADER + i + 1];
+  }
+  if(udp_len & 1) {
+    sum += packet[IPV6_HEADER + udp_len - 1] << 8;
+  }
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum & 0xffff;
+}
+/*---------------------------------------------------------------------------*/
+static void
+link_flush(void)
+{
+  if(slip_link_flush(&slip) < 0) {
+    err(1, "link: write");
+  }
+  loop_modify(&link_handler,
+              slip_link_pending(&slip) ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+/*---------------------------------------------------------------------------*/
+int
+link_send(const struct in6_addr *to, const uint8_t *buf, size_t len)
+{
+  uint8_t packet[MAX_PACKET];
+  size_t udp_len = UDP_HEADER + len;
+  uint16_t sum;
+
+  if(IPV6_HEADER + udp_len > sizeof(packet)) {
+    return -1;
+  }
+  memset(packet, 0, IPV6_HEADER + UDP_HEADER);
+  packet[0] = 0x60;
+  packet[4] = udp_len >> 8;
+  packet[5] = udp_len & 0xff;
+  packet[6] = 17;
+  packet[7] = 64;
+  memcpy(packet + 8, &address, 16);
+  memcpy(packet + 24, to, 16);
+  packet[40] = port >> 8;
+  packet[41] = port & 0xff;
+  packet[42] = COAP_DEFAULT_PORT >> 8;
+  packet[43] = COAP_DEFAULT_PORT & 0xff;
+  packet[44] = udp_len >> 8;
+  packet[45] = udp_len & 0xff;
+  memcpy(packet + IPV6_HEADER + UDP_HEADER, buf, len);
+  sum = udp_checksum(packet, udp_len);
+  if(sum == 0) sum = 0xffff;
+  packet[46] = sum >> 8;
+  packet[47] = sum & 0xff;
+
+  if(slip_link_send(&slip, packet, IPV6_HEADER + udp_len) < 0) {
+    if(verbose > 1) warnx("link: output full, dropping a request");
+    return -1;
+  }
+  link_flush();
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* The fast path: no copy from the SLIP buffer to the CoAP parser */
+static void
+packet_callback(void *arg, uint8_t *packet, int len)
+{
+  size_t udp_len;
+  struct in6_addr from;
+
+  if(len >= IPV6_HEADER + UDP_HEADER && packet[6] == 17 &&
+     memcmp(packet + 24, &address, 16) == 0 &&
+     ((packet[42] << 8) | packet[43]) == port) {
+    udp_len = (packet[44] << 8) | packet[45];
+    if(udp_len < UDP_HEADER || IPV6_HEADER + udp_len > (size_t)len ||
+       udp_checksum(packet, udp_len) != 0) {
+      if(verbose > 1) warnx("link: dropping a corrupted datagram");
+      return;
+    }
+    memcpy(&from, packet + 8, 16);
+    motes_input(&from, packet + IPV6_HEADER + UDP_HEADER,
+                udp_len - UDP_HEADER);
+    return;
+  }
+  /* The kernel's business, dropped if there is no tun device */
+  if(tun_handler.fd == -1) {
+    kernel_dropped++;
+    if(verbose > 1) {
+      warnx("link: no tun device, dropping a packet for the kernel "
+            "(%lu so far)", kernel_dropped);
+    }
+  } else if(write(tun_handler.fd, packet, len) != len) {
+    kernel_dropped++;
+    if(verbose > 1) {
+      warn("link: write to tun (%lu dropped so far)", kernel_dropped);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+text_callback(void *arg, uint8_t *text, int len)
+{
+  if(verbose > 1) {
+    fwrite(text, len, 1, stdout);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+link_callback(struct loop_handler *h, uint32_t events)
+{
+  if(events & EPOLLOUT) {
+    link_flush();
+  }
+  if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+    if(slip_link_input(&slip) < 0) {
+      errx(1, "link to the border router lost");
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+tun_callback(struct loop_handler *h, uint32_t events)
+{
+  uint8_t packet[SLIP_MAX_FRAME];
+  unsigned dropped = 0;
+  ssize_t n;
+
+  /* What does not fit in the output buffer is dropped, as tun would */
+  while((n = read(h->fd, packet, sizeof(packet))) > 0) {
+    if(slip_link_send(&slip, packet, n) < 0) {
+      dropped++;
+    }
+  }
+  if(dropped) {
+    tun_dropped += dropped;
+    if(verbose > 1) {
+      warnx("link: output full, dropping %u packets from tun (%lu so far)",
+            dropped, tun_dropped);
+    }
+  }
+  link_flush();
+}
+/*---------------------------------------------------------------------------*/
+static int
+tun_open(const char *name)
+{
+  struct ifreq ifr;
+  int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+  if(fd == -1) {
+    return -1;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+  snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+  if(ioctl(fd, TUNSETIFF, &ifr) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+void
+link_init(const char *name, const char *addr, int p, const char *tundev)
+{
+  char a[INET6_ADDRSTRLEN];
+  int prefix = 64;
+
+  if(sscanf(addr, "%45[0-9a-fA-F:]/%d", a, &prefix) < 1 ||
+     inet_pton(AF_INET6, a, &address) != 1) {
+    errx(1, "link: bad address ``%s''", addr);
+  }
+  port = p;
+  memset(&slip.prefix, 0, sizeof(slip.prefix));
+  memcpy(&slip.prefix, &address, prefix / 8 < 8 ? prefix / 8 : 8);
+  slip.packet = packet_callback;
+  slip.text = text_callback;
+  if(slip_link_open(&slip, name, B115200) < 0) {
+    err(1, "can't open the link ``%s''", name);
+  }
+  link_handler.fd = slip.fd;
+  link_handler.callback = link_callback;
+  loop_add(&link_handler, EPOLLIN);
+  link_flush();
+
+  if(tundev != NULL) {
+    if((tun_handler.fd = tun_open(tundev)) == -1) {
+      err(1, "can't attach to ``%s''", tundev);
+    }
+    tun_handler.callback = tun_callback;
+    loop_add(&tun_handler, EPOLLIN);
+  }
+  if(verbose) {
+    fprintf(stderr, "*** link to the border router on ``%s''\n", name);
+  }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,31 @@
+/**
+ * \file
+ *         Direct SLIP link to the border router.
+ *
+ *         Instead of going through tunslip6, the tun device, the kernel IPv6
+ *         stack and a UDP socket, the gateway can own the serial link with
+ *         the slip library of tunslip6: datagrams for its CoAP port are
+ *         checked and parsed where the SLIP decoder left them, everything
+ *         else is written to a tun device so the kernel still serves the
+ *         rest of the mesh traffic.
+ */
+
+#ifndef __LINK_H__
+#define __LINK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * Open the link ("host:port" or a serial device) as address/prefix (e.g.
+ * aaaa::1/64), receiving CoAP on port. tundev, if not NULL, is an existing
+ * tun interface for the other packets, which are dropped otherwise.
+ */
+void link_init(const char *name, const char *address, int port,
+               const char *tundev);
+
+/** Send a CoAP message to a mote, a motes_send_t */
+int link_send(const struct in6_addr *to, const uint8_t *buf, size_t len);
+
+#endif /* __LINK_H__ */
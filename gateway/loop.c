@@ -0,0 +1,149 @@
+/**
+ * \file
+ *         Single threaded epoll event loop shared by all gateway components.
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "loop.h"
+
+#define MAX_EVENTS 64
+
+static int epfd = -1;
+static int running;
+static struct loop_timer *timers;
+static struct loop_handler *released;
+
+/*---------------------------------------------------------------------------*/
+uint64_t
+clock_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t
+clock_wall_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t
+clock_wall_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+void
+loop_init(void)
+{
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd == -1) err(1, "epoll_create1");
+}
+/*---------------------------------------------------------------------------*/
+int
+loop_add(struct loop_handler *h, uint32_t events)
+{
+  struct epoll_event ev = { .events = events, .data.ptr = h };
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, h->fd, &ev);
+}
+/*---------------------------------------------------------------------------*/
+int
+loop_modify(struct loop_handler *h, uint32_t events)
+{
+  struct epoll_event ev = { .events = events, .data.ptr = h };
+  return epoll_ctl(epfd, EPOLL_CTL_MOD, h->fd, &ev);
+}
+/*---------------------------------------------------------------------------*/
+void
+loop_remove(struct loop_handler *h)
+{
+  epoll_ctl(epfd, EPOLL_CTL_DEL, h->fd, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+loop_release(struct loop_handler *h, loop_release_t release)
+{
+  if(h->release == NULL) {
+    loop_remove(h);
+    h->release = release;
+    h->released_next = released;
+    released = h;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+loop_every(struct loop_timer *t, uint32_t interval,
+           loop_timer_callback_t callback)
+{
+  t->interval = interval;
+  t->callback = callback;
+  t->due = clock_ms() + interval;
+  t->next = timers;
+  timers = t;
+}
+/*---------------------------------------------------------------------------*/
+static int
+run_timers(void)
+{
+  uint64_t now = clock_ms();
+  uint64_t next = now + 1000;
+  struct loop_timer *t;
+
+  /* A handful of periodic timers, a sorted queue would not pay off */
+  for(t = timers; t != NULL; t = t->next) {
+    if(t->due <= now) {
+      t->callback(t);
+      t->due += t->interval;
+      if(t->due <= now) {
+        t->due = now + t->interval;
+      }
+    }
+    if(t->due < next) {
+      next = t->due;
+    }
+  }
+  return (int)(next - now);
+}
+/*---------------------------------------------------------------------------*/
+void
+loop_run(void)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int i, n;
+
+  running = 1;
+  while(running) {
+    n = epoll_wait(epfd, events, MAX_EVENTS, run_timers());
+    if(n == -1) {
+      if(errno == EINTR) continue;
+      err(1, "epoll_wait");
+    }
+    for(i = 0; i < n; i++) {
+      struct loop_handler *h = events[i].data.ptr;
+      if(h->release == NULL) {
+        h->callback(h, events[i].events);
+      }
+    }
+    while(released != NULL) {
+      struct loop_handler *h = released;
+      released = h->released_next;
+      h->release(h);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+loop_stop(void)
+{
+  running = 0;
+}
+/*---------------------------------------------------------------------------*/
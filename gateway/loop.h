@@ -0,0 +1,66 @@
+/**
+ * \file
+ *         Single threaded epoll event loop shared by all gateway components.
+ */
+
+#ifndef __LOOP_H__
+#define __LOOP_H__
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+struct loop_handler;
+typedef void (* loop_callback_t)(struct loop_handler *h, uint32_t events);
+typedef void (* loop_release_t)(struct loop_handler *h);
+
+/**
+ * Embed a handler in the per-descriptor state and register it: the loop
+ * hands the same pointer back to the callback, no lookup is needed.
+ */
+struct loop_handler {
+  int fd;
+  loop_callback_t callback;
+  loop_release_t release;       /* Set by loop_release() */
+  struct loop_handler *released_next;
+};
+
+struct loop_timer;
+typedef void (* loop_timer_callback_t)(struct loop_timer *t);
+
+struct loop_timer {
+  uint64_t due;
+  uint32_t interval;
+  loop_timer_callback_t callback;
+  struct loop_timer *next;
+};
+
+/** Milliseconds from a monotonic clock, used for all timeouts */
+uint64_t clock_ms(void);
+
+/** Milliseconds since the epoch, used to timestamp readings */
+uint64_t clock_wall_ms(void);
+
+/** Microseconds since the epoch, the network time of the thermostats */
+uint64_t clock_wall_us(void);
+
+void loop_init(void);
+int loop_add(struct loop_handler *h, uint32_t events);
+int loop_modify(struct loop_handler *h, uint32_t events);
+void loop_remove(struct loop_handler *h);
+
+/**
+ * Remove h and call release(h) once the events already read are dispatched:
+ * the ones left for h are dropped, release may then free it. For the state
+ * of a descriptor that dies in the callback of another one.
+ */
+void loop_release(struct loop_handler *h, loop_release_t release);
+
+/** Run a callback every interval milliseconds, starting after the first one */
+void loop_every(struct loop_timer *t, uint32_t interval,
+                loop_timer_callback_t callback);
+
+/** Dispatch events until loop_stop() is called */
+void loop_run(void);
+void loop_stop(void);
+
+#endif /* __LOOP_H__ */
@@ -0,0 +1,395 @@
+/**
+ * \file
+ *         CoAP client side of the gateway: one UDP socket for all the motes.
+ *
+ *         Every request carries a 4 byte token made of the table row and the
+ *         kind of request, so a response is matched to its thermostat and
+ *         purpose without any lookup table of pending exchanges.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#include "coap.h"
+#include "gateway.h"
+#include "loop.h"
+#include "motes.h"
+
+/* Token kinds, the actuation kinds are followed by the system index */
+#define TOKEN_OBSERVE   0
+#define TOKEN_SYSTEMS   1
+#define TOKEN_ACTUATE   2
+
+/** Scan period of the table; each tick scans a tenth of it */
+#define TICK_MS                 100
+#define TICK_SLICES             10
+/** At most this many registrations per tick to avoid flooding the mesh */
+#define REGISTER_BURST          16
+/** First registration retransmission timeout, doubled at every try */
+#define REGISTER_TIMEOUT_MS     2000
+#define REGISTER_MAX_BACKOFF    4
+/** Re-register after this many missing notifications */
+#define OBSERVE_MISSED          6
+/** CoAP ACK_TIMEOUT and MAX_RETRANSMIT for the actuation requests */
+#define ACTUATE_TIMEOUT_MS      2000
+#define ACTUATE_MAX_TRIES       4
+
+#define RECV_BATCH              32
+#define MAX_DATAGRAM            1280
+
+static struct loop_handler handler;
+static motes_send_t send_hook;
+static struct loop_timer tick;
+static uint16_t next_mid;
+static unsigned scan_cursor;
+
+/*---------------------------------------------------------------------------*/
+static void
+set_token(struct coap_message *m, struct thermostat *t, unsigned kind)
+{
+  uint32_t token = ((uint32_t)(t - thermostats) << 8) | kind;
+  m->token_len = 4;
+  m->token[0] = token >> 24;
+  m->token[1] = token >> 16;
+  m->token[2] = token >> 8;
+  m->token[3] = token;
+}
+/*---------------------------------------------------------------------------*/
+static int
+send_to(const struct in6_addr *addr, const struct coap_message *m)
+{
+  struct sockaddr_in6 sa;
+  uint8_t buf[MAX_DATAGRAM];
+  int len = coap_serialize(m, buf, sizeof(buf));
+
+  if(len < 0) {
+    return -1;
+  }
+  if(send_hook != NULL) {
+    return send_hook(addr, buf, len);
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(COAP_DEFAULT_PORT);
+  sa.sin6_addr = *addr;
+  if(sendto(handler.fd, buf, len, 0, (struct sockaddr *)&sa, sizeof(sa))
+     != len) {
+    if(verbose > 1) warn("sendto");
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_request(struct thermostat *t, uint8_t code, unsigned kind,
+             const char *path, int observe)
+{
+  struct coap_message m;
+
+  coap_init(&m, COAP_TYPE_CON, code, next_mid++);
+  set_token(&m, t, kind);
+  m.uri_path = path;
+  m.observe = observe;
+  send_to(&t->addr, &m);
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_empty(const struct in6_addr *addr, coap_type_t type, uint16_t mid)
+{
+  struct coap_message m;
+  coap_init(&m, type, COAP_CODE_EMPTY, mid);
+  send_to(addr, &m);
+}
+/*---------------------------------------------------------------------------*/
+static void
+register_observe(struct thermostat *t, uint64_t now)
+{
+  send_request(t, COAP_GET, TOKEN_OBSERVE, "temperature", 0);
+  t->observe = OBSERVE_PENDING;
+  t->observe_time = now;
+  if(t->observe_tries < REGISTER_MAX_BACKOFF) {
+    t->observe_tries++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_actuation(struct thermostat *t, system_t s, uint64_t now)
+{
+  char path[32];
+  snprintf(path, sizeof(path), "systems/%s", system_names[s]);
+  send_request(t, COAP_POST, TOKEN_ACTUATE + s, path, -1);
+  t->actuation_sent[s] = now;
+  t->actuation_tries[s]++;
+}
+/*---------------------------------------------------------------------------*/
+int
+motes_actuate(struct thermostat *t, system_t s)
+{
+  if(t->actuation_sent[s] != 0) {
+    /* A toggle is already in flight, a second one would undo it */
+    return -1;
+  }
+  t->actuation_tries[s] = 0;
+  send_actuation(t, s, clock_ms());
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Is the 24 bit observe sequence number v1 newer than v2? (RFC 7641, 3.4) */
+static int
+observe_newer(uint32_t v1, uint32_t v2)
+{
+  return (v1 < v2 && v2 - v1 > (1 << 23)) || (v1 > v2 && v1 - v2 < (1 << 23));
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_temperature(struct thermostat *t, const struct coap_message *m,
+                   uint64_t now)
+{
+  int temperature;
+  uint32_t sampled;
+
+  if(COAP_CODE_CLASS(m->code) != 2) {
+    /* Registration refused, retry with the usual back-off */
+    t->observe = OBSERVE_IDLE;
+    return;
+  }
+  if(m->observe >= 0) {
+    if(t->observe == OBSERVE_ACTIVE &&
+       !observe_newer(m->observe, t->observe_seq)) {
+      return;                 /* Reordered, older than what we have */
+    }
+    t->observe_seq = m->observe;
+  }
+  if(t->observe != OBSERVE_ACTIVE) {
+    /* First answer, fetch the systems status like the flow did on start */
+    send_request(t, COAP_GET, TOKEN_SYSTEMS, "systems", -1);
+  }
+  t->observe = OBSERVE_ACTIVE;
+  t->observe_time = now;
+  t->observe_tries = 0;
+
+  if(coap_json_int(m->payload, m->payload_len, "temperature",
+                   &temperature) == 0) {
+    t->temperature = temperature;
+    t->updated = clock_wall_ms();
+    /* "t" is the network time of the reading modulo 2^32, the host's
+       clock on the other side of tunslip6 */
+    if(coap_json_uint32(m->payload, m->payload_len, "t", &sampled) == 0) {
+      t->latency = (int32_t)((uint32_t)clock_wall_us() - sampled);
+    } else {
+      t->latency = INT32_MIN;
+    }
+    gateway_reading(t);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_systems(struct thermostat *t, const struct coap_message *m)
+{
+  int s, value, changed = 0;
+
+  for(s = 0; s < SYSTEMS; s++) {
+    if(coap_json_bool(m->payload, m->payload_len, system_names[s],
+                      &value) == 0 && t->systems[s] != value) {
+      t->systems[s] = value;
+      changed = 1;
+    }
+  }
+  if(changed) {
+    gateway_systems(t);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_actuation(struct thermostat *t, system_t s,
+                 const struct coap_message *m)
+{
+  int value;
+
+  t->actuation_sent[s] = 0;
+  if(COAP_CODE_CLASS(m->code) != 2) {
+    if(verbose) {
+      fprintf(stderr, "%s: %s refused with %d.%02d\n", t->name,
+              system_names[s], COAP_CODE_CLASS(m->code),
+              COAP_CODE_DETAIL(m->code));
+    }
+    return;
+  }
+  if(coap_json_bool(m->payload, m->payload_len, "value", &value) == 0 &&
+     t->systems[s] != value) {
+    t->systems[s] = value;
+    gateway_systems(t);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_datagram(const struct in6_addr *from, const uint8_t *buf,
+                size_t len, uint64_t now)
+{
+  struct coap_message m;
+  struct thermostat *t;
+  uint32_t token, row, kind;
+
+  if(coap_parse(&m, buf, len) < 0) {
+    return;
+  }
+  t = thermostats_find(from);
+  if(m.code == COAP_CODE_EMPTY) {
+    /* Empty ACK of a separate response, or RST of a stale observe */
+    if(m.type == COAP_TYPE_RST && t != NULL && t->observe == OBSERVE_ACTIVE) {
+      t->observe = OBSERVE_IDLE;
+    }
+    return;
+  }
+  if(m.token_len == 4) {
+    token = ((uint32_t)m.token[0] << 24) | (m.token[1] << 16) |
+      (m.token[2] << 8) | m.token[3];
+    row = token >> 8;
+    kind = token & 0xff;
+  } else {
+    row = (uint32_t)-1;
+    kind = 0;
+  }
+  if(t == NULL || row != (uint32_t)(t - thermostats)) {
+    /* Not ours (e.g. an observe left over by a previous run): cancel it */
+    if(m.type == COAP_TYPE_CON || m.type == COAP_TYPE_NON) {
+      send_empty(from, COAP_TYPE_RST, m.mid);
+    }
+    return;
+  }
+  if(m.type == COAP_TYPE_CON) {
+    send_empty(from, COAP_TYPE_ACK, m.mid);
+  }
+
+  if(kind == TOKEN_OBSERVE) {
+    handle_temperature(t, &m, now);
+  } else if(kind == TOKEN_SYSTEMS) {
+    handle_systems(t, &m);
+  } else if(kind - TOKEN_ACTUATE < SYSTEMS) {
+    handle_actuation(t, kind - TOKEN_ACTUATE, &m);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+socket_callback(struct loop_handler *h, uint32_t events)
+{
+  static uint8_t bufs[RECV_BATCH][MAX_DATAGRAM];
+  static struct sockaddr_in6 from[RECV_BATCH];
+  struct mmsghdr msgs[RECV_BATCH];
+  struct iovec iov[RECV_BATCH];
+  uint64_t now = clock_ms();
+  int i, n;
+
+  do {
+    for(i = 0; i < RECV_BATCH; i++) {
+      iov[i].iov_base = bufs[i];
+      iov[i].iov_len = MAX_DATAGRAM;
+      memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+      msgs[i].msg_hdr.msg_name = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(h->fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+    if(n == -1) {
+      if(errno != EAGAIN && errno != EINTR) warn("recvmmsg");
+      return;
+    }
+    for(i = 0; i < n; i++) {
+      handle_datagram(&from[i].sin6_addr, bufs[i], msgs[i].msg_len, now);
+    }
+  } while(n == RECV_BATCH);
+}
+/*---------------------------------------------------------------------------*/
+void
+motes_input(const struct in6_addr *from, const uint8_t *buf, size_t len)
+{
+  handle_datagram(from, buf, len, clock_ms());
+}
+/*---------------------------------------------------------------------------*/
+static void
+tick_callback(struct loop_timer *timer)
+{
+  uint64_t now = clock_ms();
+  unsigned slice = (thermostats_count + TICK_SLICES - 1) / TICK_SLICES;
+  unsigned burst = 0, i;
+  int s;
+
+  for(i = 0; i < slice && thermostats_count > 0; i++) {
+    struct thermostat *t = &thermostats[scan_cursor];
+
+    if(++scan_cursor == thermostats_count) {
+      scan_cursor = 0;
+    }
+    switch(t->observe) {
+    case OBSERVE_IDLE:
+      if(burst < REGISTER_BURST) {
+        register_observe(t, now);
+        burst++;
+      }
+      break;
+    case OBSERVE_PENDING:
+      if(now - t->observe_time >
+         (uint64_t)REGISTER_TIMEOUT_MS << (t->observe_tries - 1)) {
+        t->observe = OBSERVE_IDLE;
+      }
+      break;
+    case OBSERVE_ACTIVE:
+      if(now - t->observe_time >
+         OBSERVE_MISSED * MOTES_SENSING_INTERVAL * 1000) {
+        if(verbose) {
+          fprintf(stderr, "%s: notifications lost, re-registering\n",
+                  t->name);
+        }
+        t->observe = OBSERVE_IDLE;
+      }
+      break;
+    }
+    for(s = 0; s < SYSTEMS; s++) {
+      if(t->actuation_sent[s] != 0 &&
+         now - t->actuation_sent[s] >
+         (uint64_t)ACTUATE_TIMEOUT_MS << (t->actuation_tries[s] - 1)) {
+        if(t->actuation_tries[s] >= ACTUATE_MAX_TRIES) {
+          t->actuation_sent[s] = 0;
+          warnx("%s: %s request timed out", t->name, system_names[s]);
+        } else {
+          send_actuation(t, s, now);
+        }
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+motes_init(int port, motes_send_t send)
+{
+  struct sockaddr_in6 sa;
+  int bufsize = 1 << 20;
+
+  next_mid = getpid();
+  loop_every(&tick, TICK_MS, tick_callback);
+  if((send_hook = send) != NULL) {
+    return;
+  }
+
+  handler.fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(handler.fd == -1) err(1, "socket");
+  /* Thousands of motes notify in bursts, give the kernel room to queue */
+  setsockopt(handler.fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(port);
+  sa.sin6_addr = in6addr_any;
+  if(bind(handler.fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    err(1, "bind to CoAP port %d", port);
+  }
+  handler.callback = socket_callback;
+  if(loop_add(&handler, EPOLLIN) == -1) err(1, "loop_add");
+}
+/*---------------------------------------------------------------------------*/
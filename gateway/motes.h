@@ -0,0 +1,30 @@
+/**
+ * \file
+ *         CoAP client side of the gateway: one UDP socket for all the motes.
+ */
+
+#ifndef __MOTES_H__
+#define __MOTES_H__
+
+#include "thermostats.h"
+
+/** Seconds between two notifications of a thermostat (TEMP_SENSING_INTERVAL) */
+#define MOTES_SENSING_INTERVAL  5
+
+/** Where the CoAP messages go when the gateway owns the SLIP link */
+typedef int (* motes_send_t)(const struct in6_addr *to, const uint8_t *buf,
+                             size_t len);
+
+/**
+ * Start observing every thermostat of the table, through a UDP socket
+ * bound to port, or through send if it is not NULL.
+ */
+void motes_init(int port, motes_send_t send);
+
+/** A datagram from a mote, when the gateway owns the SLIP link */
+void motes_input(const struct in6_addr *from, const uint8_t *buf, size_t len);
+
+/** Toggle a system of a thermostat, the outcome is reported asynchronously */
+int motes_actuate(struct thermostat *t, system_t system);
+
+#endif /* __MOTES_H__ */
@@ -0,0 +1,164 @@
+#!/bin/sh
+# Check the gateway's MQTT uplink end to end against mqtt-stub. A native
+# thermostat on ::1 feeds a gateway closing 2 second windows, the broker is
+# killed for 30 seconds and restarted, and what it received is compared
+# with the windows the gateway closed (its -v2 output):
+#   - every window reaches the broker, alone or merged with the following
+#     ones of the outage as the gateway reports, with the mean of their
+#     home averages
+#   - no window reaches it twice
+#   - after the restart the replay keeps to the -r rate and its burst
+#
+#   make mqtt-stub && make -C ../sensor/native && ./mqtt-check.sh -q 1
+
+qos=0
+while getopts q: opt; do
+	case $opt in
+	q) qos=$OPTARG ;;
+	*) echo "usage: $0 [-q qos]" >&2; exit 1 ;;
+	esac
+done
+
+dir=$(cd "$(dirname "$0")" && pwd)
+mote_bin=$dir/../sensor/native/thermostat-native
+port=18830
+rate=1
+burst=2                 # MQTT_BURST in gateway.c
+
+for bin in "$dir/thermostat-gateway" "$dir/mqtt-stub" "$mote_bin"; do
+	if [ ! -x "$bin" ]; then
+		echo "$0: build $bin first" >&2
+		exit 1
+	fi
+done
+
+tmp=$(mktemp -d)
+mote= gateway= broker=
+trap 'kill $mote $gateway $broker 2>/dev/null; rm -rf "$tmp"' EXIT
+trap 'exit 1' INT TERM
+
+echo "::1 12 35 Thermostat 1" > "$tmp/thermostats.conf"
+mkdir "$tmp/data"
+
+"$dir/mqtt-stub" -p $port >> "$tmp/broker.log" &
+broker=$!
+"$mote_bin" -a ::1 > /dev/null &
+mote=$!
+"$dir/thermostat-gateway" -v2 -c "$tmp/thermostats.conf" -d "$tmp/data" \
+	-H 0 -u "$tmp/gateway.sock" -w 2 -m 127.0.0.1:$port -q $qos \
+	-r $rate -T home -t thermostats > "$tmp/gateway.log" 2>&1 &
+gateway=$!
+
+echo "*** delivering for 15 s"
+sleep 15
+kill $broker
+wait $broker 2>/dev/null
+echo "*** broker down for 30 s"
+sleep 30
+restart=$(date +%s%3N)
+"$dir/mqtt-stub" -p $port >> "$tmp/broker.log" &
+broker=$!
+echo "*** broker back, replaying for 30 s"
+sleep 30
+# Let the last window close and go out before stopping the gateway
+kill $mote
+wait $mote 2>/dev/null
+mote=
+sleep 5
+kill $gateway
+wait $gateway 2>/dev/null
+gateway=
+
+grep '^\*\*\* mqtt' "$tmp/gateway.log"
+
+# The windows first, then the messages in the order the broker read them
+awk -v restart="$restart" -v rate=$rate -v burst=$burst '
+BEGIN {
+	nwindows = next_window = 0
+}
+FNR == NR {
+	if ($0 ~ /thermostats reported, home average/) {
+		window[nwindows] = $NF
+		value[nwindows++] = $(NF - 2)
+	}
+	if ($0 ~ /messages to ..home.. merged/) {
+		expected += $3
+	}
+	next
+}
+{
+	n = split($3, field, "&")
+	created_at = ""
+	for (i = 1; i <= n; i++) {
+		if (field[i] ~ /^created_at=/) created_at = substr(field[i], 12)
+		if (field[i] ~ /^field1=/) v = substr(field[i], 8) + 0
+	}
+	if ($1 >= restart) {
+		if (replayed == 0) first = $1
+		if (replayed + 1 > burst + rate * ($1 - first) / 1000 + 0.2) {
+			printf "FAIL %s: message %d of the replay %d ms after the first\n",
+			       $2, replayed + 1, $1 - first
+			failed = 1
+		}
+		replayed++
+	}
+	if (seen[$2, created_at]++) {
+		printf "FAIL %s: %s received twice\n", $2, created_at
+		failed = 1
+		next
+	}
+	if ($2 == "thermostats") {
+		channel[created_at] = 1
+		next
+	}
+	# Home: the windows up to this one, merged if more than one
+	sum = 0
+	for (k = next_window; k < nwindows; k++) {
+		sum += value[k]
+		if (window[k] == created_at) break
+	}
+	if (k == nwindows) {
+		printf "FAIL home: %s is not a window closed after %s\n",
+		       created_at, window[next_window - 1]
+		failed = 1
+		next
+	}
+	mean = sum / (k - next_window + 1)
+	if (k > next_window) merged += k - next_window + 1
+	if (mean - v > 1e-6 * (v < 0 ? -v : v) + 1e-9 ||
+	    v - mean > 1e-6 * (v < 0 ? -v : v) + 1e-9) {
+		printf "FAIL home: %s has %s, the mean of its %d windows is %s\n",
+		       created_at, v, k - next_window + 1, mean
+		failed = 1
+	}
+	home[created_at] = 1
+	next_window = k + 1
+	messages++
+}
+END {
+	for (c in home) {
+		if (!(c in channel)) {
+			printf "FAIL thermostats: nothing for %s\n", c
+			failed = 1
+		}
+	}
+	# A lost message would make the next one look merged
+	if (merged != expected) {
+		printf "FAIL home: %d windows arrived merged, the gateway merged %d\n",
+		       merged, expected
+		failed = 1
+	}
+	if (nwindows > next_window) {
+		printf "FAIL home: %d windows from %s never arrived\n",
+		       nwindows - next_window, window[next_window]
+		failed = 1
+	}
+	if (replayed == 0) {
+		print "FAIL no message after the restart"
+		failed = 1
+	}
+	printf "%d windows, %d home messages, %d windows merged, %d messages " \
+	       "after the restart\n", nwindows, messages, merged, replayed
+	if (failed) exit 1
+	print "ok"
+}' "$tmp/gateway.log" "$tmp/broker.log"
@@ -0,0 +1,149 @@
+/**
+ * \file
+ *         Minimal MQTT 3.1.1 broker for checking the gateway's uplink.
+ *
+ *         Serves one client at a time on 127.0.0.1: answers CONNECT with
+ *         an accepted CONNACK, QoS 1 PUBLISH with its PUBACK and PINGREQ
+ *         with PINGRESP, and prints every PUBLISH it reads as a line
+ *         "<milliseconds> <topic> <payload>". Nothing is forwarded: it
+ *         stands for ThingSpeak in mqtt-check.sh, which kills and restarts
+ *         it to make the gateway spool and replay.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30
+#define MQTT_PUBACK     0x40
+#define MQTT_PINGREQ    0xc0
+#define MQTT_PINGRESP   0xd0
+
+/*---------------------------------------------------------------------------*/
+static unsigned long long
+now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_packet(int fd, uint8_t type, const uint8_t *p, size_t len)
+{
+  static const uint8_t connack[] = { MQTT_CONNACK, 2, 0, 0 };
+  static const uint8_t pingresp[] = { MQTT_PINGRESP, 0 };
+  size_t tlen, off;
+  int qos;
+
+  switch(type & 0xf0) {
+  case MQTT_CONNECT:
+    write(fd, connack, sizeof(connack));
+    break;
+  case MQTT_PUBLISH:
+    if(len < 2) return;
+    tlen = p[0] << 8 | p[1];
+    qos = (type >> 1) & 3;
+    off = 2 + tlen + (qos ? 2 : 0);
+    if(off > len) return;
+    printf("%llu %.*s %.*s\n", now_ms(), (int)tlen, (const char *)p + 2,
+           (int)(len - off), (const char *)p + off);
+    if(qos) {
+      uint8_t puback[4] = { MQTT_PUBACK, 2, p[2 + tlen], p[3 + tlen] };
+      write(fd, puback, sizeof(puback));
+    }
+    break;
+  case MQTT_PINGREQ:
+    write(fd, pingresp, sizeof(pingresp));
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Fixed header + remaining length framing: 0 until the packet is complete */
+static size_t
+packet_length(const uint8_t *in, size_t len, size_t *header)
+{
+  size_t rlen = 0, i = 1;
+  int shift = 0;
+
+  do {
+    if(i >= len || i > 4) return 0;
+    rlen |= (size_t)(in[i] & 0x7f) << shift;
+    shift += 7;
+  } while(in[i++] & 0x80);
+  *header = i;
+  return i + rlen;
+}
+/*---------------------------------------------------------------------------*/
+static void
+serve(int fd)
+{
+  static uint8_t in[65536];
+  size_t len = 0, header, plen;
+  ssize_t n;
+
+  while((n = read(fd, in + len, sizeof(in) - len)) > 0) {
+    len += n;
+    while((plen = packet_length(in, len, &header)) != 0 && plen <= len) {
+      handle_packet(fd, in[0], in + header, plen - header);
+      memmove(in, in + plen, len - plen);
+      len -= plen;
+    }
+    if(len == sizeof(in)) {
+      warnx("packet over %zu bytes, dropping the client", sizeof(in));
+      return;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  struct sockaddr_in sa;
+  int port = 1883, listener, fd, c, on = 1;
+
+  while((c = getopt(argc, argv, "p:")) != -1) {
+    switch(c) {
+    case 'p':
+      port = atoi(optarg);
+      break;
+
+    case '?':
+    default:
+fprintf(stderr,"usage:  %s [-p port]\n", argv[0]);
+fprintf(stderr,"Prints \"<ms> <topic> <payload>\" for every PUBLISH received\n");
+exit(1);
+      break;
+    }
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(listener == -1) err(1, "socket");
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    err(1, "bind port %d", port);
+  }
+  if(listen(listener, 1) == -1) err(1, "listen");
+
+  while((fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+    serve(fd);
+    close(fd);
+  }
+  err(1, "accept");
+}
+/*---------------------------------------------------------------------------*/
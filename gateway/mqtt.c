@@ -0,0 +1,468 @@
+/**
+ * \file
+ *         MQTT 3.1.1 uplink of the window averages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#include "buf.h"
+#include "gateway.h"
+#include "loop.h"
+#include "mqtt.h"
+#include "spool.h"
+
+#define TICK_MS              100
+#define KEEPALIVE_S          60
+#define RESPONSE_TIMEOUT_MS  10000
+#define MIN_BACKOFF_MS       1000
+#define MAX_BACKOFF_MS       60000
+
+/** Backlog merging: messages looked at, topics and messages per merge */
+#define COALESCE_SCAN        64
+#define COALESCE_TOPICS      8
+#define COALESCE_MAX         15
+
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30
+#define MQTT_PUBACK     0x40
+#define MQTT_PINGREQ    0xc0
+#define MQTT_PINGRESP   0xd0
+
+typedef enum {
+  DISCONNECTED,
+  RESOLVING,            /* getaddrinfo_a() in progress */
+  CONNECTING,           /* TCP handshake in progress */
+  WAIT_CONNACK,
+  CONNECTED
+} mqtt_state_t;
+
+static struct loop_handler handler = { .fd = -1 };
+static struct gaicb request;
+static struct loop_timer tick;
+static mqtt_state_t state;
+static char host[128];
+static char port[8] = "1883";
+static char client_id[32];
+static int qos;
+static double rate, tokens;
+static unsigned burst;
+static mqtt_coalesce_t coalesce;
+static uint64_t merged_end;     /* Messages before it come from a merge */
+
+static struct buf in, out;
+static uint64_t state_time, last_sent, last_refill, reconnect_at;
+static uint32_t backoff = MIN_BACKOFF_MS;
+static uint16_t packet_id;
+static int inflight;
+static uint64_t inflight_time, inflight_seq;
+static uint64_t ping_time;      /* PINGREQ unanswered since, 0 if none */
+
+/*---------------------------------------------------------------------------*/
+static void
+put_length(struct buf *b, size_t len)
+{
+  do {
+    uint8_t byte = len & 0x7f;
+    len >>= 7;
+    if(len) byte |= 0x80;
+    buf_append(b, &byte, 1);
+  } while(len);
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_string(struct buf *b, const char *s, size_t len)
+{
+  uint8_t l[2] = { len >> 8, len & 0xff };
+  buf_append(b, l, 2);
+  buf_append(b, s, len);
+}
+/*---------------------------------------------------------------------------*/
+static void disconnect(const char *why);
+/*---------------------------------------------------------------------------*/
+static void
+flush(void)
+{
+  ssize_t n;
+
+  if(out.len > 0) {
+    n = write(handler.fd, out.data, out.len);
+    if(n < 0 && errno != EAGAIN) {
+      disconnect("connection lost");
+      return;
+    }
+    if(n > 0) {
+      buf_consume(&out, n);
+      last_sent = clock_ms();
+    }
+  }
+  loop_modify(&handler, out.len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+/*---------------------------------------------------------------------------*/
+static void
+disconnect(const char *why)
+{
+  if(verbose && state != DISCONNECTED) {
+    fprintf(stderr, "*** mqtt: %s, %u messages spooled\n", why,
+            spool_count());
+  }
+  if(handler.fd != -1) {
+    loop_remove(&handler);
+    close(handler.fd);
+    handler.fd = -1;
+  }
+  state = DISCONNECTED;
+  in.len = out.len = 0;
+  /* The message in flight stays in the spool and is sent again */
+  inflight = 0;
+  ping_time = 0;
+  reconnect_at = clock_ms() + backoff;
+  backoff = backoff * 2 > MAX_BACKOFF_MS ? MAX_BACKOFF_MS : backoff * 2;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_connect(void)
+{
+  size_t id_len = strlen(client_id);
+  static const uint8_t header[] = {
+    0, 4, 'M', 'Q', 'T', 'T', 4,        /* Protocol name and level */
+    0x02,                               /* Clean session */
+    KEEPALIVE_S >> 8, KEEPALIVE_S & 0xff
+  };
+  uint8_t type = MQTT_CONNECT;
+
+  buf_append(&out, &type, 1);
+  put_length(&out, sizeof(header) + 2 + id_len);
+  buf_append(&out, header, sizeof(header));
+  put_string(&out, client_id, id_len);
+  state = WAIT_CONNACK;
+  state_time = clock_ms();
+  flush();
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_ping(void)
+{
+  uint8_t ping[2] = { MQTT_PINGREQ, 0 };
+
+  buf_append(&out, ping, 2);
+  if(ping_time == 0) {
+    ping_time = clock_ms();
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_publish(const char *topic, const char *payload)
+{
+  size_t tlen = strlen(topic), plen = strlen(payload);
+  uint8_t type = MQTT_PUBLISH | (qos << 1);
+
+  buf_append(&out, &type, 1);
+  put_length(&out, 2 + tlen + (qos ? 2 : 0) + plen);
+  put_string(&out, topic, tlen);
+  if(qos) {
+    uint8_t id[2];
+    if(++packet_id == 0) packet_id = 1;
+    id[0] = packet_id >> 8;
+    id[1] = packet_id & 0xff;
+    buf_append(&out, id, 2);
+  }
+  buf_append(&out, payload, plen);
+  if(qos == 0) {
+    /*
+     * QoS 0 has no acknowledgement, and bytes accepted by the kernel may
+     * still die with a half-open connection. The broker answers in order,
+     * so its PINGRESP tells that it read the PUBLISH.
+     */
+    send_ping();
+  }
+  inflight = 1;
+  inflight_time = clock_ms();
+  flush();
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_packet(uint8_t type, const uint8_t *p, size_t len)
+{
+  switch(type & 0xf0) {
+  case MQTT_CONNACK:
+    if(len < 2 || p[1] != 0) {
+      disconnect("connection refused");
+      return;
+    }
+    state = CONNECTED;
+    backoff = MIN_BACKOFF_MS;
+    if(verbose) {
+      fprintf(stderr, "*** mqtt: connected to %s:%s, %u messages spooled\n",
+              host, port, spool_count());
+    }
+    break;
+  case MQTT_PUBACK:
+    if(len >= 2 && inflight && ((p[0] << 8) | p[1]) == packet_id) {
+      spool_pop(inflight_seq);
+      inflight = 0;
+    }
+    break;
+  case MQTT_PINGRESP:
+    ping_time = 0;
+    if(inflight && qos == 0) {
+      spool_pop(inflight_seq);
+      inflight = 0;
+    }
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+socket_callback(struct loop_handler *h, uint32_t events)
+{
+  ssize_t n;
+
+  if(state == CONNECTING) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(h->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if(error != 0) {
+      disconnect(strerror(error));
+      return;
+    }
+    send_connect();
+    return;
+  }
+  if(events & EPOLLOUT) {
+    flush();
+  }
+  if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+    buf_reserve(&in, 512);
+    n = read(h->fd, in.data + in.len, in.size - in.len);
+    if(n == 0 || (n < 0 && errno != EAGAIN)) {
+      disconnect("connection lost");
+      return;
+    }
+    if(n > 0) {
+      in.len += n;
+    }
+    /* Split the fixed header + remaining length framing */
+    while(in.len >= 2) {
+      size_t len = 0, i = 1;
+      int shift = 0;
+      const uint8_t *p = (const uint8_t *)in.data;
+      do {
+        if(i >= in.len) return;
+        len |= (size_t)(p[i] & 0x7f) << shift;
+        shift += 7;
+      } while(p[i++] & 0x80);
+      if(in.len < i + len) return;
+      handle_packet(p[0], p + i, len);
+      if(state == DISCONNECTED) return;
+      buf_consume(&in, i + len);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+resolve_broker(void)
+{
+  static struct addrinfo hints = {
+    .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM
+  };
+  struct gaicb *list[1] = { &request };
+  int rv;
+
+  /* Resolved again on every attempt, off the loop: the address may change */
+  memset(&request, 0, sizeof(request));
+  request.ar_name = host;
+  request.ar_service = port;
+  request.ar_request = &hints;
+  state = RESOLVING;
+  if((rv = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL)) != 0) {
+    disconnect(gai_strerror(rv));
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+connect_broker(struct addrinfo *res)
+{
+  struct addrinfo *ai;
+
+  for(ai = res; ai != NULL; ai = ai->ai_next) {
+    handler.fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK |
+                        SOCK_CLOEXEC, ai->ai_protocol);
+    if(handler.fd == -1) continue;
+    if(connect(handler.fd, ai->ai_addr, ai->ai_addrlen) == 0 ||
+       errno == EINPROGRESS) {
+      break;
+    }
+    close(handler.fd);
+    handler.fd = -1;
+  }
+  freeaddrinfo(res);
+  if(handler.fd == -1) {
+    disconnect("can't connect");
+    return;
+  }
+  state = CONNECTING;
+  state_time = clock_ms();
+  loop_add(&handler, EPOLLOUT);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Replaying a backlog one message per token takes as long as the outage
+ * at the rate of the windows: merge the messages at the head of the spool,
+ * up to COALESCE_MAX of each topic, into one per topic. Merged messages
+ * are not merged again, each window weighs the same.
+ */
+static void
+coalesce_backlog(void)
+{
+  const char *topics[COALESCE_TOPICS], *merged[COALESCE_TOPICS];
+  const char *payloads[COALESCE_TOPICS][COALESCE_MAX];
+  unsigned counts[COALESCE_TOPICS] = { 0 };
+  struct buf out[COALESCE_TOPICS];
+  const char *topic, *payload;
+  unsigned n, t, topics_count = 0, merges = 0;
+  uint64_t head, seq;
+
+  if(spool_peek(0, &payload, &head) == NULL || head < merged_end) {
+    return;
+  }
+  for(n = 0; n < COALESCE_SCAN &&
+      (topic = spool_peek(n, &payload, &seq)) != NULL; n++) {
+    for(t = 0; t < topics_count && strcmp(topics[t], topic) != 0; t++);
+    if(t == topics_count) {
+      if(topics_count == COALESCE_TOPICS) break;
+      topics[topics_count++] = topic;
+    }
+    if(counts[t] == COALESCE_MAX) break;
+    payloads[t][counts[t]++] = payload;
+    merges += counts[t] > 1;
+  }
+  if(merges == 0) {
+    return;
+  }
+
+  memset(out, 0, sizeof(out));
+  for(t = 0; t < topics_count; t++) {
+    if(coalesce(payloads[t], counts[t], &out[t]) < 0) break;
+    merged[t] = out[t].data;
+  }
+  if(t == topics_count) {
+    /* The topics live in the slots being replaced */
+    for(t = 0; t < topics_count; t++) {
+      topics[t] = strdup(topics[t]);
+      if(topics[t] == NULL) err(1, "mqtt");
+    }
+    if(spool_replace(n, topics_count, topics, merged) == 0) {
+      merged_end = head + n;
+      for(t = 0; t < topics_count && verbose; t++) {
+        if(counts[t] > 1) {
+          fprintf(stderr, "*** mqtt: %u messages to ``%s'' merged\n",
+                  counts[t], topics[t]);
+        }
+      }
+    }
+    for(t = 0; t < topics_count; t++) {
+      free((char *)topics[t]);
+    }
+  }
+  for(t = 0; t < topics_count; t++) {
+    buf_free(&out[t]);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+tick_callback(struct loop_timer *t)
+{
+  uint64_t now = clock_ms();
+  const char *topic, *payload;
+  int rv;
+
+  tokens += (now - last_refill) * rate / 1000.0;
+  if(tokens > burst) tokens = burst;
+  last_refill = now;
+
+  switch(state) {
+  case DISCONNECTED:
+    if(now >= reconnect_at) {
+      resolve_broker();
+    }
+    break;
+  case RESOLVING:
+    /* The resolver has its own timeouts */
+    if((rv = gai_error(&request)) == 0) {
+      connect_broker(request.ar_result);
+    } else if(rv != EAI_INPROGRESS) {
+      disconnect(gai_strerror(rv));
+    }
+    break;
+  case CONNECTING:
+  case WAIT_CONNACK:
+    if(now - state_time > RESPONSE_TIMEOUT_MS) {
+      disconnect("broker does not answer");
+    }
+    break;
+  case CONNECTED:
+    if(inflight && now - inflight_time > RESPONSE_TIMEOUT_MS) {
+      disconnect("publish not acknowledged");
+      break;
+    }
+    if(ping_time != 0 && now - ping_time > RESPONSE_TIMEOUT_MS) {
+      disconnect("no PINGRESP");
+      break;
+    }
+    topic = NULL;
+    if(!inflight && ping_time == 0 && out.len == 0 && tokens >= 1) {
+      if(coalesce != NULL) {
+        coalesce_backlog();
+      }
+      topic = spool_peek(0, &payload, &inflight_seq);
+    }
+    if(topic != NULL) {
+      tokens -= 1;
+      send_publish(topic, payload);
+    } else if(ping_time == 0 && now - last_sent > KEEPALIVE_S * 1000 / 2) {
+      send_ping();
+      flush();
+    }
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+mqtt_publish(const char *topic, const char *payload)
+{
+  if(spool_push(topic, payload) < 0) {
+    warnx("mqtt: message to ``%s'' too long, dropped", topic);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+mqtt_init(const char *broker, int q, double r, unsigned b, mqtt_coalesce_t c)
+{
+  const char *colon = strrchr(broker, ':');
+
+  /* host:port, unless it is a bare IPv6 address */
+  if(colon != NULL && strchr(broker, ':') == colon) {
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - broker), broker);
+    snprintf(port, sizeof(port), "%s", colon + 1);
+  } else {
+    snprintf(host, sizeof(host), "%s", broker);
+  }
+  snprintf(client_id, sizeof(client_id), "thermostat-gateway-%d", getpid());
+  qos = q ? 1 : 0;
+  rate = r;
+  burst = b ? b : 1;
+  tokens = burst;
+  coalesce = c;
+  last_refill = clock_ms();
+  handler.callback = socket_callback;
+  loop_every(&tick, TICK_MS, tick_callback);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,37 @@
+/**
+ * \file
+ *         MQTT 3.1.1 uplink of the window averages.
+ *
+ *         Messages are queued in the spool first and sent from there one at a
+ *         time, at most `rate' per second with bursts of `burst', and only
+ *         removed once delivered: after the PUBACK with QoS 1, after the
+ *         PINGRESP to a PINGREQ sent right behind it with QoS 0. A broker that
+ *         does not answer within 10 seconds is disconnected. While the broker
+ *         is unreachable they accumulate in the spool and are replayed when
+ *         it comes back. A backlog is merged before it is replayed: up to
+ *         15 queued messages of a topic are sent as one.
+ */
+
+#ifndef __MQTT_H__
+#define __MQTT_H__
+
+#include "buf.h"
+
+/**
+ * Append to out the message replacing the n payloads, oldest first, queued
+ * for one topic. Returns -1 if they can't be merged.
+ */
+typedef int (* mqtt_coalesce_t)(const char **payloads, unsigned n,
+                                struct buf *out);
+
+/**
+ * Connect to broker ("host" or "host:port", default port 1883) and start
+ * draining the spool, which must already be open. coalesce may be NULL.
+ */
+void mqtt_init(const char *broker, int qos, double rate, unsigned burst,
+               mqtt_coalesce_t coalesce);
+
+/** Queue a message for the broker */
+void mqtt_publish(const char *topic, const char *payload);
+
+#endif /* __MQTT_H__ */
@@ -0,0 +1,348 @@
+/**
+ * \file
+ *         Local fan-out of the thermostat notifications.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <err.h>
+
+#include "alert.h"
+#include "gateway.h"
+#include "loop.h"
+#include "mux.h"
+
+/** A consumer that falls this far behind is disconnected */
+#define MUX_MAX_BACKLOG  (256 * 1024)
+#define MUX_MAX_LINE     256
+
+static const char *resource_names[MUX_RESOURCES] = {
+  "temperature", "systems", "alert"
+};
+
+struct mux_client;
+
+struct mux_sub {
+  struct mux_client *client;
+  int row;                      /* -1 for every thermostat */
+  mux_resource_t resource;
+  struct mux_sub *next, **pprev;        /* Subscribers of the same resource */
+  struct mux_sub *client_next;          /* Subscriptions of the same client */
+};
+
+struct mux_client {
+  struct loop_handler h;
+  struct buf in, out;
+  struct mux_sub *subs;
+  uint32_t generation;          /* Last notification queued to the client */
+  int dead;
+};
+
+static struct loop_handler listener;
+static const char *socket_path;
+/* Subscriber lists, one per row and resource; row 0 is the wildcard */
+static struct mux_sub **heads;
+static uint32_t generation;
+
+#define HEAD(row, resource) (&heads[((row) + 1) * MUX_RESOURCES + (resource)])
+
+/*---------------------------------------------------------------------------*/
+static void
+client_close(struct loop_handler *h)
+{
+  struct mux_client *c = (struct mux_client *)h;
+  struct mux_sub *s, *next;
+
+  for(s = c->subs; s != NULL; s = next) {
+    next = s->client_next;
+    if(s->next) s->next->pprev = s->pprev;
+    *s->pprev = s->next;
+    free(s);
+  }
+  close(c->h.fd);
+  buf_free(&c->in);
+  buf_free(&c->out);
+  free(c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+client_kill(struct mux_client *c)
+{
+  /*
+   * Freed after the events being dispatched: the client may be in a
+   * subscriber list being walked, or have an event of its own still due
+   */
+  c->dead = 1;
+  loop_release(&c->h, client_close);
+}
+/*---------------------------------------------------------------------------*/
+static void
+client_flush(struct mux_client *c)
+{
+  ssize_t n = write(c->h.fd, c->out.data, c->out.len);
+
+  if(n < 0 && errno != EAGAIN) {
+    client_kill(c);
+    return;
+  }
+  if(n > 0) {
+    buf_consume(&c->out, n);
+  }
+  loop_modify(&c->h, c->out.len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+/*---------------------------------------------------------------------------*/
+static void
+client_send(struct mux_client *c, const char *line, size_t len)
+{
+  int was_empty = c->out.len == 0;
+
+  if(c->dead) {
+    return;
+  }
+  if(c->out.len + len > MUX_MAX_BACKLOG) {
+    if(verbose) warnx("mux: dropping a consumer that does not keep up");
+    client_kill(c);
+    return;
+  }
+  buf_append(&c->out, line, len);
+  if(was_empty) {
+    client_flush(c);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+format_line(char *line, struct thermostat *t, mux_resource_t resource)
+{
+  int n, s;
+  const char *sep = "";
+
+  n = snprintf(line, MUX_MAX_LINE,
+               "{\"id\":%u,\"address\":\"%s\",\"resource\":\"%s\","
+               "\"time\":%llu,\"payload\":{", (unsigned)(t - thermostats),
+               t->address, resource_names[resource],
+               (unsigned long long)t->updated);
+  if(resource == MUX_TEMPERATURE) {
+    n += snprintf(line + n, MUX_MAX_LINE - n, "\"temperature\":%d",
+                  t->temperature);
+  } else if(resource == MUX_ALERT) {
+    n += snprintf(line + n, MUX_MAX_LINE - n,
+                  "\"state\":\"%s\",\"temperature\":%d,"
+                  "\"min\":%d,\"max\":%d",
+                  alert_state_names[alert_state(t)], t->temperature,
+                  t->min, t->max);
+  } else {
+    for(s = 0; s < SYSTEMS; s++) {
+      if(t->systems[s] >= 0) {
+        n += snprintf(line + n, MUX_MAX_LINE - n, "%s\"%s\":%s", sep,
+                      system_names[s], t->systems[s] ? "true" : "false");
+        sep = ",";
+      }
+    }
+  }
+  n += snprintf(line + n, MUX_MAX_LINE - n, "}}\n");
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static int
+has_value(struct thermostat *t, mux_resource_t resource)
+{
+  if(resource == MUX_TEMPERATURE) {
+    return t->updated != 0;
+  }
+  if(resource == MUX_ALERT) {
+    return alert_state(t) != ALERT_NORMAL;
+  }
+  return t->systems[SYSTEM_COOLING] >= 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+mux_publish(struct thermostat *t, mux_resource_t resource)
+{
+  struct mux_sub *lists[2], *s;
+  char line[MUX_MAX_LINE];
+  int len = -1, i;
+
+  if(heads == NULL) {
+    return;
+  }
+  /* A client subscribed to a row and to the wildcard gets a single copy */
+  generation++;
+  lists[0] = *HEAD(t - thermostats, resource);
+  lists[1] = *HEAD(-1, resource);
+  for(i = 0; i < 2; i++) {
+    for(s = lists[i]; s != NULL; s = s->next) {
+      if(s->client->generation == generation) {
+        continue;
+      }
+      if(len < 0) {
+        /* Formatted once, only if somebody listens */
+        len = format_line(line, t, resource);
+      }
+      s->client->generation = generation;
+      client_send(s->client, line, len);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_current(struct mux_client *c, int row, mux_resource_t resource)
+{
+  char line[MUX_MAX_LINE];
+  unsigned i, first = row < 0 ? 0 : row;
+  unsigned last = row < 0 ? thermostats_count : (unsigned)row + 1;
+
+  for(i = first; i < last; i++) {
+    if(has_value(&thermostats[i], resource)) {
+      client_send(c, line, format_line(line, &thermostats[i], resource));
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static const char *
+client_command(struct mux_client *c, char *line)
+{
+  char command[16], address[INET6_ADDRSTRLEN], resource_name[16];
+  struct in6_addr addr;
+  struct thermostat *t;
+  struct mux_sub *s, **ps;
+  int row, resource;
+
+  if(sscanf(line, "%15s %45s %15s", command, address, resource_name) != 3) {
+    return "malformed command";
+  }
+  for(resource = 0; resource < MUX_RESOURCES; resource++) {
+    if(strcmp(resource_name, resource_names[resource]) == 0) break;
+  }
+  if(resource == MUX_RESOURCES) {
+    return "unknown resource";
+  }
+  if(strcmp(address, "*") == 0) {
+    row = -1;
+  } else if(inet_pton(AF_INET6, address, &addr) == 1 &&
+            (t = thermostats_find(&addr)) != NULL) {
+    row = t - thermostats;
+  } else {
+    return "unknown thermostat";
+  }
+
+  for(ps = &c->subs; *ps != NULL; ps = &(*ps)->client_next) {
+    if((*ps)->row == row && (*ps)->resource == resource) break;
+  }
+  if(strcmp(command, "SUBSCRIBE") == 0) {
+    if(*ps == NULL) {
+      s = calloc(1, sizeof(*s));
+      if(s == NULL) err(1, "mux");
+      s->client = c;
+      s->row = row;
+      s->resource = resource;
+      s->next = *HEAD(row, resource);
+      if(s->next) s->next->pprev = &s->next;
+      s->pprev = HEAD(row, resource);
+      *s->pprev = s;
+      s->client_next = c->subs;
+      c->subs = s;
+    }
+    send_current(c, row, resource);
+  } else if(strcmp(command, "UNSUBSCRIBE") == 0) {
+    if((s = *ps) != NULL) {
+      *ps = s->client_next;
+      if(s->next) s->next->pprev = s->pprev;
+      *s->pprev = s->next;
+      free(s);
+    }
+  } else {
+    return "unknown command";
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void
+client_callback(struct loop_handler *h, uint32_t events)
+{
+  struct mux_client *c = (struct mux_client *)h;
+  char *line, *nl;
+  ssize_t n;
+
+  if(events & EPOLLOUT) {
+    client_flush(c);
+  }
+  if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    buf_reserve(&c->in, 512);
+    n = read(h->fd, c->in.data + c->in.len, c->in.size - c->in.len - 1);
+    if(n == 0 || (n < 0 && errno != EAGAIN)) {
+      client_kill(c);
+    } else if(n > 0) {
+      c->in.len += n;
+      c->in.data[c->in.len] = '\0';
+      line = c->in.data;
+      while(!c->dead && (nl = strchr(line, '\n')) != NULL) {
+        const char *error;
+        *nl = '\0';
+        if((error = client_command(c, line)) != NULL) {
+          char reply[64];
+          client_send(c, reply, snprintf(reply, sizeof(reply),
+                                         "{\"error\":\"%s\"}\n", error));
+        }
+        line = nl + 1;
+      }
+      buf_consume(&c->in, line - c->in.data);
+      if(c->in.len > MUX_MAX_LINE) {
+        client_kill(c);
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+listener_callback(struct loop_handler *h, uint32_t events)
+{
+  struct mux_client *c;
+  int fd;
+
+  while((fd = accept4(h->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    c = calloc(1, sizeof(*c));
+    if(c == NULL) err(1, "mux");
+    c->h.fd = fd;
+    c->h.callback = client_callback;
+    loop_add(&c->h, EPOLLIN);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+mux_init(const char *path)
+{
+  struct sockaddr_un sa;
+
+  heads = calloc((thermostats_count + 1) * MUX_RESOURCES, sizeof(*heads));
+  if(heads == NULL) err(1, "mux");
+
+  listener.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listener.fd == -1) err(1, "socket");
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(sa.sun_path)) errx(1, "mux: path too long");
+  strcpy(sa.sun_path, path);
+  unlink(path);
+  if(bind(listener.fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    err(1, "bind to ``%s''", path);
+  }
+  if(listen(listener.fd, 64) == -1) err(1, "listen");
+  socket_path = path;
+  listener.callback = listener_callback;
+  loop_add(&listener, EPOLLIN);
+}
+/*---------------------------------------------------------------------------*/
+void
+mux_close(void)
+{
+  if(socket_path != NULL) {
+    unlink(socket_path);
+  }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,39 @@
+/**
+ * \file
+ *         Local fan-out of the thermostat notifications.
+ *
+ *         The gateway keeps exactly one Observe per mote resource; any number
+ *         of local consumers subscribe to it through a Unix stream socket, so
+ *         the traffic on the mesh does not depend on how many there are.
+ *
+ *         Consumers write one command per line:
+ *             SUBSCRIBE <address|*> <temperature|systems|alert>
+ *             UNSUBSCRIBE <address|*> <temperature|systems|alert>
+ *         and receive one JSON object per line and notification:
+ *             {"id":0,"address":"aaaa::212:7402:2:202","resource":
+ *              "temperature","time":1560000000000,"payload":{...}}
+ *         The current value is sent right after a subscription; for alerts
+ *         only if the thermostat is in alarm.
+ */
+
+#ifndef __MUX_H__
+#define __MUX_H__
+
+#include "thermostats.h"
+
+typedef enum {
+  MUX_TEMPERATURE,
+  MUX_SYSTEMS,
+  MUX_ALERT,
+  MUX_RESOURCES
+} mux_resource_t;
+
+/** Listen on a Unix socket, replacing a stale one left at path */
+void mux_init(const char *path);
+
+/** Fan a resource change of a thermostat out to its subscribers */
+void mux_publish(struct thermostat *t, mux_resource_t resource);
+
+void mux_close(void);
+
+#endif /* __MUX_H__ */
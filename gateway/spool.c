@@ -0,0 +1,205 @@
+/**
+ * \file
+ *         Bounded on-disk queue of the messages waiting for the broker.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#include "spool.h"
+
+#define SPOOL_MAGIC "SPOOL001"
+
+struct spool_header {
+  char magic[8];
+  uint32_t slot_size;
+  uint32_t slots;
+  /* Ever increasing positions, the slot is position % slots */
+  uint64_t head;                /* Next message to send */
+  uint64_t tail;                /* Next free slot */
+  uint64_t dropped;
+};
+
+struct spool_slot {
+  uint16_t topic_len;
+  uint16_t payload_len;
+  char data[];                  /* topic '\0' payload '\0' */
+};
+
+static int fd = -1;
+static struct spool_header *header;
+static size_t map_size;
+
+/* The header takes the place of slot 0 */
+#define SLOT(pos) \
+  ((struct spool_slot *)((char *)header + \
+   ((pos) % header->slots + 1) * (size_t)header->slot_size))
+
+/*---------------------------------------------------------------------------*/
+int
+spool_open(const char *path, unsigned slots, size_t longest)
+{
+  struct stat st;
+  size_t size = sizeof(struct spool_slot) + longest + 2;
+  int reset = 0;
+
+  size = size < SPOOL_SLOT_SIZE ? SPOOL_SLOT_SIZE : (size + 7) & ~(size_t)7;
+  if(size > SPOOL_SLOT_MAX) {
+    warnx("spool: messages of %zu bytes don't fit in a slot", longest);
+    return -1;
+  }
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(fd == -1 || fstat(fd, &st) == -1) {
+    warn("spool: can't open ``%s''", path);
+    return -1;
+  }
+  if((size_t)st.st_size >= sizeof(struct spool_header)) {
+    struct spool_header h;
+    if(pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+       memcmp(h.magic, SPOOL_MAGIC, 8) == 0) {
+      if(h.slot_size >= size) {
+        /* Keep the geometry of an existing spool, it may hold messages */
+        slots = h.slots;
+        size = h.slot_size;
+      } else if(h.tail != h.head) {
+        warnx("spool: ``%s'' holds %u messages in slots of %u bytes, "
+              "%zu are needed", path, (unsigned)(h.tail - h.head),
+              h.slot_size, size);
+        return -1;
+      } else {
+        reset = 1;
+      }
+    }
+  }
+  map_size = (size_t)(slots + 1) * size;
+  if((size_t)st.st_size < map_size && ftruncate(fd, map_size) == -1) {
+    warn("spool: can't extend ``%s''", path);
+    return -1;
+  }
+  header = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(header == MAP_FAILED) {
+    warn("spool: can't map ``%s''", path);
+    header = NULL;
+    return -1;
+  }
+  if(reset || memcmp(header->magic, SPOOL_MAGIC, 8) != 0) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SPOOL_MAGIC, 8);
+    header->slot_size = size;
+    header->slots = slots;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+fits(const char *topic, const char *payload)
+{
+  return sizeof(struct spool_slot) + strlen(topic) + strlen(payload) + 2 <=
+         header->slot_size;
+}
+/*---------------------------------------------------------------------------*/
+static void
+slot_write(uint64_t pos, const char *topic, const char *payload)
+{
+  struct spool_slot *s = SLOT(pos);
+
+  s->topic_len = strlen(topic);
+  s->payload_len = strlen(payload);
+  memcpy(s->data, topic, s->topic_len + 1);
+  memcpy(s->data + s->topic_len + 1, payload, s->payload_len + 1);
+}
+/*---------------------------------------------------------------------------*/
+int
+spool_push(const char *topic, const char *payload)
+{
+  if(header == NULL || !fits(topic, payload)) {
+    return -1;
+  }
+  if(header->tail - header->head == header->slots) {
+    header->head++;
+    header->dropped++;
+  }
+  slot_write(header->tail, topic, payload);
+  /* Publish the slot only once it is complete */
+  header->tail++;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+const char *
+spool_peek(unsigned n, const char **payload, uint64_t *seq)
+{
+  struct spool_slot *s;
+
+  if(header == NULL || header->tail - header->head <= n) {
+    return NULL;
+  }
+  s = SLOT(header->head + n);
+  *payload = s->data + s->topic_len + 1;
+  *seq = header->head + n;
+  return s->data;
+}
+/*---------------------------------------------------------------------------*/
+void
+spool_pop(uint64_t seq)
+{
+  if(header != NULL && seq >= header->head && seq < header->tail) {
+    header->head = seq + 1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+spool_replace(unsigned n, unsigned k, const char **topics,
+              const char **payloads)
+{
+  uint64_t head;
+  unsigned i;
+
+  if(header == NULL || k > n || header->tail - header->head < n) {
+    return -1;
+  }
+  for(i = 0; i < k; i++) {
+    if(!fits(topics[i], payloads[i])) return -1;
+  }
+  /*
+   * Into the last k slots, then move the head: a crash in between leaves
+   * the first n - k messages in front of the merged ones, sent twice
+   */
+  head = header->head + n - k;
+  for(i = 0; i < k; i++) {
+    slot_write(head + i, topics[i], payloads[i]);
+  }
+  header->head = head;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+unsigned
+spool_count(void)
+{
+  return header ? header->tail - header->head : 0;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t
+spool_dropped(void)
+{
+  return header ? header->dropped : 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+spool_close(void)
+{
+  if(header != NULL) {
+    msync(header, map_size, MS_SYNC);
+    munmap(header, map_size);
+    header = NULL;
+  }
+  if(fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,57 @@
+/**
+ * \file
+ *         Bounded on-disk queue of the messages waiting for the broker.
+ *
+ *         A memory-mapped ring of fixed-size slots: messages survive a
+ *         restart of the gateway, and when the ring is full the oldest
+ *         message is dropped (and counted) to make room for the newest.
+ *         The slots are sized for the longest message when the spool is
+ *         created. Each message has a sequence number, so that the one
+ *         being sent can be dropped while it is in flight without its
+ *         acknowledgement removing the next one. A backlog can be merged
+ *         in place before it is sent.
+ */
+
+#ifndef __SPOOL_H__
+#define __SPOOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPOOL_SLOT_SIZE  512           /* The smallest slot */
+#define SPOOL_SLOT_MAX   65536
+
+/**
+ * Open or create a spool of the given number of slots, for messages of up
+ * to longest bytes, topic and payload. An existing spool keeps its
+ * geometry if its slots are large enough or it is empty; -1 if not.
+ */
+int spool_open(const char *path, unsigned slots, size_t longest);
+
+/** Queue a message, returns -1 if it does not fit in a slot */
+int spool_push(const char *topic, const char *payload);
+
+/**
+ * The n-th oldest message and its sequence number, NULL if the spool holds
+ * no more. The strings stay valid until the next spool_pop(),
+ * spool_replace() or spool_push().
+ */
+const char *spool_peek(unsigned n, const char **payload, uint64_t *seq);
+
+/** Remove the messages up to seq, those dropped to make room excepted */
+void spool_pop(uint64_t seq);
+
+/**
+ * Replace the n oldest messages with the k <= n given, which take their
+ * place at the head. The strings must not point into the spool. Returns -1
+ * if one does not fit in a slot.
+ */
+int spool_replace(unsigned n, unsigned k, const char **topics,
+                  const char **payloads);
+
+unsigned spool_count(void);
+uint64_t spool_dropped(void);
+
+void spool_close(void);
+
+#endif /* __SPOOL_H__ */
@@ -0,0 +1,190 @@
+/**
+ * \file
+ *         Data-driven table of the thermostats served by the gateway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "thermostats.h"
+
+const char *system_names[SYSTEMS] = { "cooling", "heating", "ventilation" };
+
+struct thermostat *thermostats;
+unsigned thermostats_count;
+
+/* Open addressing index from address to table row, 0 marks a free slot */
+static unsigned *index_slots;
+static unsigned index_mask;
+
+/*---------------------------------------------------------------------------*/
+static unsigned
+hash_addr(const struct in6_addr *addr)
+{
+  /* Motes of the same network share the prefix, hash the interface id */
+  uint32_t a, b;
+  memcpy(&a, &addr->s6_addr[8], 4);
+  memcpy(&b, &addr->s6_addr[12], 4);
+  return (a * 0x9e3779b1u) ^ (b * 0x85ebca6bu);
+}
+/*---------------------------------------------------------------------------*/
+static void
+index_build(void)
+{
+  unsigned size = 16, i;
+
+  while(size < thermostats_count * 2) {
+    size *= 2;
+  }
+  index_slots = calloc(size, sizeof(unsigned));
+  if(index_slots == NULL) err(1, "thermostats index");
+  index_mask = size - 1;
+
+  for(i = 0; i < thermostats_count; i++) {
+    unsigned slot = hash_addr(&thermostats[i].addr) & index_mask;
+    while(index_slots[slot] != 0) {
+      slot = (slot + 1) & index_mask;
+    }
+    index_slots[slot] = i + 1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+thermostats_load(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[256];
+  unsigned size = 0, lineno = 0;
+
+  if(f == NULL) {
+    warn("can't open ``%s''", path);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), f) != NULL) {
+    struct thermostat *t;
+    char address[INET6_ADDRSTRLEN];
+    int min, max, name;
+
+    lineno++;
+    if(sscanf(line, " %45s %d %d %n", address, &min, &max, &name) != 3) {
+      if(sscanf(line, " %1s", address) == 1 && address[0] != '#') {
+        warnx("%s:%u: expected ``address min max name''", path, lineno);
+      }
+      continue;
+    }
+    if(address[0] == '#') {
+      continue;
+    }
+    if(thermostats_count == size) {
+      size = size ? size * 2 : 64;
+      thermostats = realloc(thermostats, size * sizeof(*thermostats));
+      if(thermostats == NULL) err(1, "thermostats_load");
+    }
+    t = &thermostats[thermostats_count];
+    memset(t, 0, sizeof(*t));
+    if(inet_pton(AF_INET6, address, &t->addr) != 1) {
+      warnx("%s:%u: invalid address ``%s''", path, lineno, address);
+      continue;
+    }
+    inet_ntop(AF_INET6, &t->addr, t->address, sizeof(t->address));
+    line[strcspn(line, "\r\n")] = '\0';
+    snprintf(t->name, sizeof(t->name), "%s", line + name);
+    t->min = min;
+    t->max = max;
+    memset(t->systems, -1, sizeof(t->systems));
+    t->latency = INT32_MIN;
+    if(thermostats_find(&t->addr) != NULL) {
+      warnx("%s:%u: duplicate address ``%s''", path, lineno, address);
+      continue;
+    }
+    thermostats_count++;
+  }
+  fclose(f);
+  free(index_slots);
+  index_build();
+  return thermostats_count;
+}
+/*---------------------------------------------------------------------------*/
+struct thermostat *
+thermostats_find(const struct in6_addr *addr)
+{
+  unsigned slot, i;
+
+  if(index_slots == NULL) {
+    /* Still loading, the index is built once at the end */
+    for(i = 0; i < thermostats_count; i++) {
+      if(memcmp(&thermostats[i].addr, addr, sizeof(*addr)) == 0) {
+        return &thermostats[i];
+      }
+    }
+    return NULL;
+  }
+  for(slot = hash_addr(addr) & index_mask; index_slots[slot] != 0;
+      slot = (slot + 1) & index_mask) {
+    struct thermostat *t = &thermostats[index_slots[slot] - 1];
+    if(memcmp(&t->addr, addr, sizeof(*addr)) == 0) {
+      return t;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+int
+thermostats_system(const char *name)
+{
+  int i;
+  for(i = 0; i < SYSTEMS; i++) {
+    if(strcmp(name, system_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+json_string(struct buf *out, const char *s)
+{
+  buf_append(out, "\"", 1);
+  for(; *s; s++) {
+    if(*s == '"' || *s == '\\') {
+      buf_append(out, "\\", 1);
+    }
+    buf_append(out, s, 1);
+  }
+  buf_append(out, "\"", 1);
+}
+/*---------------------------------------------------------------------------*/
+void
+thermostats_json(struct buf *out, unsigned first, unsigned count)
+{
+  unsigned i;
+  int s;
+
+  buf_append(out, "[", 1);
+  for(i = first; i < first + count && i < thermostats_count; i++) {
+    struct thermostat *t = &thermostats[i];
+
+    buf_printf(out, "%s{\"id\":%u,\"name\":", i > first ? "," : "", i);
+    json_string(out, t->name);
+    buf_printf(out, ",\"address\":\"%s\",\"min\":%d,\"max\":%d",
+               t->address, t->min, t->max);
+    if(t->updated) {
+      buf_printf(out, ",\"temperature\":%d,\"updated\":%llu",
+                 t->temperature, (unsigned long long)t->updated);
+      if(t->latency != INT32_MIN) {
+        buf_printf(out, ",\"latency_us\":%ld", (long)t->latency);
+      }
+    }
+    for(s = 0; s < SYSTEMS; s++) {
+      if(t->systems[s] >= 0) {
+        buf_printf(out, ",\"%s\":%s", system_names[s],
+                   t->systems[s] ? "true" : "false");
+      }
+    }
+    buf_append(out, "}", 1);
+  }
+  buf_append(out, "]", 1);
+}
+/*---------------------------------------------------------------------------*/
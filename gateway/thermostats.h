@@ -0,0 +1,77 @@
+/**
+ * \file
+ *         Data-driven table of the thermostats served by the gateway.
+ *
+ *         Every per-thermostat chain of the Node-RED flow becomes a row of
+ *         this table, loaded once from a configuration file.
+ */
+
+#ifndef __THERMOSTATS_H__
+#define __THERMOSTATS_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "buf.h"
+
+typedef enum {
+  SYSTEM_COOLING,
+  SYSTEM_HEATING,
+  SYSTEM_VENTILATION,
+  SYSTEMS
+} system_t;
+
+extern const char *system_names[SYSTEMS];
+
+typedef enum {
+  OBSERVE_IDLE,         /* Registration has to be (re)sent */
+  OBSERVE_PENDING,      /* Registration sent, waiting for the first answer */
+  OBSERVE_ACTIVE        /* Notifications are flowing */
+} observe_state_t;
+
+struct thermostat {
+  char name[48];
+  char address[INET6_ADDRSTRLEN];
+  struct in6_addr addr;
+  int min, max;
+
+  /* Last reading, valid if updated != 0 (wall clock milliseconds) */
+  int temperature;
+  uint64_t updated;
+  /* From the reading on the mote to its arrival here, in microseconds,
+     when the notification had a network timestamp; INT32_MIN if not */
+  int32_t latency;
+
+  /* Systems status as last reported by the mote, -1 when unknown */
+  int8_t systems[SYSTEMS];
+  /* Monotonic time an actuation was sent, 0 if none is pending */
+  uint64_t actuation_sent[SYSTEMS];
+  uint8_t actuation_tries[SYSTEMS];
+
+  observe_state_t observe;
+  uint64_t observe_time;        /* Last registration or notification */
+  uint32_t observe_seq;         /* Observe option of the last notification */
+  uint8_t observe_tries;
+};
+
+extern struct thermostat *thermostats;
+extern unsigned thermostats_count;
+
+/**
+ * Load the table. Every non-empty line not starting with '#' reads
+ *     address min max name
+ * Returns the number of thermostats, -1 on error.
+ */
+int thermostats_load(const char *path);
+
+/** Find a thermostat by address in constant time */
+struct thermostat *thermostats_find(const struct in6_addr *addr);
+
+/** Resolve a system name, -1 if unknown */
+int thermostats_system(const char *name);
+
+/** Dump count rows from first in the JSON format served to the dashboard */
+void thermostats_json(struct buf *out, unsigned first, unsigned count);
+
+#endif /* __THERMOSTATS_H__ */
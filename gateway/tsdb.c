@@ -0,0 +1,428 @@
+/**
+ * \file
+ *         Append-only time-series store of the thermostat readings.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#include "thermostats.h"
+#include "tsdb.h"
+
+#define RAW_MAGIC     "TSDBRAW1"
+#define TIER_MAGIC    "TSDBTIR1"
+#define GROW_BLOCKS   64
+#define GROW_BUCKETS  1024
+
+struct mapping {
+  int fd;
+  uint8_t *base;
+  size_t size;
+};
+
+struct raw_header {
+  char magic[8];
+  uint32_t block_size;
+  uint32_t blocks;
+};
+
+struct raw_block {
+  uint64_t first_time;
+  uint64_t last_time;
+  int64_t last_delta;
+  int32_t first_value;
+  int32_t last_value;
+  int32_t min, max;
+  uint32_t count;
+  uint16_t time_bytes;
+  uint16_t value_bytes;
+};
+
+/* Each column owns half of the space after the block header */
+#define COLUMN_SIZE   ((TSDB_BLOCK_SIZE - sizeof(struct raw_block)) / 2)
+#define TIME_COLUMN(b)  ((uint8_t *)((b) + 1))
+#define VALUE_COLUMN(b) ((uint8_t *)((b) + 1) + COLUMN_SIZE)
+/* Worst case encoding of a sample in each column */
+#define MAX_TIME_BYTES  10
+#define MAX_VALUE_BYTES 5
+
+struct tier_header {
+  char magic[8];
+  uint32_t width;               /* Bucket width in milliseconds */
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t padding;
+};
+
+struct series {
+  struct mapping raw;
+  struct mapping tier[TSDB_TIERS];
+};
+
+static const uint32_t tier_width[TSDB_TIERS] = { 60 * 1000, 3600 * 1000 };
+static const char *tier_suffix[TSDB_TIERS] = { "1m", "1h" };
+
+static struct series *series;
+static unsigned series_count;
+
+/*---------------------------------------------------------------------------*/
+static int
+map_open(struct mapping *m, const char *path, size_t initial)
+{
+  struct stat st;
+
+  m->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(m->fd == -1 || fstat(m->fd, &st) == -1) {
+    warn("tsdb: can't open ``%s''", path);
+    return -1;
+  }
+  m->size = st.st_size;
+  if(m->size < initial) {
+    if(ftruncate(m->fd, initial) == -1) {
+      warn("tsdb: can't extend ``%s''", path);
+      return -1;
+    }
+    m->size = initial;
+  }
+  m->base = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+  if(m->base == MAP_FAILED) {
+    warn("tsdb: can't map ``%s''", path);
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+map_grow(struct mapping *m, size_t size)
+{
+  if(size <= m->size) {
+    return;
+  }
+  if(ftruncate(m->fd, size) == -1) err(1, "tsdb: ftruncate");
+  m->base = mremap(m->base, m->size, size, MREMAP_MAYMOVE);
+  if(m->base == MAP_FAILED) err(1, "tsdb: mremap");
+  m->size = size;
+}
+/*---------------------------------------------------------------------------*/
+static void
+map_close(struct mapping *m)
+{
+  if(m->base != NULL && m->base != MAP_FAILED) {
+    msync(m->base, m->size, MS_SYNC);
+    munmap(m->base, m->size);
+  }
+  if(m->fd > 0) {
+    close(m->fd);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t *
+put_varint(uint8_t *p, int64_t v)
+{
+  uint64_t u = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);      /* zigzag */
+  while(u >= 0x80) {
+    *p++ = (u & 0x7f) | 0x80;
+    u >>= 7;
+  }
+  *p++ = u;
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+static const uint8_t *
+get_varint(const uint8_t *p, int64_t *v)
+{
+  uint64_t u = 0;
+  int shift = 0;
+  while(*p & 0x80) {
+    u |= (uint64_t)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  u |= (uint64_t)*p++ << shift;
+  *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+static struct raw_header *
+raw_header(struct series *s)
+{
+  return (struct raw_header *)s->raw.base;
+}
+/*---------------------------------------------------------------------------*/
+static struct raw_block *
+raw_block(struct series *s, uint32_t i)
+{
+  /* Block 0 of the file holds the header */
+  return (struct raw_block *)(s->raw.base + (size_t)(i + 1) * TSDB_BLOCK_SIZE);
+}
+/*---------------------------------------------------------------------------*/
+static struct tier_header *
+tier_header(struct series *s, tsdb_tier_t tier)
+{
+  return (struct tier_header *)s->tier[tier].base;
+}
+/*---------------------------------------------------------------------------*/
+static struct tsdb_bucket *
+tier_buckets(struct series *s, tsdb_tier_t tier)
+{
+  return (struct tsdb_bucket *)(tier_header(s, tier) + 1);
+}
+/*---------------------------------------------------------------------------*/
+static int
+series_open(struct series *s, const char *dir, const char *name)
+{
+  char path[256];
+  int tier;
+
+  snprintf(path, sizeof(path), "%s/%s.raw", dir, name);
+  if(map_open(&s->raw, path, GROW_BLOCKS * TSDB_BLOCK_SIZE) < 0) {
+    return -1;
+  }
+  if(raw_header(s)->block_size == 0) {
+    memcpy(raw_header(s)->magic, RAW_MAGIC, 8);
+    raw_header(s)->block_size = TSDB_BLOCK_SIZE;
+  } else if(memcmp(raw_header(s)->magic, RAW_MAGIC, 8) != 0 ||
+            raw_header(s)->block_size != TSDB_BLOCK_SIZE) {
+    warnx("tsdb: ``%s'' is not a series file", path);
+    return -1;
+  }
+
+  for(tier = 0; tier < TSDB_TIERS; tier++) {
+    snprintf(path, sizeof(path), "%s/%s.%s", dir, name, tier_suffix[tier]);
+    if(map_open(&s->tier[tier], path, sizeof(struct tier_header) +
+                GROW_BUCKETS * sizeof(struct tsdb_bucket)) < 0) {
+      return -1;
+    }
+    if(tier_header(s, tier)->width == 0) {
+      memcpy(tier_header(s, tier)->magic, TIER_MAGIC, 8);
+      tier_header(s, tier)->width = tier_width[tier];
+    } else if(memcmp(tier_header(s, tier)->magic, TIER_MAGIC, 8) != 0 ||
+              tier_header(s, tier)->width != tier_width[tier]) {
+      warnx("tsdb: ``%s'' is not a tier file", path);
+      return -1;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsdb_open(const char *dir)
+{
+  unsigned i;
+
+  if(mkdir(dir, 0755) == -1 && errno != EEXIST) {
+    warn("tsdb: can't create ``%s''", dir);
+    return -1;
+  }
+  series = calloc(thermostats_count, sizeof(*series));
+  if(series == NULL) err(1, "tsdb");
+  series_count = thermostats_count;
+
+  for(i = 0; i < series_count; i++) {
+    if(series_open(&series[i], dir, thermostats[i].address) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+raw_append(struct series *s, uint64_t time, int32_t value)
+{
+  struct raw_header *h = raw_header(s);
+  struct raw_block *b = h->blocks ? raw_block(s, h->blocks - 1) : NULL;
+  int64_t delta;
+
+  if(b != NULL && time < b->last_time) {
+    time = b->last_time;        /* The wall clock stepped back */
+  }
+  if(b == NULL || b->time_bytes + MAX_TIME_BYTES > COLUMN_SIZE ||
+     b->value_bytes + MAX_VALUE_BYTES > COLUMN_SIZE) {
+    /* Start a new block, its first sample lives in the header */
+    if((size_t)(h->blocks + 2) * TSDB_BLOCK_SIZE > s->raw.size) {
+      map_grow(&s->raw, s->raw.size + GROW_BLOCKS * TSDB_BLOCK_SIZE);
+      h = raw_header(s);
+    }
+    b = raw_block(s, h->blocks);
+    memset(b, 0, sizeof(*b));
+    b->first_time = b->last_time = time;
+    b->first_value = b->last_value = b->min = b->max = value;
+    b->count = 1;
+    h->blocks++;
+    return;
+  }
+
+  delta = time - b->last_time;
+  b->time_bytes = put_varint(TIME_COLUMN(b) + b->time_bytes,
+                             delta - b->last_delta) - TIME_COLUMN(b);
+  b->value_bytes = put_varint(VALUE_COLUMN(b) + b->value_bytes,
+                              (int64_t)value - b->last_value)
+    - VALUE_COLUMN(b);
+  b->last_delta = delta;
+  b->last_time = time;
+  b->last_value = value;
+  if(value < b->min) b->min = value;
+  if(value > b->max) b->max = value;
+  b->count++;
+}
+/*---------------------------------------------------------------------------*/
+static void
+tier_append(struct series *s, tsdb_tier_t tier, uint64_t time, int32_t value)
+{
+  struct tier_header *h = tier_header(s, tier);
+  struct tsdb_bucket *last = h->count ? &tier_buckets(s, tier)[h->count - 1]
+    : NULL;
+  uint64_t start = time - time % h->width;
+
+  if(last == NULL || last->start < start) {
+    if(sizeof(*h) + (h->count + 1) * sizeof(*last) > s->tier[tier].size) {
+      map_grow(&s->tier[tier], s->tier[tier].size +
+               GROW_BUCKETS * sizeof(struct tsdb_bucket));
+      h = tier_header(s, tier);
+    }
+    last = &tier_buckets(s, tier)[h->count];
+    memset(last, 0, sizeof(*last));
+    last->start = start;
+    last->min = last->max = value;
+    h->count++;
+  }
+  if(value < last->min) last->min = value;
+  if(value > last->max) last->max = value;
+  last->sum += value;
+  last->count++;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsdb_append(unsigned row, uint64_t time, int32_t value)
+{
+  int tier;
+
+  if(row >= series_count) {
+    return;
+  }
+  raw_append(&series[row], time, value);
+  for(tier = 0; tier < TSDB_TIERS; tier++) {
+    tier_append(&series[row], tier, time, value);
+  }
+}
+/*---------------------------------------------------------------------------*/
+size_t
+tsdb_scan(unsigned row, uint64_t from, uint64_t to,
+          tsdb_scan_callback_t callback, void *arg)
+{
+  struct series *s;
+  uint32_t lo, hi, i, n;
+  size_t found = 0;
+
+  if(row >= series_count) {
+    return 0;
+  }
+  s = &series[row];
+
+  /* First block that may contain from */
+  lo = 0;
+  hi = raw_header(s)->blocks;
+  while(lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if(raw_block(s, mid)->last_time < from) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for(i = lo; i < raw_header(s)->blocks; i++) {
+    const struct raw_block *b = raw_block(s, i);
+    const uint8_t *tp = TIME_COLUMN(b), *vp = VALUE_COLUMN(b);
+    struct tsdb_point p = { b->first_time, b->first_value };
+    int64_t delta = 0, dod, dv;
+
+    if(b->first_time > to) {
+      break;
+    }
+    for(n = 0; n < b->count; n++) {
+      if(n > 0) {
+        tp = get_varint(tp, &dod);
+        vp = get_varint(vp, &dv);
+        delta += dod;
+        p.time += delta;
+        p.value += dv;
+      }
+      if(p.time > to) {
+        return found;
+      }
+      if(p.time >= from) {
+        callback(&p, arg);
+        found++;
+      }
+    }
+  }
+  return found;
+}
+/*---------------------------------------------------------------------------*/
+const struct tsdb_bucket *
+tsdb_buckets(unsigned row, tsdb_tier_t tier, uint64_t from, uint64_t to,
+             size_t *count)
+{
+  const struct tsdb_bucket *b;
+  size_t lo, hi, first;
+
+  *count = 0;
+  if(row >= series_count || tier >= TSDB_TIERS) {
+    return NULL;
+  }
+  b = tier_buckets(&series[row], tier);
+  hi = tier_header(&series[row], tier)->count;
+
+  lo = 0;
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if(b[mid].start < from) lo = mid + 1; else hi = mid;
+  }
+  first = lo;
+  hi = tier_header(&series[row], tier)->count;
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if(b[mid].start <= to) lo = mid + 1; else hi = mid;
+  }
+  *count = lo - first;
+  return b + first;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsdb_sync(void)
+{
+  unsigned i;
+  int tier;
+
+  for(i = 0; i < series_count; i++) {
+    msync(series[i].raw.base, series[i].raw.size, MS_ASYNC);
+    for(tier = 0; tier < TSDB_TIERS; tier++) {
+      msync(series[i].tier[tier].base, series[i].tier[tier].size, MS_ASYNC);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+tsdb_close(void)
+{
+  unsigned i;
+  int tier;
+
+  for(i = 0; i < series_count; i++) {
+    map_close(&series[i].raw);
+    for(tier = 0; tier < TSDB_TIERS; tier++) {
+      map_close(&series[i].tier[tier]);
+    }
+  }
+  free(series);
+  series = NULL;
+  series_count = 0;
+}
+/*---------------------------------------------------------------------------*/
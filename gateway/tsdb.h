@@ -0,0 +1,70 @@
+/**
+ * \file
+ *         Append-only time-series store of the thermostat readings.
+ *
+ *         Every thermostat has three memory-mapped files in the data
+ *         directory, named after its address:
+ *             <address>.raw   every reading, in compressed columnar blocks
+ *             <address>.1m    one min/max/sum/count bucket per minute
+ *             <address>.1h    one min/max/sum/count bucket per hour
+ *
+ *         A raw block stores the timestamps as zigzag varint delta-of-deltas
+ *         in its first half and the values as zigzag varint deltas in its
+ *         second half; with a reading every 5 seconds a sample takes about
+ *         two bytes. The downsampled tiers are plain arrays of buckets that
+ *         are updated in place while their interval is open, so a chart query
+ *         is a binary search returning a pointer into the mapping.
+ */
+
+#ifndef __TSDB_H__
+#define __TSDB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TSDB_BLOCK_SIZE   4096
+
+typedef enum {
+  TSDB_MINUTE,
+  TSDB_HOUR,
+  TSDB_TIERS
+} tsdb_tier_t;
+
+struct tsdb_point {
+  uint64_t time;                /* Milliseconds since the epoch */
+  int32_t value;
+};
+
+struct tsdb_bucket {
+  uint64_t start;               /* Milliseconds since the epoch */
+  int64_t sum;
+  int32_t min, max;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+typedef void (* tsdb_scan_callback_t)(const struct tsdb_point *p, void *arg);
+
+/** Open (or create) the series of every thermostat of the table */
+int tsdb_open(const char *dir);
+
+/** Append a reading of the thermostat at row; time must not go backwards */
+void tsdb_append(unsigned row, uint64_t time, int32_t value);
+
+/** Call back for every raw reading in [from, to], returns how many */
+size_t tsdb_scan(unsigned row, uint64_t from, uint64_t to,
+                 tsdb_scan_callback_t callback, void *arg);
+
+/**
+ * Downsampled buckets starting in [from, to]. The result points into the
+ * mapping and stays valid until the next tsdb_append().
+ */
+const struct tsdb_bucket *tsdb_buckets(unsigned row, tsdb_tier_t tier,
+                                       uint64_t from, uint64_t to,
+                                       size_t *count);
+
+/** Schedule the dirty pages to be written back */
+void tsdb_sync(void);
+void tsdb_close(void);
+
+#endif /* __TSDB_H__ */
@@ -0,0 +1,776 @@
+/**
+ * \file
+ *         CoAP load generator and latency benchmark for the thermostats.
+ *
+ *         Drives GET /temperature, GET /systems and the POST actuators of
+ *         a set of thermostats, either closed loop (-C: a fixed number of
+ *         requests outstanding, a new one as soon as one completes) or open
+ *         loop (-R: requests sent at a fixed rate whatever the responses,
+ *         optionally stepped up every interval to find where latency
+ *         collapses), and holds Observe relationships on /temperature, each
+ *         from its own socket since a thermostat keeps one per endpoint.
+ *
+ *         Requests are never retransmitted: no response within the timeout
+ *         is a loss. Latencies go to log-linear histograms (16 buckets per
+ *         power of two, about 6% resolution), the notification jitter is
+ *         how far apart two notifications are from the expected period.
+ *
+ *         One CSV row per interval, then one total row per resource. -H
+ *         appends the whole latency histogram to a file, tagged with -T,
+ *         for runs to be compared bucket by bucket (compare-latency.sh),
+ *         e.g. tunslip6 as it is and with -S.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#include "coap.h"
+
+#define MAX_INFLIGHT   65536    /* The token carries the slot in 16 bits */
+#define TIMEOUT_RING   (1 << 18)
+#define MAX_DATAGRAM   512
+#define HIST_BUCKETS   (16 * 40)
+#define MAX_BURST      1000     /* Open loop sends per wakeup */
+
+enum { TEMPERATURE, SYSTEMS, COOLING, HEATING, VENTILATION, KINDS };
+
+static const struct {
+  const char *name;
+  uint8_t code;
+  const char *path;
+} kinds[KINDS] = {
+  { "temperature", COAP_GET, "temperature" },
+  { "systems", COAP_GET, "systems" },
+  { "cooling", COAP_POST, "systems/cooling" },
+  { "heating", COAP_POST, "systems/heating" },
+  { "ventilation", COAP_POST, "systems/ventilation" },
+};
+
+struct hist {
+  uint64_t count;
+  uint64_t max;
+  uint32_t bucket[HIST_BUCKETS];
+};
+
+struct stats {
+  uint64_t sent, received, lost, errors;
+  struct hist latency;
+  uint64_t notifications, missed;
+  struct hist jitter;
+};
+
+static struct sockaddr_in6 *targets;
+static unsigned targets_count, next_target;
+
+static struct request {
+  uint64_t sent_us;
+  uint16_t gen;
+  uint8_t kind;
+  uint8_t busy;
+} requests[MAX_INFLIGHT];
+static uint16_t free_slots[MAX_INFLIGHT];
+static unsigned free_count, inflight;
+
+/* Slots in the order they were sent, to expire them in that order */
+static struct {
+  uint16_t slot;
+  uint16_t gen;
+} ring[TIMEOUT_RING];
+static unsigned ring_head, ring_count;
+
+static struct observer {
+  int fd;
+  struct sockaddr_in6 *target;
+  int registered;
+  int notified;                 /* Since the registration */
+  uint64_t start_us;            /* Registration due or sent */
+  uint64_t last_us;             /* Last notification */
+  uint32_t seq;
+} *observers;
+static unsigned observers_count;
+
+static int fd, epfd;
+static uint16_t next_mid;
+static unsigned weights[KINDS], weights_total;
+static int non;
+static uint64_t timeout_us = 2000000, period_us = 5000000;
+
+static struct stats interval, totals[KINDS], observe_total;
+static uint64_t overruns;
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+clock_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static unsigned
+hist_index(uint64_t v)
+{
+  unsigned e, i;
+
+  if(v < 16) {
+    return v;
+  }
+  e = 63 - __builtin_clzll(v);
+  i = (e - 3) * 16 + ((v >> (e - 4)) & 15);
+  return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+/*---------------------------------------------------------------------------*/
+/* The lowest value of a bucket */
+static uint64_t
+hist_low(unsigned i)
+{
+  unsigned e;
+
+  if(i < 16) {
+    return i;
+  }
+  e = i / 16 + 3;
+  return (uint64_t)(16 + i % 16) << (e - 4);
+}
+/*---------------------------------------------------------------------------*/
+/* The middle of a bucket */
+static uint64_t
+hist_value(unsigned i)
+{
+  unsigned e;
+
+  if(i < 16) {
+    return i;
+  }
+  e = i / 16 + 3;
+  return ((uint64_t)(16 + i % 16) << (e - 4)) + ((1ULL << (e - 4)) >> 1);
+}
+/*---------------------------------------------------------------------------*/
+static void
+hist_add(struct hist *h, uint64_t v)
+{
+  h->bucket[hist_index(v)]++;
+  h->count++;
+  if(v > h->max) h->max = v;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+hist_quantile(const struct hist *h, double q)
+{
+  uint64_t rank, seen = 0;
+  unsigned i;
+
+  if(h->count == 0) {
+    return 0;
+  }
+  rank = q * h->count;
+  if(rank < 1) rank = 1;
+  for(i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if(seen >= rank) {
+      uint64_t v = hist_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+/*---------------------------------------------------------------------------*/
+static void
+hist_merge(struct hist *to, const struct hist *from)
+{
+  unsigned i;
+
+  for(i = 0; i < HIST_BUCKETS; i++) {
+    to->bucket[i] += from->bucket[i];
+  }
+  to->count += from->count;
+  if(from->max > to->max) to->max = from->max;
+}
+/*---------------------------------------------------------------------------*/
+/* The non-empty buckets, a CSV row each */
+static void
+hist_write(const struct hist *h, const char *path, const char *tag)
+{
+  FILE *f = fopen(path, "a");
+  uint64_t seen = 0;
+  unsigned i;
+
+  if(f == NULL) {
+    err(1, "can't append to ``%s''", path);
+  }
+  if(ftell(f) == 0) {
+    fprintf(f, "tag,low_us,high_us,count,cumulative_pct\n");
+  }
+  for(i = 0; i < HIST_BUCKETS; i++) {
+    if(h->bucket[i] > 0) {
+      seen += h->bucket[i];
+      fprintf(f, "%s,%llu,%llu,%lu,%.3f\n", tag,
+              (unsigned long long)hist_low(i),
+              (unsigned long long)hist_low(i + 1), (unsigned long)h->bucket[i],
+              100.0 * seen / h->count);
+    }
+  }
+  fclose(f);
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_row(const char *time, const char *resource, double offered,
+          const struct stats *s)
+{
+  printf("%s,%s,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,"
+         "%llu,%llu\n", time, resource, offered,
+         (unsigned long long)s->sent, (unsigned long long)s->received,
+         (unsigned long long)s->lost, (unsigned long long)s->errors,
+         (unsigned long long)hist_quantile(&s->latency, 0.5),
+         (unsigned long long)hist_quantile(&s->latency, 0.99),
+         (unsigned long long)hist_quantile(&s->latency, 0.999),
+         (unsigned long long)s->latency.max,
+         (unsigned long long)s->notifications,
+         (unsigned long long)s->missed,
+         (unsigned long long)hist_quantile(&s->jitter, 0.5),
+         (unsigned long long)hist_quantile(&s->jitter, 0.99));
+  fflush(stdout);
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_message(int sock, const struct sockaddr_in6 *to,
+             const struct coap_message *m)
+{
+  uint8_t buf[MAX_DATAGRAM];
+  int len = coap_serialize(m, buf, sizeof(buf));
+
+  if(len > 0 && sendto(sock, buf, len, 0, (const struct sockaddr *)to,
+                       to ? sizeof(*to) : 0) < 0 && errno != EAGAIN &&
+     errno != ECONNREFUSED) {
+    warn("sendto");
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_ack(int sock, const struct sockaddr_in6 *to, uint16_t mid)
+{
+  struct coap_message m;
+
+  coap_init(&m, COAP_TYPE_ACK, COAP_CODE_EMPTY, mid);
+  send_message(sock, to, &m);
+}
+/*---------------------------------------------------------------------------*/
+static int
+pick_kind(void)
+{
+  unsigned r = random() % weights_total, k;
+
+  for(k = 0; r >= weights[k]; k++) {
+    r -= weights[k];
+  }
+  return k;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns -1 when there is no slot left for it */
+static int
+send_request(uint64_t now)
+{
+  struct coap_message m;
+  struct request *r;
+  uint16_t slot;
+  int k;
+
+  if(free_count == 0 || ring_count == TIMEOUT_RING) {
+    return -1;
+  }
+  slot = free_slots[--free_count];
+  r = &requests[slot];
+  k = pick_kind();
+  r->busy = 1;
+  r->gen++;
+  r->kind = k;
+  r->sent_us = now;
+  inflight++;
+  ring[(ring_head + ring_count) % TIMEOUT_RING].slot = slot;
+  ring[(ring_head + ring_count) % TIMEOUT_RING].gen = r->gen;
+  ring_count++;
+
+  coap_init(&m, non ? COAP_TYPE_NON : COAP_TYPE_CON, kinds[k].code,
+            next_mid++);
+  m.token_len = 4;
+  m.token[0] = slot >> 8;
+  m.token[1] = slot & 0xff;
+  m.token[2] = r->gen >> 8;
+  m.token[3] = r->gen & 0xff;
+  m.uri_path = kinds[k].path;
+  send_message(fd, &targets[next_target], &m);
+  next_target = (next_target + 1) % targets_count;
+  interval.sent++;
+  totals[k].sent++;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+release(uint16_t slot)
+{
+  requests[slot].busy = 0;
+  free_slots[free_count++] = slot;
+  inflight--;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the number of requests that timed out */
+static unsigned
+expire(uint64_t now)
+{
+  unsigned expired = 0;
+
+  while(ring_count > 0) {
+    uint16_t slot = ring[ring_head].slot;
+    struct request *r = &requests[slot];
+    if(r->busy && r->gen == ring[ring_head].gen) {
+      if(now - r->sent_us < timeout_us) {
+        break;
+      }
+      interval.lost++;
+      totals[r->kind].lost++;
+      release(slot);
+      expired++;
+    }
+    ring_head = (ring_head + 1) % TIMEOUT_RING;
+    ring_count--;
+  }
+  return expired;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the number of requests that completed */
+static unsigned
+receive_responses(uint64_t now)
+{
+  uint8_t buf[MAX_DATAGRAM];
+  struct sockaddr_in6 from;
+  socklen_t fromlen;
+  struct coap_message m;
+  unsigned completed = 0;
+  ssize_t n;
+
+  while(1) {
+    fromlen = sizeof(from);
+    n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+                 (struct sockaddr *)&from, &fromlen);
+    if(n < 0) {
+      return completed;
+    }
+    if(coap_parse(&m, buf, n) < 0 || m.code == COAP_CODE_EMPTY) {
+      continue;                 /* An empty ACK announces a separate response */
+    }
+    if(m.type == COAP_TYPE_CON) {
+      send_ack(fd, &from, m.mid);
+    }
+    if(m.token_len == 4) {
+      uint16_t slot = (m.token[0] << 8) | m.token[1];
+      uint16_t gen = (m.token[2] << 8) | m.token[3];
+      struct request *r = &requests[slot];
+      if(r->busy && r->gen == gen) {
+        uint64_t latency = now - r->sent_us;
+        hist_add(&interval.latency, latency);
+        hist_add(&totals[r->kind].latency, latency);
+        interval.received++;
+        totals[r->kind].received++;
+        if(COAP_CODE_CLASS(m.code) != 2) {
+          interval.errors++;
+          totals[r->kind].errors++;
+        }
+        release(slot);
+        completed++;
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+observe_register(struct observer *o, uint64_t now, int observe)
+{
+  struct coap_message m;
+  uint32_t i = o - observers;
+
+  coap_init(&m, COAP_TYPE_CON, COAP_GET, next_mid++);
+  m.token_len = 4;
+  m.token[0] = i >> 24;
+  m.token[1] = i >> 16;
+  m.token[2] = i >> 8;
+  m.token[3] = i;
+  m.observe = observe;
+  m.uri_path = kinds[TEMPERATURE].path;
+  send_message(o->fd, NULL, &m);
+  o->start_us = now;
+}
+/*---------------------------------------------------------------------------*/
+static void
+observe_input(struct observer *o, uint64_t now)
+{
+  uint8_t buf[MAX_DATAGRAM];
+  struct coap_message m;
+  ssize_t n;
+
+  while((n = recv(o->fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+    if(coap_parse(&m, buf, n) < 0 || m.code == COAP_CODE_EMPTY) {
+      continue;
+    }
+    if(m.type == COAP_TYPE_CON) {
+      send_ack(o->fd, NULL, m.mid);
+    }
+    if(m.observe < 0 || COAP_CODE_CLASS(m.code) != 2) {
+      continue;
+    }
+    if(!o->registered) {
+      /* The response to the registration starts the sequence */
+      o->registered = 1;
+      o->notified = 0;
+    } else {
+      uint32_t gap = (m.observe - o->seq) & 0xffffff;
+      uint64_t elapsed = now - o->last_us;
+      if(gap == 0 || gap >= (1 << 23)) {
+        continue;               /* Duplicate or reordered */
+      }
+      interval.missed += gap - 1;
+      observe_total.missed += gap - 1;
+      interval.notifications++;
+      observe_total.notifications++;
+      /* The registration itself is not in phase with the notifications */
+      if(o->notified) {
+        elapsed = elapsed > period_us * gap ? elapsed - period_us * gap :
+          period_us * gap - elapsed;
+        hist_add(&interval.jitter, elapsed);
+        hist_add(&observe_total.jitter, elapsed);
+      }
+      o->notified = 1;
+    }
+    o->seq = m.observe;
+    o->last_us = now;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+observe_check(uint64_t now)
+{
+  unsigned i;
+
+  for(i = 0; i < observers_count; i++) {
+    struct observer *o = &observers[i];
+    if(!o->registered) {
+      if(now >= o->start_us && now - o->start_us >= timeout_us) {
+        observe_register(o, now, 0);
+      }
+    } else if(now - o->last_us > 3 * period_us) {
+      /* The thermostat forgot us (restart, or too many observers) */
+      o->registered = 0;
+      observe_register(o, now, 0);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+add_target(const char *address, int port)
+{
+  struct sockaddr_in6 *t;
+
+  if(targets_count % 64 == 0) {
+    targets = realloc(targets, (targets_count + 64) * sizeof(*targets));
+    if(targets == NULL) err(1, "add_target");
+  }
+  t = &targets[targets_count];
+  memset(t, 0, sizeof(*t));
+  t->sin6_family = AF_INET6;
+  t->sin6_port = htons(port);
+  if(inet_pton(AF_INET6, address, &t->sin6_addr) != 1) {
+    errx(1, "invalid address ``%s''", address);
+  }
+  targets_count++;
+}
+/*---------------------------------------------------------------------------*/
+/* The addresses of a gateway thermostats.conf */
+static void
+load_targets(const char *path, int port)
+{
+  FILE *f = fopen(path, "r");
+  char line[256], address[INET6_ADDRSTRLEN];
+
+  if(f == NULL) {
+    err(1, "can't open ``%s''", path);
+  }
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if(sscanf(line, " %45s", address) == 1 && address[0] != '#') {
+      add_target(address, port);
+    }
+  }
+  fclose(f);
+}
+/*---------------------------------------------------------------------------*/
+static void
+parse_mix(const char *mix)
+{
+  char name[16];
+  unsigned w;
+  int k, n;
+
+  memset(weights, 0, sizeof(weights));
+  while(sscanf(mix, " %15[a-z]=%u%n", name, &w, &n) == 2) {
+    for(k = 0; k < KINDS && strcmp(kinds[k].name, name) != 0; k++);
+    if(k == KINDS) {
+      errx(1, "unknown resource ``%s''", name);
+    }
+    weights[k] = w;
+    mix += n;
+    if(*mix == ',') mix++;
+  }
+  if(*mix != '\0') {
+    errx(1, "invalid mix at ``%s''", mix);
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  const char *conf = NULL;
+  const char *hist_path = NULL, *tag = "run";
+  unsigned concurrency = 0, duration = 10, report = 1, i;
+  double rate = 0, rate_end = 0, rate_step = 0;
+  int port = COAP_DEFAULT_PORT;
+  struct epoll_event ev, events[64];
+  struct rlimit rl;
+  uint64_t start, now, next_report, phase_start, phase_sent = 0;
+  char elapsed[16];
+  int c, n, k;
+
+  weights[TEMPERATURE] = 1;
+  while((c = getopt(argc, argv, "c:C:R:m:O:P:d:i:t:NH:T:p:h")) != -1) {
+    switch(c) {
+    case 'c':
+      conf = optarg;
+      break;
+    case 'C':
+      concurrency = atoi(optarg);
+      break;
+    case 'R':
+      if(sscanf(optarg, "%lf:%lf:%lf", &rate, &rate_end, &rate_step) == 1) {
+        rate_end = rate;
+      }
+      break;
+    case 'm':
+      parse_mix(optarg);
+      break;
+    case 'O':
+      observers_count = atoi(optarg);
+      break;
+    case 'P':
+      period_us = strtoull(optarg, NULL, 10) * 1000;
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'i':
+      report = atoi(optarg) > 0 ? atoi(optarg) : 1;
+      break;
+    case 't':
+      timeout_us = strtoull(optarg, NULL, 10) * 1000;
+      break;
+    case 'N':
+      non = 1;
+      break;
+    case 'H':
+      hist_path = optarg;
+      break;
+    case 'T':
+      tag = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case '?':
+    case 'h':
+    default:
+fprintf(stderr,"usage:  %s [options] [address...]\n", prog);
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -c conf     Thermostats of a gateway configuration file\n");
+fprintf(stderr," -C n        Closed loop with n requests outstanding (default 1)\n");
+fprintf(stderr," -R rate     Open loop at rate requests/s, or start:end:step to\n");
+fprintf(stderr,"             raise it by step every interval\n");
+fprintf(stderr," -m mix      Resource weights (default temperature=1), e.g.\n");
+fprintf(stderr,"             temperature=8,systems=1,cooling=1,heating=0,ventilation=0\n");
+fprintf(stderr," -O n        Observe relationships on temperature (default 0)\n");
+fprintf(stderr," -P ms       Expected notification period (default 5000)\n");
+fprintf(stderr," -d s        Duration (default 10)\n");
+fprintf(stderr," -i s        Report interval (default 1)\n");
+fprintf(stderr," -t ms       Response timeout, a loss after that (default 2000)\n");
+fprintf(stderr," -N          Non-confirmable requests\n");
+fprintf(stderr," -H file     Append the latency histogram to file\n");
+fprintf(stderr," -T tag      The histogram's tag in the file (default run)\n");
+fprintf(stderr," -p port     CoAP port (default 5683)\n");
+exit(1);
+      break;
+    }
+  }
+  if(conf != NULL) {
+    load_targets(conf, port);
+  }
+  for(i = optind; i < (unsigned)argc; i++) {
+    add_target(argv[i], port);
+  }
+  if(targets_count == 0) {
+    errx(1, "no thermostat to load, see %s -h", prog);
+  }
+  for(k = 0, weights_total = 0; k < KINDS; k++) {
+    weights_total += weights[k];
+  }
+  if(rate == 0 && concurrency == 0 && weights_total > 0) {
+    concurrency = 1;
+  }
+  if(weights_total == 0) {
+    weights[TEMPERATURE] = weights_total = 1;
+    concurrency = 0;
+    rate = rate_end = 0;
+  }
+  if(concurrency > MAX_INFLIGHT) {
+    concurrency = MAX_INFLIGHT;
+  }
+
+  /* One descriptor per Observe relationship */
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(epfd == -1 || fd == -1) err(1, "socket");
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+  srandom(getpid());
+  next_mid = random();
+  for(i = 0; i < MAX_INFLIGHT; i++) {
+    free_slots[i] = MAX_INFLIGHT - 1 - i;
+  }
+  free_count = MAX_INFLIGHT;
+
+  start = clock_us();
+  observers = calloc(observers_count, sizeof(*observers));
+  for(i = 0; i < observers_count; i++) {
+    struct observer *o = &observers[i];
+    o->target = &targets[i % targets_count];
+    o->fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(o->fd == -1 ||
+       connect(o->fd, (struct sockaddr *)o->target, sizeof(*o->target)) < 0) {
+      err(1, "observer %u", i);
+    }
+    ev.data.ptr = o;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, o->fd, &ev);
+    /* Spread the registrations over the first second */
+    o->start_us = start + (uint64_t)i * 1000000 / observers_count -
+      timeout_us;
+  }
+
+  printf("time_s,resource,offered_rps,sent,received,lost,errors,"
+         "p50_us,p99_us,p999_us,max_us,"
+         "notifications,missed,jitter_p50_us,jitter_p99_us\n");
+
+  for(i = 0; i < concurrency; i++) {
+    send_request(start);
+  }
+  next_report = start + report * 1000000ULL;
+  phase_start = start;
+
+  while((now = clock_us()) < start + duration * 1000000ULL) {
+    unsigned done;
+
+    /* Closed loop: every completion or loss makes room for a request */
+    done = expire(now);
+    if(concurrency) {
+      while(done--) send_request(now);
+    }
+    if(rate > 0) {
+      uint64_t due = (now - phase_start) * rate / 1000000;
+      for(i = 0; phase_sent < due && i < MAX_BURST; i++, phase_sent++) {
+        if(send_request(now) < 0) {
+          interval.lost++;      /* Already MAX_INFLIGHT behind */
+          overruns++;
+        }
+      }
+    }
+    observe_check(now);
+
+    if(now >= next_report) {
+      snprintf(elapsed, sizeof(elapsed), "%.1f", (now - start) / 1e6);
+      print_row(elapsed, "all", rate ? rate : interval.sent / (double)report,
+                &interval);
+      memset(&interval, 0, sizeof(interval));
+      next_report += report * 1000000ULL;
+      if(rate > 0 && rate_step > 0 && rate + rate_step <= rate_end) {
+        rate += rate_step;
+        phase_start = now;
+        phase_sent = 0;
+      }
+    }
+
+    n = epoll_wait(epfd, events, 64, rate > 0 || observers_count ? 1 : 10);
+    now = clock_us();
+    for(i = 0; i < (unsigned)n; i++) {
+      if(events[i].data.ptr == NULL) {
+        done = receive_responses(now);
+        if(concurrency) {
+          while(done--) send_request(now);
+        }
+      } else {
+        observe_input(events[i].data.ptr, now);
+      }
+    }
+  }
+
+  if(interval.sent > 0 || interval.notifications > 0) {
+    snprintf(elapsed, sizeof(elapsed), "%.1f", (now - start) / 1e6);
+    print_row(elapsed, "all", rate ? rate : interval.sent / (double)report,
+              &interval);
+  }
+
+  /* Cancel the observations */
+  for(i = 0; i < observers_count; i++) {
+    if(observers[i].registered) {
+      observe_register(&observers[i], now, 1);
+    }
+  }
+
+  for(k = 0; k < KINDS; k++) {
+    if(totals[k].sent > 0) {
+      print_row("total", kinds[k].name, 0, &totals[k]);
+    }
+  }
+  {
+    struct stats all;
+    memset(&all, 0, sizeof(all));
+    all.lost = overruns;
+    for(k = 0; k < KINDS; k++) {
+      all.sent += totals[k].sent;
+      all.received += totals[k].received;
+      all.lost += totals[k].lost;
+      all.errors += totals[k].errors;
+      hist_merge(&all.latency, &totals[k].latency);
+    }
+    all.notifications = observe_total.notifications;
+    all.missed = observe_total.missed;
+    all.jitter = observe_total.jitter;
+    print_row("total", "all", all.sent / ((now - start) / 1e6), &all);
+    if(hist_path != NULL) {
+      hist_write(&all.latency, hist_path, tag);
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Print the latency histograms that coap-load -H appended to a file side
+# by side, one column per tag, with the median and 99th percentile of each.
+# Buckets under 0.1% in every run are left out, not from the percentiles.
+#
+# E.g. the same closed loop run against tunslip6 as it is and with -S:
+#   ./coap-load -C 1 -d 30 -H latency.csv -T select aaaa::2
+#   ./coap-load -C 1 -d 30 -H latency.csv -T spin aaaa::2
+#   ./compare-latency.sh latency.csv
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 histogram.csv" >&2
+	exit 1
+fi
+
+awk -F, '
+NR == 1 { next }
+{
+	if (!($1 in total)) {
+		tags[ntags++] = $1
+	}
+	total[$1] += $4
+	count[$1, $2] += $4
+	high[$2] = $3
+	if (!($2 in seen)) {
+		seen[$2] = 1
+		lows[nlows++] = $2 + 0
+	}
+	if (!(($1, "p50") in q) && $5 >= 50) q[$1, "p50"] = $3
+	if (!(($1, "p99") in q) && $5 >= 99) q[$1, "p99"] = $3
+}
+END {
+	# Insertion sort, the buckets of a few runs
+	for (i = 1; i < nlows; i++) {
+		for (j = i; j > 0 && lows[j - 1] > lows[j]; j--) {
+			t = lows[j]; lows[j] = lows[j - 1]; lows[j - 1] = t
+		}
+	}
+	printf "%15s", "us"
+	for (t = 0; t < ntags; t++) printf "  %-31s", tags[t]
+	printf "\n"
+	for (i = 0; i < nlows; i++) {
+		shown = 0
+		for (t = 0; t < ntags; t++) {
+			if (count[tags[t], lows[i]] >= total[tags[t]] / 1000) shown = 1
+		}
+		if (!shown) continue
+		printf "%7d-%-7d", lows[i], high[lows[i]]
+		for (t = 0; t < ntags; t++) {
+			pct = 100 * count[tags[t], lows[i]] / total[tags[t]]
+			bar = ""
+			for (b = 1; b <= pct / 4 + 0.5; b++) bar = bar "#"
+			printf "  %6.2f%% %-22s", pct, bar
+		}
+		printf "\n"
+	}
+	for (t = 0; t < ntags; t++) {
+		printf "%s: %d responses, p50 < %d us, p99 < %d us\n", tags[t],
+		    total[tags[t]], q[tags[t], "p50"], q[tags[t], "p99"]
+	}
+}' "$1"
@@ -0,0 +1,11 @@
+/**
+ * \file
+ *         The network of the native thermostat is the host's UDP stack.
+ */
+
+#ifndef __CONTIKI_NET_H__
+#define __CONTIKI_NET_H__
+
+#include "contiki.h"
+
+#endif /* __CONTIKI_NET_H__ */
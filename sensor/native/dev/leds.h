@@ -0,0 +1,19 @@
+/**
+ * \file
+ *         Contiki LEDs, kept as a bit mask that the native platform logs.
+ */
+
+#ifndef __LEDS_H__
+#define __LEDS_H__
+
+#define LEDS_GREEN  1
+#define LEDS_YELLOW 2
+#define LEDS_RED    4
+#define LEDS_BLUE   LEDS_YELLOW
+#define LEDS_ALL    7
+
+void leds_on(unsigned char leds);
+void leds_off(unsigned char leds);
+unsigned char leds_get(void);
+
+#endif /* __LEDS_H__ */
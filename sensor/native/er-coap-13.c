@@ -0,0 +1,198 @@
+/**
+ * \file
+ *         Erbium REST engine and CoAP-13 packet of the native thermostat.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "erbium.h"
+#include "er-coap-13.h"
+#include "native.h"
+
+#define CODE(c, d)   (((c) << 5) | (d))
+
+PROCESS(rest_engine, "REST engine");
+
+static resource_t *resources;
+static periodic_resource_t *periodic_resources;
+
+/* Handlers write their payload here, it is sent before the next request */
+static uint8_t buffer[REST_MAX_CHUNK_SIZE];
+static char well_known[1024];
+
+/*---------------------------------------------------------------------------*/
+void
+coap_init_message(void *packet, coap_message_type_t type, uint8_t code,
+                  uint16_t mid)
+{
+  coap_packet_t *p = packet;
+
+  memset(p, 0, sizeof(*p));
+  p->type = type;
+  p->code = code;
+  p->mid = mid;
+  p->content_type = -1;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_set_payload(void *packet, const void *payload, size_t length)
+{
+  coap_packet_t *p = packet;
+
+  p->payload = payload;
+  p->payload_len = length < REST_MAX_CHUNK_SIZE ? length : REST_MAX_CHUNK_SIZE;
+  return p->payload_len;
+}
+/*---------------------------------------------------------------------------*/
+int
+coap_set_header_content_type(void *packet, unsigned int content_type)
+{
+  ((coap_packet_t *)packet)->content_type = content_type;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+set_status(void *response, unsigned int code)
+{
+  ((coap_packet_t *)response)->code = code;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+notify_subscribers(resource_t *resource, int32_t counter, void *notification)
+{
+  coap_packet_t *p = notification;
+  struct native_response r;
+
+  r.code = p->code;
+  r.content_format = p->content_type;
+  r.payload = p->payload;
+  r.payload_len = p->payload_len;
+  native_notify(resource, counter, &r);
+}
+/*---------------------------------------------------------------------------*/
+const struct rest_implementation coap_rest_implementation = {
+  "CoAP-13",
+  set_status,
+  coap_set_header_content_type,
+  coap_set_payload,
+  notify_subscribers,
+  {
+    CODE(2, 5),                 /* OK */
+    CODE(2, 1),                 /* CREATED */
+    CODE(2, 4),                 /* CHANGED */
+    CODE(2, 2),                 /* DELETED */
+    CODE(2, 3),                 /* NOT_MODIFIED */
+    CODE(4, 0),                 /* BAD_REQUEST */
+    CODE(4, 1),                 /* UNAUTHORIZED */
+    CODE(4, 2),                 /* BAD_OPTION */
+    CODE(4, 3),                 /* FORBIDDEN */
+    CODE(4, 4),                 /* NOT_FOUND */
+    CODE(4, 5),                 /* METHOD_NOT_ALLOWED */
+    CODE(5, 0)                  /* INTERNAL_SERVER_ERROR */
+  },
+  {
+    TEXT_PLAIN,
+    APPLICATION_LINK_FORMAT,
+    APPLICATION_JSON
+  }
+};
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(rest_engine, ev, data)
+{
+  periodic_resource_t *pr;
+
+  PROCESS_BEGIN();
+
+  while(1) {
+    PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_TIMER);
+    for(pr = periodic_resources; pr != NULL; pr = pr->next) {
+      if(data == &pr->periodic_timer) {
+        pr->periodic_handler(pr->resource);
+        etimer_reset(&pr->periodic_timer);
+      }
+    }
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+rest_init_engine(void)
+{
+  process_start(&rest_engine, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+rest_activate_resource(resource_t *resource)
+{
+  resource_t **r;
+
+  /* Keep the activation order, it is the order of /.well-known/core */
+  for(r = &resources; *r != NULL; r = &(*r)->next);
+  resource->next = NULL;
+  *r = resource;
+}
+/*---------------------------------------------------------------------------*/
+void
+rest_activate_periodic_resource(periodic_resource_t *pr)
+{
+  rest_activate_resource(pr->resource);
+  pr->next = periodic_resources;
+  periodic_resources = pr;
+  PROCESS_CONTEXT_BEGIN(&rest_engine);
+  etimer_set(&pr->periodic_timer, pr->period);
+  PROCESS_CONTEXT_END(&rest_engine);
+}
+/*---------------------------------------------------------------------------*/
+static void
+list_resources(struct native_response *r)
+{
+  resource_t *res;
+  size_t len = 0;
+
+  for(res = resources; res != NULL && len < sizeof(well_known); res = res->next) {
+    len += snprintf(well_known + len, sizeof(well_known) - len, "%s</%s>;%s",
+                    len ? "," : "", res->url, res->attributes);
+  }
+  r->code = CODE(2, 5);
+  r->content_format = APPLICATION_LINK_FORMAT;
+  r->payload = (const uint8_t *)well_known;
+  r->payload_len = len < sizeof(well_known) ? len : sizeof(well_known) - 1;
+}
+/*---------------------------------------------------------------------------*/
+resource_t *
+native_dispatch(unsigned method, const char *path, struct native_response *r)
+{
+  coap_packet_t response;
+  resource_t *res;
+  int32_t offset = 0;
+
+  memset(r, 0, sizeof(*r));
+  r->content_format = -1;
+  for(res = resources; res != NULL; res = res->next) {
+    if(strcmp(res->url, path) == 0) break;
+  }
+  if(res == NULL) {
+    if(method == METHOD_GET && strcmp(path, ".well-known/core") == 0) {
+      list_resources(r);
+    } else {
+      r->code = CODE(4, 4);
+    }
+    return NULL;
+  }
+  if(!(res->flags & method)) {
+    r->code = CODE(4, 5);
+    return res;
+  }
+  coap_init_message(&response, COAP_TYPE_ACK, CODE(2, 5), 0);
+  res->handler(NULL, &response, buffer, sizeof(buffer), &offset);
+  r->code = response.code;
+  r->content_format = response.content_type;
+  r->payload = response.payload;
+  r->payload_len = response.payload_len;
+  return res;
+}
+/*---------------------------------------------------------------------------*/
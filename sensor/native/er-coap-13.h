@@ -0,0 +1,42 @@
+/**
+ * \file
+ *         The CoAP-13 packet as seen by the resource handlers.
+ *
+ *         Only what a handler sets survives to the wire: code, type,
+ *         Content-Format and payload. Parsing and encoding are done by the
+ *         gateway's codec (gateway/coap.c) in the native server.
+ */
+
+#ifndef __ER_COAP_13_H__
+#define __ER_COAP_13_H__
+
+#include "erbium.h"
+
+typedef enum {
+  COAP_TYPE_CON,
+  COAP_TYPE_NON,
+  COAP_TYPE_ACK,
+  COAP_TYPE_RST
+} coap_message_type_t;
+
+typedef enum {
+  TEXT_PLAIN = 0,
+  APPLICATION_LINK_FORMAT = 40,
+  APPLICATION_JSON = 50
+} coap_content_type_t;
+
+typedef struct {
+  coap_message_type_t type;
+  uint8_t code;
+  uint16_t mid;
+  int content_type;             /* -1 when not set */
+  const uint8_t *payload;
+  uint16_t payload_len;
+} coap_packet_t;
+
+void coap_init_message(void *packet, coap_message_type_t type, uint8_t code,
+                       uint16_t mid);
+int coap_set_payload(void *packet, const void *payload, size_t length);
+int coap_set_header_content_type(void *packet, unsigned int content_type);
+
+#endif /* __ER_COAP_13_H__ */
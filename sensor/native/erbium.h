@@ -0,0 +1,111 @@
+/**
+ * \file
+ *         Erbium REST engine on Linux.
+ *
+ *         Resources are declared and activated as with Erbium, and the REST
+ *         implementation is the CoAP one: handlers fill a coap_packet_t
+ *         response, periodic handlers run from their own event timer and
+ *         hand a notification to REST.notify_subscribers().
+ */
+
+#ifndef __ERBIUM_H__
+#define __ERBIUM_H__
+
+#include "contiki.h"
+
+#ifndef REST_MAX_CHUNK_SIZE
+#define REST_MAX_CHUNK_SIZE 64
+#endif
+
+typedef enum {
+  NO_FLAGS = 0,
+  METHOD_GET = (1 << 0),
+  METHOD_POST = (1 << 1),
+  METHOD_PUT = (1 << 2),
+  METHOD_DELETE = (1 << 3),
+  HAS_SUB_RESOURCES = (1 << 4),
+  IS_PERIODIC = (1 << 6),
+  IS_OBSERVABLE = (1 << 7)
+} rest_resource_flags_t;
+
+typedef struct resource_s resource_t;
+
+typedef void (*restful_handler)(void *request, void *response,
+                                uint8_t *buffer, uint16_t preferred_size,
+                                int32_t *offset);
+typedef void (*restful_periodic_handler)(resource_t *resource);
+
+struct resource_s {
+  resource_t *next;
+  rest_resource_flags_t flags;
+  const char *url;
+  const char *attributes;
+  restful_handler handler;
+};
+
+typedef struct periodic_resource_s {
+  struct periodic_resource_s *next;
+  resource_t *resource;
+  uint32_t period;
+  struct etimer periodic_timer;
+  restful_periodic_handler periodic_handler;
+} periodic_resource_t;
+
+#define RESOURCE(name, flags, url, attributes)                          \
+  void name##_handler(void *, void *, uint8_t *, uint16_t, int32_t *);  \
+  resource_t resource_##name = { NULL, flags, url, attributes,          \
+                                 name##_handler }
+
+#define PERIODIC_RESOURCE(name, flags, url, attributes, period)         \
+  void name##_handler(void *, void *, uint8_t *, uint16_t, int32_t *);  \
+  resource_t resource_##name = { NULL, (flags) | IS_OBSERVABLE |        \
+                                 IS_PERIODIC, url, attributes,          \
+                                 name##_handler };                      \
+  void name##_periodic_handler(resource_t *);                           \
+  periodic_resource_t periodic_resource_##name = {                      \
+    NULL, &resource_##name, period, { NULL }, name##_periodic_handler }
+
+struct rest_implementation_status {
+  const unsigned int OK;
+  const unsigned int CREATED;
+  const unsigned int CHANGED;
+  const unsigned int DELETED;
+  const unsigned int NOT_MODIFIED;
+  const unsigned int BAD_REQUEST;
+  const unsigned int UNAUTHORIZED;
+  const unsigned int BAD_OPTION;
+  const unsigned int FORBIDDEN;
+  const unsigned int NOT_FOUND;
+  const unsigned int METHOD_NOT_ALLOWED;
+  const unsigned int INTERNAL_SERVER_ERROR;
+};
+
+struct rest_implementation_type {
+  unsigned int TEXT_PLAIN;
+  unsigned int APPLICATION_LINK_FORMAT;
+  unsigned int APPLICATION_JSON;
+};
+
+struct rest_implementation {
+  const char *name;
+  int (*set_response_status)(void *response, unsigned int code);
+  int (*set_header_content_type)(void *message, unsigned int type);
+  int (*set_response_payload)(void *response, const void *payload,
+                              size_t length);
+  void (*notify_subscribers)(resource_t *resource, int32_t counter,
+                             void *notification);
+  const struct rest_implementation_status status;
+  const struct rest_implementation_type type;
+};
+
+extern const struct rest_implementation coap_rest_implementation;
+
+#ifndef REST
+#define REST coap_rest_implementation
+#endif
+
+void rest_init_engine(void);
+void rest_activate_resource(resource_t *resource);
+void rest_activate_periodic_resource(periodic_resource_t *periodic_resource);
+
+#endif /* __ERBIUM_H__ */
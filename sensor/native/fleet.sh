@@ -0,0 +1,70 @@
+#!/bin/sh
+# Start a fleet of native thermostats on this machine.
+#
+# Every thermostat is a thermostat-native process bound to its own address
+# of a /64 that is routed to the loopback interface (AnyIP), so no tun or
+# tap device is needed per instance. The gateway configuration listing the
+# fleet is written to -c; the thermostats are stopped when the script is.
+
+count=100
+prefix=aaaa::
+reach=
+conf=fleet.conf
+logs=
+min=12
+max=35
+
+usage() {
+	echo "usage: $0 [-n count] [-p prefix] [-a prefix] [-c conf] [-l logdir] [-m min] [-M max]" >&2
+	echo "  -n count   number of thermostats (default $count)" >&2
+	echo "  -p prefix  /64 of the thermostat addresses (default $prefix)" >&2
+	echo "  -a prefix  /64 written to conf instead, when the gateway reaches" >&2
+	echo "             the fleet through border-router-native (e.g. aaaa::)" >&2
+	echo "  -c conf    gateway configuration to write (default $conf)" >&2
+	echo "  -l logdir  keep the output of every thermostat in logdir" >&2
+	echo "  -m -M      alarm range written to conf (default $min $max)" >&2
+	exit 1
+}
+
+while getopts n:p:a:c:l:m:M:h opt; do
+	case $opt in
+	n) count=$OPTARG ;;
+	p) prefix=$OPTARG ;;
+	a) reach=$OPTARG ;;
+	c) conf=$OPTARG ;;
+	l) logs=$OPTARG ;;
+	m) min=$OPTARG ;;
+	M) max=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+bin=$(dirname "$0")/thermostat-native
+[ -x "$bin" ] || { echo "$bin not found, run make first" >&2; exit 1; }
+
+if ! ip -6 route show table local | grep -q "^local ${prefix%::}::/64 "; then
+	ip -6 route add local "${prefix%::}::/64" dev lo ||
+		{ echo "can't route ${prefix%::}::/64 to lo (root needed)" >&2; exit 1; }
+fi
+[ -n "$reach" ] || reach=$prefix
+[ -n "$logs" ] && mkdir -p "$logs"
+
+pids=
+trap 'kill $pids 2>/dev/null; exit 0' INT TERM
+trap 'kill $pids 2>/dev/null' EXIT
+
+echo "# Fleet of $count native thermostats, written by fleet.sh" > "$conf"
+i=1
+while [ "$i" -le "$count" ]; do
+	# ::1 is the host, like the border router prefix in the simulation
+	address=$(printf "%s%x" "$prefix" $((i + 1)))
+	out=/dev/null
+	[ -n "$logs" ] && out=$logs/thermostat-$i.log
+	"$bin" -a "$address" -s "$i" > "$out" 2>&1 &
+	pids="$pids $!"
+	printf "%-30s %4d %4d   Thermostat %d\n" "$(printf "%s%x" "$reach" $((i + 1)))" "$min" "$max" "$i" >> "$conf"
+	i=$((i + 1))
+done
+
+echo "$count thermostats running, gateway configuration in $conf" >&2
+wait
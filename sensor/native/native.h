@@ -0,0 +1,42 @@
+/**
+ * \file
+ *         Glue between the Erbium engine and the UDP server of the native
+ *         thermostat.
+ *
+ *         The two halves live in different files because the engine speaks
+ *         Erbium's coap_packet_t while the server parses and encodes with
+ *         the gateway's codec, and the two headers share constant names.
+ */
+
+#ifndef __NATIVE_H__
+#define __NATIVE_H__
+
+#include "erbium.h"
+
+/** What a handler answered */
+struct native_response {
+  uint8_t code;
+  int content_format;           /* -1 when not set */
+  const uint8_t *payload;
+  size_t payload_len;
+};
+
+/**
+ * Run the handler of the resource at path for method (METHOD_GET...) and
+ * fill r. Returns the resource, NULL if there is none at path (r is then a
+ * 4.04, or the /.well-known/core listing).
+ */
+resource_t *native_dispatch(unsigned method, const char *path,
+                            struct native_response *r);
+
+/** Send a notification to the observers of resource */
+void native_notify(resource_t *resource, int32_t counter,
+                   const struct native_response *r);
+
+/** Bind the CoAP server, returns its socket */
+int native_server_init(const char *address, int port);
+
+/** Serve the datagrams waiting on the socket */
+void native_server_input(void);
+
+#endif /* __NATIVE_H__ */
@@ -0,0 +1,312 @@
+/**
+ * \file
+ *         Contiki kernel and main loop of the native thermostat.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "contiki.h"
+#include "random.h"
+#include "dev/leds.h"
+#include "native.h"
+
+#define EVENT_QUEUE_SIZE 32     /* Power of two */
+
+#define PROCESS_STATE_NONE    0
+#define PROCESS_STATE_RUNNING 1
+
+extern struct process * const autostart_processes[];
+
+struct process *process_current;
+static struct process *process_list;
+
+static struct event {
+  process_event_t ev;
+  process_data_t data;
+  struct process *p;
+} events[EVENT_QUEUE_SIZE];
+static unsigned events_head, events_count;
+
+static struct etimer *timer_list;
+static unsigned short seed;
+static unsigned char leds;
+
+/*---------------------------------------------------------------------------*/
+clock_time_t
+clock_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (clock_time_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+void
+random_init(unsigned short s)
+{
+  seed = s;
+}
+/*---------------------------------------------------------------------------*/
+unsigned short
+random_rand(void)
+{
+  static uint32_t state;
+
+  if(state == 0) {
+    state = seed ? seed : 1;
+  }
+  state = state * 1103515245 + 12345;
+  return state >> 16;
+}
+/*---------------------------------------------------------------------------*/
+void
+leds_on(unsigned char l)
+{
+  leds |= l;
+}
+/*---------------------------------------------------------------------------*/
+void
+leds_off(unsigned char l)
+{
+  leds &= ~l;
+}
+/*---------------------------------------------------------------------------*/
+unsigned char
+leds_get(void)
+{
+  return leds;
+}
+/*---------------------------------------------------------------------------*/
+static void
+call_process(struct process *p, process_event_t ev, process_data_t data)
+{
+  struct process *caller = process_current;
+  int ret;
+
+  if(p->state != PROCESS_STATE_RUNNING) {
+    return;
+  }
+  process_current = p;
+  ret = p->thread(&p->pt, ev, data);
+  process_current = caller;
+  if(ret == PT_EXITED || ret == PT_ENDED) {
+    process_exit(p);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+process_start(struct process *p, process_data_t data)
+{
+  struct process *q;
+
+  for(q = process_list; q != NULL; q = q->next) {
+    if(q == p) return;
+  }
+  p->next = process_list;
+  process_list = p;
+  p->state = PROCESS_STATE_RUNNING;
+  PT_INIT(&p->pt);
+  call_process(p, PROCESS_EVENT_INIT, data);
+}
+/*---------------------------------------------------------------------------*/
+void
+process_exit(struct process *p)
+{
+  struct process **q;
+  struct etimer **t;
+
+  for(q = &process_list; *q != NULL; q = &(*q)->next) {
+    if(*q == p) {
+      *q = p->next;
+      break;
+    }
+  }
+  p->state = PROCESS_STATE_NONE;
+  /* Its timers would post to a process that is gone */
+  for(t = &timer_list; *t != NULL;) {
+    if((*t)->p == p) {
+      *t = (*t)->next;
+    } else {
+      t = &(*t)->next;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+process_post(struct process *p, process_event_t ev, process_data_t data)
+{
+  struct event *e;
+
+  if(events_count == EVENT_QUEUE_SIZE) {
+    return 1;                   /* PROCESS_ERR_FULL */
+  }
+  e = &events[(events_head + events_count++) % EVENT_QUEUE_SIZE];
+  e->ev = ev;
+  e->data = data;
+  e->p = p;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+run_events(void)
+{
+  while(events_count > 0) {
+    struct event e = events[events_head];
+    events_head = (events_head + 1) % EVENT_QUEUE_SIZE;
+    events_count--;
+    call_process(e.p, e.ev, e.data);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+add_timer(struct etimer *et)
+{
+  struct etimer *t;
+
+  for(t = timer_list; t != NULL; t = t->next) {
+    if(t == et) return;
+  }
+  et->next = timer_list;
+  timer_list = et;
+}
+/*---------------------------------------------------------------------------*/
+void
+etimer_set(struct etimer *et, clock_time_t interval)
+{
+  et->start = clock_time();
+  et->interval = interval;
+  et->p = PROCESS_CURRENT();
+  add_timer(et);
+}
+/*---------------------------------------------------------------------------*/
+void
+etimer_reset(struct etimer *et)
+{
+  /* Drift free: the next period starts when the previous one ended */
+  et->start += et->interval;
+  add_timer(et);
+}
+/*---------------------------------------------------------------------------*/
+void
+etimer_restart(struct etimer *et)
+{
+  et->start = clock_time();
+  add_timer(et);
+}
+/*---------------------------------------------------------------------------*/
+void
+etimer_stop(struct etimer *et)
+{
+  struct etimer **t;
+
+  for(t = &timer_list; *t != NULL; t = &(*t)->next) {
+    if(*t == et) {
+      *t = et->next;
+      break;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+etimer_expired(struct etimer *et)
+{
+  struct etimer *t;
+
+  for(t = timer_list; t != NULL; t = t->next) {
+    if(t == et) return 0;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Post the expired timers, returns the milliseconds until the next one */
+static int
+run_timers(void)
+{
+  clock_time_t now = clock_time(), next = (clock_time_t)-1;
+  struct etimer **t;
+
+  for(t = &timer_list; *t != NULL;) {
+    struct etimer *et = *t;
+    if(now - et->start >= et->interval) {
+      if(process_post(et->p, PROCESS_EVENT_TIMER, et) == 0) {
+        *t = et->next;
+        continue;
+      }
+      next = 0;                 /* Queue full, try again right away */
+    } else if(et->start + et->interval - now < next) {
+      next = et->start + et->interval - now;
+    }
+    t = &et->next;
+  }
+  return next == (clock_time_t)-1 ? -1 : (int)next;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  const char *address = "::";
+  int port = 5683;
+  unsigned long s = getpid() ^ time(NULL);
+  struct pollfd pfd;
+  int c, i;
+
+  while((c = getopt(argc, argv, "a:p:s:h")) != -1) {
+    switch(c) {
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 's':
+      s = strtoul(optarg, NULL, 0);
+      break;
+    case '?':
+    case 'h':
+    default:
+fprintf(stderr,"usage:  %s [options]\n", prog);
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -a address  IPv6 address of the thermostat (default ::)\n");
+fprintf(stderr," -p port     CoAP port (default 5683)\n");
+fprintf(stderr," -s seed     Seed of the simulated temperature\n");
+exit(1);
+      break;
+    }
+  }
+
+  /* One thermostat among thousands: print as it happens, not per 4 KiB */
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  random_init(s);
+  pfd.fd = native_server_init(address, port);
+  pfd.events = POLLIN;
+
+  for(i = 0; autostart_processes[i] != NULL; i++) {
+    process_start(autostart_processes[i], NULL);
+  }
+
+  while(1) {
+    int timeout;
+
+    run_events();
+    timeout = run_timers();
+    if(events_count > 0) {
+      continue;
+    }
+    if(poll(&pfd, 1, timeout) == -1 && errno != EINTR) {
+      err(1, "poll");
+    }
+    if(pfd.revents & POLLIN) {
+      native_server_input();
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
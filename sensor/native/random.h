@@ -0,0 +1,14 @@
+/**
+ * \file
+ *         Contiki pseudo-random numbers, seeded per instance.
+ */
+
+#ifndef __RANDOM_H__
+#define __RANDOM_H__
+
+#define RANDOM_RAND_MAX 65535U
+
+void random_init(unsigned short seed);
+unsigned short random_rand(void);
+
+#endif /* __RANDOM_H__ */
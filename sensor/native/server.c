@@ -0,0 +1,219 @@
+/**
+ * \file
+ *         CoAP server and observers of the native thermostat.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#include "coap.h"
+#include "native.h"
+
+#ifndef COAP_MAX_OBSERVERS
+#ifdef COAP_MAX_OPEN_TRANSACTIONS
+#define COAP_MAX_OBSERVERS (COAP_MAX_OPEN_TRANSACTIONS - 1)
+#else
+#define COAP_MAX_OBSERVERS 3
+#endif
+#endif
+
+#define MAX_DATAGRAM 256
+
+static struct observer {
+  resource_t *resource;         /* NULL when the slot is free */
+  struct sockaddr_in6 addr;
+  uint8_t token_len;
+  uint8_t token[COAP_MAX_TOKEN_LEN];
+} observers[COAP_MAX_OBSERVERS];
+
+static int fd = -1;
+static uint16_t next_mid;
+static int32_t last_counter;
+
+/*---------------------------------------------------------------------------*/
+static void
+send_message(const struct sockaddr_in6 *to, const struct coap_message *m)
+{
+  uint8_t buf[MAX_DATAGRAM];
+  int len = coap_serialize(m, buf, sizeof(buf));
+
+  if(len > 0 &&
+     sendto(fd, buf, len, 0, (const struct sockaddr *)to, sizeof(*to)) < 0 &&
+     errno != EAGAIN) {
+    warn("sendto");
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+same_peer(const struct sockaddr_in6 *a, const struct sockaddr_in6 *b)
+{
+  return a->sin6_port == b->sin6_port &&
+    memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+remove_observer(const struct sockaddr_in6 *from, resource_t *resource)
+{
+  int i;
+
+  for(i = 0; i < COAP_MAX_OBSERVERS; i++) {
+    if(observers[i].resource != NULL &&
+       (resource == NULL || observers[i].resource == resource) &&
+       same_peer(&observers[i].addr, from)) {
+      observers[i].resource = NULL;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+add_observer(const struct sockaddr_in6 *from, resource_t *resource,
+             const struct coap_message *m)
+{
+  int i;
+
+  /* A peer registering again replaces its previous registration */
+  remove_observer(from, resource);
+  for(i = 0; i < COAP_MAX_OBSERVERS; i++) {
+    if(observers[i].resource == NULL) {
+      observers[i].resource = resource;
+      observers[i].addr = *from;
+      observers[i].token_len = m->token_len;
+      memcpy(observers[i].token, m->token, m->token_len);
+      return 0;
+    }
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+void
+native_notify(resource_t *resource, int32_t counter,
+              const struct native_response *r)
+{
+  struct coap_message m;
+  int i;
+
+  last_counter = counter;
+  for(i = 0; i < COAP_MAX_OBSERVERS; i++) {
+    if(observers[i].resource != resource) continue;
+    coap_init(&m, COAP_TYPE_NON, r->code, next_mid++);
+    m.token_len = observers[i].token_len;
+    memcpy(m.token, observers[i].token, m.token_len);
+    m.observe = counter & 0xffffff;
+    m.content_format = r->content_format;
+    m.payload = r->payload;
+    m.payload_len = r->payload_len;
+    send_message(&observers[i].addr, &m);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+handle_request(const struct sockaddr_in6 *from, const struct coap_message *req)
+{
+  struct native_response r;
+  struct coap_message res;
+  char path[64];
+  size_t len = 0;
+  unsigned method;
+  resource_t *resource;
+  int i;
+
+  switch(req->code) {
+  case COAP_GET: method = METHOD_GET; break;
+  case COAP_POST: method = METHOD_POST; break;
+  case COAP_PUT: method = METHOD_PUT; break;
+  case COAP_DELETE: method = METHOD_DELETE; break;
+  default:
+    if(req->code == COAP_CODE_EMPTY && req->type == COAP_TYPE_RST) {
+      /* The observer of a notification is gone */
+      remove_observer(from, NULL);
+    }
+    return;
+  }
+  for(i = 0; i < req->uri_segments; i++) {
+    len += snprintf(path + len, len < sizeof(path) ? sizeof(path) - len : 0,
+                    "%s%.*s", i ? "/" : "", req->uri_segment_len[i],
+                    req->uri_segment[i]);
+  }
+  path[len < sizeof(path) ? len : sizeof(path) - 1] = '\0';
+
+  resource = native_dispatch(method, path, &r);
+
+  if(req->type == COAP_TYPE_CON) {
+    coap_init(&res, COAP_TYPE_ACK, r.code, req->mid);
+  } else {
+    coap_init(&res, COAP_TYPE_NON, r.code, next_mid++);
+  }
+  res.token_len = req->token_len;
+  memcpy(res.token, req->token, req->token_len);
+  res.content_format = r.content_format;
+  res.payload = r.payload;
+  res.payload_len = r.payload_len;
+
+  if(resource != NULL && method == METHOD_GET &&
+     (resource->flags & IS_OBSERVABLE) && COAP_CODE_CLASS(r.code) == 2) {
+    if(req->observe == 0) {
+      if(add_observer(from, resource, req) == 0) {
+        res.observe = last_counter & 0xffffff;
+      }
+    } else if(req->observe == 1) {
+      remove_observer(from, resource);
+    }
+  }
+  send_message(from, &res);
+}
+/*---------------------------------------------------------------------------*/
+void
+native_server_input(void)
+{
+  uint8_t buf[MAX_DATAGRAM];
+  struct sockaddr_in6 from;
+  socklen_t fromlen;
+  struct coap_message m;
+  ssize_t n;
+
+  while(1) {
+    fromlen = sizeof(from);
+    n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from,
+                 &fromlen);
+    if(n < 0) {
+      if(errno != EAGAIN && errno != EINTR) warn("recvfrom");
+      return;
+    }
+    if(coap_parse(&m, buf, n) == 0) {
+      handle_request(&from, &m);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+native_server_init(const char *address, int port)
+{
+  struct sockaddr_in6 sa;
+  int on = 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(port);
+  if(inet_pton(AF_INET6, address, &sa.sin6_addr) != 1) {
+    errx(1, "invalid address ``%s''", address);
+  }
+  fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if(fd == -1) err(1, "socket");
+#ifdef IPV6_FREEBIND
+  /* The address may be routed to the host rather than configured on it */
+  setsockopt(fd, IPPROTO_IPV6, IPV6_FREEBIND, &on, sizeof(on));
+#endif
+  if(bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    err(1, "can't bind [%s]:%d", address, port);
+  }
+  next_mid = getpid();
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
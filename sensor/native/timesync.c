@@ -0,0 +1,40 @@
+/**
+ * \file
+ *         Network time of the native thermostat.
+ *
+ *         The native thermostats run on the host that runs tunslip6, whose
+ *         wall clock is the network time: there is nothing to synchronize
+ *         and no flood to relay.
+ */
+
+#include <time.h>
+
+#include "timesync.h"
+
+/*---------------------------------------------------------------------------*/
+void
+timesync_init(void)
+{
+}
+/*---------------------------------------------------------------------------*/
+void
+timesync_reference(uint32_t local, uint32_t network)
+{
+}
+/*---------------------------------------------------------------------------*/
+uint32_t
+timesync_local(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+/*---------------------------------------------------------------------------*/
+int
+timesync_now(uint32_t *network)
+{
+  *network = timesync_local();
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
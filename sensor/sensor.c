@@ -21,6 +21,9 @@
 #define VENTILATION_ENABLED	1
 #define REST_SERVER_ENABLED	1
 
+/** Include the network time of the reading in the notifications */
+#define TIMESTAMP_ENABLED	1
+
 
 // C doesn't natively have the bool type
 typedef enum{false, true} bool;
@@ -66,6 +69,11 @@ typedef enum{false, true} bool;
 
 #endif
 
+// If the timestamps are enabled, include the network time service
+#if TIMESTAMP_ENABLED
+#include "timesync.h"
+#endif
+
 
 /**
  * Processes definitions.
@@ -122,6 +130,12 @@ typedef enum{NONE, COOLING, HEATING} status_t;
 static status_t status;
 static bool ventilation;
 
+#if TIMESTAMP_ENABLED
+/** Network time of the last reading, valid if sampled_synced */
+static uint32_t sampled;
+static bool sampled_synced;
+#endif
+
 
 /** Resources available to the network */
 #if REST_SERVER_ENABLED
@@ -163,6 +177,10 @@ PROCESS_THREAD(boot_process, ev, data) {
 	ventilation = false;
 	
 	// Initialization is finished. Start the other processes.
+	#if TIMESTAMP_ENABLED
+	timesync_init();
+	#endif
+	
 	process_start(&temperature_sensing, NULL);
 	
 	#if REST_SERVER_ENABLED
@@ -192,6 +210,11 @@ PROCESS_THREAD(temperature_sensing, ev, data) {
 		PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_TIMER && data == &timer);
 		
 		temperature = read_temperature();
+		
+		#if TIMESTAMP_ENABLED
+		sampled_synced = timesync_now(&sampled) == 0;
+		#endif
+		
 		PRINTF("[SENSING] Temperature: %d\n", temperature);
 		
 		// Make the timer periodic
@@ -301,15 +324,24 @@ void temperature_handler(void* request, void* response, uint8_t *buffer, uint16_
 }
 
 /**
- * Periodically send the temperature in JSON format to the subscribed devices
+ * Periodically send the temperature in JSON format to the subscribed devices.
+ * When the network time is known, "t" is the time of the reading (microseconds
+ * modulo 2^32, see timesync.h), so the host can tell how old it is.
  */
 void temperature_periodic_handler(resource_t *r) {
 	static uint16_t counter = 0;
- 	static char payload[25];
+ 	static char payload[48];
 
   	coap_packet_t message[1];
 	coap_init_message(message, COAP_TYPE_NON, REST.status.OK, 0);
 	int length = snprintf(payload, sizeof(payload), "{\n\"temperature\":%d\n}", temperature);
+	
+	#if TIMESTAMP_ENABLED
+	if (sampled_synced) {
+		length = snprintf(payload, sizeof(payload), "{\n\"temperature\":%d,\n\"t\":%lu\n}", temperature, (unsigned long) sampled);
+	}
+	#endif
+	
 	coap_set_payload(message, payload, length);
 
 	REST.set_header_content_type(message, REST.type.APPLICATION_JSON);
@@ -0,0 +1,209 @@
+/**
+ * \file
+ *         Network time flooded down the DAG.
+ */
+
+#include "contiki.h"
+#include "contiki-net.h"
+#include "lib/random.h"
+#include "simple-udp.h"
+
+#include "timesync.h"
+
+#define DEBUG 0
+#include "net/uip-debug.h"
+
+/* Microseconds from the sender's timestamp to the receiver's: mostly the
+   air time of the flood at 250 kbit/s, then the 6LoWPAN and UDP input */
+#ifdef TIMESYNC_CONF_HOP_DELAY
+#define HOP_DELAY TIMESYNC_CONF_HOP_DELAY
+#else
+#define HOP_DELAY 1500
+#endif
+
+/* Relays wait up to this long, so that neighbours don't collide */
+#define RELAY_JITTER (CLOCK_SECOND / 4)
+
+/* The skew is in units of 2^-24 (about 0.06 ppm), up to 500 ppm */
+#define SKEW_SHIFT 24
+#define SKEW_MAX   ((1L << SKEW_SHIFT) / 2000)
+
+#define PERIOD_US   ((uint32_t)(TIMESYNC_PERIOD / CLOCK_SECOND) * 1000000)
+#define LIFETIME_US (TIMESYNC_LIFETIME * PERIOD_US)
+
+#define FLOOD_TYPE 'T'
+#define FLOOD_LEN  8            /* Type, level, sequence, 0, time */
+
+static struct simple_udp_connection conn;
+
+/* Local clock, the rtimer extended to 64 bits */
+static uint64_t ticks;
+static rtimer_clock_t last_rtimer;
+
+/* Network time was ref_network when the local clock read ref_local */
+static uint32_t ref_local, ref_network;
+static int32_t skew;
+static uint8_t synchronized, skew_known, root;
+static uint8_t level = 0xff, seq;
+
+PROCESS(timesync_process, "Time synchronization");
+
+/*---------------------------------------------------------------------------*/
+uint32_t
+timesync_local(void)
+{
+  rtimer_clock_t now = RTIMER_NOW();
+
+  ticks += (rtimer_clock_t)(now - last_rtimer);
+  last_rtimer = now;
+#if RTIMER_ARCH_SECOND == 32768
+  /* 10^6 / 32768 = 15625 / 512, no 64 bit division on the MSP430 */
+  return (uint32_t)((ticks * 15625) >> 9);
+#else
+  return (uint32_t)(ticks * 1000000 / RTIMER_ARCH_SECOND);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+network_time(uint32_t local)
+{
+  int32_t elapsed = local - ref_local;
+
+  return ref_network + elapsed +
+    (int32_t)(((int64_t)elapsed * skew) >> SKEW_SHIFT);
+}
+/*---------------------------------------------------------------------------*/
+int
+timesync_now(uint32_t *network)
+{
+  uint32_t local = timesync_local();
+
+  if(!synchronized || local - ref_local > LIFETIME_US) {
+    return -1;
+  }
+  *network = network_time(local);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+adjust(uint32_t local, uint32_t network)
+{
+  uint32_t elapsed = local - ref_local;
+  int32_t measured;
+
+  /* A second copy of the same flood is too close for a skew estimate, an
+     old reference too far */
+  if(synchronized && elapsed > PERIOD_US / 2 && elapsed <= LIFETIME_US) {
+    /* How much faster the reference ran than our clock */
+    measured = (int32_t)(((int64_t)(int32_t)(network - ref_network - elapsed)
+                          << SKEW_SHIFT) / elapsed);
+    if(measured > SKEW_MAX || measured < -SKEW_MAX) {
+      /* The host's clock was stepped */
+      skew_known = 0;
+      skew = 0;
+    } else if(!skew_known) {
+      skew_known = 1;
+      skew = measured;
+    } else {
+      skew += (measured - skew) / 4;
+    }
+  }
+  PRINTF("timesync: level %u, offset %ld us, skew %ld\n", level,
+         (long)(network - network_time(local)), (long)skew);
+  ref_local = local;
+  ref_network = network;
+  synchronized = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_flood(void)
+{
+  uint8_t msg[FLOOD_LEN];
+  uip_ipaddr_t addr;
+  uint32_t network;
+
+  if(timesync_now(&network) < 0) {
+    return;
+  }
+  msg[0] = FLOOD_TYPE;
+  msg[1] = level;
+  msg[2] = seq;
+  msg[3] = 0;
+  msg[4] = network >> 24;
+  msg[5] = network >> 16;
+  msg[6] = network >> 8;
+  msg[7] = network;
+  uip_create_linklocal_allnodes_mcast(&addr);
+  simple_udp_sendto(&conn, msg, sizeof(msg), &addr);
+}
+/*---------------------------------------------------------------------------*/
+static void
+receiver(struct simple_udp_connection *c,
+         const uip_ipaddr_t *sender_addr, uint16_t sender_port,
+         const uip_ipaddr_t *receiver_addr, uint16_t receiver_port,
+         const uint8_t *data, uint16_t datalen)
+{
+  uint32_t local = timesync_local(), network;
+
+  if(root || datalen < FLOOD_LEN || data[0] != FLOOD_TYPE) {
+    return;
+  }
+  if(synchronized && local - ref_local <= LIFETIME_US) {
+    if(data[2] == seq && data[1] + 1 >= level) {
+      return;                   /* Already have it from as close */
+    }
+    if((int8_t)(data[2] - seq) < 0) {
+      return;                   /* An older flood still going around */
+    }
+  }
+  network = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) |
+    ((uint32_t)data[6] << 8) | data[7];
+  seq = data[2];
+  level = data[1] + 1;
+  adjust(local, network + HOP_DELAY);
+  process_poll(&timesync_process);
+}
+/*---------------------------------------------------------------------------*/
+void
+timesync_reference(uint32_t local, uint32_t network)
+{
+  root = 1;
+  level = 0;
+  seq++;
+  adjust(local, network);
+  process_poll(&timesync_process);
+}
+/*---------------------------------------------------------------------------*/
+void
+timesync_init(void)
+{
+  process_start(&timesync_process, NULL);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(timesync_process, ev, data)
+{
+  static struct etimer tick, relay;
+
+  PROCESS_BEGIN();
+
+  last_rtimer = RTIMER_NOW();
+  simple_udp_register(&conn, TIMESYNC_PORT, NULL, TIMESYNC_PORT, receiver);
+  etimer_set(&tick, CLOCK_SECOND);
+
+  while(1) {
+    PROCESS_WAIT_EVENT();
+    if(ev == PROCESS_EVENT_POLL) {
+      /* The timestamp is taken when sending, the wait costs no accuracy */
+      etimer_set(&relay, 1 + random_rand() % RELAY_JITTER);
+    } else if(ev == PROCESS_EVENT_TIMER && data == &relay) {
+      send_flood();
+    } else if(ev == PROCESS_EVENT_TIMER && data == &tick) {
+      /* Don't let the rtimer wrap twice unseen, every 2 s on the Sky */
+      timesync_local();
+      etimer_reset(&tick);
+    }
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,58 @@
+/**
+ * \file
+ *         Network time: the host's clock, taken by the border router from
+ *         tunslip6 over the serial line and flooded down the DAG.
+ *
+ *         Network time is the host's wall clock in microseconds modulo
+ *         2^32. It wraps every 71 minutes, which is plenty for the host to
+ *         place a timestamp by comparing it with its own clock, and keeps
+ *         the arithmetic on the motes in 32 bits. Each node keeps it as a
+ *         reference point and a skew against its local clock, the rtimer
+ *         (32 kHz on the Sky).
+ *
+ *         The root gets its reference with timesync_reference() and starts
+ *         a flood: a link-local multicast with its level (0), a sequence
+ *         number and its network time when sending. A node takes the first
+ *         copy of a new flood, or a later copy from a lower level, adds the
+ *         expected delay of one hop, and relays the flood after a random
+ *         delay with its own level and network time. The skew comes from
+ *         two consecutive floods. A node that misses TIMESYNC_LIFETIME
+ *         periods is no longer synchronized.
+ */
+
+#ifndef __TIMESYNC_H__
+#define __TIMESYNC_H__
+
+#include <stdint.h>
+
+#include "contiki.h"
+
+/** How often the root refreshes its reference and floods */
+#ifdef TIMESYNC_CONF_PERIOD
+#define TIMESYNC_PERIOD TIMESYNC_CONF_PERIOD
+#else
+#define TIMESYNC_PERIOD (30 * CLOCK_SECOND)
+#endif
+
+/** Periods without a flood before a node stops timestamping */
+#define TIMESYNC_LIFETIME 4
+
+/** UDP port of the floods */
+#define TIMESYNC_PORT 5690
+
+/** Start listening to the floods and relaying them */
+void timesync_init(void);
+
+/**
+ * Root only: the network time was network when the local clock read
+ * local. Makes this node the root and floods the reference.
+ */
+void timesync_reference(uint32_t local, uint32_t network);
+
+/** The local clock in microseconds, modulo 2^32 */
+uint32_t timesync_local(void);
+
+/** Store the network time in network; -1 if not synchronized */
+int timesync_now(uint32_t *network);
+
+#endif /* __TIMESYNC_H__ */
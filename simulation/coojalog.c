@@ -0,0 +1,517 @@
+/**
+ * \file
+ *         Analyzer of Cooja simulation logs.
+ *
+ *         Reads logs of the form MM:SS.mmm<TAB>ID:n<TAB>message (the
+ *         Mote output window saved to a file, or a soak run's log) and
+ *         prints one CSV row per node:
+ *
+ *         - boot_s: when the node printed "[BOOT] Completed" (its first
+ *           line for the border router)
+ *         - sensed, delivered, lost and the sensing-to-root latency: a
+ *           "[SENSING] Temperature: T" of a thermostat is delivered when
+ *           the root prints "temperature":T within the window (-w). The
+ *           root's line doesn't tell which thermostat sent it (the
+ *           addresses are binary), so it goes to the most recent pending
+ *           reading of the same value; the older ones of that node are
+ *           lost. A reading counts as lost only once the node has had one
+ *           delivered, the ones before are sensed before anybody observed
+ *           it
+ *         - the duty of each actuator, from "[X] started" to "[X] stopped",
+ *           over the time since boot
+ *
+ *         and a last row, "all", for the whole network.
+ *
+ *         The log is memory-mapped and split into lines 64 bytes at a time
+ *         with SIMD compares (AVX2 or SSE2, a plain loop elsewhere). A node
+ *         keeps counters, a latency histogram and its pending readings,
+ *         so memory doesn't grow with the log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define PENDING       16        /* Readings of a node awaiting the root */
+#define MAX_WINDOW    60000     /* ms, the latency histogram's range */
+
+enum { COOLING, HEATING, VENTILATION, ACTUATORS };
+
+static const char *actuator_names[ACTUATORS] = {
+  "COOLING", "HEATING", "VENTILATION"
+};
+
+struct node {
+  int seen;
+  uint64_t lines;
+  uint64_t first, last, boot;
+  int booted;
+  uint64_t sensed, delivered, lost, before_observe;
+  struct {
+    uint64_t time;
+    int value;
+  } pending[PENDING];
+  int pending_head, pending_count;
+  uint32_t *latency;            /* Histogram, 1 ms bins */
+  uint64_t latency_max;
+  uint64_t on_since[ACTUATORS];
+  uint64_t on_time[ACTUATORS];
+  int on[ACTUATORS];
+};
+
+static struct node *nodes;
+static int nodes_size;
+static int root = 1;
+static uint64_t window = 5000;
+static uint64_t total_lines, bad_lines;
+
+/*---------------------------------------------------------------------------*/
+static struct node *
+node_get(int id)
+{
+  int size;
+
+  if(id >= nodes_size) {
+    size = nodes_size ? nodes_size : 64;
+    while(size <= id) size *= 2;
+    nodes = realloc(nodes, size * sizeof(*nodes));
+    if(nodes == NULL) err(1, "node_get");
+    memset(nodes + nodes_size, 0, (size - nodes_size) * sizeof(*nodes));
+    nodes_size = size;
+  }
+  return &nodes[id];
+}
+/*---------------------------------------------------------------------------*/
+static int
+prefix(const char *p, const char *end, const char *s, int len)
+{
+  return end - p >= len && memcmp(p, s, len) == 0;
+}
+#define PREFIX(p, end, s) prefix(p, end, s, sizeof(s) - 1)
+/*---------------------------------------------------------------------------*/
+static int
+number(const char *p, const char *end)
+{
+  int v = 0, neg = 0;
+
+  if(p < end && *p == '-') {
+    neg = 1;
+    p++;
+  }
+  while(p < end && *p >= '0' && *p <= '9') {
+    v = v * 10 + *p++ - '0';
+  }
+  return neg ? -v : v;
+}
+/*---------------------------------------------------------------------------*/
+/* A reading no longer pending: delivered if latency >= 0 */
+static void
+reading_done(struct node *n, int64_t latency)
+{
+  if(latency >= 0) {
+    if(n->latency == NULL &&
+       (n->latency = calloc(MAX_WINDOW + 1, sizeof(uint32_t))) == NULL) {
+      err(1, "reading_done");
+    }
+    n->latency[latency > MAX_WINDOW ? MAX_WINDOW : latency]++;
+    if((uint64_t)latency > n->latency_max) n->latency_max = latency;
+    n->delivered++;
+  } else if(n->delivered > 0) {
+    n->lost++;
+  } else {
+    n->before_observe++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+expire(struct node *n, uint64_t now)
+{
+  while(n->pending_count > 0 &&
+        n->pending[n->pending_head].time + window < now) {
+    reading_done(n, -1);
+    n->pending_head = (n->pending_head + 1) % PENDING;
+    n->pending_count--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+sensed(struct node *n, uint64_t time, int value)
+{
+  int i;
+
+  expire(n, time);
+  if(n->pending_count == PENDING) {
+    expire(n, UINT64_MAX);
+  }
+  i = (n->pending_head + n->pending_count++) % PENDING;
+  n->pending[i].time = time;
+  n->pending[i].value = value;
+  n->sensed++;
+}
+/*---------------------------------------------------------------------------*/
+static void
+root_received(uint64_t time, int value)
+{
+  struct node *best = NULL, *n;
+  int id, i, best_i = 0;
+
+  for(id = 0; id < nodes_size; id++) {
+    n = &nodes[id];
+    if(n->pending_count == 0 || id == root) continue;
+    expire(n, time);
+    for(i = n->pending_count - 1; i >= 0; i--) {
+      int j = (n->pending_head + i) % PENDING;
+      if(n->pending[j].value == value && n->pending[j].time <= time) {
+        if(best == NULL || n->pending[j].time > best->pending[best_i].time) {
+          best = n;
+          best_i = j;
+        }
+        break;
+      }
+    }
+  }
+  if(best == NULL) {
+    return;
+  }
+  /* Readings of that node older than the delivered one were lost */
+  while(best->pending_head != best_i) {
+    reading_done(best, -1);
+    best->pending_head = (best->pending_head + 1) % PENDING;
+    best->pending_count--;
+  }
+  reading_done(best, time - best->pending[best_i].time);
+  best->pending_head = (best->pending_head + 1) % PENDING;
+  best->pending_count--;
+}
+/*---------------------------------------------------------------------------*/
+static void
+actuator(struct node *n, uint64_t time, int a, int on)
+{
+  if(on && !n->on[a]) {
+    n->on_since[a] = time;
+  } else if(!on && n->on[a]) {
+    n->on_time[a] += time - n->on_since[a];
+  }
+  n->on[a] = on;
+}
+/*---------------------------------------------------------------------------*/
+static void
+line(const char *p, const char *end)
+{
+  uint64_t time = 0, field = 0;
+  const char *msg;
+  struct node *n;
+  int id, a, digits = 0, ms = -1;
+
+  /* [HH:]MM:SS.mmm */
+  for(; p < end && *p != '\t'; p++) {
+    if(*p >= '0' && *p <= '9') {
+      field = field * 10 + *p - '0';
+      if(ms >= 0) ms++;
+      digits++;
+    } else if(*p == ':') {
+      time = (time + field) * 60;
+      field = 0;
+    } else if(*p == '.') {
+      time = (time + field) * 1000;
+      field = 0;
+      ms = 0;
+    } else {
+      break;
+    }
+  }
+  total_lines++;
+  if(digits == 0 || ms != 3 || !PREFIX(p, end, "\tID:")) {
+    bad_lines++;
+    return;
+  }
+  time += field;
+  p += 4;
+  for(id = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+    id = id * 10 + *p - '0';
+  }
+  if(p == end || *p != '\t') {
+    bad_lines++;
+    return;
+  }
+  msg = p + 1;
+
+  n = node_get(id);
+  if(!n->seen) {
+    n->seen = 1;
+    n->first = time;
+  }
+  n->last = time;
+  n->lines++;
+
+  if(msg < end && *msg == '[') {
+    msg++;
+    if(PREFIX(msg, end, "SENSING] Temperature: ")) {
+      sensed(n, time, number(msg + 22, end));
+    } else if(PREFIX(msg, end, "BOOT] Completed")) {
+      if(!n->booted) {
+        n->boot = time;
+        n->booted = 1;
+      }
+    } else {
+      for(a = 0; a < ACTUATORS; a++) {
+        int len = strlen(actuator_names[a]);
+        if(prefix(msg, end, actuator_names[a], len) && msg + len < end &&
+           msg[len] == ']') {
+          if(PREFIX(msg + len, end, "] started")) {
+            actuator(n, time, a, 1);
+          } else if(PREFIX(msg + len, end, "] stopped")) {
+            actuator(n, time, a, 0);
+          }
+          break;
+        }
+      }
+    }
+  } else if(id == root && PREFIX(msg, end, "\"temperature\":")) {
+    root_received(time, number(msg + 14, end));
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Bit i set where p[i] is a newline */
+static inline uint64_t
+newlines64(const char *p)
+{
+#if defined(__AVX2__)
+  const __m256i nl = _mm256_set1_epi8('\n');
+  uint32_t lo = _mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl));
+  uint32_t hi = _mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 32)), nl));
+  return (uint64_t)hi << 32 | lo;
+#elif defined(__SSE2__)
+  const __m128i nl = _mm_set1_epi8('\n');
+  uint64_t m = 0;
+  int i;
+
+  for(i = 0; i < 4; i++) {
+    m |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)), nl))
+      << (16 * i);
+  }
+  return m;
+#else
+  uint64_t m = 0;
+  int i;
+
+  for(i = 0; i < 64; i++) {
+    m |= (uint64_t)(p[i] == '\n') << i;
+  }
+  return m;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static void
+split(const char *data, size_t size)
+{
+  const char *p = data, *start = data, *end = data + size;
+  uint64_t mask;
+
+  for(; end - p >= 64; p += 64) {
+    for(mask = newlines64(p); mask != 0; mask &= mask - 1) {
+      const char *nl = p + __builtin_ctzll(mask);
+      line(start, nl);
+      start = nl + 1;
+    }
+  }
+  for(; p < end; p++) {
+    if(*p == '\n') {
+      line(start, p);
+      start = p + 1;
+    }
+  }
+  if(start < end) {
+    line(start, end);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+percentile(const struct node *n, double q)
+{
+  uint64_t target = q * n->delivered, count = 0;
+  int i;
+
+  for(i = 0; i <= MAX_WINDOW; i++) {
+    count += n->latency[i];
+    if(count > target) {
+      return i;
+    }
+  }
+  return MAX_WINDOW;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_row(const char *name, const struct node *n, uint64_t span)
+{
+  int a;
+
+  printf("%s,%llu,%.3f,%llu,%llu,%llu,", name,
+         (unsigned long long)n->lines, n->boot / 1e3,
+         (unsigned long long)n->sensed,
+         (unsigned long long)n->delivered,
+         (unsigned long long)n->lost);
+  if(n->delivered + n->lost > 0) {
+    printf("%.2f,", 100.0 * n->lost / (n->delivered + n->lost));
+  } else {
+    printf(",");
+  }
+  if(n->delivered > 0) {
+    printf("%llu,%llu,%llu", (unsigned long long)percentile(n, 0.5),
+           (unsigned long long)percentile(n, 0.99),
+           (unsigned long long)n->latency_max);
+  } else {
+    printf(",,");
+  }
+  for(a = 0; a < ACTUATORS; a++) {
+    if(span > 0) {
+      printf(",%.2f", 100.0 * n->on_time[a] / span);
+    } else {
+      printf(",");
+    }
+  }
+  printf("\n");
+}
+/*---------------------------------------------------------------------------*/
+/* One row per node, then "all": the totals, the merged latencies, the
+   time when the last thermostat booted and the mean actuator duty */
+static void
+report(uint64_t end)
+{
+  static uint32_t all_latency[MAX_WINDOW + 1];
+  struct node all, *n;
+  uint64_t span, all_span = 0;
+  char name[16];
+  int id, a, i;
+
+  memset(&all, 0, sizeof(all));
+  all.latency = all_latency;
+  printf("node,lines,boot_s,sensed,delivered,lost,loss_pct,"
+         "latency_p50_ms,latency_p99_ms,latency_max_ms,"
+         "cooling_duty_pct,heating_duty_pct,ventilation_duty_pct\n");
+  for(id = 0; id < nodes_size; id++) {
+    n = &nodes[id];
+    if(!n->seen) continue;
+    expire(n, UINT64_MAX);
+    if(!n->booted) {
+      n->boot = n->first;
+    }
+    for(a = 0; a < ACTUATORS; a++) {
+      if(n->on[a]) {
+        n->on_time[a] += end - n->on_since[a];
+      }
+    }
+    span = id != root && end > n->boot ? end - n->boot : 0;
+    snprintf(name, sizeof(name), "%d", id);
+    print_row(name, n, span);
+
+    all.lines += n->lines;
+    if(id == root) continue;
+    if(n->boot > all.boot) all.boot = n->boot;
+    all.sensed += n->sensed;
+    all.delivered += n->delivered;
+    all.lost += n->lost;
+    if(n->latency != NULL) {
+      for(i = 0; i <= MAX_WINDOW; i++) {
+        all_latency[i] += n->latency[i];
+      }
+    }
+    if(n->latency_max > all.latency_max) all.latency_max = n->latency_max;
+    for(a = 0; a < ACTUATORS; a++) {
+      all.on_time[a] += n->on_time[a];
+    }
+    all_span += span;
+  }
+  print_row("all", &all, all_span);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  struct timespec t0, t1;
+  struct stat st;
+  uint64_t end = 0, bytes = 0;
+  double elapsed;
+  char *data;
+  int c, fd, i, quiet = 0;
+
+  while((c = getopt(argc, argv, "hqr:w:")) != -1) {
+    switch(c) {
+    case 'q':
+      quiet = 1;
+      break;
+    case 'r':
+      root = atoi(optarg);
+      break;
+    case 'w':
+      window = atoi(optarg);
+      if(window > MAX_WINDOW) window = MAX_WINDOW;
+      break;
+    case '?':
+    case 'h':
+    default:
+      goto usage;
+    }
+  }
+  if(optind == argc) {
+usage:
+fprintf(stderr,"usage:  %s [options] log...\n", prog);
+fprintf(stderr,"example: coojalog ../simulation-log.txt > nodes.csv\n");
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -q             No throughput report on stderr\n");
+fprintf(stderr," -r id          Node id of the border router (default 1)\n");
+fprintf(stderr," -w ms          Time within which the root must print a reading (default 5000)\n");
+exit(1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(i = optind; i < argc; i++) {
+    if((fd = open(argv[i], O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+      err(1, "can't open ``%s''", argv[i]);
+    }
+    if(st.st_size == 0) {
+      close(fd);
+      continue;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) {
+      err(1, "can't map ``%s''", argv[i]);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    split(data, st.st_size);
+    munmap(data, st.st_size);
+    close(fd);
+    bytes += st.st_size;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  for(i = 0; i < nodes_size; i++) {
+    if(nodes[i].seen && nodes[i].last > end) end = nodes[i].last;
+  }
+  report(end);
+
+  elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  if(!quiet) {
+    fprintf(stderr, "*** %llu lines (%llu not understood), %.1f MB in %.3f s,"
+            " %.0f MB/s\n", (unsigned long long)total_lines,
+            (unsigned long long)bad_lines, bytes / 1e6, elapsed,
+            elapsed > 0 ? bytes / 1e6 / elapsed : 0);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,182 @@
+/*
+ * Headless KPI run of a thermostat scenario, embedded by scenario.c with
+ * its @PARAMETERS@ replaced.
+ *
+ * Plays tunslip6 and the gateway on the border router's serial line: sends
+ * the aaaa::/64 prefix until the border router creates its DAG, then
+ * registers an Observe relationship on /temperature of every thermostat,
+ * from aaaa::1, and renews them periodically (a lost registration or a
+ * thermostat joining late only costs one period). The renewals' responses
+ * are deliveries too, for coojalog. The mote output is
+ * written to the log in the format of the Cooja log window, for coojalog.
+ *
+ * Every sampling period the stack pointer of each mote is read, the
+ * lowest value giving the stack high-water mark. At the end, the radio
+ * duty cycle of each mote comes from PowerTracker, and both go to the
+ * per-mote CSV before the test ends.
+ */
+
+var DURATION = @DURATION@;             /* Simulated ms */
+var SAMPLE = @SAMPLE@;
+var OBSERVE = @OBSERVE@;
+var MOTES = @MOTES@;
+var JOIN = 30000;                      /* From the DAG to the first Observe */
+var SPACING = 100;                     /* Between two registrations */
+var STACK_TOP = 0x3900;                /* End of the MSP430F1611's RAM */
+
+var out = new java.io.BufferedWriter(new java.io.FileWriter("@LOG@"));
+var lowest_sp = [];
+var dag = false;
+var message_id = 1;
+var next_observe = 2;
+
+TIMEOUT(DURATION + 60000);
+
+function pad(n, width) {
+  var s = "" + n;
+  while(s.length < width) s = "0" + s;
+  return s;
+}
+
+function timestamp(us) {
+  var ms = Math.floor(us / 1000);
+  return pad(Math.floor(ms / 60000), 2) + ":" +
+    pad(Math.floor(ms / 1000) % 60, 2) + "." + pad(ms % 1000, 3);
+}
+
+function serial(id) {
+  return sim.getMoteWithID(id).getInterfaces().getInterfaceOfType(
+    Packages.se.sics.cooja.interfaces.SerialPort);
+}
+
+/* SLIP frame of the bytes, as a Java byte[] */
+function slip(bytes) {
+  var frame = [0xc0], i, b, out;
+  for(i = 0; i < bytes.length; i++) {
+    if(bytes[i] == 0xc0) {
+      frame.push(0xdb, 0xdc);
+    } else if(bytes[i] == 0xdb) {
+      frame.push(0xdb, 0xdd);
+    } else {
+      frame.push(bytes[i]);
+    }
+  }
+  frame.push(0xc0);
+  out = java.lang.reflect.Array.newInstance(java.lang.Byte.TYPE, frame.length);
+  for(i = 0; i < frame.length; i++) {
+    b = frame[i];
+    out[i] = b > 127 ? b - 256 : b;
+  }
+  return out;
+}
+
+/* aaaa:: and the interface identifier of a Sky mote's node id */
+function address(id) {
+  return [0xaa, 0xaa, 0, 0, 0, 0, 0, 0,
+          0x02, 0x12, 0x74, id & 0xff, (id >> 8) & 0xff,
+          id & 0xff, id & 0xff, id & 0xff];
+}
+
+function checksum(src, dst, udp) {
+  var sum = 0, i, data = src.concat(dst, [0, 0, udp.length >> 8,
+                                           udp.length & 0xff, 0, 0, 0, 17],
+                                     udp);
+  if(data.length % 2) data.push(0);
+  for(i = 0; i < data.length; i += 2) {
+    sum += (data[i] << 8) | data[i + 1];
+  }
+  while(sum > 0xffff) sum = (sum & 0xffff) + (sum >> 16);
+  sum = ~sum & 0xffff;
+  return sum == 0 ? 0xffff : sum;
+}
+
+/* CON GET /temperature with Observe, the token is the node id */
+function observe(id) {
+  var src = address(1), dst = address(id), i, sum;
+  var path = "temperature";
+  var coap = [0x42, 0x01, (message_id >> 8) & 0xff, message_id & 0xff,
+              (id >> 8) & 0xff, id & 0xff, 0x60, 0x50 | path.length];
+  for(i = 0; i < path.length; i++) coap.push(path.charCodeAt(i));
+  message_id = (message_id + 1) & 0xffff;
+  var udp = [0xf0, 0xb0, 0x16, 0x33, 0, 8 + coap.length, 0, 0].concat(coap);
+  sum = checksum(src, dst, udp);
+  udp[6] = sum >> 8;
+  udp[7] = sum & 0xff;
+  var ip = [0x60, 0, 0, 0, 0, udp.length, 17, 64].concat(src, dst, udp);
+  serial(1).writeArray(slip(ip));
+}
+
+function sample_stacks() {
+  var i, sp;
+  for(i = 1; i <= MOTES; i++) {
+    try {
+      sp = sim.getMoteWithID(i).getCPU().reg[1];
+      if(lowest_sp[i] == undefined || sp < lowest_sp[i]) lowest_sp[i] = sp;
+    } catch(e) {
+    }
+  }
+}
+
+function finish() {
+  var on = [], tx = [], rx = [], i, m, line, lines, csv;
+  try {
+    lines = String(sim.getGUI().getStartedPlugin("PowerTracker")
+                   .radioStatistics()).split("\n");
+    for(i = 0; i < lines.length; i++) {
+      line = lines[i];
+      if((m = /(\d+)\s+ON\s+\d+\s+us\s+([\d.]+)\s*%/.exec(line))) on[m[1]] = m[2];
+      if((m = /(\d+)\s+TX\s+\d+\s+us\s+([\d.]+)\s*%/.exec(line))) tx[m[1]] = m[2];
+      if((m = /(\d+)\s+RX\s+\d+\s+us\s+([\d.]+)\s*%/.exec(line))) rx[m[1]] = m[2];
+    }
+  } catch(e) {
+    log.log("no radio statistics: " + e + "\n");
+  }
+  out.close();
+  csv = new java.io.BufferedWriter(new java.io.FileWriter("@MOTES_CSV@"));
+  csv.write("node,radio_on_pct,radio_tx_pct,radio_rx_pct,stack_max_bytes\n");
+  for(i = 1; i <= MOTES; i++) {
+    csv.write(i + "," + (on[i] || "") + "," + (tx[i] || "") + "," +
+              (rx[i] || "") + "," +
+              (lowest_sp[i] != undefined ? STACK_TOP - lowest_sp[i] : "") +
+              "\n");
+  }
+  csv.close();
+  log.testOK();
+}
+
+GENERATE_MSG(1000, "kpi:prefix");
+GENERATE_MSG(SAMPLE, "kpi:sample");
+GENERATE_MSG(DURATION, "kpi:end");
+
+while(true) {
+  YIELD();
+  var text = String(msg);
+  if(text == "kpi:end") {
+    finish();
+  } else if(text == "kpi:sample") {
+    sample_stacks();
+    GENERATE_MSG(SAMPLE, "kpi:sample");
+  } else if(text == "kpi:prefix") {
+    if(!dag) {
+      /* What tunslip6 answers to "?P" */
+      serial(1).writeArray(slip([0x21, 0x50, 0xaa, 0xaa, 0, 0, 0, 0, 0, 0]));
+      GENERATE_MSG(2000, "kpi:prefix");
+    }
+  } else if(text == "kpi:observe") {
+    /* One at a time, the border router buffers a single packet */
+    observe(next_observe++);
+    if(next_observe <= MOTES) {
+      GENERATE_MSG(SPACING, "kpi:observe");
+    } else {
+      next_observe = 2;
+      GENERATE_MSG(Math.max(OBSERVE - (MOTES - 1) * SPACING, SPACING),
+                   "kpi:observe");
+    }
+  } else if(mote != null) {
+    out.write(timestamp(time) + "\tID:" + id + "\t" + text + "\n");
+    if(id == 1 && !dag && text.indexOf("created a new RPL dag") >= 0) {
+      dag = true;
+      GENERATE_MSG(JOIN, "kpi:observe");
+    }
+  }
+}
@@ -0,0 +1,117 @@
+#!/bin/sh
+# Run generated Cooja scenarios headless and append their KPIs to a CSV.
+#
+# Every combination of mote count, topology, density and seed becomes a
+# scenario (see scenario.c) that Cooja runs without GUI for the simulated
+# time. kpi.js writes the mote output and the per-mote radio duty cycle
+# and stack high-water mark; coojalog turns the log into delivery ratio
+# and latency. One row per scenario is appended to the CSV, with the date
+# and the commit, so that runs can be compared over time.
+
+counts="25 50 100"
+topologies=random
+densities=6
+seeds=1
+duration=600
+csv=kpi.csv
+runs=runs
+build=1
+
+usage() {
+	echo "usage: $0 [-n counts] [-t topologies] [-d densities] [-s seeds] [-T seconds] [-o csv] [-r dir] [-B]" >&2
+	echo "  -n counts      thermostats per scenario (default \"$counts\")" >&2
+	echo "  -t topologies  random, grid (default \"$topologies\")" >&2
+	echo "  -d densities   mean neighbours in range (default \"$densities\")" >&2
+	echo "  -s seeds       placement and simulation seeds (default \"$seeds\")" >&2
+	echo "  -T seconds     simulated time (default $duration)" >&2
+	echo "  -o csv         KPIs appended to csv (default $csv)" >&2
+	echo "  -r dir         scenarios, logs and Cooja output (default $runs)" >&2
+	echo "  -B             don't build the firmware" >&2
+	echo "CONTIKI is taken from the environment, or from sensor/Makefile" >&2
+	exit 1
+}
+
+while getopts n:t:d:s:T:o:r:Bh opt; do
+	case $opt in
+	n) counts=$OPTARG ;;
+	t) topologies=$OPTARG ;;
+	d) densities=$OPTARG ;;
+	s) seeds=$OPTARG ;;
+	T) duration=$OPTARG ;;
+	o) csv=$OPTARG ;;
+	r) runs=$OPTARG ;;
+	B) build= ;;
+	*) usage ;;
+	esac
+done
+
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(dirname "$here")
+[ -n "$CONTIKI" ] || CONTIKI=$(sed -n 's/^CONTIKI *= *//p' "$root/sensor/Makefile")
+cooja=$CONTIKI/tools/cooja/dist/cooja.jar
+[ -f "$cooja" ] || { echo "$cooja not found, build Cooja or set CONTIKI" >&2; exit 1; }
+for tool in scenario coojalog; do
+	[ -x "$here/$tool" ] || { echo "$here/$tool not found, run make first" >&2; exit 1; }
+done
+
+if [ -n "$build" ]; then
+	make -C "$root/sensor" TARGET=sky sensor.sky CONTIKI="$CONTIKI" >&2 &&
+	make -C "$root/border-router" TARGET=sky border-router.sky CONTIKI="$CONTIKI" >&2 ||
+		{ echo "can't build the firmware" >&2; exit 1; }
+fi
+
+# .data + .bss of the thermostat, when the MSP430 toolchain is there
+static=$(msp430-size "$root/sensor/sensor.sky" 2>/dev/null | awk 'NR == 2 { print $2 + $3 }')
+
+mkdir -p "$runs"
+runs=$(cd "$runs" && pwd)
+commit=$(git -C "$root" rev-parse --short HEAD 2>/dev/null)
+[ -f "$csv" ] || echo "date,commit,motes,topology,density,seed,sim_s,wall_s,sensed,delivered,delivery_pct,latency_p50_ms,latency_p99_ms,latency_max_ms,radio_on_pct,radio_on_max_pct,stack_max_bytes,ram_static_bytes,ram_max_bytes" > "$csv"
+
+for n in $counts; do
+for topology in $topologies; do
+for density in $densities; do
+for seed in $seeds; do
+	name=n$n-$topology-d$density-s$seed
+	echo "*** $name" >&2
+	"$here/scenario" -n "$n" -t "$topology" -d "$density" -s "$seed" \
+		-T "$duration" -f "$root" -j "$here/kpi.js" -o "$runs/$name" \
+		> "$runs/$name.csc" || continue
+	rm -f "$runs/$name.log" "$runs/$name-motes.csv"
+	start=$(date +%s)
+	(cd "$runs" && java -mx2048m -jar "$cooja" -nogui="$name.csc" -contiki="$CONTIKI") \
+		> "$runs/$name.cooja.txt" 2>&1
+	wall=$(($(date +%s) - start))
+	[ -f "$runs/COOJA.testlog" ] && mv "$runs/COOJA.testlog" "$runs/$name.testlog"
+	if [ ! -s "$runs/$name-motes.csv" ]; then
+		echo "$name didn't complete, see $runs/$name.cooja.txt" >&2
+		continue
+	fi
+
+	# sensed delivered lost p50 p99 max of the whole network
+	network=$("$here/coojalog" -q "$runs/$name.log" |
+		awk -F, '$1 == "all" { print $4, $5, $6, $8, $9, $10 }')
+	# mean and highest radio duty cycle of the thermostats, deepest stack
+	motes=$(awk -F, 'NR > 1 {
+			if($1 != 1 && $2 != "") { sum += $2; count++; if($2 > max) max = $2 }
+			if($5 > stack) stack = $5
+		}
+		END { printf "%s %s %s", count ? sum / count : "", max, stack }' \
+		"$runs/$name-motes.csv")
+
+	echo "$network $motes" | awk -v date="$(date -u +%Y-%m-%dT%H:%M:%SZ)" \
+		-v commit="$commit" -v n="$n" -v topology="$topology" \
+		-v density="$density" -v seed="$seed" -v sim="$duration" \
+		-v wall="$wall" -v static="$static" '{
+		delivery = $2 + $3 > 0 ? sprintf("%.2f", 100 * $2 / ($2 + $3)) : ""
+		ram = static != "" && $9 != "" ? static + $9 : ""
+		printf "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
+			date, commit, n, topology, density, seed, sim, wall,
+			$1, $2, delivery, $4, $5, $6, $7, $8, $9, static, ram
+	}' >> "$csv"
+done
+done
+done
+done
+
+echo "KPIs in $csv" >&2
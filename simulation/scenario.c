@@ -0,0 +1,380 @@
+/**
+ * \file
+ *         Generator of headless Cooja scenarios.
+ *
+ *         Writes a simulation like simulation.csc (the border router as
+ *         mote 1, the thermostats after it, UDGM) for any number of
+ *         thermostats, placed at random or on a grid so that each one has
+ *         the requested mean number of neighbours in radio range. A random
+ *         placement is drawn again until every thermostat has a path to the
+ *         border router. Instead of the GUI plugins the simulation has
+ *         PowerTracker and a ScriptRunner running kpi.js, which drives the
+ *         network for the simulated time and writes the log and the per
+ *         mote measurements (see kpi.js).
+ *
+ *         The same arguments give the same file: positions come from the
+ *         seed, which is also Cooja's random seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <err.h>
+
+#define MAX_ATTEMPTS 1000
+
+struct position {
+  double x, y;
+};
+
+static uint64_t rng;
+
+/*---------------------------------------------------------------------------*/
+static double
+uniform(void)
+{
+  uint64_t z = (rng += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return ((z ^ (z >> 31)) >> 11) * (1.0 / 9007199254740992.0);
+}
+/*---------------------------------------------------------------------------*/
+/* Can every mote reach mote 0 within range? */
+static int
+connected(const struct position *p, int count, double range)
+{
+  int *queue = malloc(count * sizeof(int));
+  char *reached = calloc(count, 1);
+  int head = 0, tail = 0, i, j, n = 1;
+
+  if(queue == NULL || reached == NULL) err(1, "connected");
+  queue[tail++] = 0;
+  reached[0] = 1;
+  while(head < tail) {
+    i = queue[head++];
+    for(j = 0; j < count; j++) {
+      if(!reached[j] && hypot(p[i].x - p[j].x, p[i].y - p[j].y) <= range) {
+        reached[j] = 1;
+        queue[tail++] = j;
+        n++;
+      }
+    }
+  }
+  free(queue);
+  free(reached);
+  return n == count;
+}
+/*---------------------------------------------------------------------------*/
+static void
+place_random(struct position *p, int count, double range, double density)
+{
+  /* count * pi * range^2 / side^2 neighbours on average */
+  double side = sqrt(count * M_PI * range * range / density);
+  int attempt, i;
+
+  for(attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+    p[0].x = p[0].y = side / 2;
+    for(i = 1; i < count; i++) {
+      p[i].x = uniform() * side;
+      p[i].y = uniform() * side;
+    }
+    if(connected(p, count, range)) {
+      return;
+    }
+  }
+  warnx("no connected placement in %d attempts, some thermostats "
+        "can't reach the border router", MAX_ATTEMPTS);
+}
+/*---------------------------------------------------------------------------*/
+static void
+place_grid(struct position *p, int count, double range, double density)
+{
+  double spacing = range * sqrt(M_PI / density);
+  struct position t;
+  int columns = ceil(sqrt(count)), i, center;
+
+  for(i = 0; i < count; i++) {
+    p[i].x = (i % columns) * spacing;
+    p[i].y = (i / columns) * spacing;
+  }
+  /* The border router in the middle of the grid */
+  center = (columns / 2) * columns + columns / 2;
+  if(center >= count) center = count - 1;
+  t = p[0];
+  p[0] = p[center];
+  p[center] = t;
+  if(!connected(p, count, range)) {
+    warnx("the grid isn't connected, raise the density");
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_escaped(FILE *f, const char *s)
+{
+  for(; *s; s++) {
+    switch(*s) {
+    case '&': fputs("&amp;", f); break;
+    case '<': fputs("&lt;", f); break;
+    case '>': fputs("&gt;", f); break;
+    default: putc(*s, f); break;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* The test script with its @PARAMETERS@ replaced */
+static void
+print_script(const char *path, const char *const *vars, int nvars)
+{
+  FILE *f = fopen(path, "r");
+  char line[1024], *p, *at;
+  int i;
+
+  if(f == NULL) {
+    err(1, "can't open ``%s''", path);
+  }
+  while(fgets(line, sizeof(line), f) != NULL) {
+    for(p = line; (at = strchr(p, '@')) != NULL; p = at) {
+      *at++ = '\0';
+      print_escaped(stdout, p);
+      for(i = 0; i < nvars; i += 2) {
+        size_t len = strlen(vars[i]);
+        if(strncmp(at, vars[i], len) == 0 && at[len] == '@') {
+          print_escaped(stdout, vars[i + 1]);
+          at += len + 1;
+          break;
+        }
+      }
+      if(i == nvars) {
+        putchar('@');
+      }
+    }
+    print_escaped(stdout, p);
+  }
+  fclose(f);
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_motetype(const char *id, const char *root, const char *dir,
+               const char *name)
+{
+  static const char *interfaces[] = {
+    "se.sics.cooja.interfaces.Position",
+    "se.sics.cooja.interfaces.RimeAddress",
+    "se.sics.cooja.interfaces.IPAddress",
+    "se.sics.cooja.interfaces.Mote2MoteRelations",
+    "se.sics.cooja.interfaces.MoteAttributes",
+    "se.sics.cooja.mspmote.interfaces.MspClock",
+    "se.sics.cooja.mspmote.interfaces.MspMoteID",
+    "se.sics.cooja.mspmote.interfaces.SkyButton",
+    "se.sics.cooja.mspmote.interfaces.SkyFlash",
+    "se.sics.cooja.mspmote.interfaces.SkyCoffeeFilesystem",
+    "se.sics.cooja.mspmote.interfaces.Msp802154Radio",
+    "se.sics.cooja.mspmote.interfaces.MspSerial",
+    "se.sics.cooja.mspmote.interfaces.SkyLED",
+    "se.sics.cooja.mspmote.interfaces.MspDebugOutput",
+    "se.sics.cooja.mspmote.interfaces.SkyTemperature",
+  };
+  unsigned i;
+
+  printf("    <motetype>\n");
+  printf("      se.sics.cooja.mspmote.SkyMoteType\n");
+  printf("      <identifier>%s</identifier>\n", id);
+  printf("      <description>Sky Mote Type #%s</description>\n", id);
+  printf("      <source EXPORT=\"discard\">%s/%s/%s.c</source>\n",
+         root, dir, name);
+  printf("      <commands EXPORT=\"discard\">make %s.sky TARGET=sky</commands>\n",
+         name);
+  printf("      <firmware EXPORT=\"copy\">%s/%s/%s.sky</firmware>\n",
+         root, dir, name);
+  for(i = 0; i < sizeof(interfaces) / sizeof(interfaces[0]); i++) {
+    printf("      <moteinterface>%s</moteinterface>\n", interfaces[i]);
+  }
+  printf("    </motetype>\n");
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  const char *topology = "random", *script = "kpi.js";
+  const char *root = "[CONFIG_DIR]/..", *output = "scenario";
+  double range = 50, interference = 0, tx = 1, rx = 1, density = 6;
+  unsigned long seed = 123456;
+  int motes = 25, duration = 600, sample = 1000, observe = 60;
+  struct position *p;
+  char duration_ms[32], sample_ms[32], observe_ms[32], count[32];
+  char log[1024], csv[1024];
+  int c, i;
+
+  while((c = getopt(argc, argv, "d:f:hi:j:n:o:O:r:s:S:t:T:x:y:")) != -1) {
+    switch(c) {
+    case 'd':
+      density = atof(optarg);
+      break;
+    case 'f':
+      root = optarg;
+      break;
+    case 'i':
+      interference = atof(optarg);
+      break;
+    case 'j':
+      script = optarg;
+      break;
+    case 'n':
+      motes = atoi(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'O':
+      observe = atoi(optarg);
+      break;
+    case 'r':
+      range = atof(optarg);
+      break;
+    case 's':
+      seed = strtoul(optarg, NULL, 0);
+      break;
+    case 'S':
+      sample = atoi(optarg);
+      break;
+    case 't':
+      topology = optarg;
+      break;
+    case 'T':
+      duration = atoi(optarg);
+      break;
+    case 'x':
+      tx = atof(optarg);
+      break;
+    case 'y':
+      rx = atof(optarg);
+      break;
+    case '?':
+    case 'h':
+    default:
+      goto usage;
+    }
+  }
+  if(optind != argc || motes < 1 || density <= 0 ||
+     (strcmp(topology, "random") != 0 && strcmp(topology, "grid") != 0)) {
+usage:
+fprintf(stderr,"usage:  %s [options] > scenario.csc\n", prog);
+fprintf(stderr,"example: scenario -n 50 -d 8 -s 7 -f $PWD/.. -o runs/n50 > runs/n50.csc\n");
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -n motes       Thermostats, besides the border router (default 25)\n");
+fprintf(stderr," -t topology    random or grid (default random)\n");
+fprintf(stderr," -d density     Mean number of neighbours in range (default 6)\n");
+fprintf(stderr," -r range       Transmitting range in meters (default 50)\n");
+fprintf(stderr," -i range       Interference range (default twice -r)\n");
+fprintf(stderr," -x ratio       Transmission success ratio (default 1.0)\n");
+fprintf(stderr," -y ratio       Reception success ratio (default 1.0)\n");
+fprintf(stderr," -s seed        Placement and Cooja random seed (default 123456)\n");
+fprintf(stderr," -T seconds     Simulated time (default 600)\n");
+fprintf(stderr," -S ms          Stack sampling period (default 1000)\n");
+fprintf(stderr," -O seconds     Observe registrations renewed this often (default 60)\n");
+fprintf(stderr," -f dir         The repository, for the firmware (default [CONFIG_DIR]/..)\n");
+fprintf(stderr," -j script      The test script (default kpi.js)\n");
+fprintf(stderr," -o prefix      The script writes prefix.log and prefix-motes.csv\n");
+exit(1);
+  }
+  if(interference == 0) {
+    interference = 2 * range;
+  }
+
+  rng = seed;
+  motes++;                      /* The border router */
+  if((p = calloc(motes, sizeof(*p))) == NULL) {
+    err(1, "main");
+  }
+  if(strcmp(topology, "grid") == 0) {
+    place_grid(p, motes, range, density);
+  } else {
+    place_random(p, motes, range, density);
+  }
+
+  printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  printf("<simconf>\n");
+  printf("  <project EXPORT=\"discard\">[APPS_DIR]/mrm</project>\n");
+  printf("  <project EXPORT=\"discard\">[APPS_DIR]/mspsim</project>\n");
+  printf("  <project EXPORT=\"discard\">[APPS_DIR]/avrora</project>\n");
+  printf("  <project EXPORT=\"discard\">[APPS_DIR]/serial_socket</project>\n");
+  printf("  <project EXPORT=\"discard\">[APPS_DIR]/collect-view</project>\n");
+  printf("  <project EXPORT=\"discard\">[APPS_DIR]/powertracker</project>\n");
+  printf("  <simulation>\n");
+  printf("    <title>%d thermostats, %s, density %g, seed %lu</title>\n",
+         motes - 1, topology, density, seed);
+  printf("    <randomseed>%lu</randomseed>\n", seed);
+  printf("    <motedelay_us>1000000</motedelay_us>\n");
+  printf("    <radiomedium>\n");
+  printf("      se.sics.cooja.radiomediums.UDGM\n");
+  printf("      <transmitting_range>%g</transmitting_range>\n", range);
+  printf("      <interference_range>%g</interference_range>\n", interference);
+  printf("      <success_ratio_tx>%g</success_ratio_tx>\n", tx);
+  printf("      <success_ratio_rx>%g</success_ratio_rx>\n", rx);
+  printf("    </radiomedium>\n");
+  printf("    <events>\n");
+  printf("      <logoutput>40000</logoutput>\n");
+  printf("    </events>\n");
+  print_motetype("sky1", root, "border-router", "border-router");
+  print_motetype("sky2", root, "sensor", "sensor");
+  for(i = 0; i < motes; i++) {
+    printf("    <mote>\n");
+    printf("      <breakpoints />\n");
+    printf("      <interface_config>\n");
+    printf("        se.sics.cooja.interfaces.Position\n");
+    printf("        <x>%.3f</x>\n", p[i].x);
+    printf("        <y>%.3f</y>\n", p[i].y);
+    printf("        <z>0.0</z>\n");
+    printf("      </interface_config>\n");
+    printf("      <interface_config>\n");
+    printf("        se.sics.cooja.mspmote.interfaces.MspMoteID\n");
+    printf("        <id>%d</id>\n", i + 1);
+    printf("      </interface_config>\n");
+    printf("      <motetype_identifier>%s</motetype_identifier>\n",
+           i == 0 ? "sky1" : "sky2");
+    printf("    </mote>\n");
+  }
+  printf("  </simulation>\n");
+  printf("  <plugin>\n");
+  printf("    PowerTracker\n");
+  printf("    <width>400</width>\n");
+  printf("    <z>1</z>\n");
+  printf("    <height>400</height>\n");
+  printf("    <location_x>0</location_x>\n");
+  printf("    <location_y>0</location_y>\n");
+  printf("  </plugin>\n");
+  printf("  <plugin>\n");
+  printf("    se.sics.cooja.plugins.ScriptRunner\n");
+  printf("    <plugin_config>\n");
+  printf("      <script>");
+  snprintf(duration_ms, sizeof(duration_ms), "%d", duration * 1000);
+  snprintf(sample_ms, sizeof(sample_ms), "%d", sample);
+  snprintf(observe_ms, sizeof(observe_ms), "%d", observe * 1000);
+  snprintf(count, sizeof(count), "%d", motes);
+  snprintf(log, sizeof(log), "%s.log", output);
+  snprintf(csv, sizeof(csv), "%s-motes.csv", output);
+  {
+    const char *vars[] = {
+      "DURATION", duration_ms, "SAMPLE", sample_ms, "OBSERVE", observe_ms,
+      "MOTES", count, "LOG", log, "MOTES_CSV", csv,
+    };
+    print_script(script, vars, sizeof(vars) / sizeof(vars[0]));
+  }
+  printf("</script>\n");
+  printf("      <active>true</active>\n");
+  printf("    </plugin_config>\n");
+  printf("    <width>600</width>\n");
+  printf("    <z>0</z>\n");
+  printf("    <height>700</height>\n");
+  printf("    <location_x>400</location_x>\n");
+  printf("    <location_y>0</location_y>\n");
+  printf("  </plugin>\n");
+  printf("</simconf>\n");
+  free(p);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
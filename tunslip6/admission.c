@@ -0,0 +1,405 @@
+/**
+ * \file
+ *         Admission control of the packets sent from the host to the mesh.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "admission.h"
+#include "coap.h"
+#include "ipv6.h"
+
+#define DESTINATIONS   256      /* Power of two, more than the mesh has */
+#define PROBES         8        /* Slots a mote's address may take */
+#define RESOURCES      4        /* Cached responses per mote */
+#define PENDING        8        /* GET tokens remembered per mote */
+#define MAX_PATH       32
+#define MAX_PAYLOAD    256
+#define REPORT_MS      10000
+
+#define DEFAULT_MAX_AGE 60
+
+extern int verbose;
+
+struct bucket {
+  double tokens;
+  double rate;
+  double burst;
+  uint64_t refill;
+};
+
+struct resource {
+  char path[MAX_PATH];
+  uint64_t expires;             /* 0 if nothing is cached */
+  int format;                   /* -1 if the response had none */
+  uint16_t len;
+  uint8_t payload[MAX_PAYLOAD];
+};
+
+struct pending {
+  uint8_t tkl;
+  uint8_t token[8];
+  char path[MAX_PATH];
+};
+
+struct destination {
+  struct in6_addr addr;
+  uint64_t used;                /* Its last packet, 0 if the slot is free */
+  struct bucket bucket;
+  struct resource resources[RESOURCES];
+  struct pending pending[PENDING];
+  unsigned next_resource, next_pending;
+};
+
+static struct destination destinations[DESTINATIONS];
+static struct bucket mesh;
+static struct bucket other;     /* Non-CoAP traffic, all destinations */
+static double mote_rate;
+static uint8_t prefix[8];       /* The mesh's /64 */
+static uint16_t reply_mid;
+
+static unsigned long forwarded, shed, cached, dropped;
+static uint64_t last_report;
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+static void
+bucket_init(struct bucket *b, double rate)
+{
+  b->rate = rate;
+  b->burst = rate * 2 < 2 ? 2 : rate * 2;
+  b->tokens = b->burst;
+  b->refill = now_ms();
+}
+/*---------------------------------------------------------------------------*/
+static void
+bucket_refill(struct bucket *b, uint64_t now)
+{
+  b->tokens += (now - b->refill) * b->rate / 1000;
+  if(b->tokens > b->burst) {
+    b->tokens = b->burst;
+  }
+  b->refill = now;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Telemetry may not dig into the half of the bucket kept for the others,
+ * priority traffic may go into debt, up to one burst
+ */
+static int
+bucket_allows(const struct bucket *b, int priority)
+{
+  if(b->rate == 0) {
+    return 1;
+  }
+  return priority ? b->tokens - 1 >= -b->burst : b->tokens >= 1 + b->burst / 2;
+}
+/*---------------------------------------------------------------------------*/
+static void
+bucket_take(struct bucket *b)
+{
+  if(b->rate != 0) {
+    b->tokens -= 1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The state of a mote, NULL if addr is not a unicast address of the mesh.
+ * A mote not seen yet takes the first free slot after its hash, or the
+ * least recently used of the PROBES slots there: slots are never freed.
+ */
+static struct destination *
+destination_find(const uint8_t *addr, uint64_t now)
+{
+  struct destination *d, *oldest = NULL;
+  uint32_t h;
+  unsigned i, n;
+
+  if(memcmp(addr, prefix, sizeof(prefix)) != 0) {
+    return NULL;
+  }
+  memcpy(&h, addr + 12, 4);
+  h *= 2654435761u;
+  for(n = 0, i = h >> 24; n < PROBES; n++, i++) {
+    d = &destinations[i & (DESTINATIONS - 1)];
+    if(d->used == 0) {
+      oldest = d;
+      break;
+    }
+    if(memcmp(&d->addr, addr, 16) == 0) {
+      d->used = now;
+      return d;
+    }
+    if(oldest == NULL || d->used < oldest->used) {
+      oldest = d;
+    }
+  }
+  memset(oldest, 0, sizeof(*oldest));
+  memcpy(&oldest->addr, addr, 16);
+  oldest->used = now;
+  bucket_init(&oldest->bucket, mote_rate);
+  return oldest;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * CoAP message of a UDP datagram in an IPv6 packet, from or to COAP_PORT,
+ * and its Uri-Path as one string
+ */
+static int
+parse(const uint8_t *packet, int len, int ports, struct coap_message *m,
+      char *path)
+{
+  const uint8_t *coap;
+  int i, n = 0;
+
+  path[0] = '\0';
+  if((coap = ipv6_coap(packet, len, ports, &len)) == NULL ||
+     coap_parse(m, coap, len) < 0) {
+    return -1;
+  }
+  for(i = 0; i < m->uri_segments && n < MAX_PATH; i++) {
+    n += snprintf(path + n, MAX_PATH - n, "/%.*s", m->uri_segment_len[i],
+                  (const char *)m->uri_segment[i]);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+udp_checksum(const uint8_t *ip, int udp_len)
+{
+  uint32_t sum = 17 + udp_len;
+  int i;
+
+  /* Pseudo header addresses, then the datagram */
+  for(i = 8; i < IPV6_HEADER; i += 2) {
+    sum += (ip[i] << 8) | ip[i + 1];
+  }
+  for(i = 0; i < udp_len; i += 2) {
+    sum += (ip[IPV6_HEADER + i] << 8) |
+      (i + 1 < udp_len ? ip[IPV6_HEADER + i + 1] : 0);
+  }
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  sum = ~sum & 0xffff;
+  return sum ? sum : 0xffff;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The response to a request parse() accepted, from the mote's address and
+ * port to the client's, with no extension header whatever the request had
+ */
+static int
+cached_reply(const uint8_t *request, int request_len,
+             const struct coap_message *m, const struct resource *r,
+             uint64_t now, uint8_t *reply)
+{
+  const uint8_t *request_udp;
+  struct coap_message c;
+  uint8_t *udp = reply + IPV6_HEADER;
+  int len, udp_len, next;
+  uint16_t sum;
+
+  request_udp = request + ipv6_transport(request, request_len, &next);
+
+  coap_init(&c, m->type == COAP_TYPE_CON ? COAP_TYPE_ACK : COAP_TYPE_NON,
+            COAP_CONTENT, m->type == COAP_TYPE_CON ? m->mid : reply_mid++);
+  c.token_len = m->token_len;
+  memcpy(c.token, m->token, m->token_len);
+  c.content_format = r->format;
+  /* What is left of the freshness, the client must not cache it longer */
+  c.max_age = (r->expires - now + 999) / 1000;
+  c.payload = r->payload;
+  c.payload_len = r->len;
+  len = coap_serialize(&c, udp + UDP_HEADER,
+                       1280 - IPV6_HEADER - UDP_HEADER);
+
+  udp_len = UDP_HEADER + len;
+  reply[0] = 0x60;
+  reply[1] = reply[2] = reply[3] = 0;
+  reply[4] = udp_len >> 8;
+  reply[5] = udp_len & 0xff;
+  reply[6] = PROTO_UDP;
+  reply[7] = 64;
+  memcpy(reply + 8, request + 24, 16);
+  memcpy(reply + 24, request + 8, 16);
+  udp[0] = COAP_PORT >> 8;
+  udp[1] = COAP_PORT & 0xff;
+  udp[2] = request_udp[0];
+  udp[3] = request_udp[1];
+  udp[4] = udp_len >> 8;
+  udp[5] = udp_len & 0xff;
+  udp[6] = udp[7] = 0;
+  sum = udp_checksum(reply, udp_len);
+  udp[6] = sum >> 8;
+  udp[7] = sum & 0xff;
+  return IPV6_HEADER + udp_len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+report(uint64_t now)
+{
+  if(verbose && (shed || cached || dropped) &&
+     now - last_report >= REPORT_MS) {
+    fprintf(stderr, "*** admission: %lu forwarded, %lu GETs answered from "
+            "cache, %lu shed, %lu dropped over the debt limit\n",
+            forwarded, cached, shed, dropped);
+    forwarded = shed = cached = dropped = 0;
+    last_report = now;
+  }
+}
+/*---------------------------------------------------------------------------*/
+admission_t
+admission_filter(const uint8_t *packet, int len,
+                 uint8_t *reply, int *reply_len)
+{
+  struct destination *d;
+  struct coap_message m;
+  struct pending *p;
+  struct resource *r;
+  char path[MAX_PATH];
+  uint64_t now = now_ms();
+  int priority = 1, i;
+
+  if(len < 40 || (packet[0] >> 4) != 6) {
+    return ADMISSION_FORWARD;
+  }
+
+  if(parse(packet, len, IPV6_DESTINATION, &m, path) < 0) {
+    /* ICMPv6, RPL and the like: only their own bucket */
+    bucket_refill(&other, now);
+    if(bucket_allows(&other, 1)) {
+      bucket_take(&other);
+      forwarded++;
+      return ADMISSION_FORWARD;
+    }
+    dropped++;
+    report(now);
+    return ADMISSION_DROP;
+  }
+
+  d = destination_find(packet + 24, now);
+  if(m.code != 0 && m.code < 32) {
+    if(m.code == COAP_GET) {
+      /* Remember the token to recognize the response */
+      if(d != NULL) {
+        p = &d->pending[d->next_pending++ % PENDING];
+        p->tkl = m.token_len;
+        memcpy(p->token, m.token, m.token_len);
+        strcpy(p->path, path);
+      }
+      priority = m.observe >= 0;
+    } else if(d != NULL) {
+      /* The thermostat is changing, whatever was cached is stale */
+      for(i = 0; i < RESOURCES; i++) {
+        d->resources[i].expires = 0;
+      }
+    }
+  }
+
+  if(d != NULL) {
+    bucket_refill(&d->bucket, now);
+  }
+  bucket_refill(&mesh, now);
+  if((d == NULL || bucket_allows(&d->bucket, priority)) &&
+     bucket_allows(&mesh, priority)) {
+    if(d != NULL) {
+      bucket_take(&d->bucket);
+    }
+    bucket_take(&mesh);
+    forwarded++;
+    return ADMISSION_FORWARD;
+  }
+
+  report(now);
+  if(priority) {
+    if(verbose > 2) {
+      char addr[INET6_ADDRSTRLEN];
+      inet_ntop(AF_INET6, packet + 24, addr, sizeof(addr));
+      printf("Dropping CoAP %u.%02u %s to %s over the debt limit\n",
+             m.code >> 5, m.code & 31, path, addr);
+    }
+    dropped++;
+    return ADMISSION_DROP;
+  }
+  for(i = 0; d != NULL && i < RESOURCES; i++) {
+    r = &d->resources[i];
+    if(r->expires > now && strcmp(r->path, path) == 0) {
+      *reply_len = cached_reply(packet, len, &m, r, now, reply);
+      cached++;
+      return ADMISSION_REPLY;
+    }
+  }
+  if(verbose > 2) {
+    char addr[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, packet + 24, addr, sizeof(addr));
+    printf("Shedding GET %s to %s\n", path, addr);
+  }
+  shed++;
+  return ADMISSION_DROP;
+}
+/*---------------------------------------------------------------------------*/
+void
+admission_learn(const uint8_t *packet, int len)
+{
+  struct destination *d;
+  struct resource *r;
+  struct pending *p;
+  struct coap_message m;
+  char path[MAX_PATH];
+  uint64_t now = now_ms();
+  int i;
+
+  if(parse(packet, len, IPV6_SOURCE, &m, path) < 0 ||
+     m.code != COAP_CONTENT || m.payload_len > MAX_PAYLOAD ||
+     (d = destination_find(packet + 8, now)) == NULL) {
+    return;
+  }
+  for(p = NULL, i = 0; i < PENDING; i++) {
+    if(d->pending[i].tkl == m.token_len &&
+       memcmp(d->pending[i].token, m.token, m.token_len) == 0) {
+      p = &d->pending[i];
+    }
+  }
+  if(p == NULL) {
+    return;
+  }
+  /* Observe notifications keep refreshing the same entry */
+  for(r = NULL, i = 0; i < RESOURCES; i++) {
+    if(strcmp(d->resources[i].path, p->path) == 0) {
+      r = &d->resources[i];
+    }
+  }
+  if(r == NULL) {
+    r = &d->resources[d->next_resource++ % RESOURCES];
+    strcpy(r->path, p->path);
+  }
+  r->expires = now + (uint64_t)(m.max_age < 0 ? DEFAULT_MAX_AGE :
+                                 m.max_age) * 1000;
+  r->format = m.content_format;
+  r->len = m.payload_len;
+  memcpy(r->payload, m.payload, m.payload_len);
+}
+/*---------------------------------------------------------------------------*/
+void
+admission_init(double rate, double mesh_rate, const uint8_t *mesh_prefix)
+{
+  mote_rate = rate;
+  memcpy(prefix, mesh_prefix, sizeof(prefix));
+  bucket_init(&mesh, mesh_rate);
+  /* A mote's worth, or the mesh's if only the mesh is limited */
+  bucket_init(&other, rate != 0 ? rate : mesh_rate);
+  reply_mid = now_ms();
+}
+/*---------------------------------------------------------------------------*/
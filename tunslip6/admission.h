@@ -0,0 +1,49 @@
+/**
+ * \file
+ *         Admission control of the packets sent from the host to the mesh.
+ *
+ *         Every mote has a token bucket refilled at a fixed rate of packets
+ *         per second, and a second bucket bounds the whole mesh. CoAP
+ *         requests that change a thermostat (POST, PUT, DELETE), Observe
+ *         registrations, ACKs and RSTs have priority: they may take the
+ *         buckets into debt, up to one burst, and are dropped beyond it.
+ *         Plain GETs are telemetry: they may not use the half of a bucket
+ *         kept for the others, and when they are over the limit they are
+ *         answered with the last response of the mote for the same
+ *         resource, while its Max-Age lasts, or dropped. Non-CoAP traffic
+ *         (ICMPv6, RPL) has a bucket of its own, at the rate of a mote (of
+ *         the mesh without a mote rate), and leaves the others alone.
+ *
+ *         Only the unicast addresses of the mesh's /64 are motes; the
+ *         others, multicast, link-local or off the mesh, share the mesh's
+ *         bucket and nothing is cached for them. The table of motes is
+ *         bounded: a new mote may take the place of the one that has been
+ *         quiet the longest.
+ */
+
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+#include <stdint.h>
+
+typedef enum {
+  ADMISSION_FORWARD,
+  ADMISSION_DROP,
+  ADMISSION_REPLY               /* Write the reply back to the host */
+} admission_t;
+
+/**
+ * Rates in packets per second, a zero mesh rate means no mesh limit;
+ * prefix is the first 8 bytes of the mesh's addresses
+ */
+void admission_init(double mote_rate, double mesh_rate,
+                    const uint8_t *prefix);
+
+/** Classify an IPv6 packet from the host; reply must hold 1280 bytes */
+admission_t admission_filter(const uint8_t *packet, int len,
+                             uint8_t *reply, int *reply_len);
+
+/** Look at an IPv6 packet from the mesh for responses worth caching */
+void admission_learn(const uint8_t *packet, int len);
+
+#endif /* __ADMISSION_H__ */
@@ -0,0 +1,114 @@
+/**
+ * \file
+ *         Hand the tun device over from a running tunslip6 to its successor.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <err.h>
+
+#include "handover.h"
+
+/*---------------------------------------------------------------------------*/
+static int
+socket_address(const char *path, struct sockaddr_un *sa)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(sa->sun_path)) {
+    errx(1, "handover: path too long");
+  }
+  strcpy(sa->sun_path, path);
+  return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+/*---------------------------------------------------------------------------*/
+int
+handover_receive(const char *path, char *dev, int size)
+{
+  struct sockaddr_un sa;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  int s, fd = -1;
+  ssize_t n;
+
+  s = socket_address(path, &sa);
+  if(s == -1 || connect(s, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    if(s != -1) close(s);
+    return -1;
+  }
+  /* The interface name comes with the descriptor */
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = dev;
+  iov.iov_len = size - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  n = recvmsg(s, &msg, 0);
+  if(n > 0) {
+    dev[n] = '\0';
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+       cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+    }
+  }
+  close(s);
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+int
+handover_listen(const char *path)
+{
+  struct sockaddr_un sa;
+  int s = socket_address(path, &sa);
+
+  if(s == -1) err(1, "handover: socket");
+  unlink(path);
+  if(bind(s, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    err(1, "handover: bind to ``%s''", path);
+  }
+  if(listen(s, 1) == -1) err(1, "handover: listen");
+  fcntl(s, F_SETFD, FD_CLOEXEC);
+  return s;
+}
+/*---------------------------------------------------------------------------*/
+int
+handover_send(int listenfd, int tunfd, const char *dev)
+{
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  int s;
+
+  if((s = accept(listenfd, NULL, NULL)) == -1) {
+    return -1;
+  }
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = (void *)dev;
+  iov.iov_len = strlen(dev);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &tunfd, sizeof(int));
+  if(sendmsg(s, &msg, 0) == -1) {
+    close(s);
+    return -1;
+  }
+  close(s);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
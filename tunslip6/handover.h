@@ -0,0 +1,24 @@
+/**
+ * \file
+ *         Hand the tun device over from a running tunslip6 to its successor.
+ *
+ *         The running tunslip6 listens on a Unix socket. A new one started
+ *         with the same socket connects to it before opening the serial
+ *         link and receives the tun descriptor (SCM_RIGHTS); the old one
+ *         then exits without touching the interface, so addresses, routes
+ *         and the daemons using them never see it go down.
+ */
+
+#ifndef __HANDOVER_H__
+#define __HANDOVER_H__
+
+/** The tun descriptor of the tunslip6 listening on path, -1 if none */
+int handover_receive(const char *path, char *dev, int size);
+
+/** Listen on path for a successor, returns the socket */
+int handover_listen(const char *path);
+
+/** Accept the successor on the listening socket and pass it tunfd */
+int handover_send(int listenfd, int tunfd, const char *dev);
+
+#endif /* __HANDOVER_H__ */
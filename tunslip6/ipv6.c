@@ -0,0 +1,51 @@
+/**
+ * \file
+ *         The headers of the IPv6 packets tunslip6 looks into.
+ */
+
+#include <stddef.h>
+
+#include "ipv6.h"
+
+/*---------------------------------------------------------------------------*/
+int
+ipv6_transport(const uint8_t *packet, int len, int *next)
+{
+  int offset = IPV6_HEADER;
+
+  if(len < IPV6_HEADER || (packet[0] >> 4) != 6) {
+    return -1;
+  }
+  *next = packet[6];
+  /* RPL's hop-by-hop option, on the packets from the mesh */
+  if(*next == PROTO_HBH && len >= offset + 8) {
+    *next = packet[offset];
+    offset += (packet[offset + 1] + 1) * 8;
+  }
+  return offset;
+}
+/*---------------------------------------------------------------------------*/
+const uint8_t *
+ipv6_coap(const uint8_t *packet, int len, int ports, int *coap_len)
+{
+  const uint8_t *udp, *coap;
+  int next, offset;
+
+  if((offset = ipv6_transport(packet, len, &next)) < 0 ||
+     next != PROTO_UDP || len < offset + UDP_HEADER + COAP_HEADER) {
+    return NULL;
+  }
+  udp = packet + offset;
+  if(!((ports & IPV6_SOURCE) && ((udp[0] << 8) | udp[1]) == COAP_PORT) &&
+     !((ports & IPV6_DESTINATION) && ((udp[2] << 8) | udp[3]) == COAP_PORT)) {
+    return NULL;
+  }
+  coap = udp + UDP_HEADER;
+  *coap_len = len - offset - UDP_HEADER;
+  if((coap[0] >> 6) != 1 || (coap[0] & 15) > 8 ||
+     COAP_HEADER + (coap[0] & 15) > *coap_len) {
+    return NULL;
+  }
+  return coap;
+}
+/*---------------------------------------------------------------------------*/
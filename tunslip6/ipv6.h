@@ -0,0 +1,45 @@
+/**
+ * \file
+ *         The headers of the IPv6 packets tunslip6 looks into.
+ *
+ *         The admission control, the noise filters and the tracing each
+ *         need the transport header of a packet, and some the CoAP message
+ *         in it. Packets from the mesh carry RPL's hop-by-hop option, the
+ *         only extension header skipped; nothing is copied and only what
+ *         the packet is long enough for is returned.
+ */
+
+#ifndef __IPV6_H__
+#define __IPV6_H__
+
+#include <stdint.h>
+
+#define IPV6_HEADER    40
+#define UDP_HEADER     8
+#define COAP_HEADER    4
+
+#define PROTO_HBH      0
+#define PROTO_UDP      17
+#define PROTO_ICMP6    58
+
+#define COAP_PORT      5683
+
+/* The ports ipv6_coap() looks at */
+#define IPV6_SOURCE      1
+#define IPV6_DESTINATION 2
+
+/**
+ * The offset of the transport header, past the hop-by-hop option, with its
+ * protocol in *next; -1 if packet is not IPv6
+ */
+int ipv6_transport(const uint8_t *packet, int len, int *next);
+
+/**
+ * The CoAP message of a UDP datagram from or to COAP_PORT, as ports says,
+ * and its length in *coap_len; NULL if there is none. Only the version and
+ * the token length of the message are checked.
+ */
+const uint8_t *ipv6_coap(const uint8_t *packet, int len, int ports,
+                         int *coap_len);
+
+#endif /* __IPV6_H__ */
@@ -0,0 +1,316 @@
+/**
+ * \file
+ *         Filter of the host's own control traffic to the mesh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ipv6.h"
+#include "noise.h"
+
+#define REPORT_MS      10000
+#define MAX_RA         1280
+
+
+#define ICMP6_MLD_QUERY     130
+#define ICMP6_MLD_REPORT    131
+#define ICMP6_MLD_DONE      132
+#define ICMP6_RS            133
+#define ICMP6_RA            134
+#define ICMP6_NS            135
+#define ICMP6_MLD2_REPORT   143
+
+#define SLIP_END       0300
+#define SLIP_ESC       0333
+
+enum { FORWARD, DROP, REPLY, LIMIT };
+
+enum { MLD, RS, DAD, MDNS, LLMNR, DHCP, MULTICAST, CLASSES };
+
+extern int verbose;
+
+static struct class {
+  const char *name;
+  int action;
+  double rate, tokens;
+  uint64_t refill;
+  unsigned long packets, filtered;
+  unsigned long long reclaimed; /* Serial bytes */
+} classes[CLASSES] = {
+  { "mld", DROP }, { "rs", REPLY }, { "dad", DROP }, { "mdns", DROP },
+  { "llmnr", DROP }, { "dhcp", DROP }, { "multicast", LIMIT, 1 },
+};
+
+static uint8_t ra[MAX_RA];
+static int ra_len;
+static double line_rate;        /* Bytes per second */
+static uint64_t start, last_report;
+static unsigned long long last_reclaimed;
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+/* What the packet takes on the serial line, SLIP escapes and END */
+static int
+serial_bytes(const uint8_t *p, int len)
+{
+  int i, n = len + 1;
+
+  for(i = 0; i < len; i++) {
+    n += p[i] == SLIP_END || p[i] == SLIP_ESC;
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static int
+classify(const uint8_t *p, int len)
+{
+  int next, offset, port;
+  int multicast = p[24] == 0xff && (p[25] & 15) == 2;
+
+  /* CoAP and everything else to the motes */
+  if(p[6] == PROTO_UDP && !multicast) {
+    return -1;
+  }
+  offset = ipv6_transport(p, len, &next);
+  if(next == PROTO_ICMP6 && len >= offset + 4) {
+    switch(p[offset]) {
+    case ICMP6_MLD_QUERY:
+    case ICMP6_MLD_REPORT:
+    case ICMP6_MLD_DONE:
+    case ICMP6_MLD2_REPORT:
+      return MLD;
+    case ICMP6_RS:
+      return RS;
+    case ICMP6_NS:
+      /* From the unspecified address */
+      if(p[8] == 0 && memcmp(p + 8, p + 9, 15) == 0) {
+        return DAD;
+      }
+      break;
+    }
+  } else if(next == PROTO_UDP && len >= offset + UDP_HEADER) {
+    port = (p[offset + 2] << 8) | p[offset + 3];
+    if(port == 5353) {
+      return MDNS;
+    } else if(port == 5355) {
+      return LLMNR;
+    } else if(port == 547) {
+      return DHCP;
+    }
+  }
+  return multicast ? MULTICAST : -1;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+icmp6_checksum(const uint8_t *ip, int icmp_len)
+{
+  uint32_t sum = PROTO_ICMP6 + icmp_len;
+  int i;
+
+  for(i = 8; i < 40; i += 2) {
+    sum += (ip[i] << 8) | ip[i + 1];
+  }
+  for(i = 0; i < icmp_len; i += 2) {
+    sum += (ip[40 + i] << 8) | (i + 1 < icmp_len ? ip[41 + i] : 0);
+  }
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum & 0xffff;
+}
+/*---------------------------------------------------------------------------*/
+/* The border router's advertisement, to the soliciting host */
+static int
+ra_reply(const uint8_t *rs, uint8_t *reply)
+{
+  static const uint8_t all_nodes[16] = { 0xff, 0x02, [15] = 1 };
+  uint16_t sum;
+
+  memcpy(reply, ra, ra_len);
+  if(rs[8] == 0 && memcmp(rs + 8, rs + 9, 15) == 0) {
+    memcpy(reply + 24, all_nodes, 16);
+  } else {
+    memcpy(reply + 24, rs + 8, 16);
+  }
+  reply[42] = reply[43] = 0;
+  sum = icmp6_checksum(reply, ra_len - 40);
+  reply[42] = sum >> 8;
+  reply[43] = sum & 0xff;
+  return ra_len;
+}
+/*---------------------------------------------------------------------------*/
+static double
+burst(const struct class *c)
+{
+  return c->rate < 1 ? 1 : c->rate;
+}
+/*---------------------------------------------------------------------------*/
+static int
+allowed(struct class *c, uint64_t now)
+{
+  c->tokens += (now - c->refill) * c->rate / 1000;
+  if(c->tokens > burst(c)) {
+    c->tokens = burst(c);
+  }
+  c->refill = now;
+  if(c->tokens < 1) {
+    return 0;
+  }
+  c->tokens -= 1;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+report(uint64_t now)
+{
+  unsigned long long reclaimed = 0;
+  int i;
+
+  if(now - last_report < REPORT_MS) {
+    return;
+  }
+  for(i = 0; i < CLASSES; i++) {
+    reclaimed += classes[i].reclaimed;
+  }
+  if(reclaimed != last_reclaimed) {
+    fprintf(stderr, "*** noise: %llu serial bytes reclaimed in %.0f s, "
+            "%.2f%% of the line\n", reclaimed - last_reclaimed,
+            (now - last_report) / 1000.0,
+            100.0 * (reclaimed - last_reclaimed) * 1000 /
+            ((now - last_report) * line_rate));
+  }
+  last_reclaimed = reclaimed;
+  last_report = now;
+}
+/*---------------------------------------------------------------------------*/
+admission_t
+noise_filter(const uint8_t *packet, int len,
+             uint8_t *reply, int *reply_len)
+{
+  struct class *c;
+  uint64_t now;
+  admission_t verdict = ADMISSION_DROP;
+  int i;
+
+  if(len < 40 || (packet[0] >> 4) != 6 || (i = classify(packet, len)) < 0) {
+    return ADMISSION_FORWARD;
+  }
+  c = &classes[i];
+  c->packets++;
+  now = now_ms();
+  switch(c->action) {
+  case FORWARD:
+    return ADMISSION_FORWARD;
+  case REPLY:
+    if(ra_len == 0) {
+      return ADMISSION_FORWARD;
+    }
+    *reply_len = ra_reply(packet, reply);
+    verdict = ADMISSION_REPLY;
+    break;
+  case LIMIT:
+    if(allowed(c, now)) {
+      return ADMISSION_FORWARD;
+    }
+    break;
+  }
+  c->filtered++;
+  c->reclaimed += serial_bytes(packet, len);
+  if(verbose > 2) {
+    printf("%s %s packet of length %d\n",
+           verdict == ADMISSION_REPLY ? "Answering" : "Dropping", c->name,
+           len);
+  }
+  if(verbose) {
+    report(now);
+  }
+  return verdict;
+}
+/*---------------------------------------------------------------------------*/
+void
+noise_learn(const uint8_t *packet, int len)
+{
+  if(len >= 40 + 16 && len <= MAX_RA && (packet[0] >> 4) == 6 &&
+     packet[6] == PROTO_ICMP6 && packet[40] == ICMP6_RA) {
+    memcpy(ra, packet, len);
+    ra_len = len;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+noise_report(FILE *f)
+{
+  unsigned long long reclaimed = 0;
+  double seconds = (now_ms() - start) / 1000.0;
+  int i;
+
+  for(i = 0; i < CLASSES; i++) {
+    if(classes[i].packets > 0) {
+      fprintf(f, "*** noise: %s %lu packets, %lu %s, %llu serial bytes\n",
+              classes[i].name, classes[i].packets, classes[i].filtered,
+              classes[i].action == REPLY ? "answered" : "dropped",
+              classes[i].reclaimed);
+    }
+    reclaimed += classes[i].reclaimed;
+  }
+  if(seconds > 0) {
+    fprintf(f, "*** noise: %llu serial bytes reclaimed in %.0f s, "
+            "%.2f%% of the line\n", reclaimed, seconds,
+            100.0 * reclaimed / (seconds * line_rate));
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+noise_init(const char *spec, int baud)
+{
+  char *copy = strdup(spec), *item, *value, *end;
+  int i, ret = 0;
+
+  for(item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+    if(strcmp(item, "default") == 0) {
+      continue;
+    }
+    if((value = strchr(item, '=')) == NULL) {
+      ret = -1;
+      break;
+    }
+    *value++ = '\0';
+    for(i = 0; i < CLASSES && strcmp(classes[i].name, item) != 0; i++);
+    if(i == CLASSES) {
+      ret = -1;
+      break;
+    }
+    if(strcmp(value, "forward") == 0) {
+      classes[i].action = FORWARD;
+    } else if(strcmp(value, "drop") == 0) {
+      classes[i].action = DROP;
+    } else if(strcmp(value, "reply") == 0 && i == RS) {
+      classes[i].action = REPLY;
+    } else if((classes[i].rate = strtod(value, &end)) > 0 && *end == '\0') {
+      classes[i].action = LIMIT;
+    } else {
+      ret = -1;
+      break;
+    }
+  }
+  free(copy);
+  line_rate = baud / 10.0;
+  start = last_report = now_ms();
+  for(i = 0; i < CLASSES; i++) {
+    classes[i].tokens = burst(&classes[i]);
+    classes[i].refill = start;
+  }
+  return ret;
+}
+/*---------------------------------------------------------------------------*/
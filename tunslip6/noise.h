@@ -0,0 +1,50 @@
+/**
+ * \file
+ *         Filter of the host's own control traffic to the mesh.
+ *
+ *         Whatever the host's kernel and daemons send to the tun device
+ *         would go over the serial line: MLD reports, router solicitations,
+ *         duplicate address detection, mDNS, LLMNR, DHCPv6 and other
+ *         link-local multicast. None of it is for the motes, and at 115200
+ *         baud it competes with the CoAP traffic. Every class has an action:
+ *
+ *         - forward: as before
+ *         - drop
+ *         - reply: a router solicitation is answered with the last router
+ *           advertisement that came from the border router, forwarded
+ *           while there is none
+ *         - a number: forwarded at that many packets per second at most,
+ *           the others dropped
+ *
+ *         The classes and their defaults are mld=drop, rs=reply, dad=drop,
+ *         mdns=drop, llmnr=drop, dhcp=drop and multicast=1 (the other
+ *         link-local multicast). The header checks are a few byte compares,
+ *         unicast UDP (CoAP) is told apart first. Counters of the packets
+ *         and of the serial bytes each class didn't use are reported.
+ */
+
+#ifndef __NOISE_H__
+#define __NOISE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "admission.h"
+
+/**
+ * Apply spec, a list of class=action separated by commas ("default"
+ * keeps the defaults), to a line of baud bits per second; -1 if invalid
+ */
+int noise_init(const char *spec, int baud);
+
+/** Classify an IPv6 packet from the host; reply must hold 1280 bytes */
+admission_t noise_filter(const uint8_t *packet, int len,
+                         uint8_t *reply, int *reply_len);
+
+/** Look at an IPv6 packet from the mesh for router advertisements */
+void noise_learn(const uint8_t *packet, int len);
+
+/** Print the counters since the start */
+void noise_report(FILE *f);
+
+#endif /* __NOISE_H__ */
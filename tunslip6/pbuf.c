@@ -0,0 +1,111 @@
+/**
+ * \file
+ *         Pool of reference counted packet buffers.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pbuf.h"
+
+static struct pbuf *pool;
+static struct pbuf **free_list;
+static int count, available, lowest;
+static unsigned long allocated, exhausted;
+/* tunslip6 -M allocates from two threads */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*---------------------------------------------------------------------------*/
+int
+pbuf_init(int n)
+{
+  int i;
+
+  if(posix_memalign((void **)&pool, PBUF_ALIGN, n * sizeof(*pool)) != 0 ||
+     (free_list = malloc(n * sizeof(*free_list))) == NULL) {
+    return -1;
+  }
+  for(i = 0; i < n; i++) {
+    free_list[i] = &pool[n - 1 - i];
+  }
+  count = available = lowest = n;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+struct pbuf *
+pbuf_alloc(void)
+{
+  struct pbuf *p = NULL;
+
+  pthread_mutex_lock(&lock);
+  if(available == 0) {
+    exhausted++;
+  } else {
+    /* The last one freed, still in the cache */
+    p = free_list[--available];
+    if(available < lowest) {
+      lowest = available;
+    }
+    allocated++;
+  }
+  pthread_mutex_unlock(&lock);
+  if(p != NULL) {
+    p->refs = 1;
+    p->len = 0;
+  }
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+int
+pbuf_available(void)
+{
+  return __atomic_load_n(&available, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+struct pbuf *
+pbuf_ref(struct pbuf *p)
+{
+  __atomic_add_fetch(&p->refs, 1, __ATOMIC_RELAXED);
+  return p;
+}
+/*---------------------------------------------------------------------------*/
+void
+pbuf_unref(struct pbuf *p)
+{
+  if(__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&lock);
+    free_list[available++] = p;
+    pthread_mutex_unlock(&lock);
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+pbuf_enqueue(struct pbuf_queue *q, struct pbuf *p)
+{
+  if(q->tail - q->head == PBUF_COUNT) {
+    return -1;
+  }
+  q->slot[q->tail++ % PBUF_COUNT] = p;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+struct pbuf *
+pbuf_peek(const struct pbuf_queue *q)
+{
+  return q->head == q->tail ? NULL : q->slot[q->head % PBUF_COUNT];
+}
+/*---------------------------------------------------------------------------*/
+struct pbuf *
+pbuf_dequeue(struct pbuf_queue *q)
+{
+  return q->head == q->tail ? NULL : q->slot[q->head++ % PBUF_COUNT];
+}
+/*---------------------------------------------------------------------------*/
+void
+pbuf_report(FILE *f)
+{
+  fprintf(f, "*** pbuf: %lu packets in %d buffers of %d bytes, "
+          "at most %d in use, %lu times none left\n", allocated, count,
+          (int)sizeof(struct pbuf), count - lowest, exhausted);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,71 @@
+/**
+ * \file
+ *         Pool of reference counted packet buffers.
+ *
+ *         tunslip6 decodes the frames from the serial line straight into
+ *         these buffers, and reads the packets from the tun device into
+ *         them. A packet then goes to whoever needs it, the tun device's
+ *         write queue, the tracing, the filters, without being copied: a
+ *         consumer that keeps it past the call takes a reference, and the
+ *         buffer goes back to the pool with the last one. Decoding and
+ *         encoding are the only copies of a packet.
+ *
+ *         The buffers are allocated once at the start, aligned on cache
+ *         lines; the header shares the first line with the IPv6 header.
+ *         When the pool is empty, the tun device is not read and frames
+ *         from the serial line are dropped until a buffer comes back. The
+ *         pool and the references can be used from several threads, a
+ *         queue from one.
+ */
+
+#ifndef __PBUF_H__
+#define __PBUF_H__
+
+#include <stdio.h>
+
+#include "serial.h"
+
+#define PBUF_SIZE      SERIAL_MAX_FRAME
+#define PBUF_ALIGN     64
+#define PBUF_COUNT     64
+
+struct pbuf {
+  int refs;
+  int len;
+  unsigned char data[PBUF_SIZE];
+} __attribute__((aligned(PBUF_ALIGN)));
+
+/* A FIFO of buffers, each holding a reference */
+struct pbuf_queue {
+  struct pbuf *slot[PBUF_COUNT];
+  unsigned head, tail;
+};
+
+/** Allocate count buffers; -1 if there is no memory */
+int pbuf_init(int count);
+
+/** A buffer with one reference, NULL if the pool is empty */
+struct pbuf *pbuf_alloc(void);
+
+/** Buffers left in the pool */
+int pbuf_available(void);
+
+/** Another reference to p */
+struct pbuf *pbuf_ref(struct pbuf *p);
+
+/** Drop a reference, the last one returns p to the pool */
+void pbuf_unref(struct pbuf *p);
+
+/** Append p to q with the caller's reference; -1 if q is full */
+int pbuf_enqueue(struct pbuf_queue *q, struct pbuf *p);
+
+/** The first buffer of q, NULL if it is empty */
+struct pbuf *pbuf_peek(const struct pbuf_queue *q);
+
+/** Remove the first buffer of q, its reference goes to the caller */
+struct pbuf *pbuf_dequeue(struct pbuf_queue *q);
+
+/** Print the use of the pool since the start */
+void pbuf_report(FILE *f);
+
+#endif /* __PBUF_H__ */
@@ -0,0 +1,186 @@
+/**
+ * \file
+ *         Recordings of the serial byte stream, with timing.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "record.h"
+
+#define HEADER_LEN (sizeof(RECORD_MAGIC) - 1 + 8)
+
+/* Flush at least this often, a crash loses less than a second */
+#define FLUSH_INTERVAL 1000000
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+clock_us(clockid_t id)
+{
+  struct timespec ts;
+
+  clock_gettime(id, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_varint(FILE *f, uint64_t v)
+{
+  while(v >= 0x80) {
+    putc((v & 0x7f) | 0x80, f);
+    v >>= 7;
+  }
+  putc(v, f);
+}
+/*---------------------------------------------------------------------------*/
+static int
+get_varint(FILE *f, uint64_t *v)
+{
+  int c, shift = 0;
+
+  *v = 0;
+  do {
+    if((c = getc(f)) == EOF || shift > 63) {
+      return -1;
+    }
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while(c & 0x80);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+record_create(struct record *r, const char *path)
+{
+  unsigned char header[HEADER_LEN];
+  int i;
+
+  memset(r, 0, sizeof(*r));
+  if((r->f = fopen(path, "w")) == NULL) {
+    return -1;
+  }
+  setvbuf(r->f, NULL, _IOFBF, 65536);
+  r->start = clock_us(CLOCK_REALTIME);
+  r->last = r->flushed = clock_us(CLOCK_MONOTONIC);
+  memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC) - 1);
+  for(i = 0; i < 8; i++) {
+    header[sizeof(RECORD_MAGIC) - 1 + i] = r->start >> (8 * i);
+  }
+  if(fwrite(header, sizeof(header), 1, r->f) != 1 || fflush(r->f) != 0) {
+    fclose(r->f);
+    r->f = NULL;
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+record_write(struct record *r, int dir, const void *buf, int len)
+{
+  const unsigned char *p = buf;
+  uint64_t now;
+  int n;
+
+  if(r->f == NULL || len <= 0) {
+    return;
+  }
+  now = clock_us(CLOCK_MONOTONIC);
+  do {
+    n = len > RECORD_MAX_CHUNK ? RECORD_MAX_CHUNK : len;
+    put_varint(r->f, now - r->last);
+    put_varint(r->f, (uint64_t)n << 1 | dir);
+    fwrite(p, n, 1, r->f);
+    r->last = now;
+    p += n;
+    len -= n;
+  } while(len > 0);
+  r->pending = 1;
+  if(now - r->flushed >= FLUSH_INTERVAL) {
+    fflush(r->f);
+    r->flushed = now;
+    r->pending = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+long
+record_tick(struct record *r)
+{
+  uint64_t now;
+
+  if(r->f == NULL || !r->pending) {
+    return -1;
+  }
+  now = clock_us(CLOCK_MONOTONIC);
+  if(now - r->flushed < FLUSH_INTERVAL) {
+    return FLUSH_INTERVAL - (now - r->flushed);
+  }
+  fflush(r->f);
+  r->flushed = now;
+  r->pending = 0;
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+int
+record_open(struct record *r, const char *path)
+{
+  unsigned char header[HEADER_LEN];
+  int i;
+
+  memset(r, 0, sizeof(*r));
+  if((r->f = fopen(path, "r")) == NULL) {
+    return -1;
+  }
+  if(fread(header, sizeof(header), 1, r->f) != 1 ||
+     memcmp(header, RECORD_MAGIC, sizeof(RECORD_MAGIC) - 1) != 0) {
+    fclose(r->f);
+    r->f = NULL;
+    errno = EINVAL;
+    return -1;
+  }
+  for(i = 0; i < 8; i++) {
+    r->start |= (uint64_t)header[sizeof(RECORD_MAGIC) - 1 + i] << (8 * i);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+record_read(struct record *r, struct record_chunk *c)
+{
+  uint64_t delta, v;
+  int first;
+
+  if((first = getc(r->f)) == EOF) {
+    return 0;
+  }
+  ungetc(first, r->f);
+  if(get_varint(r->f, &delta) == -1 || get_varint(r->f, &v) == -1 ||
+     (v >> 1) > RECORD_MAX_CHUNK) {
+    return -1;
+  }
+  r->time += delta;
+  c->time = r->time;
+  c->dir = v & 1;
+  c->len = v >> 1;
+  if(fread(c->data, 1, c->len, r->f) != (size_t)c->len) {
+    return -1;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+record_rewind(struct record *r)
+{
+  fseek(r->f, HEADER_LEN, SEEK_SET);
+  r->time = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+record_close(struct record *r)
+{
+  if(r->f != NULL) {
+    fclose(r->f);
+    r->f = NULL;
+  }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,67 @@
+/**
+ * \file
+ *         Recordings of the serial byte stream, with timing.
+ *
+ *         A recording starts with RECORD_MAGIC and the wall clock time at
+ *         which it was started (8 bytes, microseconds, little endian), so
+ *         it can be matched against logs. Then comes one chunk per read()
+ *         from or write() to the serial line: the microseconds elapsed on
+ *         the monotonic clock since the previous chunk, the length shifted
+ *         left by one with the direction in the low bit, both as LEB128
+ *         varints, and the bytes themselves. A busy link costs two or three
+ *         bytes per chunk on top of its traffic.
+ */
+
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RECORD_MAGIC     "SLIPREC1"
+#define RECORD_MAX_CHUNK 65536
+
+#define RECORD_IN        0      /* Read from the serial line */
+#define RECORD_OUT       1      /* Written to the serial line */
+
+struct record {
+  FILE *f;
+  uint64_t start;               /* Wall clock, microseconds */
+  uint64_t last;                /* Monotonic time of the last chunk */
+  uint64_t flushed;
+  int pending;                  /* Written since the last flush */
+  uint64_t time;                /* When reading: of the last chunk, since the start */
+};
+
+struct record_chunk {
+  uint64_t time;                /* Microseconds since the start */
+  int dir;
+  int len;
+  unsigned char data[RECORD_MAX_CHUNK];
+};
+
+/** Start a recording, returns -1 with errno set on failure */
+int record_create(struct record *r, const char *path);
+
+/** Add len bytes read from (RECORD_IN) or written to the serial line */
+void record_write(struct record *r, int dir, const void *buf, int len);
+
+/**
+ * Flush what was written a second ago or more, for when the line goes
+ * quiet. The microseconds until the next flush is due, -1 if nothing is
+ * waiting.
+ */
+long record_tick(struct record *r);
+
+/** Open a recording for reading, returns -1 if it isn't one */
+int record_open(struct record *r, const char *path);
+
+/** The next chunk: 1, or 0 at the end, or -1 if the recording is cut short */
+int record_read(struct record *r, struct record_chunk *c);
+
+/** Read the recording again from its first chunk */
+void record_rewind(struct record *r);
+
+void record_close(struct record *r);
+
+#endif /* __RECORD_H__ */
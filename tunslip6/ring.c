@@ -0,0 +1,61 @@
+/**
+ * \file
+ *         Lock-free ring of frames from one thread to another.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+/*---------------------------------------------------------------------------*/
+int
+ring_init(struct ring *r, unsigned count, unsigned slot_size, sem_t *ready)
+{
+  if(posix_memalign((void **)&r->slots, RING_ALIGN,
+                    (size_t)count * slot_size) != 0 ||
+     (r->lengths = calloc(count, sizeof(*r->lengths))) == NULL ||
+     sem_init(&r->space, 0, count) == -1) {
+    return -1;
+  }
+  r->count = count;
+  r->slot_size = slot_size;
+  r->ready = ready;
+  r->head = r->tail = 0;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+unsigned char *
+ring_reserve(struct ring *r)
+{
+  while(sem_wait(&r->space) == -1 && errno == EINTR);
+  return r->slots + (size_t)(r->tail & (r->count - 1)) * r->slot_size;
+}
+/*---------------------------------------------------------------------------*/
+void
+ring_publish(struct ring *r, int len)
+{
+  r->lengths[r->tail & (r->count - 1)] = len;
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+  sem_post(r->ready);
+}
+/*---------------------------------------------------------------------------*/
+unsigned char *
+ring_peek(struct ring *r, int *len)
+{
+  unsigned i = r->head & (r->count - 1);
+
+  if(r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  *len = r->lengths[i];
+  return r->slots + (size_t)i * r->slot_size;
+}
+/*---------------------------------------------------------------------------*/
+void
+ring_release(struct ring *r)
+{
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  sem_post(&r->space);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,58 @@
+/**
+ * \file
+ *         Lock-free ring of frames from one thread to another.
+ *
+ *         tunslip6 -M runs a thread per stage: the serial line's input and
+ *         decoding, the tun device's input and encoding, and the serial
+ *         line's output. The stages hand frames to the serial output
+ *         through these rings. The slots are allocated once and hold the
+ *         frame itself: the producer encodes into the slot it reserved and
+ *         the consumer writes from it, with nothing copied in between.
+ *
+ *         A ring has one producer and one consumer. The head belongs to
+ *         the consumer and the tail to the producer, each on its own cache
+ *         line; they are only loaded and stored, with acquire and release
+ *         ordering. The semaphores only count, for a thread to sleep when
+ *         there is nothing to do: the free slots, which the producer waits
+ *         for, and the consumer's frames, which can be shared by several
+ *         rings. A sem_post() nobody waits for makes no system call.
+ */
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <semaphore.h>
+
+#define RING_ALIGN     64
+
+struct ring {
+  unsigned char *slots;
+  int *lengths;
+  unsigned count;               /* A power of two */
+  unsigned slot_size;
+  sem_t space;
+  sem_t *ready;
+  unsigned head __attribute__((aligned(RING_ALIGN)));
+  unsigned tail __attribute__((aligned(RING_ALIGN)));
+};
+
+/**
+ * Allocate count slots of slot_size bytes, count a power of two; ready is
+ * posted for each frame. -1 if there is no memory.
+ */
+int ring_init(struct ring *r, unsigned count, unsigned slot_size,
+              sem_t *ready);
+
+/** The producer's next slot, waiting for one to be free */
+unsigned char *ring_reserve(struct ring *r);
+
+/** The producer wrote len bytes to its slot: hand it over */
+void ring_publish(struct ring *r, int len);
+
+/** The consumer's next frame and its length, NULL if there is none */
+unsigned char *ring_peek(struct ring *r, int *len);
+
+/** The consumer is done with its frame: free the slot */
+void ring_release(struct ring *r);
+
+#endif /* __RING_H__ */
@@ -0,0 +1,278 @@
+/**
+ * \file
+ *         The serial side of tunslip6, as units that can be measured alone.
+ */
+
+#include <string.h>
+
+#include "serial.h"
+#include "slip.h"
+
+/* Below define allows importing saved output into Wireshark as "Raw IP" packet type */
+#define WIRESHARK_IMPORT_FORMAT 1
+
+static const char hex[] = "0123456789abcdef";
+
+/*---------------------------------------------------------------------------*/
+void
+serial_decoder_init(struct serial_decoder *d,
+                    const struct serial_callbacks *callbacks,
+                    int verbose, void *arg)
+{
+  d->callbacks = callbacks;
+  d->verbose = verbose;
+  d->arg = arg;
+  d->framing = SERIAL_SLIP;
+  d->escaped = 0;
+  d->inbufptr = 0;
+  d->inbuf = d->buf;
+}
+/*---------------------------------------------------------------------------*/
+void
+serial_decoder_buffer(struct serial_decoder *d, unsigned char *buf)
+{
+  d->inbuf = buf;
+}
+/*---------------------------------------------------------------------------*/
+int
+is_sensible_string(const unsigned char *s, int len)
+{
+  int i;
+  for(i = 1; i < len; i++) {
+    if(s[i] == 0 || s[i] == '\r' || s[i] == '\n' || s[i] == '\t') {
+      continue;
+    } else if(s[i] < ' ' || '~' < s[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+serial_frame_t
+serial_classify(const unsigned char *frame, int len)
+{
+  if(frame[0] == '!') {
+    if(len >= 2 + 16 && frame[1] == 'M') {
+      return SERIAL_MAC;
+    }
+    if(len >= 3 && frame[1] == 'F') {
+      return SERIAL_FRAMING;
+    }
+    return len >= 2 && frame[1] == 'R' ? SERIAL_TRACE : SERIAL_CONFIG;
+  } else if(frame[0] == '?') {
+    if(len >= 2 && frame[1] == 'P') {
+      return SERIAL_PREFIX_REQUEST;
+    }
+    return len >= 2 + 4 && frame[1] == 'T' ? SERIAL_TIME_REQUEST :
+      SERIAL_CONFIG;
+  } else if(frame[0] == DEBUG_LINE_MARKER) {
+    return SERIAL_DEBUG;
+  } else if(is_sensible_string(frame, len)) {
+    return SERIAL_TEXT;
+  }
+  return SERIAL_PACKET;
+}
+/*---------------------------------------------------------------------------*/
+unsigned short
+serial_crc16(const void *data, int len)
+{
+  const unsigned char *p = data;
+  unsigned short acc = 0;
+  int i;
+
+  for(i = 0; i < len; i++) {
+    acc ^= p[i];
+    acc = (acc >> 8) | (acc << 8);
+    acc ^= (acc & 0xff00) << 4;
+    acc ^= (acc >> 8) >> 4;
+    acc ^= (acc & 0xff00) >> 5;
+  }
+  return acc;
+}
+/*---------------------------------------------------------------------------*/
+int
+serial_decode_cobs(unsigned char *frame, int len)
+{
+  int i = 0, o = 0, code, n;
+
+  /* The output never overtakes the input */
+  while(i < len) {
+    code = frame[i++];
+    if(code == 0 || i + code - 1 > len) {
+      return -1;
+    }
+    for(n = 1; n < code; n++) {
+      frame[o++] = frame[i++];
+    }
+    if(code < 0xff && i < len) {
+      frame[o++] = 0;
+    }
+  }
+  if(o < 2 || serial_crc16(frame, o - 2) !=
+     (frame[o - 2] | (frame[o - 1] << 8))) {
+    return -1;
+  }
+  return o - 2;
+}
+/*---------------------------------------------------------------------------*/
+static void
+cobs_byte(struct serial_decoder *d, unsigned char c)
+{
+  const struct serial_callbacks *cb = d->callbacks;
+  int n;
+
+  if(c != 0) {
+    d->inbuf[d->inbufptr++] = c;
+    return;
+  }
+  if(d->inbufptr == 0) {
+    return;
+  }
+  n = serial_decode_cobs(d->inbuf, d->inbufptr);
+  if(n > 0) {
+    cb->frame(d, d->inbuf, n);
+  } else if(cb->corrupted) {
+    cb->corrupted(d, d->inbufptr);
+  }
+  d->inbufptr = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+serial_decode(struct serial_decoder *d, const unsigned char *buf, int len)
+{
+  const struct serial_callbacks *cb = d->callbacks;
+  int i;
+  unsigned char c;
+
+  for(i = 0; i < len; i++) {
+    if(d->inbufptr >= SERIAL_MAX_FRAME) {
+      if(cb->overflow) cb->overflow(d, d->inbufptr);
+      d->inbufptr = 0;
+    }
+    c = buf[i];
+    if(d->framing == SERIAL_COBS) {
+      cobs_byte(d, c);
+      continue;
+    }
+    if(d->escaped) {
+      d->escaped = 0;
+      if(c == SLIP_ESC_END) {
+        c = SLIP_END;
+      } else if(c == SLIP_ESC_ESC) {
+        c = SLIP_ESC;
+      }
+    } else if(c == SLIP_ESC) {
+      d->escaped = 1;
+      continue;
+    } else if(c == SLIP_END) {
+      if(d->inbufptr > 0) {
+        cb->frame(d, d->inbuf, d->inbufptr);
+        d->inbufptr = 0;
+      }
+      continue;
+    }
+    d->inbuf[d->inbufptr++] = c;
+
+    if(cb->echo == NULL) {
+      continue;
+    }
+    /* Echo lines as they are received for verbose=2,3,5+ */
+    /* Echo all printable characters for verbose==4 */
+    if((d->verbose == 2) || (d->verbose == 3) || (d->verbose > 4)) {
+      if(c == '\n' && is_sensible_string(d->inbuf, d->inbufptr)) {
+        cb->echo(d, d->inbuf, d->inbufptr);
+        d->inbufptr = 0;
+      }
+    } else if(d->verbose == 4) {
+      if(c == 0 || c == '\r' || c == '\n' || c == '\t' ||
+         (c >= ' ' && c <= '~')) {
+        cb->echo(d, &c, 1);
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+serial_encode(unsigned char *out, const void *packet, int len)
+{
+  const unsigned char *p = packet;
+  unsigned char *o = out;
+  int i;
+
+  for(i = 0; i < len; i++) {
+    switch(p[i]) {
+    case SLIP_END:
+      *o++ = SLIP_ESC;
+      *o++ = SLIP_ESC_END;
+      break;
+    case SLIP_ESC:
+      *o++ = SLIP_ESC;
+      *o++ = SLIP_ESC_ESC;
+      break;
+    default:
+      *o++ = p[i];
+      break;
+    }
+  }
+  *o++ = SLIP_END;
+  return o - out;
+}
+/*---------------------------------------------------------------------------*/
+int
+serial_encode_cobs(unsigned char *out, const void *packet, int len)
+{
+  const unsigned char *p = packet;
+  unsigned short crc = serial_crc16(packet, len);
+  unsigned char trailer[2] = { crc & 0xff, crc >> 8 };
+  unsigned char *o = out + 1, *code = out;
+  int i, c;
+
+  for(i = 0; i < len + 2; i++) {
+    c = i < len ? p[i] : trailer[i - len];
+    if(c == 0) {
+      *code = o - code;
+      code = o++;
+      continue;
+    }
+    *o++ = c;
+    if(o - code == 0xff) {
+      *code = 0xff;
+      code = o++;
+    }
+  }
+  *code = o - code;
+  *o++ = 0;
+  return o - out;
+}
+/*---------------------------------------------------------------------------*/
+int
+serial_hexdump(char *out, const unsigned char *p, int len)
+{
+  char *o = out;
+  int i;
+
+#if WIRESHARK_IMPORT_FORMAT
+  memcpy(o, "0000", 4);
+  o += 4;
+  for(i = 0; i < len; i++) {
+    *o++ = ' ';
+    *o++ = hex[p[i] >> 4];
+    *o++ = hex[p[i] & 15];
+  }
+#else
+  memcpy(o, "         ", 9);
+  o += 9;
+  for(i = 0; i < len; i++) {
+    *o++ = hex[p[i] >> 4];
+    *o++ = hex[p[i] & 15];
+    if((i & 3) == 3) *o++ = ' ';
+    if((i & 15) == 15) {
+      memcpy(o, "\n         ", 10);
+      o += 10;
+    }
+  }
+#endif
+  *o++ = '\n';
+  return o - out;
+}
+/*---------------------------------------------------------------------------*/
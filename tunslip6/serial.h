@@ -0,0 +1,118 @@
+/**
+ * \file
+ *         The serial side of tunslip6, as units that can be measured alone.
+ *
+ *         Decoding the SLIP byte stream into frames, telling what a frame
+ *         is (a packet, a configuration message, debug output), encoding a
+ *         packet and the hex dump of -v5. None of them does any I/O: the
+ *         decoder hands frames and the text it echoes to callbacks, the
+ *         encoder and the dump write to the caller's buffer. tunslip6 does
+ *         the reading, writing and printing; slipbench drives them with
+ *         synthetic or recorded traffic.
+ *
+ *         Frames are SLIP, or once negotiated COBS with a CRC-16 trailer:
+ *         the frame and its CRC (Contiki's crc16_data(), low byte first)
+ *         are COBS encoded and end with a zero byte. COBS adds one byte
+ *         per 254 where SLIP may double the size, and a frame that fails
+ *         its CRC is dropped at the link instead of going to the tun
+ *         device. The host asks with "?FC" in SLIP, preceded by a zero
+ *         byte that ends any COBS frame in progress; a border router built
+ *         with COBS=1 answers "!FC", still in SLIP, and from then on both
+ *         ends use COBS, starting with a zero byte that ends whatever the
+ *         other end took for a COBS frame meanwhile. An older border
+ *         router doesn't answer and the link stays SLIP.
+ */
+
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <stddef.h>
+
+#define SERIAL_MAX_FRAME   2000
+#define DEBUG_LINE_MARKER  '\r'
+
+/* Bytes serial_encode() or serial_encode_cobs() may write for len bytes */
+#define SERIAL_ENCODED_MAX(len) (2 * (len) + 4)
+
+typedef enum {
+  SERIAL_SLIP,
+  SERIAL_COBS                   /* With a CRC-16 */
+} serial_framing_t;
+
+/* The host's request for COBS, the border router answers "!FC" */
+#define SERIAL_COBS_REQUEST "\0\300?FC\300"
+
+/* Bytes serial_hexdump() may write for a packet of len bytes */
+#define SERIAL_HEXDUMP_MAX(len) (3 * (len) + (len) / 4 + 2 * (len) / 16 + 32)
+
+typedef enum {
+  SERIAL_PACKET,                /* To the tun device */
+  SERIAL_MAC,                   /* "!M", the border router's MAC address */
+  SERIAL_PREFIX_REQUEST,        /* "?P" */
+  SERIAL_TIME_REQUEST,          /* "?T", the border router wants our clock */
+  SERIAL_TRACE,                 /* "!R", a trace record (see trace.h) */
+  SERIAL_FRAMING,               /* "!F", the framing the border router took */
+  SERIAL_CONFIG,                /* Another "!" or "?" message */
+  SERIAL_DEBUG,                 /* '\r', debug output of the border router */
+  SERIAL_TEXT                   /* Printable string without the marker */
+} serial_frame_t;
+
+struct serial_decoder;
+
+struct serial_callbacks {
+  /** A complete frame, only valid during the call */
+  void (*frame)(struct serial_decoder *d, unsigned char *frame, int len);
+  /** Text echoed as it is received with verbose 2 to 5 (may be NULL) */
+  void (*echo)(struct serial_decoder *d, const unsigned char *s, int len);
+  /** A frame longer than SERIAL_MAX_FRAME was dropped (may be NULL) */
+  void (*overflow)(struct serial_decoder *d, int len);
+  /** A COBS frame failed its CRC and was dropped (may be NULL) */
+  void (*corrupted)(struct serial_decoder *d, int len);
+};
+
+struct serial_decoder {
+  const struct serial_callbacks *callbacks;
+  int verbose;                  /* tunslip6's -v level, for the echo */
+  void *arg;
+  serial_framing_t framing;     /* May change in the frame callback */
+  int escaped;
+  int inbufptr;
+  unsigned char *inbuf;         /* buf, or the caller's */
+  unsigned char buf[SERIAL_MAX_FRAME];
+};
+
+void serial_decoder_init(struct serial_decoder *d,
+                         const struct serial_callbacks *callbacks,
+                         int verbose, void *arg);
+
+/**
+ * Decode into buf, of SERIAL_MAX_FRAME bytes, from the next frame on.
+ * The frame callback may give a new buffer to keep the frame it got.
+ */
+void serial_decoder_buffer(struct serial_decoder *d, unsigned char *buf);
+
+/** Decode len bytes read from the serial line */
+void serial_decode(struct serial_decoder *d, const unsigned char *buf, int len);
+
+/** What a frame is */
+serial_frame_t serial_classify(const unsigned char *frame, int len);
+
+/** Printable text, the first byte (a marker) is not checked */
+int is_sensible_string(const unsigned char *s, int len);
+
+/** SLIP encode packet into out, with the trailing END; returns the length */
+int serial_encode(unsigned char *out, const void *packet, int len);
+
+/** COBS encode packet and its CRC into out, with the trailing zero */
+int serial_encode_cobs(unsigned char *out, const void *packet, int len);
+
+/** Decode a COBS frame in place; its length without the CRC, -1 if bad */
+int serial_decode_cobs(unsigned char *frame, int len);
+
+/** CRC-16 of Contiki's crc16_data() (CCITT, reflected, starting at 0) */
+unsigned short serial_crc16(const void *data, int len);
+
+/** The -v5 dump of a packet into out, with the newline; returns the length */
+int serial_hexdump(char *out, const unsigned char *p, int len);
+
+#endif /* __SERIAL_H__ */
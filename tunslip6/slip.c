@@ -0,0 +1,280 @@
+/**
+ * \file
+ *         SLIP link to the border router, as a library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "serial.h"
+#include "slip.h"
+
+/*---------------------------------------------------------------------------*/
+static int
+open_tcp(const char *name)
+{
+  struct addrinfo hints, *res, *ai;
+  char host[128];
+  const char *colon = strrchr(name, ':');
+  int fd = -1;
+
+  snprintf(host, sizeof(host), "%.*s", (int)(colon - name), name);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if(getaddrinfo(host, colon + 1, &hints, &res) != 0) {
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+  for(ai = res; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if(fd == -1) continue;
+    if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+/* Same settings as tunslip6's stty_telos(), without flow control */
+static int
+open_serial(const char *name, int baudrate)
+{
+  struct termios tty;
+  int fd, i;
+
+  fd = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if(fd == -1) {
+    return -1;
+  }
+  if(tcgetattr(fd, &tty) == 0) {
+    cfmakeraw(&tty);
+    tty.c_cc[VTIME] = 0;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cflag &= ~(CRTSCTS | HUPCL);
+    tty.c_cflag |= CLOCAL;
+    cfsetispeed(&tty, baudrate);
+    cfsetospeed(&tty, baudrate);
+    tcsetattr(fd, TCSAFLUSH, &tty);
+    i = TIOCM_DTR;
+    ioctl(fd, TIOCMBIS, &i);
+    usleep(10 * 1000);          /* Wait for hardware 10ms. */
+    tcflush(fd, TCIOFLUSH);
+  }
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+void
+slip_link_attach(struct slip_link *l, int fd)
+{
+  l->fd = fd;
+  l->in_len = l->out_begin = l->out_end = 0;
+  l->escaped = l->cobs = 0;
+  l->corrupted = 0;
+  fcntl(l->fd, F_SETFL, O_NONBLOCK);
+  /* Terminate whatever garbage the other end received before */
+  l->out[l->out_end++] = SLIP_END;
+}
+/*---------------------------------------------------------------------------*/
+int
+slip_link_open(struct slip_link *l, const char *name, int baudrate)
+{
+  const char *colon = strrchr(name, ':');
+  int fd;
+
+  if(name[0] != '/' && colon != NULL && colon != name) {
+    fd = open_tcp(name);
+  } else {
+    fd = open_serial(name, baudrate);
+  }
+  if(fd == -1) {
+    l->fd = -1;
+    return -1;
+  }
+  slip_link_attach(l, fd);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+frame_received(struct slip_link *l)
+{
+  uint8_t *f = l->in;
+  int i;
+
+  if(l->in_len >= 40 && (f[0] >> 4) == 6) {
+    l->packet(l->arg, f, l->in_len);
+  } else if(l->control != NULL && (f[0] == '!' || f[0] == '?')) {
+    l->control(l->arg, f, l->in_len);
+  } else if(l->in_len >= 2 && f[0] == '?' && f[1] == 'P') {
+    /* Prefix info requested */
+    uint8_t reply[2 + 8] = { '!', 'P' };
+    for(i = 0; i < 8; i++) reply[2 + i] = l->prefix.s6_addr[i];
+    slip_link_send(l, reply, sizeof(reply));
+  } else if(l->in_len >= 2 + 4 && f[0] == '?' && f[1] == 'T') {
+    /* Time requested: its timestamp back with our clock, as tunslip6 */
+    uint8_t reply[2 + 4 + 8] = { '!', 'T' };
+    struct timespec ts;
+    uint64_t now;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    memcpy(reply + 2, f + 2, 4);
+    for(i = 0; i < 8; i++) reply[6 + i] = now >> (56 - 8 * i);
+    slip_link_send(l, reply, sizeof(reply));
+  } else if(f[0] == DEBUG_LINE_MARKER) {
+    if(l->text) l->text(l->arg, f + 1, l->in_len - 1);
+  } else if(f[0] != '!' && is_sensible_string(f, l->in_len)) {
+    if(l->text) l->text(l->arg, f, l->in_len);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+cobs_byte(struct slip_link *l, uint8_t c)
+{
+  static const uint8_t request[] = SERIAL_COBS_REQUEST;
+  int n;
+
+  if(c == SLIP_END && l->control != NULL && l->in_len == 4 &&
+     memcmp(l->in, request + 1, 4) == 0) {
+    /* The host starts over in SLIP */
+    l->cobs = 0;
+    l->in_len = 3;
+    memmove(l->in, l->in + 1, 3);
+    frame_received(l);
+    l->in_len = 0;
+    return;
+  }
+  if(c != 0) {
+    if(l->in_len == SLIP_MAX_FRAME) {
+      l->in_len = 0;
+    }
+    l->in[l->in_len++] = c;
+    return;
+  }
+  if(l->in_len > 0) {
+    n = serial_decode_cobs(l->in, l->in_len);
+    if(n > 0) {
+      l->in_len = n;
+      frame_received(l);
+    } else {
+      l->corrupted++;
+    }
+    l->in_len = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+slip_link_input(struct slip_link *l)
+{
+  uint8_t buf[4096];
+  ssize_t n, i;
+  uint8_t c;
+
+  n = read(l->fd, buf, sizeof(buf));
+  if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    return -1;
+  }
+  for(i = 0; i < n; i++) {
+    c = buf[i];
+    if(l->cobs) {
+      cobs_byte(l, c);
+      continue;
+    }
+    if(l->escaped) {
+      l->escaped = 0;
+      if(c == SLIP_ESC_END) c = SLIP_END;
+      else if(c == SLIP_ESC_ESC) c = SLIP_ESC;
+    } else if(c == SLIP_ESC) {
+      l->escaped = 1;
+      continue;
+    } else if(c == SLIP_END) {
+      if(l->in_len > 0) {
+        frame_received(l);
+        l->in_len = 0;
+      }
+      continue;
+    }
+    if(l->in_len == SLIP_MAX_FRAME) {
+      /* Too large to be a packet, drop it */
+      l->in_len = 0;
+    }
+    l->in[l->in_len++] = c;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+out_room(struct slip_link *l, int len)
+{
+  if(l->out_begin > 0) {
+    memmove(l->out, l->out + l->out_begin, l->out_end - l->out_begin);
+    l->out_end -= l->out_begin;
+    l->out_begin = 0;
+  }
+  return l->out_end + len <= SLIP_OUT_SIZE;
+}
+/*---------------------------------------------------------------------------*/
+int
+slip_link_send(struct slip_link *l, const void *packet, int len)
+{
+  /* Worst case every byte is escaped */
+  if(!out_room(l, SERIAL_ENCODED_MAX(len))) {
+    return -1;
+  }
+  if(l->cobs) {
+    l->out_end += serial_encode_cobs(l->out + l->out_end, packet, len);
+  } else {
+    l->out_end += serial_encode(l->out + l->out_end, packet, len);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+slip_link_send_raw(struct slip_link *l, const void *bytes, int len)
+{
+  if(!out_room(l, len)) {
+    return -1;
+  }
+  memcpy(l->out + l->out_end, bytes, len);
+  l->out_end += len;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+slip_link_flush(struct slip_link *l)
+{
+  ssize_t n;
+
+  if(!slip_link_pending(l)) {
+    return 0;
+  }
+  n = write(l->fd, l->out + l->out_begin, l->out_end - l->out_begin);
+  if(n < 0) {
+    return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  }
+  l->out_begin += n;
+  if(l->out_begin == l->out_end) {
+    l->out_begin = l->out_end = 0;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+slip_link_close(struct slip_link *l)
+{
+  if(l->fd != -1) {
+    close(l->fd);
+    l->fd = -1;
+  }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,86 @@
+/**
+ * \file
+ *         SLIP link to the border router, as a library.
+ *
+ *         The framing and link logic of tunslip6 for programs that want the
+ *         IPv6 packets of the mesh without a tun device in the way: the link
+ *         is a serial device or the TCP serial socket of Cooja, frames are
+ *         decoded in place in the link's buffer and handed to a callback,
+ *         the border router's prefix and time requests are answered and its
+ *         debug output is passed on as text.
+ *
+ *         The link never blocks: call slip_link_input() when the descriptor
+ *         is readable and slip_link_flush() while slip_link_pending().
+ *
+ *         The same framing serves the border router end of the link (see
+ *         border-router/native): with a control callback the "!" and "?"
+ *         configuration frames go to it instead of being answered. It may
+ *         then take COBS framing (serial.h) by setting cobs once its "!FC"
+ *         answer is queued; a later "?FC" in SLIP takes it back to SLIP
+ *         and to the control callback again.
+ */
+
+#ifndef __SLIP_H__
+#define __SLIP_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define SLIP_END     0300
+#define SLIP_ESC     0333
+#define SLIP_ESC_END 0334
+#define SLIP_ESC_ESC 0335
+
+#define SLIP_MAX_FRAME  2000
+#define SLIP_OUT_SIZE   (16 * 1024)
+
+/** A decoded frame, only valid during the call */
+typedef void (* slip_frame_callback_t)(void *arg, uint8_t *frame, int len);
+
+struct slip_link {
+  int fd;
+  struct in6_addr prefix;       /* Answered to the "?P" requests */
+  slip_frame_callback_t packet; /* IPv6 packets */
+  slip_frame_callback_t text;   /* Debug output of the border router */
+  slip_frame_callback_t control; /* "!" and "?" frames, border router end */
+  void *arg;
+
+  uint8_t in[SLIP_MAX_FRAME];
+  int in_len;
+  int escaped;
+  int cobs;                     /* COBS with a CRC-16 instead of SLIP */
+  unsigned long corrupted;      /* COBS frames that failed their CRC */
+  uint8_t out[SLIP_OUT_SIZE];
+  int out_begin, out_end;
+};
+
+/**
+ * Open the link: "host:port" connects to a TCP serial socket, anything else
+ * is a serial device set to raw mode at baudrate (e.g. B115200). Returns -1
+ * with errno set on failure.
+ */
+int slip_link_open(struct slip_link *l, const char *name, int baudrate);
+
+/** Use an already open descriptor (e.g. a pty) as the link */
+void slip_link_attach(struct slip_link *l, int fd);
+
+/** Read what is available and dispatch the frames; -1 once the link is gone */
+int slip_link_input(struct slip_link *l);
+
+/** Queue an IPv6 packet; -1 if the output buffer has no room for it */
+int slip_link_send(struct slip_link *l, const void *packet, int len);
+
+/**
+ * Queue bytes as they are, outside of any frame (e.g. the zero byte after
+ * switching to COBS); -1 if the output buffer has no room for them
+ */
+int slip_link_send_raw(struct slip_link *l, const void *bytes, int len);
+
+/** Write as much of the queued output as the descriptor takes */
+int slip_link_flush(struct slip_link *l);
+
+#define slip_link_pending(l) ((l)->out_end > (l)->out_begin)
+
+void slip_link_close(struct slip_link *l);
+
+#endif /* __SLIP_H__ */
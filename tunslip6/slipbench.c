@@ -0,0 +1,567 @@
+/**
+ * \file
+ *         Microbenchmarks of tunslip6's serial side.
+ *
+ *         Builds traffic mixes from a fixed seed, so that two builds see
+ *         exactly the same bytes, and times the units of serial.h on them:
+ *         decoding the SLIP stream (with classification of every frame),
+ *         encoding, classifying, is_sensible_string() and the -v5 hex dump.
+ *         Each measurement is repeated and the median kept. The CSV output
+ *         of one build is the baseline of the next one (-c).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "record.h"
+#include "serial.h"
+#include "slip.h"
+
+#define MAX_REPEAT 99
+
+struct mix {
+  const char *name;
+  unsigned char *frames;        /* Raw frames, back to back */
+  int *lengths;
+  int count;
+  size_t bytes;
+  unsigned char *stream;        /* The same frames SLIP encoded */
+  size_t stream_len;
+};
+
+struct baseline {
+  char mix[32], op[32];
+  double ns_per_byte;
+};
+
+static struct baseline *baselines;
+static int baselines_count;
+
+static uint32_t rng = 2463534242U;
+static volatile unsigned long sink;
+
+/*---------------------------------------------------------------------------*/
+static uint32_t
+xorshift(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+clock_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+static void
+mix_add(struct mix *m, const unsigned char *frame, int len)
+{
+  static int size;
+
+  if(m->count == 0) {
+    size = 0;
+  }
+  if(m->count == size) {
+    size = size ? size * 2 : 1024;
+    m->lengths = realloc(m->lengths, size * sizeof(int));
+  }
+  m->frames = realloc(m->frames, m->bytes + len);
+  m->stream = realloc(m->stream, m->stream_len + SERIAL_ENCODED_MAX(len));
+  if(m->lengths == NULL || m->frames == NULL || m->stream == NULL) {
+    err(1, "mix_add");
+  }
+  memcpy(m->frames + m->bytes, frame, len);
+  m->lengths[m->count++] = len;
+  m->bytes += len;
+  m->stream_len += serial_encode(m->stream + m->stream_len, frame, len);
+}
+/*---------------------------------------------------------------------------*/
+/* IPv6 + UDP + a thermostat notification, as the mesh sends them */
+static int
+make_coap(unsigned char *p)
+{
+  int len, plen;
+
+  memset(p, 0, 48);
+  p[0] = 0x60;
+  p[6] = 17;
+  p[7] = 63;
+  p[8] = 0xaa;
+  p[9] = 0xaa;
+  p[16] = 0x02;
+  p[17] = 0x12;
+  p[18] = 0x74;
+  p[19] = xorshift() % 16;
+  p[21] = p[19];
+  p[22] = p[19];
+  p[23] = p[19];
+  p[24] = 0xaa;
+  p[25] = 0xaa;
+  p[39] = 1;
+  p[40] = 0x16;
+  p[41] = 0x33;
+  p[42] = xorshift();
+  p[43] = xorshift();
+  len = 48;
+  p[len++] = 0x52;              /* NON, 2 byte token */
+  p[len++] = 0x45;              /* 2.05 */
+  p[len++] = xorshift();
+  p[len++] = xorshift();
+  p[len++] = xorshift();
+  p[len++] = xorshift();
+  p[len++] = 0x62;              /* Observe */
+  p[len++] = xorshift();
+  p[len++] = xorshift();
+  p[len++] = 0x61;              /* Content-Format */
+  p[len++] = 50;
+  p[len++] = 0xff;
+  len += sprintf((char *)p + len, "{\n\"temperature\":%u\n}",
+                 10 + xorshift() % 25);
+  plen = len - 40;
+  p[4] = p[44] = plen >> 8;
+  p[5] = p[45] = plen & 0xff;
+  p[46] = xorshift();
+  p[47] = xorshift();
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+/* The largest packets a 6LoWPAN mesh reassembles */
+static int
+make_large(unsigned char *p)
+{
+  int i, len = 1280;
+
+  for(i = 0; i < len; i++) {
+    p[i] = xorshift();
+  }
+  p[0] = 0x60;
+  p[4] = (len - 40) >> 8;
+  p[5] = (len - 40) & 0xff;
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+/* Half of the bytes need escaping */
+static int
+make_escape(unsigned char *p)
+{
+  int i, len = 200;
+
+  for(i = 0; i < len; i++) {
+    uint32_t r = xorshift();
+    p[i] = r & 1 ? (r & 2 ? SLIP_END : SLIP_ESC) : r >> 8;
+  }
+  p[0] = 0x60;
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+/* What the border router and the motes print */
+static int
+make_debug(unsigned char *p)
+{
+  static const char *lines[] = {
+    "[SENSING] Temperature: %u\n",
+    "[SIM] Temperature set to %u\n",
+    "[COOLING] started %u\n",
+    "RPL: Sending DIO with rank %u\n",
+  };
+  uint32_t r = xorshift();
+
+  /* Half with the debug marker, half as bare printable strings */
+  p[0] = DEBUG_LINE_MARKER;
+  return (r & 1) + sprintf((char *)p + (r & 1), lines[(r >> 1) % 4],
+                           (r >> 8) % 1000);
+}
+/*---------------------------------------------------------------------------*/
+static void
+build_mix(struct mix *m, const char *name, size_t size,
+          int coap, int large, int escape, int debug)
+{
+  unsigned char frame[SERIAL_MAX_FRAME];
+  int total = coap + large + escape + debug;
+
+  memset(m, 0, sizeof(*m));
+  m->name = name;
+  while(m->bytes < size) {
+    int r = xorshift() % total, len;
+    if((r -= coap) < 0) {
+      len = make_coap(frame);
+    } else if((r -= large) < 0) {
+      len = make_large(frame);
+    } else if((r -= escape) < 0) {
+      len = make_escape(frame);
+    } else {
+      len = make_debug(frame);
+    }
+    mix_add(m, frame, len);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+load_frame(struct serial_decoder *d, unsigned char *frame, int len)
+{
+  mix_add(d->arg, frame, len);
+}
+/*---------------------------------------------------------------------------*/
+/* A recording (tunslip6 -w), or a raw serial byte stream */
+static void
+load_file(struct mix *m, const char *path)
+{
+  static const struct serial_callbacks callbacks = { load_frame };
+  static struct serial_decoder d;
+  static struct record_chunk chunk;
+  struct record r;
+  FILE *f;
+  size_t n;
+
+  memset(m, 0, sizeof(*m));
+  m->name = "file";
+  serial_decoder_init(&d, &callbacks, 0, m);
+  if(record_open(&r, path) == 0) {
+    /* What the border router sent */
+    while(record_read(&r, &chunk) > 0) {
+      if(chunk.dir == RECORD_IN) {
+        serial_decode(&d, chunk.data, chunk.len);
+      }
+    }
+    record_close(&r);
+  } else if((f = fopen(path, "r")) != NULL) {
+    while((n = fread(chunk.data, 1, sizeof(chunk.data), f)) > 0) {
+      serial_decode(&d, chunk.data, n);
+    }
+    fclose(f);
+  } else {
+    err(1, "can't open ``%s''", path);
+  }
+  if(m->count == 0) {
+    errx(1, "no frame in ``%s''", path);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+count_frame(struct serial_decoder *d, unsigned char *frame, int len)
+{
+  sink += serial_classify(frame, len) + len;
+}
+/*---------------------------------------------------------------------------*/
+static void
+run_decode(const struct mix *m)
+{
+  static const struct serial_callbacks callbacks = { count_frame };
+  static struct serial_decoder d;
+
+  serial_decoder_init(&d, &callbacks, 1, NULL);
+  serial_decode(&d, m->stream, m->stream_len);
+}
+/*---------------------------------------------------------------------------*/
+static void
+run_encode(const struct mix *m)
+{
+  static unsigned char out[SERIAL_ENCODED_MAX(SERIAL_MAX_FRAME)];
+  const unsigned char *p = m->frames;
+  int i;
+
+  for(i = 0; i < m->count; p += m->lengths[i++]) {
+    sink += serial_encode(out, p, m->lengths[i]);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+run_classify(const struct mix *m)
+{
+  const unsigned char *p = m->frames;
+  int i;
+
+  for(i = 0; i < m->count; p += m->lengths[i++]) {
+    sink += serial_classify(p, m->lengths[i]);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+run_sensible(const struct mix *m)
+{
+  const unsigned char *p = m->frames;
+  int i;
+
+  for(i = 0; i < m->count; p += m->lengths[i++]) {
+    sink += is_sensible_string(p, m->lengths[i]);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+run_hexdump(const struct mix *m)
+{
+  static char out[SERIAL_HEXDUMP_MAX(SERIAL_MAX_FRAME)];
+  const unsigned char *p = m->frames;
+  int i;
+
+  for(i = 0; i < m->count; p += m->lengths[i++]) {
+    sink += serial_hexdump(out, p, m->lengths[i]);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static const struct {
+  const char *name;
+  void (*run)(const struct mix *m);
+  int stream;                   /* Measured per byte of the encoded stream */
+} ops[] = {
+  { "decode", run_decode, 1 },
+  { "encode", run_encode, 0 },
+  { "classify", run_classify, 0 },
+  { "sensible", run_sensible, 0 },
+  { "hexdump", run_hexdump, 0 },
+};
+/*---------------------------------------------------------------------------*/
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+/*---------------------------------------------------------------------------*/
+static void
+load_baseline(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[256];
+  struct baseline b;
+
+  if(f == NULL) {
+    err(1, "can't open ``%s''", path);
+  }
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if(sscanf(line, "%31[^,],%31[^,],%*[^,],%*[^,],%lf", b.mix, b.op,
+              &b.ns_per_byte) != 3) {
+      continue;                 /* The header */
+    }
+    baselines = realloc(baselines, (baselines_count + 1) * sizeof(b));
+    if(baselines == NULL) err(1, "load_baseline");
+    baselines[baselines_count++] = b;
+  }
+  fclose(f);
+}
+/*---------------------------------------------------------------------------*/
+static void
+bench(const struct mix *m, int op, int repeat)
+{
+  uint64_t t[MAX_REPEAT], start;
+  size_t bytes = ops[op].stream ? m->stream_len : m->bytes;
+  double ns, ns_per_byte;
+  int i;
+
+  ops[op].run(m);               /* Warm the caches up */
+  for(i = 0; i < repeat; i++) {
+    start = clock_ns();
+    ops[op].run(m);
+    t[i] = clock_ns() - start;
+  }
+  qsort(t, repeat, sizeof(t[0]), compare_u64);
+  ns = t[repeat / 2];
+  ns_per_byte = ns / bytes;
+  printf("%s,%s,%zu,%d,%.4f,%.0f", m->name, ops[op].name, bytes, m->count,
+         ns_per_byte, m->count * 1e9 / ns);
+  if(baselines_count > 0) {
+    for(i = 0; i < baselines_count; i++) {
+      if(strcmp(baselines[i].mix, m->name) == 0 &&
+         strcmp(baselines[i].op, ops[op].name) == 0) {
+        printf(",%.4f,%+.1f", baselines[i].ns_per_byte,
+               100 * (ns_per_byte / baselines[i].ns_per_byte - 1));
+        break;
+      }
+    }
+    if(i == baselines_count) printf(",,");
+  }
+  printf("\n");
+  fflush(stdout);
+}
+/*---------------------------------------------------------------------------*/
+/* Encode and decode packet; with flips, no bit flipped on the line gets by */
+static int
+cobs_check(const char *name, const unsigned char *packet, int len, int flips)
+{
+  static unsigned char out[SERIAL_ENCODED_MAX(SERIAL_MAX_FRAME)];
+  int n, i, bit;
+
+  n = serial_encode_cobs(out, packet, len);
+  if(memchr(out, 0, n - 1) != NULL || out[n - 1] != 0) {
+    warnx("%s: encoded with a zero inside or not at the end", name);
+    return 1;
+  }
+  if(serial_decode_cobs(out, n - 1) != len || memcmp(out, packet, len) != 0) {
+    warnx("%s: decoded differently", name);
+    return 1;
+  }
+  for(i = 0; flips && i < n - 1; i++) {
+    for(bit = 0; bit < 8; bit++) {
+      serial_encode_cobs(out, packet, len);
+      out[i] ^= 1 << bit;
+      /* A zero ends the frame on the line, the decoder never sees it */
+      if(out[i] != 0 && serial_decode_cobs(out, n - 1) != -1) {
+        warnx("%s: bit %d of byte %d flipped and not detected", name, bit, i);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Known vectors of the COBS framing and its CRC, the number of failures */
+static int
+selftest(void)
+{
+  static unsigned char packet[SERIAL_MAX_FRAME], out[SERIAL_MAX_FRAME];
+  static const unsigned char empty[] = { 0x01, 0x01, 0x01, 0x00 };
+  static const int runs[] = { 251, 252, 253, 254, 255, 506, 507, 508, 509 };
+  unsigned short crc;
+  int failed = 0, i, len, n;
+
+  /* Contiki's crc16_data(), i.e. CRC-16/KERMIT */
+  if((crc = serial_crc16("123456789", 9)) != 0x2189) {
+    warnx("crc: 0x%04x for \"123456789\", not 0x2189", crc);
+    failed++;
+  }
+
+  /* No data and a CRC of zero: three empty blocks */
+  n = serial_encode_cobs(out, packet, 0);
+  if(n != sizeof(empty) || memcmp(out, empty, n) != 0) {
+    warnx("empty: wrong encoding");
+    failed++;
+  }
+  failed += cobs_check("empty", packet, 0, 1);
+
+  /* One byte of the CRC zero, the low then the high one */
+  for(i = 0; i < 2; i++) {
+    for(n = 1; n < 0x10000; n++) {
+      packet[0] = n >> 8;
+      packet[1] = n;
+      crc = serial_crc16(packet, 2);
+      if((crc & 0xff) == 0 && i == 0 && crc != 0) break;
+      if((crc >> 8) == 0 && i == 1 && crc != 0) break;
+    }
+    failed += cobs_check(i == 0 ? "crc low zero" : "crc high zero",
+                         packet, 2, 1);
+  }
+
+  /* Runs without a zero around the longest block, 254 bytes */
+  for(n = 0; n < (int)(sizeof(runs) / sizeof(runs[0])); n++) {
+    for(i = 0; i < runs[n]; i++) {
+      packet[i] = 1 + i % 255;
+    }
+    failed += cobs_check("run", packet, runs[n], 1);
+  }
+
+  /* Nothing but zeros */
+  memset(packet, 0, 300);
+  failed += cobs_check("zeros", packet, 300, 1);
+
+  /*
+   * The frame ending in a full block, without the code of an empty one
+   * after it: 252 bytes and their CRC, none of them zero.
+   */
+  for(n = 0; ; n++) {
+    for(i = 0; i < 252; i++) {
+      packet[i] = 1 + (i + n) % 255;
+    }
+    crc = serial_crc16(packet, 252);
+    if((crc & 0xff) != 0 && (crc >> 8) != 0) break;
+  }
+  out[0] = 0xff;
+  memcpy(out + 1, packet, 252);
+  out[253] = crc & 0xff;
+  out[254] = crc >> 8;
+  if(serial_decode_cobs(out, 255) != 252 || memcmp(out, packet, 252) != 0) {
+    warnx("trailing full block: decoded differently");
+    failed++;
+  }
+
+  /* Random frames, a quarter of the bytes zero */
+  for(n = 0; n < 1000; n++) {
+    len = xorshift() % 1281;
+    for(i = 0; i < len; i++) {
+      packet[i] = xorshift() % 4 ? xorshift() : 0;
+    }
+    failed += cobs_check("random", packet, len, 0);
+  }
+  return failed;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  const char *file = NULL, *only = NULL;
+  size_t size = 4 << 20;
+  struct mix mixes[6];
+  int repeat = 9, count = 0, c, i, op;
+
+  while((c = getopt(argc, argv, "c:f:m:n:s:th")) != -1) {
+    switch(c) {
+    case 'c':
+      load_baseline(optarg);
+      break;
+    case 'f':
+      file = optarg;
+      break;
+    case 'm':
+      only = optarg;
+      break;
+    case 'n':
+      repeat = atoi(optarg);
+      if(repeat < 1) repeat = 1;
+      if(repeat > MAX_REPEAT) repeat = MAX_REPEAT;
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      if(selftest() > 0) {
+        errx(1, "COBS framing self test failed");
+      }
+      printf("COBS framing self test passed\n");
+      return 0;
+    case '?':
+    case 'h':
+    default:
+fprintf(stderr,"usage:  %s [options]\n", prog);
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -c baseline  Compare with the CSV output of another build\n");
+fprintf(stderr," -f file      Also measure a recording (tunslip6 -w) or raw serial bytes\n");
+fprintf(stderr," -m mix       Only this mix: coap, large, escape, debug, mixed, file\n");
+fprintf(stderr," -n repeat    Measurements per result, the median is kept (default 9)\n");
+fprintf(stderr," -s bytes     Size of each synthetic mix (default 4 MiB)\n");
+fprintf(stderr," -t           Check the COBS framing and its CRC on known vectors\n");
+exit(1);
+      break;
+    }
+  }
+
+  build_mix(&mixes[count++], "coap", size, 1, 0, 0, 0);
+  build_mix(&mixes[count++], "large", size, 0, 1, 0, 0);
+  build_mix(&mixes[count++], "escape", size, 0, 0, 1, 0);
+  build_mix(&mixes[count++], "debug", size, 0, 0, 0, 1);
+  build_mix(&mixes[count++], "mixed", size, 80, 5, 0, 15);
+  if(file != NULL) {
+    load_file(&mixes[count++], file);
+  }
+
+  printf("mix,op,bytes,packets,ns_per_byte,packets_per_s%s\n",
+         baselines_count ? ",baseline_ns_per_byte,change_pct" : "");
+  for(i = 0; i < count; i++) {
+    if(only != NULL && strcmp(only, mixes[i].name) != 0) continue;
+    for(op = 0; op < (int)(sizeof(ops) / sizeof(ops[0])); op++) {
+      bench(&mixes[i], op, repeat);
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,633 @@
+/**
+ * \file
+ *         Serial link impairment proxy.
+ *
+ *         Sits between a host (tunslip6, the gateway) and the border
+ *         router's serial link: the host opens a pseudo-terminal (-L) or
+ *         connects to a TCP port (-l), the border router is a device or
+ *         pseudo-terminal (-s) or Cooja's serial socket server (-a/-p).
+ *         Each direction has its own impairments:
+ *
+ *         - baud: bytes leave one by one, 10 bit times apart (8N1)
+ *         - delay, jitter, dist: latency drawn once per SLIP frame, from a
+ *           uniform (delay +- jitter), normal (standard deviation jitter)
+ *           or Pareto (heavy tailed, mean extra delay jitter) distribution.
+ *           A serial line doesn't reorder, so a frame never overtakes the
+ *           previous one
+ *         - ber, loss: bit errors and lost bytes, as a UART overrun drops them
+ *         - stall: the line stops for a while, at exponentially distributed
+ *           intervals
+ *
+ *         Cuts (-x) make the line dead in both directions; with -c the
+ *         host's TCP connection is closed as well. All random draws come
+ *         from generators seeded by -S, one per direction and purpose, so a
+ *         run with the same seed and the same traffic sees the same errors,
+ *         losses and frame latencies.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <err.h>
+
+#include "slip.h"
+
+#define QUEUE_SIZE (1 << 18)    /* Bytes in flight per direction */
+
+enum { DIST_UNIFORM, DIST_NORMAL, DIST_PARETO };
+
+struct impairment {
+  double baud;                  /* 0 for unlimited */
+  double delay, jitter;         /* Microseconds */
+  int dist;
+  double ber, loss;
+  double stall_every, stall_for; /* Microseconds */
+};
+
+struct direction {
+  const char *name;
+  struct impairment conf;
+  uint64_t rng_bytes, rng_frames, rng_stalls;
+  struct {
+    uint64_t due;
+    unsigned char c;
+  } *queue;
+  unsigned head, tail;
+  int frame_start;
+  double frame_delay;
+  double last_due;              /* Of the last queued byte */
+  double stall_start;
+  struct {
+    uint64_t in, out, corrupted, lost, cut, stalls, max_queue;
+  } stats;
+};
+
+static struct direction to_host = { "to the host" };
+static struct direction to_mote = { "to the border router" };
+static uint64_t start, cut_start, cut_end;
+static double cut_every, cut_for;
+static uint64_t rng_cuts;
+static int cuts, close_on_cut;
+static volatile sig_atomic_t report_now, quit;
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+clock_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+splitmix(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+/*---------------------------------------------------------------------------*/
+/* Uniform in [0, 1) */
+static double
+uniform(uint64_t *rng)
+{
+  return (splitmix(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+/*---------------------------------------------------------------------------*/
+static double
+exponential(uint64_t *rng, double mean)
+{
+  return -mean * log(1 - uniform(rng));
+}
+/*---------------------------------------------------------------------------*/
+static double
+frame_latency(struct direction *d)
+{
+  const struct impairment *c = &d->conf;
+  double u, v, l;
+
+  switch(c->dist) {
+  case DIST_NORMAL:
+    u = uniform(&d->rng_frames);
+    v = uniform(&d->rng_frames);
+    l = c->delay + c->jitter * sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+    break;
+  case DIST_PARETO:
+    /* Shape 1.5, scaled so that the mean is jitter */
+    l = c->delay + c->jitter / 3 * pow(1 - uniform(&d->rng_frames), -1 / 1.5);
+    break;
+  default:
+    l = c->delay + c->jitter * (2 * uniform(&d->rng_frames) - 1);
+    break;
+  }
+  return l < 0 ? 0 : l;
+}
+/*---------------------------------------------------------------------------*/
+static void
+direction_init(struct direction *d, uint64_t seed)
+{
+  d->rng_bytes = seed * 3 + 1;
+  d->rng_frames = seed * 3 + 2;
+  d->rng_stalls = seed * 3 + 3;
+  d->queue = calloc(QUEUE_SIZE, sizeof(*d->queue));
+  if(d->queue == NULL) {
+    err(1, "direction_init");
+  }
+  d->frame_start = 1;
+  d->last_due = start;
+  if(d->conf.stall_for > 0) {
+    d->stall_start = start + exponential(&d->rng_stalls, d->conf.stall_every);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+queue_space(const struct direction *d)
+{
+  return QUEUE_SIZE - (d->tail - d->head);
+}
+/*---------------------------------------------------------------------------*/
+/* Impair bytes read at time now and queue them */
+static void
+direction_input(struct direction *d, const unsigned char *buf, int len,
+                uint64_t now)
+{
+  const struct impairment *c = &d->conf;
+  double p_byte = 1 - pow(1 - c->ber, 8), due;
+  unsigned char b;
+  int i;
+
+  d->stats.in += len;
+  if(cuts && now >= cut_start && now < cut_end) {
+    d->stats.cut += len;
+    return;
+  }
+  for(i = 0; i < len; i++) {
+    b = buf[i];
+    if(d->frame_start) {
+      d->frame_delay = frame_latency(d);
+      d->frame_start = 0;
+    }
+    if(b == SLIP_END) {
+      d->frame_start = 1;
+    }
+    if(c->loss > 0 && uniform(&d->rng_bytes) < c->loss) {
+      d->stats.lost++;
+      continue;
+    }
+    if(p_byte > 0 && uniform(&d->rng_bytes) < p_byte) {
+      b ^= 1 << (splitmix(&d->rng_bytes) & 7);
+      d->stats.corrupted++;
+    }
+    due = now + d->frame_delay;
+    if(c->baud > 0 && due < d->last_due + 10e6 / c->baud) {
+      due = d->last_due + 10e6 / c->baud;
+    } else if(due < d->last_due) {
+      due = d->last_due;
+    }
+    while(c->stall_for > 0 && due >= d->stall_start) {
+      if(due < d->stall_start + c->stall_for) {
+        due = d->stall_start + c->stall_for;
+        d->stats.stalls++;
+      }
+      d->stall_start += c->stall_for +
+        exponential(&d->rng_stalls, c->stall_every);
+    }
+    d->last_due = due;
+    d->queue[d->tail % QUEUE_SIZE].due = due;
+    d->queue[d->tail % QUEUE_SIZE].c = b;
+    d->tail++;
+  }
+  if(d->tail - d->head > d->stats.max_queue) {
+    d->stats.max_queue = d->tail - d->head;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Write the bytes that are due, returns when the next one is (0 if none) */
+static uint64_t
+direction_output(struct direction *d, int fd, uint64_t now)
+{
+  unsigned char buf[4096];
+  int n = 0;
+  ssize_t w;
+
+  while(d->head + n != d->tail && n < (int)sizeof(buf) &&
+        d->queue[(d->head + n) % QUEUE_SIZE].due <= now) {
+    buf[n] = d->queue[(d->head + n) % QUEUE_SIZE].c;
+    n++;
+  }
+  if(n > 0 && fd != -1) {
+    w = write(fd, buf, n);
+    if(w == -1 && (errno == EAGAIN || errno == EINTR)) {
+      return now + 1000;        /* The reader is behind, try again soon */
+    } else if(w == -1) {
+      w = n;                    /* The peer has gone, the bytes are lost */
+    }
+    if(w > 0) {
+      d->head += w;
+      d->stats.out += w;
+    }
+  } else if(n > 0) {
+    d->head += n;
+  }
+  if(d->head == d->tail) {
+    return 0;
+  }
+  return d->queue[d->head % QUEUE_SIZE].due;
+}
+/*---------------------------------------------------------------------------*/
+static void
+parse_impairment(const char *spec, struct impairment *a,
+                 struct impairment *b)
+{
+  char *copy = strdup(spec), *key, *value, *save = NULL;
+  struct impairment c = *a;
+
+  for(key = strtok_r(copy, ",", &save); key != NULL;
+      key = strtok_r(NULL, ",", &save)) {
+    if((value = strchr(key, '=')) == NULL) {
+      errx(1, "``%s'': expected key=value", key);
+    }
+    *value++ = '\0';
+    if(strcmp(key, "baud") == 0) {
+      c.baud = atof(value);
+    } else if(strcmp(key, "delay") == 0) {
+      c.delay = atof(value) * 1000;
+    } else if(strcmp(key, "jitter") == 0) {
+      c.jitter = atof(value) * 1000;
+    } else if(strcmp(key, "dist") == 0) {
+      if(strcmp(value, "uniform") == 0) {
+        c.dist = DIST_UNIFORM;
+      } else if(strcmp(value, "normal") == 0) {
+        c.dist = DIST_NORMAL;
+      } else if(strcmp(value, "pareto") == 0) {
+        c.dist = DIST_PARETO;
+      } else {
+        errx(1, "unknown distribution ``%s''", value);
+      }
+    } else if(strcmp(key, "ber") == 0) {
+      c.ber = atof(value);
+    } else if(strcmp(key, "loss") == 0) {
+      c.loss = atof(value);
+    } else if(strcmp(key, "stall") == 0) {
+      if(sscanf(value, "%lf:%lf", &c.stall_every, &c.stall_for) != 2) {
+        errx(1, "stall=every:ms expected");
+      }
+      c.stall_every *= 1000;
+      c.stall_for *= 1000;
+    } else {
+      errx(1, "unknown impairment ``%s''", key);
+    }
+  }
+  *a = c;
+  if(b != NULL) {
+    *b = c;
+  }
+  free(copy);
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_pty(const char *link, int *slave)
+{
+  struct termios tty;
+  int master;
+  char *name;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master == -1 || grantpt(master) == -1 || unlockpt(master) == -1 ||
+     (name = ptsname(master)) == NULL) {
+    err(1, "can't open a pseudo-terminal");
+  }
+  /* Keep the slave open so that the master doesn't hang up */
+  *slave = open(name, O_RDWR | O_NOCTTY);
+  if(*slave == -1 || tcgetattr(*slave, &tty) == -1) {
+    err(1, "can't open %s", name);
+  }
+  cfmakeraw(&tty);
+  tcsetattr(*slave, TCSANOW, &tty);
+  if(link != NULL) {
+    unlink(link);
+    if(symlink(name, link) == -1) {
+      err(1, "can't link %s to %s", link, name);
+    }
+  }
+  fprintf(stderr, "*** host side on %s%s%s\n", name,
+          link ? " linked from " : "", link ? link : "");
+  return master;
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_listener(int port)
+{
+  struct sockaddr_in6 sa;
+  int s, on = 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(port);
+  sa.sin6_addr = in6addr_any;
+  if((s = socket(AF_INET6, SOCK_STREAM, 0)) == -1 ||
+     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+     bind(s, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+     listen(s, 1) == -1) {
+    err(1, "can't listen on port %d", port);
+  }
+  fprintf(stderr, "*** host side on port %d\n", port);
+  return s;
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_mote(const char *dev, const char *host, const char *port)
+{
+  struct addrinfo hints, *res, *p;
+  struct termios tty;
+  int fd = -1, rv;
+
+  if(dev != NULL) {
+    if((fd = open(dev, O_RDWR | O_NOCTTY)) == -1) {
+      err(1, "can't open ``%s''", dev);
+    }
+    if(tcgetattr(fd, &tty) == 0) {
+      cfmakeraw(&tty);
+      tcsetattr(fd, TCSANOW, &tty);
+    }
+    fprintf(stderr, "*** border router on ``%s''\n", dev);
+    return fd;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if((rv = getaddrinfo(host, port, &hints, &res)) != 0) {
+    errx(1, "getaddrinfo: %s", gai_strerror(rv));
+  }
+  for(p = res; p != NULL; p = p->ai_next) {
+    if((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+      continue;
+    }
+    if(connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if(fd == -1) {
+    err(1, "can't connect to ``%s:%s''", host, port);
+  }
+  fprintf(stderr, "*** border router on ``%s:%s''\n", host, port);
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+static void
+report(struct direction *d)
+{
+  fprintf(stderr, "*** %.1f s %s: %llu bytes in, %llu out, %llu corrupted, "
+          "%llu lost, %llu cut, %llu stalls, %llu queued at most\n",
+          (clock_us() - start) / 1e6, d->name,
+          (unsigned long long)d->stats.in, (unsigned long long)d->stats.out,
+          (unsigned long long)d->stats.corrupted,
+          (unsigned long long)d->stats.lost,
+          (unsigned long long)d->stats.cut,
+          (unsigned long long)d->stats.stalls,
+          (unsigned long long)d->stats.max_queue);
+}
+/*---------------------------------------------------------------------------*/
+static void
+sigreport(int signo)
+{
+  if(signo == SIGALRM) {
+    report_now = 1;
+  } else {
+    quit = 1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Read from fd into d, returns 0 when the peer has gone */
+static int
+link_input(struct direction *d, int fd, uint64_t now)
+{
+  unsigned char buf[4096];
+  int space = queue_space(d);
+  ssize_t n;
+
+  if(space <= 0) {
+    return 1;
+  }
+  n = read(fd, buf, space < (int)sizeof(buf) ? space : (int)sizeof(buf));
+  if(n > 0) {
+    direction_input(d, buf, n, now);
+  } else if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+    return 0;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  const char *link = NULL, *dev = NULL, *host = NULL, *port = NULL;
+  struct pollfd pfd[3];
+  struct timespec ts;
+  struct sigaction sa;
+  uint64_t seed = 1, now, next, due;
+  int listen_port = 0, interval = 0;
+  int listener = -1, hostfd = -1, motefd, slave = -1;
+  int c, n;
+
+  while((c = getopt(argc, argv, "a:b:cd:hL:l:p:S:s:u:v:x:")) != -1) {
+    switch(c) {
+    case 'a':
+      host = optarg;
+      break;
+    case 'b':
+      parse_impairment(optarg, &to_host.conf, &to_mote.conf);
+      break;
+    case 'c':
+      close_on_cut = 1;
+      break;
+    case 'd':
+      parse_impairment(optarg, &to_host.conf, NULL);
+      break;
+    case 'L':
+      link = optarg;
+      break;
+    case 'l':
+      listen_port = atoi(optarg);
+      break;
+    case 'p':
+      port = optarg;
+      break;
+    case 'S':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    case 's':
+      dev = optarg;
+      break;
+    case 'u':
+      parse_impairment(optarg, &to_mote.conf, NULL);
+      break;
+    case 'v':
+      interval = atoi(optarg);
+      break;
+    case 'x':
+      if(sscanf(optarg, "%lf:%lf", &cut_every, &cut_for) != 2) {
+        errx(1, "-x every:ms expected");
+      }
+      cut_every *= 1000;
+      cut_for *= 1000;
+      cuts = 1;
+      break;
+    case '?':
+    case 'h':
+    default:
+      goto usage;
+    }
+  }
+  if(optind != argc || (dev == NULL) == (host == NULL || port == NULL)) {
+usage:
+fprintf(stderr,"usage:  %s [options] -s siodev | -a serveraddr -p serverport\n", prog);
+fprintf(stderr,"example: slipimpair -L /tmp/slow-tty -b baud=38400,ber=1e-5 -a 127.0.0.1 -p 60001\n");
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -s siodev      Border router on a serial device or pseudo-terminal\n");
+fprintf(stderr," -a serveraddr  Border router on Cooja's serial socket server\n");
+fprintf(stderr," -p serverport  \n");
+fprintf(stderr," -L link        Host side on a pseudo-terminal, linked from link\n");
+fprintf(stderr," -l port        Host side on a TCP port instead, for tunslip6 -a\n");
+fprintf(stderr," -b spec        Impairments in both directions\n");
+fprintf(stderr," -u spec        Impairments to the border router\n");
+fprintf(stderr," -d spec        Impairments to the host\n");
+fprintf(stderr,"                spec is a comma separated list of\n");
+fprintf(stderr,"                baud=rate, delay=ms, jitter=ms,\n");
+fprintf(stderr,"                dist=uniform|normal|pareto, ber=rate, loss=rate,\n");
+fprintf(stderr,"                stall=every:ms (mean interval and length)\n");
+fprintf(stderr," -x every:ms    Cut the line at this mean interval, for ms\n");
+fprintf(stderr," -c             Close the host's TCP connection at each cut\n");
+fprintf(stderr," -S seed        Seed of the random draws (default 1)\n");
+fprintf(stderr," -v seconds     Print statistics at this interval\n");
+exit(1);
+  }
+
+  motefd = open_mote(dev, host, port);
+  if(listen_port) {
+    listener = open_listener(listen_port);
+  } else {
+    hostfd = open_pty(link, &slave);
+  }
+  fcntl(motefd, F_SETFL, O_NONBLOCK);
+  if(hostfd != -1) {
+    fcntl(hostfd, F_SETFL, O_NONBLOCK);
+  }
+
+  start = clock_us();
+  direction_init(&to_host, seed);
+  direction_init(&to_mote, seed + 1000);
+  rng_cuts = seed * 3;
+  if(cuts) {
+    cut_start = start + exponential(&rng_cuts, cut_every);
+    cut_end = cut_start + cut_for;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sigreport;
+  sigaction(SIGALRM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  if(interval > 0) {
+    struct itimerval it = { { interval, 0 }, { interval, 0 } };
+    setitimer(ITIMER_REAL, &it, NULL);
+  }
+
+  while(!quit) {
+    now = clock_us();
+    if(cuts && now >= cut_end) {
+      cut_start = cut_end + exponential(&rng_cuts, cut_every);
+      cut_end = cut_start + cut_for;
+    }
+    if(cuts && close_on_cut && hostfd != -1 && listener != -1 &&
+       now >= cut_start && now < cut_end) {
+      close(hostfd);
+      hostfd = -1;
+    }
+    if(report_now) {
+      report(&to_mote);
+      report(&to_host);
+      report_now = 0;
+    }
+
+    next = 0;
+    if((due = direction_output(&to_host, hostfd, now)) != 0) {
+      next = due;
+    }
+    if((due = direction_output(&to_mote, motefd, now)) != 0 &&
+       (next == 0 || due < next)) {
+      next = due;
+    }
+    if(cuts && (next == 0 || cut_end < next)) {
+      next = cut_end;
+    }
+
+    n = 0;
+    pfd[n].fd = motefd;
+    pfd[n++].events = POLLIN;
+    if(hostfd != -1) {
+      pfd[n].fd = hostfd;
+      pfd[n++].events = POLLIN;
+    } else if(listener != -1) {
+      pfd[n].fd = listener;
+      pfd[n++].events = POLLIN;
+    }
+    now = clock_us();
+    ts.tv_sec = next > now ? (next - now) / 1000000 : 0;
+    ts.tv_nsec = next > now ? (next - now) % 1000000 * 1000 : 0;
+    if(ppoll(pfd, n, next == 0 ? NULL : &ts, NULL) == -1) {
+      if(errno == EINTR) continue;
+      err(1, "poll");
+    }
+
+    now = clock_us();
+    if((pfd[0].revents & (POLLIN | POLLHUP)) &&
+       !link_input(&to_host, motefd, now)) {
+      fprintf(stderr, "*** the border router has gone\n");
+      break;
+    }
+    if(n > 1 && (pfd[1].revents & (POLLIN | POLLHUP))) {
+      if(hostfd == -1) {
+        if((hostfd = accept(listener, NULL, NULL)) != -1) {
+          fcntl(hostfd, F_SETFL, O_NONBLOCK);
+          fprintf(stderr, "*** host connected\n");
+        }
+      } else if(!link_input(&to_mote, hostfd, now)) {
+        fprintf(stderr, "*** host disconnected\n");
+        close(hostfd);
+        hostfd = -1;
+        if(listener == -1) {
+          break;
+        }
+      }
+    }
+  }
+  report(&to_mote);
+  report(&to_host);
+  if(link != NULL) {
+    unlink(link);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
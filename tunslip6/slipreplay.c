@@ -0,0 +1,324 @@
+/**
+ * \file
+ *         Replay a recording of the serial line (tunslip6 -w) to a host.
+ *
+ *         Plays the border router: the bytes it sent are written, at their
+ *         recorded times divided by the speed factor (or as fast as the
+ *         host reads them), to a pseudo-terminal for tunslip6 -s or the
+ *         gateway, or to a TCP connection as Cooja's serial socket server
+ *         does for tunslip6 -a. What the host writes back is read and
+ *         counted against what it wrote during the recording. Replay starts
+ *         when the host first writes, as both send END when they open the
+ *         link.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <err.h>
+
+#include "record.h"
+#include "serial.h"
+
+struct count {
+  uint64_t bytes;
+  uint64_t frames;
+  struct serial_decoder decoder;
+};
+
+static struct count replayed, recorded_out, host_out;
+static uint64_t lag_total, lag_max, chunks;
+static int slave = -1;
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+clock_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+static void
+count_frame(struct serial_decoder *d, unsigned char *frame, int len)
+{
+  ((struct count *)d->arg)->frames++;
+}
+/*---------------------------------------------------------------------------*/
+static void
+count_init(struct count *c)
+{
+  static const struct serial_callbacks callbacks = { count_frame };
+
+  memset(c, 0, sizeof(*c));
+  serial_decoder_init(&c->decoder, &callbacks, 0, c);
+}
+/*---------------------------------------------------------------------------*/
+static void
+count_bytes(struct count *c, const unsigned char *buf, int len)
+{
+  c->bytes += len;
+  serial_decode(&c->decoder, buf, len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_pty(const char *link)
+{
+  struct termios tty;
+  int master;
+  char *name;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master == -1 || grantpt(master) == -1 || unlockpt(master) == -1 ||
+     (name = ptsname(master)) == NULL) {
+    err(1, "can't open a pseudo-terminal");
+  }
+  /* Keep the slave open so that the master doesn't hang up */
+  slave = open(name, O_RDWR | O_NOCTTY);
+  if(slave == -1 || tcgetattr(slave, &tty) == -1) {
+    err(1, "can't open %s", name);
+  }
+  cfmakeraw(&tty);
+  tcsetattr(slave, TCSANOW, &tty);
+  if(link != NULL) {
+    unlink(link);
+    if(symlink(name, link) == -1) {
+      err(1, "can't link %s to %s", link, name);
+    }
+  }
+  fprintf(stderr, "*** replaying on %s%s%s\n", name,
+          link ? " linked from " : "", link ? link : "");
+  return master;
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_server(int port)
+{
+  struct sockaddr_in6 sa;
+  int s, fd, on = 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_port = htons(port);
+  sa.sin6_addr = in6addr_any;
+  if((s = socket(AF_INET6, SOCK_STREAM, 0)) == -1 ||
+     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+     bind(s, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+     listen(s, 1) == -1) {
+    err(1, "can't listen on port %d", port);
+  }
+  fprintf(stderr, "*** replaying on port %d\n", port);
+  if((fd = accept(s, NULL, NULL)) == -1) {
+    err(1, "accept");
+  }
+  close(s);
+  return fd;
+}
+/*---------------------------------------------------------------------------*/
+/* Read what the host wrote, returns 0 when it has gone */
+static int
+host_input(int fd)
+{
+  unsigned char buf[4096];
+  ssize_t n;
+
+  for(;;) {
+    n = read(fd, buf, sizeof(buf));
+    if(n > 0) {
+      count_bytes(&host_out, buf, n);
+    } else if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      return 0;
+    } else {
+      return 1;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Wait until the host writes, or until deadline (0 for ever) */
+static int
+host_wait(int fd, uint64_t deadline)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  struct timespec ts, *timeout = NULL;
+  uint64_t now;
+
+  if(deadline != 0) {
+    now = clock_us();
+    if(now >= deadline) {
+      return 1;
+    }
+    ts.tv_sec = (deadline - now) / 1000000;
+    ts.tv_nsec = (deadline - now) % 1000000 * 1000;
+    timeout = &ts;
+  }
+  if(ppoll(&pfd, 1, timeout, NULL) > 0) {
+    return host_input(fd);
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Write a chunk once it is due, reading from the host meanwhile */
+static int
+replay_chunk(int fd, const struct record_chunk *c, uint64_t due)
+{
+  struct pollfd pfd = { fd, POLLIN | POLLOUT, 0 };
+  uint64_t now;
+  int off = 0;
+  ssize_t n;
+
+  while((now = clock_us()) < due) {
+    if(!host_wait(fd, due)) {
+      return 0;
+    }
+  }
+  while(off < c->len) {
+    if(ppoll(&pfd, 1, NULL, NULL) == -1 && errno != EINTR) {
+      err(1, "poll");
+    }
+    if((pfd.revents & (POLLIN | POLLHUP)) && !host_input(fd)) {
+      return 0;
+    }
+    if(pfd.revents & POLLOUT) {
+      n = write(fd, c->data + off, c->len - off);
+      if(n == -1 && errno != EAGAIN && errno != EINTR) {
+        return 0;
+      }
+      if(n > 0) {
+        count_bytes(&replayed, c->data + off, n);
+        off += n;
+      }
+    }
+  }
+  now = clock_us();
+  if(due != 0 && now > due) {
+    lag_total += now - due;
+    if(now - due > lag_max) lag_max = now - due;
+  }
+  chunks++;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  static struct record_chunk chunk;
+  struct record r;
+  const char *prog = argv[0];
+  const char *link = NULL;
+  double speed = 1;
+  uint64_t start, end, base, recorded = 0;
+  int port = 0, loops = 1, immediate = 0, linger = 1000;
+  int fd, c, loop, ret = 1, alive = 1;
+
+  while((c = getopt(argc, argv, "iL:l:p:t:x:h")) != -1) {
+    switch(c) {
+    case 'i':
+      immediate = 1;
+      break;
+    case 'L':
+      link = optarg;
+      break;
+    case 'l':
+      loops = atoi(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 't':
+      linger = atoi(optarg);
+      break;
+    case 'x':
+      speed = atof(optarg);
+      break;
+    case '?':
+    case 'h':
+    default:
+      goto usage;
+    }
+  }
+  if(optind != argc - 1) {
+usage:
+fprintf(stderr,"usage:  %s [options] recording\n", prog);
+fprintf(stderr,"example: slipreplay -L /tmp/br-tty -x 10 field.slip\n");
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -i             Start at once, without waiting for the host\n");
+fprintf(stderr," -L link        Symbolic link to the pseudo-terminal\n");
+fprintf(stderr," -l loops       Replay the recording this many times (default 1)\n");
+fprintf(stderr," -p port        Serve one TCP connection on port instead\n");
+fprintf(stderr," -t ms          Keep reading from the host after the end (default 1000)\n");
+fprintf(stderr," -x speed       Speed factor, 0 for as fast as the host reads (default 1)\n");
+exit(1);
+  }
+  if(record_open(&r, argv[optind]) == -1) {
+    err(1, "can't open ``%s''", argv[optind]);
+  }
+  count_init(&replayed);
+  count_init(&recorded_out);
+  count_init(&host_out);
+
+  fd = port ? open_server(port) : open_pty(link);
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  if(!immediate) {
+    while(host_out.bytes == 0 && alive) {
+      alive = host_wait(fd, 0);
+    }
+  }
+
+  start = clock_us();
+  for(loop = 0; loop < loops && alive; loop++) {
+    record_rewind(&r);
+    base = clock_us();
+    while(alive && (ret = record_read(&r, &chunk)) > 0) {
+      recorded = chunk.time;
+      if(chunk.dir == RECORD_OUT) {
+        count_bytes(&recorded_out, chunk.data, chunk.len);
+        continue;
+      }
+      alive = replay_chunk(fd, &chunk,
+                           speed > 0 ? base + chunk.time / speed : 0);
+    }
+    if(ret == -1) {
+      warnx("``%s'' is cut short", argv[optind]);
+    }
+  }
+  if(!alive) {
+    warnx("the host has gone");
+  }
+  end = clock_us();
+  base = end + linger * 1000ULL;
+  while(alive && clock_us() < base) {
+    alive = host_wait(fd, base);
+  }
+
+  fprintf(stderr, "*** replayed %llu bytes, %llu frames in %.3f s"
+          " (recorded in %.3f s), late by %llu us on average, %llu us at most\n",
+          (unsigned long long)replayed.bytes,
+          (unsigned long long)replayed.frames,
+          (end - start) / 1e6,
+          recorded / 1e6,
+          (unsigned long long)(chunks ? lag_total / chunks : 0),
+          (unsigned long long)lag_max);
+  fprintf(stderr, "*** the host wrote %llu bytes, %llu frames"
+          " (%llu bytes, %llu frames when recorded)\n",
+          (unsigned long long)host_out.bytes,
+          (unsigned long long)host_out.frames,
+          (unsigned long long)recorded_out.bytes,
+          (unsigned long long)recorded_out.frames);
+  record_close(&r);
+  if(link != NULL) {
+    unlink(link);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
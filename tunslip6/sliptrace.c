@@ -0,0 +1,389 @@
+/**
+ * \file
+ *         Per-hop latencies from the traces of tunslip6 -X.
+ *
+ *         Joins the lines tunslip6 writes for a CoAP packet with the
+ *         border router's record of the same packet (tunslip6/trace.h):
+ *         a "br-down" or "br-up" line goes to the oldest line of the same
+ *         direction, message ID and token before it that has none yet.
+ *         Each packet then splits into hops:
+ *
+ *         - down: encode (tun read to SLIP encoded), queue (to written),
+ *           serial (to the border router's SLIP input), router (to the
+ *           radio)
+ *         - up: router (radio to SLIP output), serial (to tunslip6's
+ *           read), decode (to decoded), tun (to written to the tun device)
+ *
+ *         The serial hops need the border router's times to be network
+ *         time (synchronized 1); without its records there are only the
+ *         host's hops. A request to a mote and the first response from it
+ *         with the same token make an exchange: the hops of both packets,
+ *         mesh (from the radio sending the request to it receiving the
+ *         response, on the border router's clock), link instead when the
+ *         border router didn't trace them, and other for what remains of
+ *         the total, the serial hops of an unsynchronized border router.
+ *
+ *         Prints one CSV row per hop with the share of the path's time
+ *         it takes, or with -f the folded stacks of a flame graph
+ *         (flamegraph.pl --countname us).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+
+#define BR_WINDOW       10000000 /* us, a host line waits this long for its record */
+#define EXCHANGE_WINDOW 60000000 /* us, a request this long for its response */
+
+/* A line of tunslip6 (host) or of the border router (br) */
+struct line {
+  int dir;                      /* 'd' or 'u' */
+  char mote[48];
+  unsigned code, mid;
+  char token[20];
+  int64_t t[3];
+  int synchronized;
+  int br;                       /* Index of the record, -1 if none */
+  int used;
+};
+
+enum {
+  DOWN_ENCODE, DOWN_QUEUE, DOWN_SERIAL, DOWN_ROUTER, DOWN_TOTAL,
+  UP_ROUTER, UP_SERIAL, UP_DECODE, UP_TUN, UP_TOTAL,
+  EX_DOWN_ENCODE, EX_DOWN_QUEUE, EX_DOWN_SERIAL, EX_DOWN_ROUTER, EX_MESH,
+  EX_LINK, EX_UP_ROUTER, EX_UP_SERIAL, EX_UP_DECODE, EX_UP_TUN, EX_OTHER,
+  EX_TOTAL, HOPS
+};
+
+static struct hop {
+  const char *path, *name;
+  int total;                    /* The hop whose sum the shares are of */
+  int64_t *v;
+  size_t n, size;
+  int64_t sum;
+} hops[HOPS] = {
+  { "down", "encode", DOWN_TOTAL }, { "down", "queue", DOWN_TOTAL },
+  { "down", "serial", DOWN_TOTAL }, { "down", "router", DOWN_TOTAL },
+  { "down", "total", DOWN_TOTAL },
+  { "up", "router", UP_TOTAL }, { "up", "serial", UP_TOTAL },
+  { "up", "decode", UP_TOTAL }, { "up", "tun", UP_TOTAL },
+  { "up", "total", UP_TOTAL },
+  { "exchange", "down;encode", EX_TOTAL },
+  { "exchange", "down;queue", EX_TOTAL },
+  { "exchange", "down;serial", EX_TOTAL },
+  { "exchange", "down;router", EX_TOTAL },
+  { "exchange", "mesh", EX_TOTAL }, { "exchange", "link", EX_TOTAL },
+  { "exchange", "up;router", EX_TOTAL }, { "exchange", "up;serial", EX_TOTAL },
+  { "exchange", "up;decode", EX_TOTAL }, { "exchange", "up;tun", EX_TOTAL },
+  { "exchange", "other", EX_TOTAL }, { "exchange", "total", EX_TOTAL },
+};
+
+static struct line *host, *br;
+static size_t hosts, host_size, brs, br_size;
+
+/* Where each br line comes among the host lines */
+static size_t *br_after;
+
+/*---------------------------------------------------------------------------*/
+static void
+add(int hop, int64_t us)
+{
+  struct hop *h = &hops[hop];
+
+  if(h->n == h->size) {
+    h->size = h->size ? h->size * 2 : 1024;
+    h->v = realloc(h->v, h->size * sizeof(*h->v));
+    if(h->v == NULL) {
+      err(1, "realloc");
+    }
+  }
+  h->v[h->n++] = us;
+  h->sum += us;
+}
+/*---------------------------------------------------------------------------*/
+static struct line *
+append(struct line **lines, size_t *n, size_t *size)
+{
+  if(*n == *size) {
+    *size = *size ? *size * 2 : 1024;
+    *lines = realloc(*lines, *size * sizeof(**lines));
+    if(*lines == NULL) {
+      err(1, "realloc");
+    }
+  }
+  memset(&(*lines)[*n], 0, sizeof(**lines));
+  (*lines)[*n].br = -1;
+  return &(*lines)[(*n)++];
+}
+/*---------------------------------------------------------------------------*/
+static void
+read_trace(FILE *f, const char *name)
+{
+  char buf[256], dir[8];
+  struct line *l;
+  long long a, b, c;
+  unsigned lineno = 0;
+  int sync;
+
+  while(fgets(buf, sizeof(buf), f) != NULL) {
+    lineno++;
+    l = NULL;
+    if(strncmp(buf, "br-", 3) == 0) {
+      l = append(&br, &brs, &br_size);
+      if(sscanf(buf, "br-%7[^,],%u,%19[^,],%d,%lld,%lld", dir, &l->mid,
+                l->token, &sync, &a, &b) != 6) {
+        brs--;
+        l = NULL;
+      } else {
+        l->synchronized = sync;
+        l->t[0] = a;
+        l->t[1] = b;
+        br_after = realloc(br_after, br_size * sizeof(*br_after));
+        if(br_after == NULL) {
+          err(1, "realloc");
+        }
+        br_after[brs - 1] = hosts;
+      }
+    } else {
+      l = append(&host, &hosts, &host_size);
+      if(sscanf(buf, "%7[^,],%47[^,],%u,%u,%19[^,],%lld,%lld,%lld", dir,
+                l->mote, &l->code, &l->mid, l->token, &a, &b, &c) != 8) {
+        hosts--;
+        l = NULL;
+      } else {
+        l->t[0] = a;
+        l->t[1] = b;
+        l->t[2] = c;
+      }
+    }
+    if(l == NULL || (strcmp(dir, "down") != 0 && strcmp(dir, "up") != 0)) {
+      warnx("%s:%u: not a trace line", name, lineno);
+      continue;
+    }
+    l->dir = dir[0];
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Give each border router record the host line of its packet */
+static void
+join_records(void)
+{
+  size_t cursor[2] = { 0, 0 };
+  size_t i, j, *first;
+  struct line *h, *r;
+
+  for(i = 0; i < brs; i++) {
+    r = &br[i];
+    first = &cursor[r->dir == 'u'];
+    for(j = *first; j < br_after[i]; j++) {
+      h = &host[j];
+      if(h->dir != r->dir || h->br >= 0) {
+        continue;
+      }
+      if(h->t[0] + BR_WINDOW < host[br_after[i] - 1].t[0]) {
+        /* Its record is lost, the older ones' too */
+        *first = j + 1;
+        continue;
+      }
+      if(h->mid == r->mid && strcmp(h->token, r->token) == 0) {
+        h->br = i;
+        break;
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* The hops of a packet, as hops of the path from base, their sum */
+static int64_t
+packet_hops(const struct line *h, int base)
+{
+  const struct line *r = h->br >= 0 ? &br[h->br] : NULL;
+  int64_t us, sum = 0;
+
+#define HOP(n, v) do { us = (v); add(base + (n), us); sum += us; } while(0)
+  if(h->dir == 'd') {
+    HOP(0, h->t[1] - h->t[0]);
+    if(h->t[2] != 0) {          /* 0 if it never left */
+      HOP(1, h->t[2] - h->t[1]);
+      if(r != NULL && r->synchronized) {
+        HOP(2, r->t[0] - h->t[2]);
+      }
+    }
+    if(r != NULL) {
+      HOP(3, r->t[1] - r->t[0]);
+    }
+  } else {
+    if(r != NULL) {
+      HOP(0, r->t[1] - r->t[0]);
+      if(r->synchronized) {
+        HOP(1, h->t[0] - r->t[1]);
+      }
+    }
+    HOP(2, h->t[1] - h->t[0]);
+    HOP(3, h->t[2] - h->t[1]);
+  }
+#undef HOP
+  return sum;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_slow(const struct line *request, const struct line *response,
+           int64_t total, size_t *n)
+{
+  int i;
+
+  fprintf(stderr, "*** %s %s mid %u/%u: %lld us =", request->mote,
+          request->token, request->mid, response->mid, (long long)total);
+  for(i = EX_DOWN_ENCODE; i < EX_TOTAL; i++) {
+    if(hops[i].n > n[i]) {
+      fprintf(stderr, " %s %lld", hops[i].name,
+              (long long)hops[i].v[hops[i].n - 1]);
+    }
+  }
+  fputc('\n', stderr);
+}
+/*---------------------------------------------------------------------------*/
+/* A request and the first response to it from the mote with its token */
+static void
+join_exchanges(int64_t slow)
+{
+  size_t i, j, n[HOPS];
+  struct line *q, *p;
+  int64_t total, parts;
+  int k;
+
+  for(i = 0; i < hosts; i++) {
+    q = &host[i];
+    if(q->dir != 'd' || q->code == 0 || q->code >= 32 ||
+       strcmp(q->token, "-") == 0) {
+      continue;
+    }
+    p = NULL;
+    for(j = i + 1; j < hosts && host[j].t[0] <= q->t[0] + EXCHANGE_WINDOW;
+        j++) {
+      if(host[j].dir == 'u' && !host[j].used && host[j].code >= 64 &&
+         strcmp(host[j].mote, q->mote) == 0 &&
+         strcmp(host[j].token, q->token) == 0) {
+        p = &host[j];
+        break;
+      }
+    }
+    if(p == NULL || q->t[2] == 0) {
+      continue;
+    }
+    p->used = 1;
+    for(k = 0; k < HOPS; k++) {
+      n[k] = hops[k].n;
+    }
+    total = p->t[2] - q->t[0];
+    parts = packet_hops(q, EX_DOWN_ENCODE) + packet_hops(p, EX_UP_ROUTER);
+    if(q->br >= 0 && p->br >= 0 &&
+       br[q->br].synchronized == br[p->br].synchronized) {
+      add(EX_MESH, br[p->br].t[0] - br[q->br].t[1]);
+      parts += hops[EX_MESH].v[hops[EX_MESH].n - 1];
+    } else if(q->br < 0 && p->br < 0) {
+      add(EX_LINK, p->t[0] - q->t[2]);
+      parts += hops[EX_LINK].v[hops[EX_LINK].n - 1];
+    }
+    if(total != parts) {
+      add(EX_OTHER, total - parts);
+    }
+    add(EX_TOTAL, total);
+    if(slow > 0 && total >= slow) {
+      print_slow(q, p, total, n);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+compare(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+/*---------------------------------------------------------------------------*/
+static int64_t
+percentile(const struct hop *h, int p)
+{
+  return h->v[(h->n - 1) * p / 100];
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const char *prog = argv[0];
+  int folded = 0;
+  int64_t slow = 0;
+  struct hop *h;
+  FILE *f;
+  size_t i;
+  int c;
+
+  while((c = getopt(argc, argv, "ft:h")) != -1) {
+    switch(c) {
+    case 'f':
+      folded = 1;
+      break;
+    case 't':
+      slow = atoll(optarg);
+      break;
+    case '?':
+    case 'h':
+    default:
+      goto usage;
+    }
+  }
+  if(optind == argc) {
+usage:
+fprintf(stderr,"usage:  %s [options] trace...\n", prog);
+fprintf(stderr,"example: sliptrace -t 20000 /tmp/hops.csv\n");
+fprintf(stderr,"Options are:\n");
+fprintf(stderr," -f             Print folded stacks for a flame graph instead\n");
+fprintf(stderr," -t us          Print the exchanges taking this long, hop by hop\n");
+exit(1);
+  }
+
+  for(; optind < argc; optind++) {
+    if((f = fopen(argv[optind], "r")) == NULL) {
+      err(1, "can't open ``%s''", argv[optind]);
+    }
+    read_trace(f, argv[optind]);
+    fclose(f);
+  }
+
+  join_records();
+  for(i = 0; i < hosts; i++) {
+    if(host[i].dir == 'd') {
+      add(DOWN_TOTAL, packet_hops(&host[i], DOWN_ENCODE));
+    } else {
+      add(UP_TOTAL, packet_hops(&host[i], UP_ROUTER));
+    }
+  }
+  join_exchanges(slow);
+
+  if(!folded) {
+    printf("path,hop,count,p50_us,p99_us,max_us,share_pct\n");
+  }
+  for(h = hops; h < hops + HOPS; h++) {
+    if(h->n == 0) {
+      continue;
+    }
+    if(folded) {
+      if(h - hops != h->total && h->sum > 0) {
+        printf("%s;%s %lld\n", h->path, h->name, (long long)h->sum);
+      }
+      continue;
+    }
+    qsort(h->v, h->n, sizeof(*h->v), compare);
+    printf("%s,%s,%zu,%lld,%lld,%lld,%.1f\n", h->path, h->name, h->n,
+           (long long)percentile(h, 50), (long long)percentile(h, 99),
+           (long long)h->v[h->n - 1],
+           hops[h->total].sum ? 100.0 * h->sum / hops[h->total].sum : 0.0);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,163 @@
+/**
+ * \file
+ *         Per-hop tracing of the CoAP packets crossing tunslip6.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "ipv6.h"
+#include "trace.h"
+
+/*---------------------------------------------------------------------------*/
+uint64_t
+trace_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/*---------------------------------------------------------------------------*/
+int
+trace_open(struct trace *t, const char *path)
+{
+  memset(t, 0, sizeof(*t));
+  t->f = fopen(path, "a");
+  return t->f == NULL ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_close(struct trace *t)
+{
+  if(t->f != NULL) {
+    fclose(t->f);
+    t->f = NULL;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+trace_key(const uint8_t *packet, int len, int dir, struct trace_key *key)
+{
+  const uint8_t *coap;
+
+  if((coap = ipv6_coap(packet, len, IPV6_SOURCE | IPV6_DESTINATION,
+                       &len)) == NULL) {
+    return -1;
+  }
+  key->code = coap[1];
+  key->mid = (coap[2] << 8) | coap[3];
+  key->tkl = coap[0] & 15;
+  memcpy(key->token, coap + 4, key->tkl);
+  memcpy(key->mote, packet + (dir == TRACE_DOWN ? 24 : 8), 16);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_key(FILE *f, const struct trace_key *key, int mote)
+{
+  char address[INET6_ADDRSTRLEN];
+  int i;
+
+  if(mote) {
+    inet_ntop(AF_INET6, key->mote, address, sizeof(address));
+    fprintf(f, "%s,%u,", address, key->code);
+  }
+  fprintf(f, "%u,", key->mid);
+  if(key->tkl == 0) {
+    fputc('-', f);
+  }
+  for(i = 0; i < key->tkl; i++) {
+    fprintf(f, "%02x", key->token[i]);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_up(struct trace *t, const struct trace_key *key,
+         uint64_t read, uint64_t decoded, uint64_t written)
+{
+  fputs("up,", t->f);
+  print_key(t->f, key, 1);
+  fprintf(t->f, ",%llu,%llu,%llu\n", (unsigned long long)read,
+          (unsigned long long)decoded, (unsigned long long)written);
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_down(struct trace *t, const struct trace_pending *p, uint64_t written)
+{
+  fputs("down,", t->f);
+  print_key(t->f, &p->key, 1);
+  fprintf(t->f, ",%llu,%llu,%llu\n", (unsigned long long)p->tun,
+          (unsigned long long)p->encoded, (unsigned long long)written);
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_down(struct trace *t, const struct trace_key *key,
+           uint64_t tun, uint64_t encoded, int end)
+{
+  struct trace_pending *p;
+
+  if(t->pending_count == TRACE_PENDING) {
+    /* The line is stuck, don't wait any longer for the oldest */
+    write_down(t, &t->pending[t->pending_head], 0);
+    t->pending_head = (t->pending_head + 1) % TRACE_PENDING;
+    t->pending_count--;
+  }
+  p = &t->pending[(t->pending_head + t->pending_count++) % TRACE_PENDING];
+  p->key = *key;
+  p->tun = tun;
+  p->encoded = encoded;
+  p->end = end;
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_written(struct trace *t, int offset, uint64_t now)
+{
+  struct trace_pending *p;
+
+  while(t->pending_count > 0) {
+    p = &t->pending[t->pending_head];
+    if(p->end > offset) {
+      break;
+    }
+    write_down(t, p, now);
+    t->pending_head = (t->pending_head + 1) % TRACE_PENDING;
+    t->pending_count--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* The 32 bit network time of the border router, placed before now */
+static uint64_t
+unwrap(const uint8_t *p, uint64_t now)
+{
+  uint32_t t = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+  return now - (uint32_t)((uint32_t)now - t);
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_record(struct trace *t, const uint8_t *frame, int len, uint64_t now)
+{
+  struct trace_key key;
+  const uint8_t *times;
+
+  /* serial_classify() only saw "!R" */
+  if(len < TRACE_RECORD_MIN) {
+    return;
+  }
+  key.tkl = frame[6];
+  if(len < TRACE_RECORD_MIN + key.tkl || key.tkl > 8) {
+    return;
+  }
+  key.mid = (frame[4] << 8) | frame[5];
+  memcpy(key.token, frame + 7, key.tkl);
+  times = frame + 7 + key.tkl;
+  fputs(frame[2] == TRACE_DOWN ? "br-down," : "br-up,", t->f);
+  print_key(t->f, &key, 0);
+  fprintf(t->f, ",%u,%llu,%llu\n", frame[3] & 1,
+          (unsigned long long)unwrap(times, now),
+          (unsigned long long)unwrap(times + 4, now));
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,89 @@
+/**
+ * \file
+ *         Per-hop tracing of the CoAP packets crossing tunslip6.
+ *
+ *         With -X file, tunslip6 writes a line for every CoAP packet it
+ *         passes between the tun device and the serial line, and for every
+ *         trace record the border router sends about the same packets when
+ *         built with TRACE=1 (a "!R" frame, see border-router/trace.h):
+ *
+ *             down,<mote>,<code>,<mid>,<token>,<tun read>,<encoded>,<written>
+ *             up,<mote>,<code>,<mid>,<token>,<read>,<decoded>,<tun written>
+ *             br-down,<mid>,<token>,<synchronized>,<slip in>,<radio sent>
+ *             br-up,<mid>,<token>,<synchronized>,<radio in>,<slip out>
+ *
+ *         Times are microseconds since the epoch; written is when the
+ *         write() that finished the packet's frame started, as the border
+ *         router may read it before the call returns. The border router's
+ *         are its network time (sensor/timesync.h) placed against the
+ *         host's clock, comparable with the host's when synchronized is 1
+ *         and only with each other otherwise. The token is in hex, "-" when empty.
+ *         sliptrace joins the lines into per-hop latencies.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* "!R", direction, flags, message ID, token length, ingress, egress */
+#define TRACE_RECORD_MIN (2 + 1 + 1 + 2 + 1 + 4 + 4)
+
+#define TRACE_DOWN 'd'          /* Host to mesh */
+#define TRACE_UP   'u'          /* Mesh to host */
+
+/* What identifies a CoAP packet along its way */
+struct trace_key {
+  uint8_t code;
+  uint16_t mid;
+  uint8_t tkl;
+  uint8_t token[8];
+  uint8_t mote[16];             /* Destination down, source up */
+};
+
+/* A packet from the tun device waiting to be written to the serial line */
+struct trace_pending {
+  struct trace_key key;
+  uint64_t tun, encoded;
+  int end;                      /* Where its frame ends in the output buffer */
+};
+
+#define TRACE_PENDING 64
+
+struct trace {
+  FILE *f;
+  struct trace_pending pending[TRACE_PENDING];
+  int pending_head, pending_count;
+};
+
+/** Open the trace file, -1 on failure */
+int trace_open(struct trace *t, const char *path);
+
+/** Fill key if the IPv6 packet carries CoAP, returns 0; -1 otherwise */
+int trace_key(const uint8_t *packet, int len, int dir, struct trace_key *key);
+
+/** A packet from the serial line was written to the tun device */
+void trace_up(struct trace *t, const struct trace_key *key,
+              uint64_t read, uint64_t decoded, uint64_t written);
+
+/** A packet from the tun device was encoded, its frame ends at end */
+void trace_down(struct trace *t, const struct trace_key *key,
+                uint64_t tun, uint64_t encoded, int end);
+
+/**
+ * The output buffer was written up to offset by a write() started at
+ * now: the packets whose frames end there are gone
+ */
+void trace_written(struct trace *t, int offset, uint64_t now);
+
+/** A "!R" record of the border router */
+void trace_record(struct trace *t, const uint8_t *frame, int len,
+                  uint64_t now);
+
+void trace_close(struct trace *t);
+
+/** Wall clock in microseconds */
+uint64_t trace_now(void);
+
+#endif /* __TRACE_H__ */
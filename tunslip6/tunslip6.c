@@ -32,22 +32,25 @@
  *
  */
 
- /* Below define allows importing saved output into Wireshark as "Raw IP" packet type */
-#define WIRESHARK_IMPORT_FORMAT 1
- 
+#define _GNU_SOURCE             /* CPU affinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/time.h>
 
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <termios.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -56,6 +59,16 @@
 
 #include <err.h>
 
+#include "admission.h"
+#include "noise.h"
+#include "pbuf.h"
+#include "handover.h"
+#include "record.h"
+#include "ring.h"
+#include "serial.h"
+#include "slip.h"
+#include "trace.h"
+
 int verbose = 1;
 const char *ipaddr;
 const char *netmask;
@@ -63,13 +76,45 @@ int slipfd = 0;
 uint16_t basedelay=0,delaymsec=0;
 uint32_t startsec,startmsec,delaystartsec,delaystartmsec;
 int timestamp = 0, flowcontrol=0;
+int admission = 0;
+int cobs = 0;
+static int corrupted_run;       /* COBS frames dropped in a row */
+int noise = 0;
+int persistent = 0, handed_over = 0;
+const char *handover_path = NULL;
+struct record recording;
+struct trace tracing;
+/* With -X, when the last serial read and tun read returned */
+static uint64_t serial_read_time, tun_read_time;
+/*
+ * The frame being decoded, and the packets waiting for the tun device: with
+ * -M, each thread that writes to it has its own queue and waits for it in
+ * its own poll()
+ */
+static struct pbuf *rx;
+static __thread struct pbuf_queue tun_queue;
+static unsigned long rx_dropped;
+/* -M: a thread per stage, the serial output fed by rings (see ring.h) */
+int threads = 0;
+static int cpus[3] = { -1, -1, -1 };
+static struct ring control_ring, data_ring;
+static sem_t tx_ready;
+/* -S: select() doesn't sleep for spin_us after the last event */
+long spin_us = 0;
+static uint64_t spin_active;
+/* The recording and the filters' tables, shared by the threads */
+static pthread_mutex_t shared = PTHREAD_MUTEX_INITIALIZER;
 
 int ssystem(const char *fmt, ...)
      __attribute__((__format__ (__printf__, 1, 2)));
 void write_to_serial(int outfd, void *inbuf, int len);
 
 void slip_send(int fd, unsigned char c);
-void slip_send_char(int fd, unsigned char c);
+void send_raw(const void *bytes, int len);
+void tun_send(int fd, struct pbuf *p);
+void tun_flush(int fd);
+void send_frame(const void *frame, int len);
+void request_cobs(void);
 
 //#define PROGRESS(s) fprintf(stderr, s)
 #define PROGRESS(s) do { } while (0)
@@ -92,12 +137,6 @@ ssystem(const char *fmt, ...)
   return system(cmd);
 }
 
-#define SLIP_END     0300
-#define SLIP_ESC     0333
-#define SLIP_ESC_END 0334
-#define SLIP_ESC_ESC 0335
-
-
 /* get sockaddr, IPv4 or IPv6: */
 void *
 get_in_addr(struct sockaddr *sa)
@@ -136,206 +175,304 @@ stamptime(void)
   }
 }
 
-int
-is_sensible_string(const unsigned char *s, int len)
+static void
+print_hexdump(const unsigned char *p, int len)
 {
-  int i;
-  for(i = 1; i < len; i++) {
-    if(s[i] == 0 || s[i] == '\r' || s[i] == '\n' || s[i] == '\t') {
-      continue;
-    } else if(s[i] < ' ' || '~' < s[i]) {
-      return 0;
+  char dump[SERIAL_HEXDUMP_MAX(SERIAL_MAX_FRAME)];
+
+  fwrite(dump, serial_hexdump(dump, p, len), 1, stdout);
+}
+
+static void
+lock_shared(void)
+{
+  if(threads) pthread_mutex_lock(&shared);
+}
+
+static void
+unlock_shared(void)
+{
+  if(threads) pthread_mutex_unlock(&shared);
+}
+
+static void
+frame_received(struct serial_decoder *d, unsigned char *frame, int len)
+{
+  int outfd = *(int *)d->arg;
+
+  corrupted_run = 0;
+  switch(serial_classify(frame, len)) {
+  case SERIAL_MAC:
+    {
+      /* Read gateway MAC address and autoconfigure tap0 interface */
+      char macs[24];
+      int i, pos;
+      for(i = 0, pos = 0; i < 16; i++) {
+	macs[pos++] = frame[2 + i];
+	if((i & 1) == 1 && i < 14) {
+	  macs[pos++] = ':';
+	}
+      }
+      if(timestamp) stamptime();
+      macs[pos] = '\0';
+//      printf("*** Gateway's MAC address: %s\n", macs);
+      fprintf(stderr,"*** Gateway's MAC address: %s\n", macs);
+      if (timestamp) stamptime();
+      ssystem("ifconfig %s down", tundev);
+      if (timestamp) stamptime();
+      ssystem("ifconfig %s hw ether %s", tundev, &macs[6]);
+      if (timestamp) stamptime();
+      ssystem("ifconfig %s up", tundev);
+    }
+    break;
+  case SERIAL_PREFIX_REQUEST:
+    {
+      /* Prefix info requested */
+      struct in6_addr addr;
+      unsigned char reply[2 + 8] = { '!', 'P' };
+      char *s = strchr(ipaddr, '/');
+      if(s != NULL) {
+	*s = '\0';
+      }
+      inet_pton(AF_INET6, ipaddr, &addr);
+      if(timestamp) stamptime();
+      fprintf(stderr,"*** Address:%s => %02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
+ //     printf("*** Address:%s => %02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
+	     ipaddr, 
+	     addr.s6_addr[0], addr.s6_addr[1],
+	     addr.s6_addr[2], addr.s6_addr[3],
+	     addr.s6_addr[4], addr.s6_addr[5],
+	     addr.s6_addr[6], addr.s6_addr[7]);
+      memcpy(reply + 2, addr.s6_addr, 8);
+      send_frame(reply, sizeof(reply));
+    }
+    break;
+  case SERIAL_TIME_REQUEST:
+    {
+      /* Send back the border router's time with ours, taken now that its
+	 request is in, in microseconds since the epoch */
+      struct timespec ts;
+      uint64_t now;
+      unsigned char reply[2 + 4 + 8] = { '!', 'T' };
+      int i;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+      memcpy(reply + 2, frame + 2, 4);
+      for(i = 0; i < 8; i++) {
+	reply[6 + i] = now >> (56 - 8 * i);
+      }
+      send_frame(reply, sizeof(reply));
     }
+    break;
+  case SERIAL_TRACE:
+    if(tracing.f) trace_record(&tracing, frame, len, trace_now());
+    break;
+  case SERIAL_FRAMING:
+    if(cobs && frame[2] == 'C' && d->framing != SERIAL_COBS) {
+      /* What follows is COBS, from the next byte on. Our SLIP since the
+	 request would be the start of its first COBS frame: end it. */
+      __atomic_store_n(&d->framing, SERIAL_COBS, __ATOMIC_RELAXED);
+      send_raw("", 1);
+      if(timestamp) stamptime();
+      fprintf(stderr, "*** COBS framing with CRC-16 on the serial line\n");
+    }
+    break;
+  case SERIAL_CONFIG:
+    break;
+  case SERIAL_DEBUG:
+    fwrite(frame + 1, len - 1, 1, stdout);
+    break;
+  case SERIAL_TEXT:
+    if(verbose==1) {   /* strings already echoed below for verbose>1 */
+      if (timestamp) stamptime();
+      fwrite(frame, len, 1, stdout);
+    }
+    break;
+  case SERIAL_PACKET:
+    if(verbose>2) {
+      if (timestamp) stamptime();
+      printf("Packet from SLIP of length %d - write TUN\n", len);
+      if (verbose>4) {
+	print_hexdump(frame, len);
+      }
+    }
+    lock_shared();
+    if(admission) admission_learn(frame, len);
+    if(noise) noise_learn(frame, len);
+    unlock_shared();
+    {
+      uint64_t decoded = tracing.f ? trace_now() : 0;
+      struct trace_key key;
+      int traced = tracing.f && trace_key(frame, len, TRACE_UP, &key) == 0;
+      struct pbuf *p = rx;
+
+      /* The frame stays where it was decoded, the next one gets a new
+	 buffer */
+      if((rx = pbuf_alloc()) == NULL) {
+	/* All of them wait for the tun device */
+	rx = p;
+	if(rx_dropped++ == 0 && verbose) {
+	  if(timestamp) stamptime();
+	  fprintf(stderr, "*** tun device behind, dropping packets\n");
+	}
+	break;
+      }
+      serial_decoder_buffer(d, rx->data);
+      p->len = len;
+      tun_send(outfd, p);
+      if(traced) {
+        trace_up(&tracing, &key, serial_read_time, decoded, trace_now());
+      }
+    }
+    break;
+  }
+}
+
+static void
+echo_received(struct serial_decoder *d, const unsigned char *s, int len)
+{
+  if(d->verbose == 4) {
+    fwrite(s, len, 1, stdout);
+    if(s[len - 1] == '\n') if(timestamp) stamptime();
+  } else {
+    if (timestamp) stamptime();
+    fwrite(s, len, 1, stdout);
+  }
+}
+
+static void
+overflow(struct serial_decoder *d, int len)
+{
+  if(timestamp) stamptime();
+  fprintf(stderr, "*** dropping large %d byte packet\n", len);
+}
+
+static void
+corrupted(struct serial_decoder *d, int len)
+{
+  if(verbose) {
+    if(timestamp) stamptime();
+    fprintf(stderr, "*** dropping corrupted %d byte frame\n", len);
+  }
+  if(++corrupted_run == 3) {
+    /* The border router restarted in SLIP, or the line is that bad */
+    if(timestamp) stamptime();
+    fprintf(stderr, "*** back to SLIP framing, asking for COBS again\n");
+    __atomic_store_n(&d->framing, SERIAL_SLIP, __ATOMIC_RELAXED);
+    corrupted_run = 0;
+    request_cobs();
   }
-  return 1;
 }
 
+static const struct serial_callbacks serial_callbacks = {
+  frame_received, echo_received, overflow, corrupted
+};
+static struct serial_decoder decoder;
+
 /*
  * Read from serial, when we have a packet write it to tun. No output
- * buffering, input buffered by stdio.
+ * buffering.
  */
 void
-serial_to_tun(FILE *inslip, int outfd)
+serial_to_tun(int infd, int outfd)
 {
-  static union {
-    unsigned char inbuf[2000];
-  } uip;
-  static int inbufptr = 0;
-  int ret,i;
-  unsigned char c;
-
-#ifdef linux
-  ret = fread(&c, 1, 1, inslip);
-  if(ret == -1 || ret == 0) err(1, "serial_to_tun: read");
-  goto after_fread;
-#endif
+  unsigned char buf[4096];
+  int n;
 
- read_more:
-  if(inbufptr >= sizeof(uip.inbuf)) {
-     if(timestamp) stamptime();
-     fprintf(stderr, "*** dropping large %d byte packet\n",inbufptr);
-	 inbufptr = 0;
-  }
-  ret = fread(&c, 1, 1, inslip);
-#ifdef linux
- after_fread:
-#endif
-  if(ret == -1) {
+  n = read(infd, buf, sizeof(buf));
+  if(n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
     err(1, "serial_to_tun: read");
   }
-  if(ret == 0) {
-    clearerr(inslip);
+  if(n > 0) {
+    if(tracing.f) serial_read_time = trace_now();
+    lock_shared();
+    record_write(&recording, RECORD_IN, buf, n);
+    unlock_shared();
+    decoder.arg = &outfd;
+    serial_decode(&decoder, buf, n);
+  }
+}
+
+/* A packet to the tun device, with the caller's reference */
+void
+tun_send(int fd, struct pbuf *p)
+{
+  if(pbuf_enqueue(&tun_queue, p) == -1) {
+    pbuf_unref(p);
     return;
   }
-  /*  fprintf(stderr, ".");*/
-  switch(c) {
-  case SLIP_END:
-    if(inbufptr > 0) {
-      if(uip.inbuf[0] == '!') {
-	if(uip.inbuf[1] == 'M') {
-	  /* Read gateway MAC address and autoconfigure tap0 interface */
-	  char macs[24];
-	  int i, pos;
-	  for(i = 0, pos = 0; i < 16; i++) {
-	    macs[pos++] = uip.inbuf[2 + i];
-	    if((i & 1) == 1 && i < 14) {
-	      macs[pos++] = ':';
-	    }
-	  }
-          if(timestamp) stamptime();
-	  macs[pos] = '\0';
-//	  printf("*** Gateway's MAC address: %s\n", macs);
-	  fprintf(stderr,"*** Gateway's MAC address: %s\n", macs);
-          if (timestamp) stamptime();
-	  ssystem("ifconfig %s down", tundev);
-          if (timestamp) stamptime();
-	  ssystem("ifconfig %s hw ether %s", tundev, &macs[6]);
-          if (timestamp) stamptime();
-	  ssystem("ifconfig %s up", tundev);
-	}
-      } else if(uip.inbuf[0] == '?') {
-	if(uip.inbuf[1] == 'P') {
-          /* Prefix info requested */
-          struct in6_addr addr;
-	  int i;
-	  char *s = strchr(ipaddr, '/');
-	  if(s != NULL) {
-	    *s = '\0';
-	  }
-          inet_pton(AF_INET6, ipaddr, &addr);
-          if(timestamp) stamptime();
-          fprintf(stderr,"*** Address:%s => %02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
- //         printf("*** Address:%s => %02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
-		 ipaddr, 
-		 addr.s6_addr[0], addr.s6_addr[1],
-		 addr.s6_addr[2], addr.s6_addr[3],
-		 addr.s6_addr[4], addr.s6_addr[5],
-		 addr.s6_addr[6], addr.s6_addr[7]);
-	  slip_send(slipfd, '!');
-	  slip_send(slipfd, 'P');
-	  for(i = 0; i < 8; i++) {
-	    /* need to call the slip_send_char for stuffing */
-	    slip_send_char(slipfd, addr.s6_addr[i]);
-	  }
-	  slip_send(slipfd, SLIP_END);
-        }
-#define DEBUG_LINE_MARKER '\r'
-      } else if(uip.inbuf[0] == DEBUG_LINE_MARKER) {    
-	fwrite(uip.inbuf + 1, inbufptr - 1, 1, stdout);
-      } else if(is_sensible_string(uip.inbuf, inbufptr)) {
-        if(verbose==1) {   /* strings already echoed below for verbose>1 */
-          if (timestamp) stamptime();
-          fwrite(uip.inbuf, inbufptr, 1, stdout);
-        }
-      } else {
-        if(verbose>2) {
-          if (timestamp) stamptime();
-          printf("Packet from SLIP of length %d - write TUN\n", inbufptr);
-          if (verbose>4) {
-#if WIRESHARK_IMPORT_FORMAT
-            printf("0000");
-	        for(i = 0; i < inbufptr; i++) printf(" %02x",uip.inbuf[i]);
-#else
-            printf("         ");
-            for(i = 0; i < inbufptr; i++) {
-              printf("%02x", uip.inbuf[i]);
-              if((i & 3) == 3) printf(" ");
-              if((i & 15) == 15) printf("\n         ");
-            }
-#endif
-            printf("\n");
-          }
-        }
-	if(write(outfd, uip.inbuf, inbufptr) != inbufptr) {
-	  err(1, "serial_to_tun: write");
-	}
-      }
-      inbufptr = 0;
-    }
-    break;
+  tun_flush(fd);
+}
 
-  case SLIP_ESC:
-    if(fread(&c, 1, 1, inslip) != 1) {
-      clearerr(inslip);
-      /* Put ESC back and give up! */
-      ungetc(SLIP_ESC, inslip);
-      return;
-    }
+void
+tun_flush(int fd)
+{
+  struct pbuf *p;
+  int n;
 
-    switch(c) {
-    case SLIP_ESC_END:
-      c = SLIP_END;
-      break;
-    case SLIP_ESC_ESC:
-      c = SLIP_ESC;
-      break;
-    }
-    /* FALLTHROUGH */
-  default:
-    uip.inbuf[inbufptr++] = c;
-
-    /* Echo lines as they are received for verbose=2,3,5+ */
-    /* Echo all printable characters for verbose==4 */
-    if((verbose==2) || (verbose==3) || (verbose>4)) {
-      if(c=='\n') {
-        if(is_sensible_string(uip.inbuf, inbufptr)) {
-          if (timestamp) stamptime();
-          fwrite(uip.inbuf, inbufptr, 1, stdout);
-          inbufptr=0;
-        }
-      }
-    } else if(verbose==4) {
-      if(c == 0 || c == '\r' || c == '\n' || c == '\t' || (c >= ' ' && c <= '~')) {
-	fwrite(&c, 1, 1, stdout);
-        if(c=='\n') if(timestamp) stamptime();
-      }
+  while((p = pbuf_peek(&tun_queue)) != NULL) {
+    n = write(fd, p->data, p->len);
+    if(n == -1 && errno == EAGAIN) {
+      return;                   /* When select() or poll() says so */
+    } else if(n != p->len) {
+      err(1, "serial_to_tun: write");
     }
-    
-    break;
+    pbuf_unref(pbuf_dequeue(&tun_queue));
   }
-
-  goto read_more;
 }
 
-unsigned char slip_buf[2000];
+/* A packet from tun, encoded, and the prefix reply */
+unsigned char slip_buf[SERIAL_ENCODED_MAX(2000) + 64];
 int slip_end, slip_begin;
 
+/* A frame in the framing of the link, the serial decoder's thread may
+   change it meanwhile */
+static int
+encode(unsigned char *out, const void *frame, int len)
+{
+  if(__atomic_load_n(&decoder.framing, __ATOMIC_RELAXED) == SERIAL_COBS) {
+    return serial_encode_cobs(out, frame, len);
+  }
+  return serial_encode(out, frame, len);
+}
+
+/* A frame to the border router, from the serial decoder with -M */
 void
-slip_send_char(int fd, unsigned char c)
+send_frame(const void *frame, int len)
 {
-  switch(c) {
-  case SLIP_END:
-    slip_send(fd, SLIP_ESC);
-    slip_send(fd, SLIP_ESC_END);
-    break;
-  case SLIP_ESC:
-    slip_send(fd, SLIP_ESC);
-    slip_send(fd, SLIP_ESC_ESC);
-    break;
-  default:
-    slip_send(fd, c);
-    break;
+  if(threads) {
+    ring_publish(&control_ring, encode(ring_reserve(&control_ring),
+                                       frame, len));
+    return;
+  }
+  if(slip_end + SERIAL_ENCODED_MAX(len) > sizeof(slip_buf)) {
+    err(1, "slip_send overflow");
   }
+  slip_end += encode(slip_buf + slip_end, frame, len);
+}
+
+/* Bytes as they are, outside any frame */
+void
+send_raw(const void *bytes, int len)
+{
+  const unsigned char *p = bytes;
+
+  if(threads) {
+    memcpy(ring_reserve(&control_ring), bytes, len);
+    ring_publish(&control_ring, len);
+    return;
+  }
+  while(len-- > 0) {
+    slip_send(slipfd, *p++);
+  }
+}
+
+void
+request_cobs(void)
+{
+  static const char request[] = SERIAL_COBS_REQUEST;
+
+  send_raw(request, sizeof(request) - 1);
 }
 
 void
@@ -357,12 +494,14 @@ slip_empty()
 void
 slip_flushbuf(int fd)
 {
+  uint64_t start = 0;
   int n;
   
   if(slip_empty()) {
     return;
   }
 
+  if(tracing.f) start = trace_now();
   n = write(fd, slip_buf + slip_begin, (slip_end - slip_begin));
 
   if(n == -1 && errno != EAGAIN) {
@@ -370,7 +509,9 @@ slip_flushbuf(int fd)
   } else if(n == -1) {
     PROGRESS("Q");		/* Outqueueis full! */
   } else {
+    record_write(&recording, RECORD_OUT, slip_buf + slip_begin, n);
     slip_begin += n;
+    if(tracing.f) trace_written(&tracing, slip_begin, start);
     if(slip_begin == slip_end) {
       slip_begin = slip_end = 0;
     }
@@ -381,24 +522,12 @@ void
 write_to_serial(int outfd, void *inbuf, int len)
 {
   u_int8_t *p = inbuf;
-  int i;
 
   if(verbose>2) {
     if (timestamp) stamptime();
     printf("Packet from TUN of length %d - write SLIP\n", len);
     if (verbose>4) {
-#if WIRESHARK_IMPORT_FORMAT
-      printf("0000");
-	  for(i = 0; i < len; i++) printf(" %02x", p[i]);
-#else
-      printf("         ");
-      for(i = 0; i < len; i++) {
-        printf("%02x", p[i]);
-        if((i & 3) == 3) printf(" ");
-        if((i & 15) == 15) printf("\n         ");
-      }
-#endif
-      printf("\n");
+      print_hexdump(p, len);
     }
   }
 
@@ -407,22 +536,19 @@ write_to_serial(int outfd, void *inbuf, int len)
    */
   /* slip_send(outfd, SLIP_END); */
 
-  for(i = 0; i < len; i++) {
-    switch(p[i]) {
-    case SLIP_END:
-      slip_send(outfd, SLIP_ESC);
-      slip_send(outfd, SLIP_ESC_END);
-      break;
-    case SLIP_ESC:
-      slip_send(outfd, SLIP_ESC);
-      slip_send(outfd, SLIP_ESC_ESC);
-      break;
-    default:
-      slip_send(outfd, p[i]);
-      break;
+  if(threads) {
+    /* Encoded into the ring, waiting for the serial output to catch up */
+    ring_publish(&data_ring, encode(ring_reserve(&data_ring), p, len));
+    PROGRESS("t");
+    return;
+  }
+  send_frame(p, len);
+  if(tracing.f) {
+    struct trace_key key;
+    if(trace_key(p, len, TRACE_DOWN, &key) == 0) {
+      trace_down(&tracing, &key, tun_read_time, trace_now(), slip_end);
     }
   }
-  slip_send(outfd, SLIP_END);
   PROGRESS("t");
 }
 
@@ -433,15 +559,41 @@ write_to_serial(int outfd, void *inbuf, int len)
 int
 tun_to_serial(int infd, int outfd)
 {
-  struct {
-    unsigned char inbuf[2000];
-  } uip;
+  /* The caller made sure there are two buffers: the reply to the tun
+     device, if any, is written to the second one */
+  struct pbuf *p = pbuf_alloc(), *reply = pbuf_alloc();
+  admission_t verdict = ADMISSION_FORWARD;
   int size;
 
-  if((size = read(infd, uip.inbuf, 2000)) == -1) err(1, "tun_to_serial: read");
+  if(p == NULL || reply == NULL) {
+    /* -M: the other thread holds them, for a while */
+    if(p != NULL) pbuf_unref(p);
+    if(reply != NULL) pbuf_unref(reply);
+    return -1;
+  }
+  if((size = read(infd, p->data, PBUF_SIZE)) == -1) {
+    if(errno != EAGAIN) err(1, "tun_to_serial: read");
+    size = 0;
+  }
+  if(tracing.f) tun_read_time = trace_now();
+
+  lock_shared();
+  if(size > 0 && noise) {
+    verdict = noise_filter(p->data, size, reply->data, &reply->len);
+  }
+  if(size > 0 && admission && verdict == ADMISSION_FORWARD) {
+    verdict = admission_filter(p->data, size, reply->data, &reply->len);
+  }
+  unlock_shared();
 
-  write_to_serial(outfd, uip.inbuf, size);
-  return size;
+  if(verdict == ADMISSION_REPLY) {
+    tun_send(infd, pbuf_ref(reply));
+  } else if(size > 0 && verdict == ADMISSION_FORWARD) {
+    write_to_serial(outfd, p->data, size);
+  }
+  pbuf_unref(reply);
+  pbuf_unref(p);
+  return verdict == ADMISSION_FORWARD ? size : 0;
 }
 
 #ifndef BAUDRATE
@@ -485,7 +637,8 @@ stty_telos(int fd)
   if(tcsetattr(fd, TCSAFLUSH, &tty) == -1) err(1, "tcsetattr");
 
   i = TIOCM_DTR;
-  if(ioctl(fd, TIOCMBIS, &i) == -1) err(1, "ioctl");
+  /* A pty has no modem control lines */
+  if(ioctl(fd, TIOCMBIS, &i) == -1 && errno != ENOTTY) err(1, "ioctl");
 #endif
 
   usleep(10*1000);		/* Wait for hardware 10ms. */
@@ -498,6 +651,10 @@ int
 devopen(const char *dev, int flags)
 {
   char t[32];
+  if(dev[0] == '/') {
+    /* Outside /dev, e.g. the pty link of border-router-native */
+    return open(dev, flags);
+  }
   strcpy(t, "/dev/");
   strncat(t, dev, sizeof(t) - 5);
   return open(t, flags);
@@ -532,20 +689,64 @@ tun_alloc(char *dev, int tap)
     close(fd);
     return err;
   }
+  /* Keep the interface, and its addresses and routes, when we exit */
+  if(persistent && ioctl(fd, TUNSETPERSIST, 1) < 0) {
+    warn("tun_alloc: TUNSETPERSIST");
+  }
   strcpy(dev, ifr.ifr_name);
   return fd;
 }
+
+/* An existing interface that is already up needs no configuration */
+int
+tun_configured(const char *dev)
+{
+  struct ifreq ifr;
+  int fd, up = 0;
+
+  if((fd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
+    return 0;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+  if(ioctl(fd, SIOCGIFFLAGS, &ifr) == 0) {
+    up = (ifr.ifr_flags & IFF_UP) != 0;
+  }
+  close(fd);
+  return up;
+}
 #else
 int
 tun_alloc(char *dev, int tap)
 {
   return devopen(dev, O_RDWR);
 }
+
+int
+tun_configured(const char *dev)
+{
+  return 0;
+}
 #endif
 
 void
 cleanup(void)
 {
+  record_close(&recording);
+  trace_close(&tracing);
+  if(noise) noise_report(stderr);
+  if(rx_dropped) {
+    fprintf(stderr, "*** %lu packets dropped, the tun device was behind\n",
+            rx_dropped);
+  }
+  if(verbose > 1) pbuf_report(stderr);
+  if(handover_path != NULL && !handed_over) {
+    unlink(handover_path);
+  }
+  if(persistent || handed_over) {
+    /* The interface stays up for the next tunslip6 */
+    return;
+  }
 #ifndef __APPLE__
   if (timestamp) stamptime();
   ssystem("ifconfig %s down", tundev);
@@ -626,7 +827,7 @@ ifconf(const char *tundev, const char *ipaddr)
     }
     ai=0;
     cc=scc=0;
-    while(c=*ptr++) {
+    while((c=*ptr++)) {
       if(c=='/') break;
       if(c==':') {
 	if(cc)
@@ -685,6 +886,203 @@ ifconf(const char *tundev, const char *ipaddr)
   ssystem("ifconfig %s\n", tundev);
 }
 
+static uint64_t
+now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * The timeout of select() with -S: none, polling, while there was an
+ * event in the last quarter of spin_us, then polling but yielding the CPU
+ * in between, and sleeping once spin_us went by without any.
+ */
+static struct timeval *
+spin_timeout(struct timeval *tv)
+{
+  uint64_t idle;
+
+  if(spin_us == 0) {
+    return NULL;
+  }
+  idle = now_us() - spin_active;
+  if(idle >= spin_us) {
+    return NULL;
+  }
+  if(idle >= spin_us / 4) {
+    sched_yield();
+  }
+  tv->tv_sec = tv->tv_usec = 0;
+  return tv;
+}
+
+static void
+realtime(int priority)
+{
+  struct sched_param param = { .sched_priority = priority };
+
+  if(sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+    warn("can't run at SCHED_FIFO priority %d", priority);
+  }
+  if(mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    warn("can't lock the memory");
+  }
+}
+
+/* -M: the slots of the rings to the serial output */
+#define CONTROL_SLOTS 16
+#define CONTROL_SLOT  64
+#define DATA_SLOTS    8
+
+static void
+pin(int cpu)
+{
+#ifdef linux
+  cpu_set_t set;
+
+  if(cpu < 0) {
+    return;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    warnx("can't run on CPU %d", cpu);
+  }
+#endif
+}
+
+static void *
+serial_rx_thread(void *arg)
+{
+  int tunfd = (intptr_t)arg;
+  struct pollfd pfd[2] = { { slipfd, POLLIN }, { tunfd, POLLOUT } };
+
+  pin(cpus[0]);
+  while(1) {
+    /* The tun device only while packets wait for it */
+    pfd[1].revents = 0;
+    if(poll(pfd, pbuf_peek(&tun_queue) != NULL ? 2 : 1, -1) == -1 &&
+       errno != EINTR) err(1, "poll");
+    if(pfd[1].revents) {
+      tun_flush(tunfd);
+    }
+    if(pfd[0].revents) {
+      serial_to_tun(slipfd, tunfd);
+    }
+  }
+  return NULL;
+}
+
+static void *
+tun_rx_thread(void *arg)
+{
+  struct pollfd pfd = { (intptr_t)arg, POLLIN };
+
+  pin(cpus[1]);
+  while(1) {
+    /* The filters' replies to the host wait here, not in tun_send() */
+    pfd.events = pbuf_peek(&tun_queue) != NULL ? POLLIN | POLLOUT : POLLIN;
+    if(poll(&pfd, 1, -1) == -1 && errno != EINTR) err(1, "poll");
+    if(pfd.revents & POLLOUT) {
+      tun_flush(pfd.fd);
+    }
+    if((pfd.revents & ~POLLOUT) && tun_to_serial(pfd.fd, slipfd) == -1) {
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+static void
+serial_write(const unsigned char *p, int len)
+{
+  struct pollfd pfd = { slipfd, POLLOUT };
+  int n;
+
+  while(len > 0) {
+    if((n = write(slipfd, p, len)) == -1) {
+      if(errno != EAGAIN) err(1, "slip_flushbuf write failed");
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    lock_shared();
+    record_write(&recording, RECORD_OUT, p, n);
+    unlock_shared();
+    p += n;
+    len -= n;
+  }
+}
+
+static void *
+serial_tx_thread(void *arg)
+{
+  unsigned char *frame;
+  int len;
+
+  pin(cpus[2]);
+  while(1) {
+    /* One post per frame, the border router's replies first */
+    while(sem_wait(&tx_ready) == -1 && errno == EINTR);
+    if((frame = ring_peek(&control_ring, &len)) != NULL) {
+      serial_write(frame, len);
+      ring_release(&control_ring);
+    } else if((frame = ring_peek(&data_ring, &len)) != NULL) {
+      serial_write(frame, len);
+      ring_release(&data_ring);
+    }
+  }
+  return NULL;
+}
+
+/* Run the bridge as three threads, never returns */
+static void
+pipeline_run(int tunfd)
+{
+  void *(*stages[3])(void *) = {
+    serial_rx_thread, tun_rx_thread, serial_tx_thread
+  };
+  struct pollfd pfd = { slipfd, POLLOUT };
+  pthread_t thread[3];
+  long wait;
+  int i;
+
+  /* What is queued so far, before the threads take the line */
+  while(!slip_empty()) {
+    poll(&pfd, 1, -1);
+    slip_flushbuf(slipfd);
+  }
+  pfd.fd = tunfd;
+  while(pbuf_peek(&tun_queue) != NULL) {
+    poll(&pfd, 1, -1);
+    tun_flush(tunfd);
+  }
+  if(sem_init(&tx_ready, 0, 0) == -1 ||
+     ring_init(&control_ring, CONTROL_SLOTS, CONTROL_SLOT, &tx_ready) == -1 ||
+     ring_init(&data_ring, DATA_SLOTS, SERIAL_ENCODED_MAX(PBUF_SIZE),
+               &tx_ready) == -1) {
+    err(1, "pipeline_run");
+  }
+  threads = 1;
+  for(i = 0; i < 3; i++) {
+    if(pthread_create(&thread[i], NULL, stages[i],
+                      (void *)(intptr_t)tunfd) != 0) {
+      errx(1, "pipeline_run: can't start a thread");
+    }
+  }
+  if (timestamp) stamptime();
+  fprintf(stderr, "*** serial input, tun input and serial output threads\n");
+  /* The stages never return: this thread only flushes the recording */
+  while(1) {
+    lock_shared();
+    wait = record_tick(&recording);
+    unlock_shared();
+    usleep(wait > 0 ? wait : 1000000);
+  }
+}
+
 int
 main(int argc, char **argv)
 {
@@ -692,24 +1090,38 @@ main(int argc, char **argv)
   int tunfd, maxfd;
   int ret;
   fd_set rset, wset;
-  FILE *inslip;
   const char *siodev = NULL;
   const char *host = NULL;
   const char *port = NULL;
   const char *prog;
   int baudrate = -2;
   int tap = 0;
+  int handoverfd = -1, configured = 0;
+  double mote_rate = 0, mesh_rate = 0;
+  const char *noise_spec = NULL;
+  int pipelined = 0;
+  int priority = 0;
+  struct timeval tv, *timeout;
+  long wait;
   slipfd = 0;
 
   prog = argv[0];
   setvbuf(stdout, NULL, _IOLBF, 0); /* Line buffered output. */
 
-  while((c = getopt(argc, argv, "B:HLhs:t:v::d::a:p:T")) != -1) {
+  while((c = getopt(argc, argv, "B:CF:HLhM::Pr:R:S::s:t:U:v::w:X:Y:d::a:p:T")) != -1) {
     switch(c) {
     case 'B':
       baudrate = atoi(optarg);
       break;
 
+    case 'C':
+      cobs = 1;
+      break;
+
+    case 'F':
+      noise_spec = optarg;
+      break;
+
     case 'H':
       flowcontrol=1;
       break;
@@ -718,6 +1130,31 @@ main(int argc, char **argv)
       timestamp=1;
       break;
 
+    case 'M':
+      pipelined = 1;
+      if(optarg &&
+         sscanf(optarg, "%d,%d,%d", &cpus[0], &cpus[1], &cpus[2]) != 3) {
+        errx(1, "-M takes three CPUs, e.g. -M0,1,2");
+      }
+      break;
+
+    case 'P':
+      persistent = 1;
+      break;
+
+    case 'r':
+      mote_rate = atof(optarg);
+      break;
+
+    case 'R':
+      mesh_rate = atof(optarg);
+      break;
+
+    case 'S':
+      spin_us = 10000;
+      if(optarg) spin_us = atol(optarg);
+      break;
+
     case 's':
       if(strncmp("/dev/", optarg, 5) == 0) {
 	siodev = optarg + 5;
@@ -728,12 +1165,16 @@ main(int argc, char **argv)
 
     case 't':
       if(strncmp("/dev/", optarg, 5) == 0) {
-	strncpy(tundev, optarg + 5, sizeof(tundev));
+	strncpy(tundev, optarg + 5, sizeof(tundev) - 1);
       } else {
-	strncpy(tundev, optarg, sizeof(tundev));
+	strncpy(tundev, optarg, sizeof(tundev) - 1);
       }
       break;
 
+    case 'U':
+      handover_path = optarg;
+      break;
+
     case 'a':
       host = optarg;
       break;
@@ -742,6 +1183,22 @@ main(int argc, char **argv)
       port = optarg;
       break;
 
+    case 'w':
+      if(record_create(&recording, optarg) == -1) {
+        err(1, "can't record to ``%s''", optarg);
+      }
+      break;
+
+    case 'X':
+      if(trace_open(&tracing, optarg) == -1) {
+        err(1, "can't trace to ``%s''", optarg);
+      }
+      break;
+
+    case 'Y':
+      priority = atoi(optarg);
+      break;
+
     case 'd':
       basedelay = 10;
       if (optarg) basedelay = atoi(optarg);
@@ -767,11 +1224,25 @@ fprintf(stderr," -B baudrate    9600,19200,38400,57600,115200 (default),230400,4
 #else
 fprintf(stderr," -B baudrate    9600,19200,38400,57600,115200 (default),230400\n");
 #endif
+fprintf(stderr," -C             COBS framing with a CRC if the border router takes it\n");
+fprintf(stderr," -F classes     Filter the host's control traffic, \"default\" or a list of\n");
+fprintf(stderr,"                class=action, e.g. mdns=forward,multicast=5 (see noise.h)\n");
 fprintf(stderr," -H             Hardware CTS/RTS flow control (default disabled)\n");
 fprintf(stderr," -L             Log output format (adds time stamps)\n");
+fprintf(stderr," -M[rx,tun,tx]  A thread each for serial input, tun input and serial\n");
+fprintf(stderr,"                output, optionally on these CPUs, e.g. -M0,1,2\n");
+fprintf(stderr," -P             Persistent tun device, left configured on exit\n");
+fprintf(stderr," -r rate        Packets per second to each mote (default unlimited)\n");
+fprintf(stderr,"                Over the limit only actuations, Observe registrations\n");
+fprintf(stderr,"                and non-CoAP traffic pass, GETs get a cached response\n");
+fprintf(stderr," -R rate        Packets per second to the whole mesh (default unlimited)\n");
+fprintf(stderr," -S[us]         Busy-poll the serial line and tun device for us after\n");
+fprintf(stderr,"                each packet before sleeping again (-S is -S10000)\n");
 fprintf(stderr," -s siodev      Serial device (default /dev/ttyUSB0)\n");
 fprintf(stderr," -T             Make tap interface (default is tun interface)\n");
 fprintf(stderr," -t tundev      Name of interface (default tap0 or tun0)\n");
+fprintf(stderr," -U path        Take the tun device over from the tunslip6 listening on\n");
+fprintf(stderr,"                this socket, then listen on it for a successor\n");
 fprintf(stderr," -v[level]      Verbosity level\n");
 fprintf(stderr,"    -v0         No messages\n");
 fprintf(stderr,"    -v1         Encapsulated SLIP debug messages (default)\n");
@@ -780,6 +1251,10 @@ fprintf(stderr,"    -v3         Printable strings and SLIP packet notifications\
 fprintf(stderr,"    -v4         All printable characters as they are received\n");
 fprintf(stderr,"    -v5         All SLIP packets in hex\n");
 fprintf(stderr,"    -v          Equivalent to -v3\n");
+fprintf(stderr," -w file        Record the serial byte stream, with timing, to file\n");
+fprintf(stderr," -X file        Trace the CoAP packets and the border router's records\n");
+fprintf(stderr,"                to file, for sliptrace\n");
+fprintf(stderr," -Y priority    Run at this SCHED_FIFO priority, memory locked\n");
 fprintf(stderr," -d[basedelay]  Minimum delay between outgoing SLIP packets.\n");
 fprintf(stderr,"                Actual delay is basedelay*(#6LowPAN fragments) milliseconds.\n");
 fprintf(stderr,"                -d is equivalent to -d10.\n");
@@ -793,7 +1268,7 @@ exit(1);
   argv += (optind - 1);
 
   if(argc != 2 && argc != 3) {
-    err(1, "usage: %s [-B baudrate] [-H] [-L] [-s siodev] [-t tundev] [-T] [-v verbosity] [-d delay] [-a serveraddress] [-p serverport] ipaddress", prog);
+    err(1, "usage: %s [-B baudrate] [-C] [-F classes] [-H] [-L] [-M[cpus]] [-P] [-r rate] [-R rate] [-S[us]] [-s siodev] [-t tundev] [-T] [-U path] [-v verbosity] [-w file] [-X file] [-Y priority] [-d delay] [-a serveraddress] [-p serverport] ipaddress", prog);
   }
   ipaddr = argv[1];
 
@@ -839,6 +1314,18 @@ exit(1);
       strcpy(tundev, "tun0");
     }
   }
+  /* The predecessor lets go of the serial link once we have its tun fd */
+  tunfd = -1;
+  if(handover_path != NULL) {
+    tunfd = handover_receive(handover_path, tundev, sizeof(tundev));
+    if(tunfd != -1) {
+      if (timestamp) stamptime();
+      fprintf(stderr, "*** took ``%s'' over from the running tunslip6\n",
+              tundev);
+      configured = 1;
+    }
+  }
+
   if(host != NULL) {
     struct addrinfo hints, *servinfo, *p;
     int rv;
@@ -889,7 +1376,8 @@ exit(1);
     if(siodev != NULL) {
       slipfd = devopen(siodev, O_RDWR | O_NONBLOCK);
       if(slipfd == -1) {
-	err(1, "can't open siodev ``/dev/%s''", siodev);
+	err(1, "can't open siodev ``%s%s''", siodev[0] == '/' ? "" : "/dev/",
+	    siodev);
       }
     } else {
       static const char *siodevs[] = {
@@ -908,25 +1396,84 @@ exit(1);
       }
     }
     if (timestamp) stamptime();
-    fprintf(stderr, "********SLIP started on ``/dev/%s''\n", siodev);
+    fprintf(stderr, "********SLIP started on ``%s%s''\n",
+            siodev[0] == '/' ? "" : "/dev/", siodev);
     stty_telos(slipfd);
   }
   slip_send(slipfd, SLIP_END);
-  inslip = fdopen(slipfd, "r");
-  if(inslip == NULL) err(1, "main: fdopen");
+  if(pbuf_init(PBUF_COUNT) == -1) err(1, "pbuf_init");
+  rx = pbuf_alloc();
+  serial_decoder_init(&decoder, &serial_callbacks, verbose, NULL);
+  serial_decoder_buffer(&decoder, rx->data);
+  if(cobs) {
+    request_cobs();
+  }
 
-  tunfd = tun_alloc(tundev, tap);
-  if(tunfd == -1) err(1, "main: open");
-  if (timestamp) stamptime();
-  fprintf(stderr, "opened %s device ``/dev/%s''\n",
-          tap ? "tap" : "tun", tundev);
+  if(tunfd == -1) {
+    configured = persistent && tun_configured(tundev);
+    tunfd = tun_alloc(tundev, tap);
+    if(tunfd == -1) err(1, "main: open");
+    if (timestamp) stamptime();
+    fprintf(stderr, "opened %s device ``/dev/%s''%s\n",
+            tap ? "tap" : "tun", tundev,
+            configured ? ", already configured" : "");
+  }
+  /* Written from tun_queue when the device takes them */
+  if(fcntl(tunfd, F_SETFL, fcntl(tunfd, F_GETFL) | O_NONBLOCK) == -1) {
+    err(1, "fcntl");
+  }
 
   atexit(cleanup);
   signal(SIGHUP, sigcleanup);
   signal(SIGTERM, sigcleanup);
   signal(SIGINT, sigcleanup);
   signal(SIGALRM, sigalarm);
-  ifconf(tundev, ipaddr);
+  if(!configured) {
+    ifconf(tundev, ipaddr);
+  }
+  if(handover_path != NULL) {
+    handoverfd = handover_listen(handover_path);
+  }
+
+  if(mote_rate > 0 || mesh_rate > 0) {
+    if(tap) {
+      warnx("admission control needs a tun interface, disabled");
+    } else {
+      struct in6_addr addr;
+      char *s = strndup(ipaddr, strcspn(ipaddr, "/"));
+      if(s == NULL || inet_pton(AF_INET6, s, &addr) != 1) {
+        errx(1, "admission control: ``%s'' is not an IPv6 address", ipaddr);
+      }
+      free(s);
+      admission_init(mote_rate, mesh_rate, addr.s6_addr);
+      admission = 1;
+    }
+  }
+  if(noise_spec != NULL) {
+    if(tap) {
+      warnx("the noise filter needs a tun interface, disabled");
+    } else if(noise_init(noise_spec, baudrate > 0 ? baudrate : 115200) < 0) {
+      errx(1, "bad filter ``%s''", noise_spec);
+    } else {
+      noise = 1;
+    }
+  }
+
+  if(priority > 0) {
+    realtime(priority);
+  }
+  if(pipelined && spin_us > 0) {
+    warnx("-S busy-polls the single-threaded loop, -M ignored");
+    pipelined = 0;
+  }
+  spin_active = now_us();
+  if(pipelined) {
+    if(tracing.f || basedelay || handover_path != NULL) {
+      warnx("-M doesn't go with -X, -d or -U, single-threaded");
+    } else {
+      pipeline_run(tunfd);
+    }
+  }
 
   while(1) {
     maxfd = 0;
@@ -950,19 +1497,49 @@ exit(1);
 
     FD_SET(slipfd, &rset);	/* Read from slip ASAP! */
     if(slipfd > maxfd) maxfd = slipfd;
+
+    if(handoverfd != -1) {
+      FD_SET(handoverfd, &rset);
+      if(handoverfd > maxfd) maxfd = handoverfd;
+    }
     
     /* We only have one packet at a time queued for slip output. */
-    if(slip_empty()) {
+    if(slip_empty() && pbuf_available() >= 2) {
       FD_SET(tunfd, &rset);
       if(tunfd > maxfd) maxfd = tunfd;
     }
+    if(pbuf_peek(&tun_queue) != NULL) {
+      FD_SET(tunfd, &wset);
+      if(tunfd > maxfd) maxfd = tunfd;
+    }
 
-    ret = select(maxfd + 1, &rset, &wset, NULL, NULL);
+    /* Wake up to flush the recording if the line goes quiet */
+    timeout = spin_timeout(&tv);
+    if(timeout == NULL && (wait = record_tick(&recording)) > 0) {
+      tv.tv_sec = wait / 1000000;
+      tv.tv_usec = wait % 1000000;
+      timeout = &tv;
+    }
+    ret = select(maxfd + 1, &rset, &wset, NULL, timeout);
     if(ret == -1 && errno != EINTR) {
       err(1, "select");
     } else if(ret > 0) {
+      if(spin_us) spin_active = now_us();
+      if(handoverfd != -1 && FD_ISSET(handoverfd, &rset) &&
+         handover_send(handoverfd, tunfd, tundev) == 0) {
+        /* Best effort for what is queued for the mote */
+        slip_flushbuf(slipfd);
+        handed_over = 1;
+        if (timestamp) stamptime();
+        fprintf(stderr, "*** handed ``%s'' over, exiting\n", tundev);
+        exit(0);
+      }
+
       if(FD_ISSET(slipfd, &rset)) {
-        serial_to_tun(inslip, tunfd);
+        serial_to_tun(slipfd, tunfd);
+      }
+      if(FD_ISSET(tunfd, &wset)) {
+        tun_flush(tunfd);
       }
       
       if(FD_ISSET(slipfd, &wset)) {
@@ -981,15 +1558,13 @@ exit(1);
        if(dmsec>delaymsec) delaymsec=0;
       }
       if(delaymsec==0) {
-        int size;
         if(slip_empty() && FD_ISSET(tunfd, &rset)) {
-          size=tun_to_serial(tunfd, slipfd);
+          tun_to_serial(tunfd, slipfd);
           slip_flushbuf(slipfd);
           sigalarm_reset();
           if(basedelay) {
             struct timeval tv;
             gettimeofday(&tv, NULL) ;
- //         delaymsec=basedelay*(1+(size/120));//multiply by # of 6lowpan packets?
             delaymsec=basedelay;
             delaystartsec =tv.tv_sec;
             delaystartmsec=tv.tv_usec/1000;